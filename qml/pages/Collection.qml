@@ -79,6 +79,8 @@ Page {
         delegate: ListItem {
             id: collectionItem
 
+            highlighted: down || model.selected
+
             ListView.onAdd: AddAnimation {
                 target: collectionItem
             }
@@ -127,6 +129,10 @@ Page {
                 }
             }
             onClicked: {
+                if (collectionModel.selectedCount > 0){
+                    collectionModel.setSelected(model.type, model.id, !model.selected);
+                    return;
+                }
                 if (model.type == "waypoint"){
                     waypointDialog.name = model.name;
                     waypointDialog.description = model.description;
@@ -152,6 +158,12 @@ Page {
                 }
             }
             menu: ContextMenu {
+                MenuItem {
+                    text: model.selected ? qsTr("Unselect") : qsTr("Select")
+                    onClicked: {
+                        collectionModel.setSelected(model.type, model.id, !model.selected);
+                    }
+                }
                 MenuItem {
                     text: qsTr("Edit")
                     onClicked: {
@@ -166,6 +178,7 @@ Page {
                 MenuItem {
                     text: qsTr("Move to")
                     onClicked: {
+                        moveDialog.selection = false;
                         moveDialog.itemId = model.id;
                         moveDialog.itemType = model.type;
                         moveDialog.name = model.name;
@@ -228,6 +241,35 @@ Page {
         VerticalScrollDecorator {}
 
         PullDownMenu {
+            MenuItem {
+                text: qsTr("Delete selected")
+                visible: collectionModel.selectedCount > 0
+                onClicked: {
+                    remorse.execute(qsTr("Deleting %n items", "", collectionModel.selectedCount),
+                                    function() {
+                                        collectionModel.deleteSelected();
+                                    });
+                }
+            }
+            MenuItem {
+                text: qsTr("Move selected to")
+                visible: collectionModel.selectedCount > 0
+                onClicked: {
+                    moveDialog.selection = true;
+                    moveDialog.collectionId = collectionPage.collectionId;
+                    moveDialog.open();
+                }
+            }
+            MenuItem {
+                text: qsTr("Clear selection")
+                visible: collectionModel.selectedCount > 0
+                onClicked: collectionModel.clearSelection()
+            }
+            MenuItem {
+                text: qsTr("Select all")
+                visible: collectionView.count > 0
+                onClicked: collectionModel.selectAll()
+            }
             MenuItem {
                 text: qsTr("Export")
 
@@ -299,6 +341,7 @@ Page {
     CollectionSelector{
         id: moveDialog
 
+        property bool selection: false
         property string itemType
         property string itemId: ""
         property string name
@@ -308,9 +351,14 @@ Page {
 
         canAccept : collectionId != collectionPage.collectionId
 
-        title: qsTr("Move \"%1\" to").arg(name)
+        title: selection ? qsTr("Move %n items to", "", collectionModel.selectedCount) : qsTr("Move \"%1\" to").arg(name)
 
         onAccepted: {
+            if (selection){
+                console.log("Move " + collectionModel.selectedCount + " items to collection id " + moveDialog.collectionId);
+                collectionModel.moveSelected(moveDialog.collectionId);
+                return;
+            }
             console.log("Move " + itemType + " id " + itemId + " to collection id " + moveDialog.collectionId);
             if (itemType === "waypoint"){
                 collectionModel.moveWaypoint(itemId, moveDialog.collectionId);
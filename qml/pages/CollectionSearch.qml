@@ -0,0 +1,133 @@
+/*
+ OSM Scout for Sailfish OS
+ Copyright (C) 2018  Lukas Karas
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+
+import harbour.osmscout.map 1.0
+
+Page {
+    id: searchPage
+
+    signal selectWaypoint(double lat, double lon)
+    signal selectTrack(LocationEntry bbox, var trackId);
+    property var acceptDestination;
+
+    RemorsePopup { id: remorse }
+
+    CollectionSearchModel {
+        id: searchModel
+        onError: {
+            remorse.execute(message, function() { }, 10 * 1000);
+        }
+    }
+
+    SilicaListView {
+        id: searchResultView
+        anchors.fill: parent
+        spacing: Theme.paddingMedium
+        clip: true
+
+        currentIndex: -1 // otherwise currentItem will steal focus
+
+        model: searchModel
+
+        header: Column {
+            width: searchResultView.width
+
+            PageHeader {
+                title: qsTr("Search in collections")
+            }
+            SearchField {
+                id: searchField
+                width: parent.width
+                placeholderText: qsTr("Name, description or symbol")
+                focus: true
+
+                onTextChanged: {
+                    searchModel.pattern = text;
+                }
+                EnterKey.iconSource: "image://theme/icon-m-enter-close"
+                EnterKey.onClicked: focus = false
+            }
+        }
+
+        delegate: ListItem {
+            id: searchItem
+
+            Image{
+                id: entryIcon
+
+                source: 'image://harbour-osmscout/' + (model.type == "waypoint" ? 'poi-icons/marker.svg' :'pics/route.svg') + '?' + Theme.primaryColor
+
+                width: Theme.iconSizeMedium
+                fillMode: Image.PreserveAspectFit
+                horizontalAlignment: Image.AlignHCenter
+                verticalAlignment: Image.AlignVCenter
+                height: width
+                x: Theme.paddingMedium
+
+                sourceSize.width: width
+                sourceSize.height: height
+            }
+            Column{
+                x: Theme.paddingMedium
+                anchors.left: entryIcon.right
+                anchors.right: parent.right
+                anchors.verticalCenter: entryIcon.verticalCenter
+
+                Label {
+                    width: parent.width
+                    text: model.name
+                    truncationMode: TruncationMode.Fade
+                }
+                Label {
+                    text: model.collectionName
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    color: Theme.secondaryColor
+                    width: parent.width
+                    truncationMode: TruncationMode.Fade
+                }
+            }
+            onClicked: {
+                console.log("selected " + model.type + ": " + model.name + " (" + model.id + ")");
+                if (model.type == "waypoint"){
+                    selectWaypoint(model.latitude, model.longitude);
+                }else{
+                    selectTrack(searchModel.boundingBox(index), model.id);
+                }
+                pageStack.pop(acceptDestination);
+            }
+        }
+
+        VerticalScrollDecorator {}
+
+        ViewPlaceholder {
+            enabled: searchModel.pattern.length > 1 && !searchModel.searching && searchResultView.count == 0
+            text: qsTr("Nothing found")
+        }
+
+        BusyIndicator {
+            running: searchModel.searching
+            size: BusyIndicatorSize.Large
+            anchors.horizontalCenter: parent.horizontalCenter
+            anchors.verticalCenter: parent.verticalCenter
+        }
+    }
+}
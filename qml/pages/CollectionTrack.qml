@@ -34,6 +34,8 @@ Dialog{
     signal selectTrack(LocationEntry bbox, var trackId);
     property var acceptPage;
     property var trackId;
+    readonly property int chunkOverlayIdBase: 1000000; // overlays of streamed chunks, above segment ids
+    property int chunkOverlayId: chunkOverlayIdBase;
 
     acceptDestination: trackDialog.acceptPage
     acceptDestinationAction: PageStackAction.Pop
@@ -53,7 +55,8 @@ Dialog{
 
         onLoadingChanged: {
             console.log("loading chagned: " + loading+ " segments: "+trackModel.segmentCount);
-            if (!loading){
+            if (!loading && chunkOverlayId == chunkOverlayIdBase){
+                // points were not streamed by chunks
                 var cnt=trackModel.segmentCount;
                 for (var segment=0; segment<cnt; segment++){
                     var obj=trackModel.createOverlayForSegment(segment);
@@ -64,6 +67,15 @@ Dialog{
                 }
             }
         }
+
+        onSegmentChunkLoaded: {
+            var obj=trackModel.createOverlayForChunk(segment, offset, count);
+            if (obj){
+                obj.type="_track";
+                wayPreviewMap.addOverlayObject(chunkOverlayId, obj);
+                chunkOverlayId++;
+            }
+        }
     }
 
     DialogHeader {
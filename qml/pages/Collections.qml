@@ -26,12 +26,14 @@ import QtQml.Models 2.1
 import harbour.osmscout.map 1.0
 
 import "../custom"
+import "../custom/Utils.js" as Utils
 
 Page {
     id: collectionListPage
 
     signal selectWaypoint(double lat, double lon)
     signal selectTrack(LocationEntry bbox, var trackId);
+    signal selectCollection(LocationEntry bbox);
     property var acceptDestination;
 
     RemorsePopup { id: remorse }
@@ -44,11 +46,20 @@ Page {
         onError: {
             remorse.execute(message, function() { }, 10 * 1000);
         }
+        onImportFinished: {
+            console.log("onImportFinished: success " + success + ", cancelled " + cancelled + ", duplicates " + duplicates);
+            if (success && duplicates > 0){
+                remorse.execute(qsTr("Skipped %n already imported entries", "", duplicates), function() { }, 10 * 1000);
+            }
+        }
     }
 
     SilicaListView {
         id: collectionListView
-        anchors.fill: parent
+        anchors.top: parent.top
+        anchors.left: parent.left
+        anchors.right: parent.right
+        anchors.bottom: importProgressBar.visible ? importProgressBar.top : parent.bottom
         spacing: Theme.paddingMedium
         x: Theme.paddingMedium
         clip: true
@@ -110,6 +121,18 @@ Page {
                     width: parent.width
                     truncationMode: TruncationMode.Fade
                 }
+                Label {
+                    id: summaryLabel
+
+                    visible: model.trackCount > 0 || model.waypointCount > 0
+                    text: model.trackCount > 0 ?
+                              qsTr("%1 tracks, %2 waypoints, %3").arg(model.trackCount).arg(model.waypointCount).arg(Utils.humanDistance(model.distance)) :
+                              qsTr("%1 waypoints").arg(model.waypointCount)
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    color: Theme.secondaryColor
+                    width: parent.width
+                    truncationMode: TruncationMode.Fade
+                }
             }
             onClicked: {
                 console.log("selected collection: " + model.name + " (" + model.id + ")");
@@ -122,6 +145,17 @@ Page {
                 collectionPage.selectTrack.connect(selectTrack);
             }
             menu: ContextMenu {
+                MenuItem {
+                    text: qsTr("Show whole collection")
+                    visible: model.trackCount > 0 || model.waypointCount > 0
+                    onClicked: {
+                        var bbox = collectionListModel.boundingBox(model.id);
+                        if (bbox != null){
+                            selectCollection(bbox);
+                            pageStack.pop(acceptDestination);
+                        }
+                    }
+                }
                 MenuItem {
                     text: model.visible ? qsTr("Hide on map") : qsTr("Show on map")
                     onClicked: {
@@ -161,6 +195,25 @@ Page {
         VerticalScrollDecorator {}
 
         PullDownMenu {
+            MenuItem {
+                text: qsTr("Cancel import")
+                visible: collectionListModel.importing
+                onClicked: {
+                    console.log("Cancel import of " + collectionListModel.importFile);
+                    collectionListModel.cancelImport();
+                }
+            }
+            MenuItem {
+                text: qsTr("Search")
+                onClicked: {
+                    var searchPage = pageStack.push(Qt.resolvedUrl("CollectionSearch.qml"),
+                                   {
+                                        acceptDestination: acceptDestination
+                                   })
+                    searchPage.selectWaypoint.connect(selectWaypoint);
+                    searchPage.selectTrack.connect(selectTrack);
+                }
+            }
             MenuItem {
                 text: qsTr("Import")
                 onClicked: {
@@ -190,6 +243,17 @@ Page {
         }
     }
 
+    ProgressBar {
+        id: importProgressBar
+        visible: collectionListModel.importing
+        anchors.bottom: parent.bottom
+        width: parent.width
+        minimumValue: 0
+        maximumValue: 1
+        value: collectionListModel.importProgress
+        label: qsTr("Importing %1").arg(collectionListModel.importFile.replace(/^.*[\\\/]/, ''))
+    }
+
     Component {
         id: filePickerPage
         FilePickerPage {
@@ -208,6 +208,7 @@ Page {
                                                             });
                         collectionsPage.selectWaypoint.connect(showWaypoint);
                         collectionsPage.selectTrack.connect(showTrack);
+                        collectionsPage.selectCollection.connect(selectLocation);
                     }else{
                         console.log("TODO: "+ action)
                     }
@@ -0,0 +1,351 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "BatchDistance.h"
+
+#include <osmscout/util/Geometry.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// AVX kernel is compiled with target attribute and selected at runtime,
+// when the whole unit is not compiled for AVX already
+#if defined(__AVX__)
+#define BATCH_DISTANCE_AVX
+#define BATCH_DISTANCE_AVX_TARGET
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define BATCH_DISTANCE_AVX
+#define BATCH_DISTANCE_AVX_DISPATCH
+#define BATCH_DISTANCE_AVX_TARGET __attribute__((target("avx")))
+#endif
+
+#if defined(BATCH_DISTANCE_AVX)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace osmscout;
+
+constexpr double BatchDistance::MaxApproximatedDistance;
+constexpr double BatchDistance::MaxApproximatedLatitude;
+constexpr double BatchDistance::RelativeError;
+constexpr double BatchDistance::AbsoluteError;
+
+namespace {
+  // WGS-84
+  static constexpr double SemiMajorAxis = 6378137.0;
+  static constexpr double Flattening = 1.0 / 298.257223563;
+  static constexpr double E2 = Flattening * (2.0 - Flattening); // first eccentricity squared
+  static constexpr double MeridionalFactor = SemiMajorAxis * (1.0 - E2);
+
+  static constexpr double DegToRad = M_PI / 180.0;
+  static constexpr double MaxMidLatitude = BatchDistance::MaxApproximatedLatitude * DegToRad;
+
+  static constexpr size_t ChunkSize = 256; // points gathered to coordinate arrays at once
+
+  // Taylor series of cosine, 1 / (2k)! with alternating sign, highest power first.
+  // Truncation error is below 1e-15 for |x| <= pi / 2
+  static const double CosCoefficients[] = {
+    -1.0 / 6402373705728000.0, // x^18
+     1.0 / 20922789888000.0,
+    -1.0 / 87178291200.0,
+     1.0 / 479001600.0,
+    -1.0 / 3628800.0,
+     1.0 / 40320.0,
+    -1.0 / 720.0,
+     1.0 / 24.0,
+    -1.0 / 2.0,
+     1.0
+  };
+
+  inline double cosine(double x)
+  {
+    double x2 = x * x;
+    double r = CosCoefficients[0];
+    for (size_t i = 1; i < sizeof(CosCoefficients) / sizeof(double); i++){
+      r = r * x2 + CosCoefficients[i];
+    }
+    return r;
+  }
+
+  /**
+   * approximated distance, NaN or value over the limit when pair should be computed exactly
+   */
+  inline double approximated(double latA, double lonA, double latB, double lonB)
+  {
+    double dLat = (latB - latA) * DegToRad;
+    double dLon = (lonB - lonA) * DegToRad;
+    double phi = (latA + latB) * (0.5 * DegToRad);
+    if (std::abs(phi) > MaxMidLatitude){
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    double c = cosine(phi);
+    double w = 1.0 - E2 * (1.0 - c * c);
+    double sw = std::sqrt(w);
+    double dy = MeridionalFactor / (w * sw) * dLat;
+    double dx = SemiMajorAxis / sw * c * dLon;
+    return std::sqrt(dx * dx + dy * dy);
+  }
+
+  inline double exact(double latA, double lonA, double latB, double lonB)
+  {
+    return GetEllipsoidalDistance(GeoCoord(latA, lonA), GeoCoord(latB, lonB)).AsMeter();
+  }
+
+  inline double scalar(double latA, double lonA, double latB, double lonB)
+  {
+    double d = approximated(latA, lonA, latB, lonB);
+    // negated comparison catches NaN
+    if (!(d <= BatchDistance::MaxApproximatedDistance)){
+      return exact(latA, lonA, latB, lonB);
+    }
+    return d;
+  }
+
+#if defined(BATCH_DISTANCE_AVX)
+  /**
+   * @return bit mask of lanes that should be computed exactly
+   */
+  BATCH_DISTANCE_AVX_TARGET
+  inline int avx(const double *latA, const double *lonA,
+                 const double *latB, const double *lonB,
+                 double *result)
+  {
+    const __m256d la = _mm256_loadu_pd(latA);
+    const __m256d lb = _mm256_loadu_pd(latB);
+    const __m256d degToRad = _mm256_set1_pd(DegToRad);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    __m256d dLat = _mm256_mul_pd(_mm256_sub_pd(lb, la), degToRad);
+    __m256d dLon = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lonB), _mm256_loadu_pd(lonA)), degToRad);
+    __m256d phi = _mm256_mul_pd(_mm256_add_pd(la, lb), _mm256_set1_pd(0.5 * DegToRad));
+
+    __m256d x2 = _mm256_mul_pd(phi, phi);
+    __m256d c = _mm256_set1_pd(CosCoefficients[0]);
+    for (size_t i = 1; i < sizeof(CosCoefficients) / sizeof(double); i++){
+      c = _mm256_add_pd(_mm256_mul_pd(c, x2), _mm256_set1_pd(CosCoefficients[i]));
+    }
+
+    __m256d w = _mm256_sub_pd(one, _mm256_mul_pd(_mm256_set1_pd(E2), _mm256_sub_pd(one, _mm256_mul_pd(c, c))));
+    __m256d sw = _mm256_sqrt_pd(w);
+    __m256d dy = _mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(MeridionalFactor), _mm256_mul_pd(w, sw)), dLat);
+    __m256d dx = _mm256_mul_pd(_mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(SemiMajorAxis), sw), c), dLon);
+    __m256d d = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+    _mm256_storeu_pd(result, d);
+
+    __m256d absPhi = _mm256_andnot_pd(_mm256_set1_pd(-0.0), phi);
+    __m256d valid = _mm256_and_pd(_mm256_cmp_pd(d, _mm256_set1_pd(BatchDistance::MaxApproximatedDistance), _CMP_LE_OQ),
+                                  _mm256_cmp_pd(absPhi, _mm256_set1_pd(MaxMidLatitude), _CMP_LE_OQ));
+    return ~_mm256_movemask_pd(valid) & 0xf;
+  }
+#endif
+
+#if defined(__SSE2__)
+  /**
+   * @return bit mask of lanes that should be computed exactly
+   */
+  inline int sse2(const double *latA, const double *lonA,
+                  const double *latB, const double *lonB,
+                  double *result)
+  {
+    const __m128d la = _mm_loadu_pd(latA);
+    const __m128d lb = _mm_loadu_pd(latB);
+    const __m128d degToRad = _mm_set1_pd(DegToRad);
+    const __m128d one = _mm_set1_pd(1.0);
+
+    __m128d dLat = _mm_mul_pd(_mm_sub_pd(lb, la), degToRad);
+    __m128d dLon = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(lonB), _mm_loadu_pd(lonA)), degToRad);
+    __m128d phi = _mm_mul_pd(_mm_add_pd(la, lb), _mm_set1_pd(0.5 * DegToRad));
+
+    __m128d x2 = _mm_mul_pd(phi, phi);
+    __m128d c = _mm_set1_pd(CosCoefficients[0]);
+    for (size_t i = 1; i < sizeof(CosCoefficients) / sizeof(double); i++){
+      c = _mm_add_pd(_mm_mul_pd(c, x2), _mm_set1_pd(CosCoefficients[i]));
+    }
+
+    __m128d w = _mm_sub_pd(one, _mm_mul_pd(_mm_set1_pd(E2), _mm_sub_pd(one, _mm_mul_pd(c, c))));
+    __m128d sw = _mm_sqrt_pd(w);
+    __m128d dy = _mm_mul_pd(_mm_div_pd(_mm_set1_pd(MeridionalFactor), _mm_mul_pd(w, sw)), dLat);
+    __m128d dx = _mm_mul_pd(_mm_mul_pd(_mm_div_pd(_mm_set1_pd(SemiMajorAxis), sw), c), dLon);
+    __m128d d = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+    _mm_storeu_pd(result, d);
+
+    __m128d absPhi = _mm_andnot_pd(_mm_set1_pd(-0.0), phi);
+    __m128d valid = _mm_and_pd(_mm_cmple_pd(d, _mm_set1_pd(BatchDistance::MaxApproximatedDistance)),
+                               _mm_cmple_pd(absPhi, _mm_set1_pd(MaxMidLatitude)));
+    return ~_mm_movemask_pd(valid) & 0x3;
+  }
+#endif
+
+  inline int scalarKernel(const double *latA, const double *lonA,
+                          const double *latB, const double *lonB,
+                          double *result)
+  {
+    result[0] = scalar(latA[0], lonA[0], latB[0], lonB[0]);
+    return 0;
+  }
+
+  using Kernel = int (*)(const double *latA, const double *lonA,
+                         const double *latB, const double *lonB,
+                         double *result);
+
+  /**
+   * batch of pairs computed by kernel with given count of lanes. Tail shorter
+   * than Lanes is padded by the last pair, so single pair goes through the same
+   * kernel and its distance is the same in all methods (compiler may contract
+   * scalar arithmetic differently)
+   */
+  template <size_t Lanes, Kernel vectorized>
+  void batch(const double *latA, const double *lonA,
+             const double *latB, const double *lonB,
+             size_t count, double *result)
+  {
+    size_t i = 0;
+    for (; i + Lanes <= count; i += Lanes){
+      int exactLanes = vectorized(latA + i, lonA + i, latB + i, lonB + i, result + i);
+      // rare: long gaps in track, polar regions
+      for (size_t lane = 0; exactLanes != 0; lane++, exactLanes >>= 1){
+        if (exactLanes & 1){
+          result[i + lane] = exact(latA[i + lane], lonA[i + lane], latB[i + lane], lonB[i + lane]);
+        }
+      }
+    }
+    if (i == count){
+      return;
+    }
+    double la[Lanes], lo[Lanes], lb[Lanes], lob[Lanes], r[Lanes];
+    size_t rest = count - i;
+    for (size_t lane = 0; lane < Lanes; lane++){
+      size_t j = i + std::min(lane, rest - 1);
+      la[lane] = latA[j];
+      lo[lane] = lonA[j];
+      lb[lane] = latB[j];
+      lob[lane] = lonB[j];
+    }
+    int exactLanes = vectorized(la, lo, lb, lob, r);
+    for (size_t lane = 0; lane < rest; lane++){
+      result[i + lane] = (exactLanes >> lane) & 1 ?
+                         exact(latA[i + lane], lonA[i + lane], latB[i + lane], lonB[i + lane]) : r[lane];
+    }
+  }
+
+  struct Implementation
+  {
+    const char *name;
+    void (*distances)(const double *latA, const double *lonA,
+                      const double *latB, const double *lonB,
+                      size_t count, double *result);
+  };
+
+  Implementation select()
+  {
+#if defined(BATCH_DISTANCE_AVX_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")){
+      return {"avx", batch<4, avx>};
+    }
+#elif defined(BATCH_DISTANCE_AVX)
+    return {"avx", batch<4, avx>};
+#endif
+#if defined(__SSE2__)
+    return {"sse2", batch<2, sse2>};
+#else
+    return {"scalar", batch<1, scalarKernel>};
+#endif
+  }
+
+  /**
+   * implementation selected for this cpu on first use
+   */
+  const Implementation& selected()
+  {
+    static const Implementation implementation = select();
+    return implementation;
+  }
+}
+
+void BatchDistance::distances(const double *latA, const double *lonA,
+                              const double *latB, const double *lonB,
+                              size_t count, double *result)
+{
+  selected().distances(latA, lonA, latB, lonB, count, result);
+}
+
+void BatchDistance::consecutive(const double *lat, const double *lon, size_t count, double *result)
+{
+  if (count < 2){
+    return;
+  }
+  distances(lat, lon, lat + 1, lon + 1, count - 1, result);
+}
+
+void BatchDistance::consecutive(const std::vector<gpx::TrackPoint> &points, std::vector<double> &result)
+{
+  result.resize(points.size() < 2 ? 0 : points.size() - 1);
+  double lat[ChunkSize + 1];
+  double lon[ChunkSize + 1];
+  // chunks overlap by one point
+  for (size_t from = 0; from + 1 < points.size(); from += ChunkSize){
+    size_t to = std::min(points.size(), from + ChunkSize + 1);
+    for (size_t i = from; i < to; i++){
+      lat[i - from] = points[i].coord.GetLat();
+      lon[i - from] = points[i].coord.GetLon();
+    }
+    consecutive(lat, lon, to - from, result.data() + from);
+  }
+}
+
+double BatchDistance::distance(const GeoCoord &a, const GeoCoord &b)
+{
+  double latA = a.GetLat();
+  double lonA = a.GetLon();
+  double latB = b.GetLat();
+  double lonB = b.GetLon();
+  double result;
+  distances(&latA, &lonA, &latB, &lonB, 1, &result);
+  return result;
+}
+
+Distance BatchDistance::length(const std::vector<gpx::TrackPoint> &points)
+{
+  double lat[ChunkSize + 1];
+  double lon[ChunkSize + 1];
+  double result[ChunkSize];
+  double sum = 0;
+  for (size_t from = 0; from + 1 < points.size(); from += ChunkSize){
+    size_t to = std::min(points.size(), from + ChunkSize + 1);
+    for (size_t i = from; i < to; i++){
+      lat[i - from] = points[i].coord.GetLat();
+      lon[i - from] = points[i].coord.GetLon();
+    }
+    consecutive(lat, lon, to - from, result);
+    for (size_t i = 0; i + 1 < to - from; i++){
+      sum += result[i];
+    }
+  }
+  return Distance::Of<Meter>(sum);
+}
+
+const char* BatchDistance::implementation()
+{
+  return selected().name;
+}
@@ -0,0 +1,90 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_BATCHDISTANCE_H
+#define OSMSCOUT_SAILFISH_BATCHDISTANCE_H
+
+#include <osmscout/gpx/TrackPoint.h>
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Ellipsoidal (WGS-84) distance of many coordinate pairs, replacement
+ * of osmscout::GetEllipsoidalDistance for track processing.
+ *
+ * Points of track are close to each other, so the distance is computed
+ * in closed form on the plane tangent to the ellipsoid, with meridional
+ * and prime vertical radius of curvature at the mid latitude. It avoids
+ * iterations of Vincenty formula and it is vectorized: AVX is selected
+ * at runtime when the cpu supports it (x86 with gcc >= 4.9 or clang),
+ * SSE2 when the compiler targets it, scalar code otherwise.
+ *
+ * Pairs farther than MaxApproximatedDistance or closer to the pole than
+ * MaxApproximatedLatitude are computed by GetEllipsoidalDistance.
+ * Difference to GetEllipsoidalDistance is below
+ * RelativeError * distance + AbsoluteError.
+ */
+class BatchDistance
+{
+public:
+  static constexpr double MaxApproximatedDistance = 2000; // meters
+  static constexpr double MaxApproximatedLatitude = 85; // degrees
+  static constexpr double RelativeError = 1e-6;
+  static constexpr double AbsoluteError = 1e-5; // meters, rounding of Vincenty formula for tiny distances
+
+public:
+  /**
+   * result[i] = distance between (latA[i], lonA[i]) and (latB[i], lonB[i]) in meters,
+   * coordinates are in degrees
+   */
+  static void distances(const double *latA, const double *lonA,
+                        const double *latB, const double *lonB,
+                        size_t count, double *result);
+
+  /**
+   * result[i] = distance between coordinates i and i + 1,
+   * result should have space for count - 1 values
+   */
+  static void consecutive(const double *lat, const double *lon, size_t count, double *result);
+
+  /**
+   * distances between consecutive points, result[i] is distance
+   * between points[i] and points[i + 1]
+   */
+  static void consecutive(const std::vector<osmscout::gpx::TrackPoint> &points, std::vector<double> &result);
+
+  /**
+   * distance of single pair in meters, bit-identical to the batch result
+   */
+  static double distance(const osmscout::GeoCoord &a, const osmscout::GeoCoord &b);
+
+  /**
+   * sum of distances between consecutive points,
+   * the same value as gpx::TrackSegment::GetLength
+   */
+  static osmscout::Distance length(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * @return name of instruction set selected for this cpu ("avx", "sse2" or "scalar")
+   */
+  static const char* implementation();
+};
+
+#endif //OSMSCOUT_SAILFISH_BATCHDISTANCE_H
@@ -0,0 +1,125 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_BOUNDEDQUEUE_H
+#define OSMSCOUT_SAILFISH_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * Blocking FIFO queue with limited capacity, for passing work
+ * between producer and consumer threads.
+ *
+ * Producer is blocked when queue is full, consumer when queue is empty.
+ * When queue is closed, producer stop pushing and consumer
+ * gets remaining items.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity):
+    capacity(capacity > 0 ? capacity : 1)
+  {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  /**
+   * @return false when queue was closed, item is dropped in such case
+   */
+  bool push(T &&item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    pushCondition.wait(lock, [this]{ return closed || queue.size() < capacity; });
+    if (closed){
+      return false;
+    }
+    queue.push_back(std::move(item));
+    popCondition.notify_one();
+    return true;
+  }
+
+  /**
+   * @return false when queue is closed and empty
+   */
+  bool pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    popCondition.wait(lock, [this]{ return closed || !queue.empty(); });
+    if (queue.empty()){
+      return false;
+    }
+    item = std::move(queue.front());
+    queue.pop_front();
+    pushCondition.notify_one();
+    return true;
+  }
+
+  /**
+   * pop item without blocking
+   * @return false when queue is empty
+   */
+  bool tryPop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.empty()){
+      return false;
+    }
+    item = std::move(queue.front());
+    queue.pop_front();
+    pushCondition.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    pushCondition.notify_all();
+    popCondition.notify_all();
+  }
+
+  bool isClosed() const
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return closed;
+  }
+
+  /**
+   * @return true when queue is closed and all items were taken
+   */
+  bool isDrained() const
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return closed && queue.empty();
+  }
+
+private:
+  const size_t capacity;
+  mutable std::mutex mutex;
+  std::condition_variable pushCondition;
+  std::condition_variable popCondition;
+  std::deque<T> queue;
+  bool closed{false};
+};
+
+#endif //OSMSCOUT_SAILFISH_BOUNDEDQUEUE_H
@@ -19,11 +19,14 @@
 
 #include "CollectionListModel.h"
 
+#include <osmscout/LocationEntry.h>
+
 #include <QDebug>
 
 CollectionListModel::CollectionListModel()
 {
   Storage *storage = Storage::getInstance();
+  Storage *reader = Storage::getReader();
   if (storage){
     connect(storage, SIGNAL(initialised()),
             this, SLOT(storageInitialised()),
@@ -34,11 +37,11 @@ CollectionListModel::CollectionListModel()
             Qt::QueuedConnection);
 
     connect(this, SIGNAL(collectionLoadRequest()),
-            storage, SLOT(loadCollections()),
+            reader, SLOT(loadCollections()),
             Qt::QueuedConnection);
 
-    connect(storage, SIGNAL(collectionsLoaded(std::vector<Collection>, bool)),
-            this, SLOT(onCollectionsLoaded(std::vector<Collection>, bool)),
+    connect(storage, SIGNAL(collectionsLoaded(CollectionList, bool)),
+            this, SLOT(onCollectionsLoaded(CollectionList, bool)),
             Qt::QueuedConnection);
 
     connect(storage, SIGNAL(error(QString)),
@@ -56,6 +59,18 @@ CollectionListModel::CollectionListModel()
     connect(this, SIGNAL(importCollectionRequest(QString)),
             storage, SLOT(importCollection(QString)),
             Qt::QueuedConnection);
+
+    connect(this, SIGNAL(cancelImportRequest(qint64)),
+            storage, SLOT(cancelImport(qint64)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(importProgress(qint64, QString, double)),
+            this, SLOT(onImportProgress(qint64, QString, double)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(importFinished(qint64, QString, bool, bool, int)),
+            this, SLOT(onImportFinished(qint64, QString, bool, bool, int)),
+            Qt::QueuedConnection);
   }
 
   emit collectionLoadRequest();
@@ -79,24 +94,25 @@ void CollectionListModel::storageInitialisationError(QString)
   storageInitialised();
 }
 
-void CollectionListModel::onCollectionsLoaded(std::vector<Collection> collections, bool ok)
+void CollectionListModel::onCollectionsLoaded(CollectionList snapshot, bool ok)
 {
   collectionsLoaded = true;
+  const std::vector<Collection> &collections = *snapshot;
 
   // following process is little bit complicated, but we don't want to call
   // model reset - it breaks UI animations for changes
 
   // process removals
-  QMap<qint64, Collection> currentColMap;
-  for (auto col: collections){
-    currentColMap[col.id] = col;
+  QSet<qint64> currentIds;
+  for (const auto &col: collections){
+    currentIds << col.id;
   }
 
   bool deleteDone=false;
   while (!deleteDone){
     deleteDone=true;
     for (int row=0;row<this->collections.size(); row++){
-      if (!currentColMap.contains(this->collections.at(row).id)){
+      if (!currentIds.contains(this->collections.at(row).id)){
         beginRemoveRows(QModelIndex(), row, row);
         this->collections.removeAt(row);
         endRemoveRows();
@@ -107,18 +123,18 @@ void CollectionListModel::onCollectionsLoaded(std::vector<Collection> collection
   }
 
   // process adds
-  QMap<qint64, Collection> oldColMap;
-  for (auto col: this->collections){
-    oldColMap[col.id] = col;
+  QSet<qint64> oldIds;
+  for (const auto &col: this->collections){
+    oldIds << col.id;
   }
 
   for (size_t row = 0; row < collections.size(); row++) {
-    auto col = collections.at(row);
-    if (!oldColMap.contains(col.id)){
+    const Collection &col = collections.at(row);
+    if (!oldIds.contains(col.id)){
       beginInsertRows(QModelIndex(), row, row);
       this->collections.insert(row, col);
       endInsertRows();
-      oldColMap[col.id] = col;
+      oldIds << col.id;
     }else{
       this->collections[row] = col;
       // TODO: check changed roles
@@ -148,6 +164,11 @@ QVariant CollectionListModel::data(const QModelIndex &index, int role) const
     case DescriptionRole: return collection.description;
     case IdRole: return QString::number(collection.id);
     case VisibleRole: return collection.visible;
+    case TrackCountRole: return collection.trackCount;
+    case WaypointCountRole: return collection.waypointCount;
+    case DistanceRole: return collection.distance.AsMeter();
+    case DurationRole: return (qint64)collection.duration.count();
+    case LastModificationRole: return collection.lastModification;
   }
   return QVariant();
 }
@@ -160,6 +181,11 @@ QHash<int, QByteArray> CollectionListModel::roleNames() const
   roles[DescriptionRole]="description";
   roles[IdRole]="id";
   roles[VisibleRole]="visible";
+  roles[TrackCountRole]="trackCount";
+  roles[WaypointCountRole]="waypointCount";
+  roles[DistanceRole]="distance";
+  roles[DurationRole]="duration";
+  roles[LastModificationRole]="lastModification";
 
   return roles;
 }
@@ -173,11 +199,49 @@ Qt::ItemFlags CollectionListModel::flags(const QModelIndex &index) const
   return QAbstractItemModel::flags(index) | Qt::ItemIsEnabled | Qt::ItemIsSelectable;
 }
 
+QObject* CollectionListModel::boundingBox(QString idStr) const
+{
+  bool ok;
+  qint64 id = idStr.toLongLong(&ok);
+  if (!ok){
+    qWarning() << "Can't convert" << idStr << "to number";
+    return nullptr;
+  }
+  for (const auto &collection: collections){
+    if (collection.id == id && collection.bbox.IsValid()){
+      // QML will take ownership
+      return new osmscout::LocationEntry(osmscout::LocationEntry::Type::typeNone,
+                                         "bbox",
+                                         "bbox",
+                                         QStringList(),
+                                         "",
+                                         collection.bbox.GetCenter(),
+                                         collection.bbox);
+    }
+  }
+  return nullptr;
+}
+
 bool CollectionListModel::isLoading() const
 {
   return !collectionsLoaded;
 }
 
+bool CollectionListModel::isImporting() const
+{
+  return importJobId >= 0;
+}
+
+double CollectionListModel::getImportProgress() const
+{
+  return importProgress;
+}
+
+QString CollectionListModel::getImportFile() const
+{
+  return importFile;
+}
+
 void CollectionListModel::createCollection(QString name, QString description)
 {
   collectionsLoaded=false;
@@ -213,7 +277,37 @@ void CollectionListModel::editCollection(QString idStr, bool visible, QString na
 
 void CollectionListModel::importCollection(QString filePath)
 {
-  collectionsLoaded=false;
-  emit loadingChanged();
+  // collection list is updated when import is finished,
+  // progress is reported by importProgressChanged meanwhile
   emit importCollectionRequest(filePath);
 }
+
+void CollectionListModel::cancelImport()
+{
+  if (importJobId < 0){
+    return;
+  }
+  emit cancelImportRequest(importJobId);
+}
+
+void CollectionListModel::onImportProgress(qint64 jobId, QString filePath, double progress)
+{
+  importJobId = jobId;
+  importFile = filePath;
+  importProgress = progress;
+  emit importProgressChanged();
+}
+
+void CollectionListModel::onImportFinished(qint64 jobId, QString filePath, bool success, bool cancelled, int duplicates)
+{
+  if (jobId == importJobId){
+    importJobId = -1;
+    importFile.clear();
+    importProgress = 0;
+    emit importProgressChanged();
+  }
+  if (!success && !cancelled){
+    qWarning() << "Import of" << filePath << "failed";
+  }
+  emit importFinished(success, cancelled, duplicates);
+}
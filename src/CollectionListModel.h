@@ -30,6 +30,9 @@ class CollectionListModel : public QAbstractListModel {
 
   Q_OBJECT
   Q_PROPERTY(bool loading READ isLoading NOTIFY loadingChanged)
+  Q_PROPERTY(bool importing READ isImporting NOTIFY importProgressChanged)
+  Q_PROPERTY(double importProgress READ getImportProgress NOTIFY importProgressChanged)
+  Q_PROPERTY(QString importFile READ getImportFile NOTIFY importProgressChanged)
 
 signals:
   void loadingChanged() const;
@@ -37,16 +40,22 @@ signals:
   void updateCollectionRequest(Collection);
   void deleteCollectionRequest(qint64);
   void importCollectionRequest(QString);
+  void cancelImportRequest(qint64);
+  void importProgressChanged();
+  void importFinished(bool success, bool cancelled, int duplicates);
   void error(QString message);
 
 public slots:
   void storageInitialised();
   void storageInitialisationError(QString);
-  void onCollectionsLoaded(std::vector<Collection> collections, bool ok);
+  void onCollectionsLoaded(CollectionList collections, bool ok);
   void createCollection(QString name, QString description);
   void deleteCollection(QString id);
   void editCollection(QString id, bool visible, QString name, QString description);
   void importCollection(QString filePath);
+  void cancelImport();
+  void onImportProgress(qint64 jobId, QString filePath, double progress);
+  void onImportFinished(qint64 jobId, QString filePath, bool success, bool cancelled, int duplicates);
 
 public:
   CollectionListModel();
@@ -57,7 +66,12 @@ public:
     NameRole = Qt::UserRole,
     DescriptionRole = Qt::UserRole+1,
     IdRole = Qt::UserRole+2,
-    VisibleRole = Qt::UserRole+3
+    VisibleRole = Qt::UserRole+3,
+    TrackCountRole = Qt::UserRole+4,
+    WaypointCountRole = Qt::UserRole+5,
+    DistanceRole = Qt::UserRole+6, // meters
+    DurationRole = Qt::UserRole+7, // milliseconds
+    LastModificationRole = Qt::UserRole+8
   };
   Q_ENUM(Roles)
 
@@ -66,11 +80,25 @@ public:
   virtual QHash<int, QByteArray> roleNames() const;
   Q_INVOKABLE virtual Qt::ItemFlags flags(const QModelIndex &index) const;
 
+  /**
+   * @return bounding box of all tracks and waypoints in collection as LocationEntry,
+   * null for unknown or empty collection
+   */
+  Q_INVOKABLE QObject* boundingBox(QString id) const;
+
   bool isLoading() const;
+  bool isImporting() const;
+  double getImportProgress() const;
+  QString getImportFile() const;
 
 public:
   QList<Collection> collections;
   bool collectionsLoaded{false};
+
+  // import job running in storage, -1 when there is none
+  qint64 importJobId{-1};
+  QString importFile;
+  double importProgress{0};
 };
 
 #endif //OSMSCOUT_SAILFISH_COLLECTIONLISTMODEL_H
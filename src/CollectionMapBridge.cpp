@@ -18,11 +18,13 @@
 */
 
 #include "CollectionMapBridge.h"
+#include "TrackSimplifier.h"
 
 CollectionMapBridge::CollectionMapBridge(QObject *parent):
   QObject(parent)
 {
   Storage *storage = Storage::getInstance();
+  Storage *reader = Storage::getReader();
   if (storage) {
     connect(storage, SIGNAL(initialised()),
             this, SLOT(init()),
@@ -33,11 +35,11 @@ CollectionMapBridge::CollectionMapBridge(QObject *parent):
             Qt::QueuedConnection);
 
     connect(this, SIGNAL(collectionLoadRequest()),
-            storage, SLOT(loadCollections()),
+            reader, SLOT(loadCollections()),
             Qt::QueuedConnection);
 
-    connect(storage, SIGNAL(collectionsLoaded(std::vector<Collection>, bool)),
-            this, SLOT(onCollectionsLoaded(std::vector<Collection>, bool)),
+    connect(storage, SIGNAL(collectionsLoaded(CollectionList, bool)),
+            this, SLOT(onCollectionsLoaded(CollectionList, bool)),
             Qt::QueuedConnection);
 
     connect(storage, SIGNAL(error(QString)),
@@ -45,19 +47,31 @@ CollectionMapBridge::CollectionMapBridge(QObject *parent):
             Qt::QueuedConnection);
 
     connect(this, SIGNAL(collectionDetailRequest(Collection)),
-            storage, SLOT(loadCollectionDetails(Collection)),
+            reader, SLOT(loadCollectionDetails(Collection)),
             Qt::QueuedConnection);
 
     connect(storage, SIGNAL(collectionDetailsLoaded(Collection, bool)),
             this, SLOT(onCollectionDetailsLoaded(Collection, bool)),
             Qt::QueuedConnection);
 
-    connect(this, SIGNAL(trackDataRequest(Track)),
-            storage, SLOT(loadTrackData(Track)),
+    connect(this, SIGNAL(trackDataRequest(Track, qint64)),
+            reader, SLOT(streamTrackData(Track, qint64)),
             Qt::QueuedConnection);
 
-    connect(storage, SIGNAL(trackDataLoaded(Track, bool, bool)),
-            this, SLOT(onTrackDataLoaded(Track, bool, bool)),
+    connect(storage, SIGNAL(trackDataLoaded(Track, qint64, bool, bool)),
+            this, SLOT(onTrackDataLoaded(Track, qint64, bool, bool)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(trackDataChunkLoaded(Track, TrackChunk)),
+            this, SLOT(onTrackDataChunkLoaded(Track, TrackChunk)),
+            Qt::QueuedConnection);
+
+    connect(this, SIGNAL(trackLodRequest(Track, int)),
+            reader, SLOT(loadTrackLod(Track, int)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(trackLodLoaded(Track, TrackLod)),
+            this, SLOT(onTrackLodLoaded(Track, TrackLod)),
             Qt::QueuedConnection);
 
     init();
@@ -98,7 +112,13 @@ void CollectionMapBridge::onCollectionDetailsLoaded(Collection collection, bool
       if (!trkVisible.contains(trk.id) || trkVisible[trk.id] != trk.lastModification) {
         qDebug() << "Request track data (" << trk.id << ")"
                  << trkVisible[trk.id] << "/" << trk.lastModification;
-        emit trackDataRequest(trk);
+        removeTrackOverlay(trk.id);
+        TrackOverlay &overlay = trackOverlays[trk.id];
+        overlay.track = trk;
+        overlay.lastModification = trk.lastModification;
+        overlay.level = level;
+        trkVisible.insert(trk.id, trk.lastModification);
+        requestTrack(overlay);
       }
     }
   }
@@ -130,49 +150,190 @@ void CollectionMapBridge::onCollectionDetailsLoaded(Collection collection, bool
   }
   for (const auto &id :trkToHide.keys()){
     qDebug() << "Removing overlay track" << id << trkToHide[id];
-    delegatedMap->removeOverlayObject(id + overlayTrkIdBase);
+    removeTrackOverlay(id);
     trkVisible.remove(id);
   }
 }
 
-void CollectionMapBridge::onTrackDataLoaded(Track track, bool complete, bool ok)
+void CollectionMapBridge::onTrackDataLoaded(Track track, qint64 requestId, bool complete, bool ok)
+{
+  // track points are displayed progressively in onTrackDataChunkLoaded,
+  // when loading fails, forget the track, so it will be requested again
+  if (!complete || ok || !trackOverlays.contains(track.id)){
+    return;
+  }
+  if (trackOverlays[track.id].requestId == requestId &&
+      trackOverlays[track.id].level == 0 &&
+      displayedTracks.contains(track.collectionId)){
+    removeTrackOverlay(track.id);
+    displayedTracks[track.collectionId].remove(track.id);
+  }
+}
+
+void CollectionMapBridge::onTrackDataChunkLoaded(Track track, TrackChunk chunk)
 {
   if (delegatedMap == nullptr ||
-      !complete ||
-      !ok ||
-      !displayedTracks.contains(track.collectionId) ||
-      displayedTracks[track.collectionId][track.id] == track.lastModification
-      ){
+      !chunk.points ||
+      chunk.points->empty() ||
+      !trackOverlays.contains(track.id)){
     return;
   }
 
-  qDebug() << "Adding overlay track"
-           << track.name
-           << "(" << track.id << ")"
-           << displayedTracks[track.collectionId][track.id] << "/" << track.lastModification;
+  TrackOverlay &overlay = trackOverlays[track.id];
+  if (overlay.requestId != chunk.requestId || overlay.level != 0){
+    // chunk from another request for the same track
+    return;
+  }
 
-  for (const osmscout::gpx::TrackSegment &seg : track.data->segments) {
+  // chunks of one request are delivered in order,
+  // every segment starts with offset 0
+  std::vector<osmscout::Point> points;
+  points.reserve(chunk.points->size() + 1);
+  if (chunk.segment == overlay.segment && chunk.offset == overlay.nextOffset) {
+    if (chunk.offset > 0) {
+      // connect to the previous chunk
+      points.emplace_back(0, overlay.lastPoint);
+    }
+  } else if (chunk.offset != 0) {
+    qWarning() << "Unexpected track chunk" << chunk.segment << chunk.offset << "/" << overlay.segment << overlay.nextOffset;
+    return;
+  }
+
+  const TrackPointBuffer &chunkPoints = *(chunk.points);
+  for (size_t i = 0; i < chunkPoints.size(); i++) {
+    points.emplace_back(0, chunkPoints.coord(i));
+  }
+  overlay.segment = chunk.segment;
+  overlay.nextOffset = chunk.offset + chunkPoints.size();
+  overlay.lastPoint = chunkPoints.coord(chunkPoints.size() - 1);
+
+  if (points.size() < 2){
+    return;
+  }
+
+  if (chunk.offset == 0 && chunk.segment == 0) {
+    qDebug() << "Adding overlay track"
+             << track.name
+             << "(" << track.id << ")"
+             << track.lastModification;
+  }
+
+  osmscout::OverlayWay trkOverlay(points);
+  trkOverlay.setTypeName(trackTypeName);
+  trkOverlay.setName(track.name);
+  qint64 overlayId = nextTrkOverlayId++;
+  delegatedMap->addOverlayObject(overlayId, &trkOverlay);
+  overlay.overlayIds << overlayId;
+  removeStaleOverlays(overlay);
+}
+
+void CollectionMapBridge::onTrackLodLoaded(Track track, TrackLod lod)
+{
+  if (delegatedMap == nullptr || !trackOverlays.contains(track.id)){
+    return;
+  }
+
+  TrackOverlay &overlay = trackOverlays[track.id];
+  if (overlay.lastModification != track.lastModification || overlay.level != lod.level){
+    return;
+  }
+
+  if (!lod.segments){
+    // loading fails, forget the track, so it will be requested again
+    removeTrackOverlay(track.id);
+    if (displayedTracks.contains(track.collectionId)){
+      displayedTracks[track.collectionId].remove(track.id);
+    }
+    return;
+  }
+
+  overlay.staleOverlayIds << overlay.overlayIds;
+  overlay.overlayIds.clear();
+  for (const auto &segment: *(lod.segments)){
+    if (segment.size() < 2){
+      continue;
+    }
     std::vector<osmscout::Point> points;
-    points.reserve(seg.points.size());
-    for (auto const &p:seg.points) {
-      points.emplace_back(0, p.coord);
+    points.reserve(segment.size());
+    for (const auto &coord: segment){
+      points.emplace_back(0, coord);
     }
     osmscout::OverlayWay trkOverlay(points);
     trkOverlay.setTypeName(trackTypeName);
     trkOverlay.setName(track.name);
-    delegatedMap->addOverlayObject(overlayTrkIdBase + track.id, &trkOverlay);
+    qint64 overlayId = nextTrkOverlayId++;
+    delegatedMap->addOverlayObject(overlayId, &trkOverlay);
+    overlay.overlayIds << overlayId;
+  }
+  removeStaleOverlays(overlay);
+}
+
+void CollectionMapBridge::onViewChanged()
+{
+  if (delegatedMap == nullptr){
+    return;
+  }
+  int newLevel = TrackSimplifier::levelForPixelSize(delegatedMap->GetPixelSize());
+  if (newLevel == level){
+    return;
+  }
+  qDebug() << "Track level of detail" << level << "->" << newLevel;
+  level = newLevel;
+
+  // current overlays are displayed until the new level is loaded
+  for (auto &overlay: trackOverlays){
+    overlay.staleOverlayIds << overlay.overlayIds;
+    overlay.overlayIds.clear();
+    overlay.segment = 0;
+    overlay.nextOffset = 0;
+    overlay.level = level;
+    requestTrack(overlay);
+  }
+}
+
+void CollectionMapBridge::requestTrack(TrackOverlay &overlay)
+{
+  if (overlay.level > 0){
+    emit trackLodRequest(overlay.track, overlay.level);
+  } else {
+    overlay.requestId = Storage::newRequestId();
+    emit trackDataRequest(overlay.track, overlay.requestId);
+  }
+}
+
+void CollectionMapBridge::removeStaleOverlays(TrackOverlay &overlay)
+{
+  if (delegatedMap != nullptr){
+    for (qint64 overlayId: overlay.staleOverlayIds){
+      delegatedMap->removeOverlayObject(overlayId);
+    }
   }
-  displayedTracks[track.collectionId][track.id] = track.lastModification;
+  overlay.staleOverlayIds.clear();
 }
 
-void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collections, bool /*ok*/)
+void CollectionMapBridge::removeTrackOverlay(qint64 trackId)
 {
+  if (!trackOverlays.contains(trackId)){
+    return;
+  }
+  TrackOverlay overlay = trackOverlays.take(trackId);
+  if (delegatedMap != nullptr){
+    for (qint64 overlayId: overlay.overlayIds + overlay.staleOverlayIds){
+      delegatedMap->removeOverlayObject(overlayId);
+    }
+  }
+}
+
+void CollectionMapBridge::onCollectionsLoaded(CollectionList snapshot, bool /*ok*/)
+{
+  const std::vector<Collection> &collections = *snapshot;
   qDebug() << "Loaded" << collections.size() << "collections";
 
   // clear deleted collections on map
   if (delegatedMap == nullptr) {
     displayedTracks.clear();
     displayedWaypoints.clear();
+    trackOverlays.clear();
   }else{
     QMap<qint64, QMap<qint64, QDateTime>> tracksToHide = displayedTracks;
     QMap<qint64, QMap<qint64, QDateTime>> waypointsToHide = displayedWaypoints;
@@ -192,7 +353,7 @@ void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collection
     }
     for (const auto &colId: tracksToHide.keys()) {
       for (const auto &trkId: displayedTracks.take(colId).keys()) {
-        delegatedMap->removeOverlayObject(overlayTrkIdBase + trkId);
+        removeTrackOverlay(trkId);
       }
     }
   }
@@ -200,11 +361,17 @@ void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collection
 
 void CollectionMapBridge::setMap(QObject *map)
 {
+  if (delegatedMap != nullptr){
+    disconnect(delegatedMap, SIGNAL(viewChanged()), this, SLOT(onViewChanged()));
+  }
   delegatedMap = dynamic_cast<osmscout::MapWidget*>(map);
   if (delegatedMap == nullptr){
     return;
   }
   qDebug() << "CollectionMapBridge map:" << delegatedMap;
+  level = TrackSimplifier::levelForPixelSize(delegatedMap->GetPixelSize());
+  connect(delegatedMap, SIGNAL(viewChanged()),
+          this, SLOT(onViewChanged()));
   init();
 }
 
@@ -27,6 +27,24 @@
 #include <QObject>
 #include <QtCore/QSet>
 
+/**
+ * Overlay objects of track. Raw track points (level 0) are displayed
+ * progressively chunk by chunk, simplified geometry at once.
+ */
+class TrackOverlay
+{
+public:
+  Track track;
+  QDateTime lastModification;
+  int level{0}; // requested level of detail, see TrackSimplifier
+  QList<qint64> overlayIds;
+  QList<qint64> staleOverlayIds; // previous level, removed when requested level is displayed
+  qint64 requestId{0}; // outstanding request of raw points, see Storage::streamTrackData
+  size_t segment{0};
+  size_t nextOffset{0};
+  osmscout::GeoCoord lastPoint;
+};
+
 class CollectionMapBridge : public QObject {
 
   Q_OBJECT
@@ -37,15 +55,19 @@ class CollectionMapBridge : public QObject {
 signals:
   void collectionLoadRequest();
   void collectionDetailRequest(Collection);
-  void trackDataRequest(Track track);
+  void trackDataRequest(Track track, qint64 requestId);
+  void trackLodRequest(Track track, int level);
   void error(QString message);
 
 public slots:
   void init();
   void storageInitialisationError(QString);
-  void onCollectionsLoaded(std::vector<Collection> collections, bool ok);
+  void onCollectionsLoaded(CollectionList collections, bool ok);
   void onCollectionDetailsLoaded(Collection collection, bool ok);
-  void onTrackDataLoaded(Track track, bool complete, bool ok);
+  void onTrackDataLoaded(Track track, qint64 requestId, bool complete, bool ok);
+  void onTrackDataChunkLoaded(Track track, TrackChunk chunk);
+  void onTrackLodLoaded(Track track, TrackLod lod);
+  void onViewChanged();
 
 public:
   CollectionMapBridge(QObject *parent = nullptr);
@@ -73,15 +95,23 @@ public:
 
   void setTrackType(QString type);
 
+private:
+  void removeTrackOverlay(qint64 trackId);
+  void removeStaleOverlays(TrackOverlay &overlay);
+  void requestTrack(TrackOverlay &overlay);
+
 private:
   osmscout::MapWidget *delegatedMap{nullptr};
   QString waypointTypeName{"_waypoint"};
   QString trackTypeName{"_track"};
   qint64 overlayWptIdBase{10000};
-  qint64 overlayTrkIdBase{50000};
+  qint64 overlayTrkIdBase{1000000000};
+  qint64 nextTrkOverlayId{overlayTrkIdBase};
+  int level{0}; // level of detail matching current map view
 
   QMap<qint64, QMap<qint64, QDateTime>> displayedWaypoints;
   QMap<qint64, QMap<qint64, QDateTime>> displayedTracks;
+  QMap<qint64, TrackOverlay> trackOverlays;
 };
 
 #endif //OSMSCOUT_SAILFISH_COLLECTIONMAPBRIDGE_H
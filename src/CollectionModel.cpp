@@ -31,6 +31,7 @@
 CollectionModel::CollectionModel()
 {
   Storage *storage = Storage::getInstance();
+  Storage *reader = Storage::getReader();
   if (storage){
     connect(storage, SIGNAL(initialised()),
             this, SLOT(storageInitialised()),
@@ -41,7 +42,7 @@ CollectionModel::CollectionModel()
             Qt::QueuedConnection);
 
     connect(this, SIGNAL(collectionDetailRequest(Collection)),
-            storage, SLOT(loadCollectionDetails(Collection)),
+            reader, SLOT(loadCollectionDetails(Collection)),
             Qt::QueuedConnection);
 
     connect(storage, SIGNAL(collectionDetailsLoaded(Collection, bool)),
@@ -69,7 +70,7 @@ CollectionModel::CollectionModel()
             Qt::QueuedConnection);
 
     connect(this, SIGNAL(exportCollectionRequest(qint64, QString)),
-            storage, SLOT(exportCollection(qint64, QString)),
+            reader, SLOT(exportCollection(qint64, QString)),
             Qt::QueuedConnection);
 
     connect(storage, SIGNAL(collectionExported(bool)),
@@ -87,6 +88,22 @@ CollectionModel::CollectionModel()
     connect(this, SIGNAL(moveTrackRequest(qint64, qint64)),
             storage, SLOT(moveTrack(qint64, qint64)),
             Qt::QueuedConnection);
+
+    connect(this, SIGNAL(deleteWaypointsRequest(qint64, QList<qint64>)),
+            storage, SLOT(deleteWaypoints(qint64, QList<qint64>)),
+            Qt::QueuedConnection);
+
+    connect(this, SIGNAL(deleteTracksRequest(qint64, QList<qint64>)),
+            storage, SLOT(deleteTracks(qint64, QList<qint64>)),
+            Qt::QueuedConnection);
+
+    connect(this, SIGNAL(moveWaypointsRequest(QList<qint64>, qint64)),
+            storage, SLOT(moveWaypoints(QList<qint64>, qint64)),
+            Qt::QueuedConnection);
+
+    connect(this, SIGNAL(moveTracksRequest(QList<qint64>, qint64)),
+            storage, SLOT(moveTracks(QList<qint64>, qint64)),
+            Qt::QueuedConnection);
   }
 }
 
@@ -114,10 +131,31 @@ void CollectionModel::onCollectionDetailsLoaded(Collection collection, bool ok)
     return;
   }
   collectionLoaded = true;
+  // rows points to old snapshots until handleChanges finish
+  TrackList oldTracks = this->collection.tracks;
+  WaypointList oldWaypoints = this->collection.waypoints;
   this->collection = collection;
 
-  handleChanges<Waypoint>(0, waypoints, collection.waypoints ? *(collection.waypoints): std::vector<Waypoint>());
-  handleChanges<Track>(waypoints.size(), tracks, collection.tracks ? *(collection.tracks): std::vector<Track>());
+  static const std::vector<Waypoint> noWaypoints;
+  static const std::vector<Track> noTracks;
+  handleChanges<Waypoint>(0, waypoints, collection.waypoints ? *(collection.waypoints): noWaypoints);
+  handleChanges<Track>(waypoints.size(), tracks, collection.tracks ? *(collection.tracks): noTracks);
+
+  // forget selection of removed entries
+  int selectedCount = getSelectedCount();
+  QSet<qint64> ids;
+  for (const Waypoint *waypoint: waypoints){
+    ids << waypoint->id;
+  }
+  selectedWaypoints.intersect(ids);
+  ids.clear();
+  for (const Track *track: tracks){
+    ids << track->id;
+  }
+  selectedTracks.intersect(ids);
+  if (selectedCount != getSelectedCount()){
+    emit selectionChanged();
+  }
 
   if (!ok){
     qWarning() << "Collection load fails";
@@ -139,8 +177,8 @@ QVariant CollectionModel::data(const QModelIndex &index, int role) const
   }
   int row = index.row();
 
-  if (row < waypoints.size()){
-    const Waypoint &waypoint = waypoints.at(row);
+  if (row < (int)waypoints.size()){
+    const Waypoint &waypoint = *waypoints[row];
     switch(role){
       case TypeRole: return "waypoint";
       case NameRole: return QString::fromStdString(waypoint.data.name.getOrElse(""));
@@ -151,12 +189,13 @@ QVariant CollectionModel::data(const QModelIndex &index, int role) const
       case LatitudeRole: return waypoint.data.coord.GetLat();
       case LongitudeRole: return waypoint.data.coord.GetLon();
       case TimeRole: return timestampToDateTime(waypoint.data.time);
+      case SelectedRole: return selectedWaypoints.contains(waypoint.id);
     }
   } else {
     row -= waypoints.size();
   }
-  if (row < tracks.size()){
-    const Track &track = tracks.at(row);
+  if (row < (int)tracks.size()){
+    const Track &track = *tracks[row];
     switch(role){
       case TypeRole: return "track";
       case NameRole: return track.name;
@@ -165,6 +204,7 @@ QVariant CollectionModel::data(const QModelIndex &index, int role) const
 
       case TimeRole: return track.creationTime;
       case DistanceRole: return track.statistics.distance.AsMeter();
+      case SelectedRole: return selectedTracks.contains(track.id);
     }
   }
 
@@ -189,6 +229,8 @@ QHash<int, QByteArray> CollectionModel::roleNames() const
   // track
   roles[DistanceRole] = "distance";
 
+  roles[SelectedRole] = "selected";
+
   return roles;
 }
 
@@ -394,3 +436,112 @@ void CollectionModel::moveTrack(QString trackIdStr, QString collectionIdStr)
   emit loadingChanged();
   emit moveTrackRequest(trackId, collectionId);
 }
+
+void CollectionModel::setSelected(QString type, QString idStr, bool selected)
+{
+  bool ok;
+  qint64 id = idStr.toLongLong(&ok);
+  if (!ok){
+    qWarning() << "Can't convert" << idStr << "to number";
+    return;
+  }
+
+  bool waypoint = (type == "waypoint");
+  QSet<qint64> &selection = waypoint ? selectedWaypoints : selectedTracks;
+  if (selection.contains(id) == selected){
+    return;
+  }
+  if (selected){
+    selection << id;
+  } else {
+    selection.remove(id);
+  }
+
+  int row = -1;
+  if (waypoint){
+    for (size_t i = 0; i < waypoints.size(); i++){
+      if (waypoints[i]->id == id){
+        row = i;
+        break;
+      }
+    }
+  } else {
+    for (size_t i = 0; i < tracks.size(); i++){
+      if (tracks[i]->id == id){
+        row = waypoints.size() + i;
+        break;
+      }
+    }
+  }
+  if (row >= 0){
+    dataChanged(index(row), index(row), QVector<int>() << SelectedRole);
+  }
+  emit selectionChanged();
+}
+
+void CollectionModel::selectAll()
+{
+  for (const Waypoint *waypoint: waypoints){
+    selectedWaypoints << waypoint->id;
+  }
+  for (const Track *track: tracks){
+    selectedTracks << track->id;
+  }
+  if (rowCount() > 0){
+    dataChanged(index(0), index(rowCount() - 1), QVector<int>() << SelectedRole);
+  }
+  emit selectionChanged();
+}
+
+void CollectionModel::clearSelection()
+{
+  if (getSelectedCount() == 0){
+    return;
+  }
+  selectedWaypoints.clear();
+  selectedTracks.clear();
+  if (rowCount() > 0){
+    dataChanged(index(0), index(rowCount() - 1), QVector<int>() << SelectedRole);
+  }
+  emit selectionChanged();
+}
+
+void CollectionModel::deleteSelected()
+{
+  if (getSelectedCount() == 0){
+    return;
+  }
+
+  collectionLoaded = true;
+  emit loadingChanged();
+  if (!selectedWaypoints.isEmpty()){
+    emit deleteWaypointsRequest(collection.id, selectedWaypoints.toList());
+  }
+  if (!selectedTracks.isEmpty()){
+    emit deleteTracksRequest(collection.id, selectedTracks.toList());
+  }
+  clearSelection();
+}
+
+void CollectionModel::moveSelected(QString collectionIdStr)
+{
+  bool ok;
+  qint64 collectionId = collectionIdStr.toLongLong(&ok);
+  if (!ok){
+    qWarning() << "Can't convert" << collectionIdStr << "to number";
+    return;
+  }
+  if (getSelectedCount() == 0){
+    return;
+  }
+
+  collectionLoaded = false;
+  emit loadingChanged();
+  if (!selectedWaypoints.isEmpty()){
+    emit moveWaypointsRequest(selectedWaypoints.toList(), collectionId);
+  }
+  if (!selectedTracks.isEmpty()){
+    emit moveTracksRequest(selectedTracks.toList(), collectionId);
+  }
+  clearSelection();
+}
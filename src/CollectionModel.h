@@ -36,6 +36,7 @@ class CollectionModel : public QAbstractListModel {
   Q_PROPERTY(QString name READ getCollectionName NOTIFY loadingChanged)
   Q_PROPERTY(QString filesystemName READ getCollectionFilesystemName NOTIFY loadingChanged)
   Q_PROPERTY(QString description READ getCollectionDescription NOTIFY loadingChanged)
+  Q_PROPERTY(int selectedCount READ getSelectedCount NOTIFY selectionChanged)
 
 signals:
   void loadingChanged();
@@ -50,6 +51,11 @@ signals:
   void error(QString message);
   void moveWaypointRequest(qint64 waypointId, qint64 collectionId);
   void moveTrackRequest(qint64 trackId, qint64 collectionId);
+  void deleteWaypointsRequest(qint64 collectionId, QList<qint64> ids);
+  void deleteTracksRequest(qint64 collectionId, QList<qint64> ids);
+  void moveWaypointsRequest(QList<qint64> waypointIds, qint64 collectionId);
+  void moveTracksRequest(QList<qint64> trackIds, qint64 collectionId);
+  void selectionChanged();
 
 public slots:
   void storageInitialised();
@@ -65,6 +71,13 @@ public slots:
   void moveWaypoint(QString waypointId, QString collectionId);
   void moveTrack(QString trackId, QString collectionId);
 
+  // multi-select, selected entries are identified by type ("waypoint" or "track") and id
+  void setSelected(QString type, QString id, bool selected);
+  void selectAll();
+  void clearSelection();
+  void deleteSelected();
+  void moveSelected(QString collectionId);
+
 public:
   CollectionModel();
 
@@ -83,7 +96,9 @@ public:
     LongitudeRole = Qt::UserRole+7,
 
     // type == track
-    DistanceRole = Qt::UserRole+8
+    DistanceRole = Qt::UserRole+8,
+
+    SelectedRole = Qt::UserRole+9
   };
   Q_ENUM(Roles)
 
@@ -105,26 +120,36 @@ public:
   QString getCollectionDescription() const;
   bool isVisible() const;
 
+  int getSelectedCount() const
+  {
+    return selectedWaypoints.size() + selectedTracks.size();
+  }
+
   bool isExporting();
   Q_INVOKABLE QStringList getExportSuggestedDirectories();
 
 
+  /**
+   * Synchronise model rows with current snapshot. Rows are pointers
+   * to entries of snapshot held by collection, old snapshot have to be alive
+   * until this method returns.
+   */
   template <class T>
-  void handleChanges(int rowOffset, QList<T> &old, const std::vector<T> &current)
+  void handleChanges(int rowOffset, std::vector<const T*> &rows, const std::vector<T> &current)
   {
     // process removals
-    QMap<qint64, T> currentDirMap;
-    for (auto entry: current){
-      currentDirMap[entry.id] = entry;
+    QSet<qint64> currentIds;
+    for (const auto &entry: current){
+      currentIds << entry.id;
     }
 
     bool deleteDone=false;
     while (!deleteDone){
       deleteDone=true;
-      for (int row=0;row<old.size(); row++){
-        if (!currentDirMap.contains(old.at(row).id)){
+      for (size_t row=0;row<rows.size(); row++){
+        if (!currentIds.contains(rows[row]->id)){
           beginRemoveRows(QModelIndex(), row+rowOffset, row+rowOffset);
-          old.removeAt(row);
+          rows.erase(rows.begin() + row);
           endRemoveRows();
           deleteDone = false;
           break;
@@ -133,20 +158,20 @@ public:
     }
 
     // process adds
-    QMap<qint64, T> oldDirMap;
-    for (auto entry: old){
-      oldDirMap[entry.id] = entry;
+    QSet<qint64> oldIds;
+    for (const T *entry: rows){
+      oldIds << entry->id;
     }
 
     for (size_t row = 0; row < current.size(); row++) {
-      auto entry = current.at(row);
-      if (!oldDirMap.contains(entry.id)){
+      const T &entry = current[row];
+      if (!oldIds.contains(entry.id)){
         beginInsertRows(QModelIndex(), row+rowOffset, row+rowOffset);
-        old.insert(row, entry);
+        rows.insert(rows.begin() + row, &entry);
         endInsertRows();
-        oldDirMap[entry.id] = entry;
+        oldIds << entry.id;
       }else{
-        old[row] = entry;
+        rows[row] = &entry;
         // TODO: check changed roles
         dataChanged(index(row+rowOffset), index(row+rowOffset), roleNames().keys().toVector());
       }
@@ -155,8 +180,11 @@ public:
 
 public:
   Collection collection;
-  QList<Track> tracks;
-  QList<Waypoint> waypoints;
+  std::vector<const Track*> tracks; // rows, pointers to collection.tracks snapshot
+  std::vector<const Waypoint*> waypoints; // rows, pointers to collection.waypoints snapshot
+
+  QSet<qint64> selectedWaypoints;
+  QSet<qint64> selectedTracks;
 
   bool collectionLoaded{false};
   bool collectionExporting{false};
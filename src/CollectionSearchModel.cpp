@@ -0,0 +1,170 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "CollectionSearchModel.h"
+
+#include <osmscout/LocationEntry.h>
+
+#include <QDebug>
+
+CollectionSearchModel::CollectionSearchModel()
+{
+  Storage *storage = Storage::getInstance();
+  Storage *reader = Storage::getReader();
+  if (storage){
+    connect(this, SIGNAL(searchRequest(QString, int)),
+            reader, SLOT(searchItems(QString, int)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(searchFinished(QString, std::vector<SearchResultItem>, bool)),
+            this, SLOT(onSearchFinished(QString, std::vector<SearchResultItem>, bool)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(error(QString)),
+            this, SIGNAL(error(QString)),
+            Qt::QueuedConnection);
+  }
+}
+
+CollectionSearchModel::~CollectionSearchModel()
+{
+}
+
+void CollectionSearchModel::onSearchFinished(QString pattern, std::vector<SearchResultItem> items, bool ok)
+{
+  if (pattern != this->pattern){
+    // result of outdated request, newer is pending
+    return;
+  }
+  if (!ok){
+    qWarning() << "Search of" << pattern << "fails";
+  }
+  beginResetModel();
+  this->items = std::move(items);
+  endResetModel();
+  searching = false;
+  emit searchingChanged();
+}
+
+int CollectionSearchModel::rowCount(const QModelIndex &) const
+{
+  return items.size();
+}
+
+QVariant CollectionSearchModel::data(const QModelIndex &index, int role) const
+{
+  if(index.row() < 0 || index.row() >= (int)items.size()) {
+    return QVariant();
+  }
+  const SearchResultItem &item = items[index.row()];
+  switch(role){
+    case NameRole: return item.name;
+    case DescriptionRole: return item.description;
+    case TypeRole: return item.type == SearchResultItem::TrackType ? "track" : "waypoint";
+    case IdRole: return QString::number(item.id);
+    case CollectionIdRole: return QString::number(item.collectionId);
+    case CollectionNameRole: return item.collectionName;
+    case SymbolRole: return item.symbol;
+    case LatitudeRole: return item.bbox.GetCenter().GetLat();
+    case LongitudeRole: return item.bbox.GetCenter().GetLon();
+  }
+  return QVariant();
+}
+
+QHash<int, QByteArray> CollectionSearchModel::roleNames() const
+{
+  QHash<int, QByteArray> roles=QAbstractItemModel::roleNames();
+
+  roles[NameRole]="name";
+  roles[DescriptionRole]="description";
+  roles[TypeRole]="type";
+  roles[IdRole]="id";
+  roles[CollectionIdRole]="collectionId";
+  roles[CollectionNameRole]="collectionName";
+  roles[SymbolRole]="symbol";
+  roles[LatitudeRole]="latitude";
+  roles[LongitudeRole]="longitude";
+
+  return roles;
+}
+
+Qt::ItemFlags CollectionSearchModel::flags(const QModelIndex &index) const
+{
+  if(!index.isValid()) {
+    return Qt::ItemIsEnabled;
+  }
+
+  return QAbstractItemModel::flags(index) | Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+}
+
+QObject* CollectionSearchModel::boundingBox(int row) const
+{
+  if (row < 0 || row >= (int)items.size() || !items[row].bbox.IsValid()){
+    return nullptr;
+  }
+  const SearchResultItem &item = items[row];
+  // QML will take ownership
+  return new osmscout::LocationEntry(osmscout::LocationEntry::Type::typeNone,
+                                     "bbox",
+                                     "bbox",
+                                     QStringList(),
+                                     "",
+                                     item.bbox.GetCenter(),
+                                     item.bbox);
+}
+
+QString CollectionSearchModel::getPattern() const
+{
+  return pattern;
+}
+
+void CollectionSearchModel::setPattern(QString pattern)
+{
+  if (pattern == this->pattern){
+    return;
+  }
+  this->pattern = pattern;
+  emit patternChanged(pattern);
+
+  if (pattern.trimmed().length() < MinPatternLength){
+    beginResetModel();
+    items.clear();
+    endResetModel();
+    searching = false;
+  } else {
+    searching = true;
+    emit searchRequest(pattern, limit);
+  }
+  emit searchingChanged();
+}
+
+bool CollectionSearchModel::isSearching() const
+{
+  return searching;
+}
+
+int CollectionSearchModel::getLimit() const
+{
+  return limit;
+}
+
+void CollectionSearchModel::setLimit(int limit)
+{
+  this->limit = limit;
+}
@@ -0,0 +1,93 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_COLLECTIONSEARCHMODEL_H
+#define OSMSCOUT_SAILFISH_COLLECTIONSEARCHMODEL_H
+
+#include "Storage.h"
+
+#include <QObject>
+#include <QtCore/QAbstractItemModel>
+
+/**
+ * Full-text search of tracks and waypoints in all collections.
+ * Search is started when pattern is changed, results of outdated
+ * patterns are ignored.
+ */
+class CollectionSearchModel : public QAbstractListModel {
+
+  Q_OBJECT
+  Q_PROPERTY(QString pattern READ getPattern WRITE setPattern NOTIFY patternChanged)
+  Q_PROPERTY(bool searching READ isSearching NOTIFY searchingChanged)
+  Q_PROPERTY(int limit READ getLimit WRITE setLimit)
+
+signals:
+  void patternChanged(QString);
+  void searchingChanged() const;
+  void searchRequest(QString pattern, int limit);
+  void error(QString message);
+
+public slots:
+  void onSearchFinished(QString pattern, std::vector<SearchResultItem> items, bool ok);
+
+public:
+  // shorter patterns match too many entries to be ranked quickly
+  static constexpr int MinPatternLength = 2;
+
+  CollectionSearchModel();
+
+  virtual ~CollectionSearchModel();
+
+  enum Roles {
+    NameRole = Qt::UserRole,
+    DescriptionRole = Qt::UserRole+1,
+    TypeRole = Qt::UserRole+2,
+    IdRole = Qt::UserRole+3,
+    CollectionIdRole = Qt::UserRole+4,
+    CollectionNameRole = Qt::UserRole+5,
+    SymbolRole = Qt::UserRole+6,
+    LatitudeRole = Qt::UserRole+7,
+    LongitudeRole = Qt::UserRole+8
+  };
+  Q_ENUM(Roles)
+
+  Q_INVOKABLE virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+  Q_INVOKABLE virtual QVariant data(const QModelIndex &index, int role) const;
+  virtual QHash<int, QByteArray> roleNames() const;
+  Q_INVOKABLE virtual Qt::ItemFlags flags(const QModelIndex &index) const;
+
+  /**
+   * @return bounding box of item as LocationEntry, null for invalid row
+   */
+  Q_INVOKABLE QObject* boundingBox(int row) const;
+
+  QString getPattern() const;
+  void setPattern(QString pattern);
+  bool isSearching() const;
+  int getLimit() const;
+  void setLimit(int limit);
+
+private:
+  QString pattern;
+  bool searching{false};
+  int limit{100};
+  std::vector<SearchResultItem> items;
+};
+
+#endif //OSMSCOUT_SAILFISH_COLLECTIONSEARCHMODEL_H
@@ -20,12 +20,20 @@
 #include <osmscout/LocationEntry.h>
 #include <osmscout/OverlayObject.h>
 #include "CollectionTrackModel.h"
+#include "TrackStatisticsAccumulator.h"
+
+#include <QDebug>
+#include <QVariantMap>
+
+#include <algorithm>
+#include <map>
 
 using namespace osmscout;
 
 CollectionTrackModel::CollectionTrackModel()
 {
   Storage *storage = Storage::getInstance();
+  Storage *reader = Storage::getReader();
   if (storage) {
     connect(storage, SIGNAL(initialised()),
             this, SLOT(storageInitialised()),
@@ -35,12 +43,16 @@ CollectionTrackModel::CollectionTrackModel()
             this, SLOT(storageInitialisationError(QString)),
             Qt::QueuedConnection);
 
-    connect(this, SIGNAL(trackDataRequest(Track)),
-            storage, SLOT(loadTrackData(Track)),
+    connect(this, SIGNAL(trackDataRequest(Track, qint64)),
+            reader, SLOT(streamTrackData(Track, qint64)),
+            Qt::QueuedConnection);
+
+    connect(storage, SIGNAL(trackDataLoaded(Track, qint64, bool, bool)),
+            this, SLOT(onTrackDataLoaded(Track, qint64, bool, bool)),
             Qt::QueuedConnection);
 
-    connect(storage, SIGNAL(trackDataLoaded(Track, bool, bool)),
-            this, SLOT(onTrackDataLoaded(Track, bool, bool)),
+    connect(storage, SIGNAL(trackDataChunkLoaded(Track, TrackChunk)),
+            this, SLOT(onTrackDataChunkLoaded(Track, TrackChunk)),
             Qt::QueuedConnection);
   }
 }
@@ -49,7 +61,8 @@ void CollectionTrackModel::storageInitialised()
 {
   if (track.id > 0) {
     loading = true;
-    emit trackDataRequest(track);
+    requestId = Storage::newRequestId();
+    emit trackDataRequest(track, requestId);
     emit loadingChanged();
   }
 }
@@ -174,11 +187,21 @@ QObject *CollectionTrackModel::getBBox() const
                            track.statistics.bbox);
 }
 
-void CollectionTrackModel::onTrackDataLoaded(Track track, bool complete, bool /*ok*/)
+void CollectionTrackModel::onTrackDataLoaded(Track track, qint64 requestId, bool complete, bool /*ok*/)
 {
+  if (track.id != this->track.id || requestId != this->requestId){
+    return;
+  }
   loading = !complete;
   GeoBox originalBox = this->track.statistics.bbox;
+  std::shared_ptr<TrackSegments> data = this->track.data;
   this->track = track;
+  if (!complete){
+    // points will be delivered by chunks
+    this->track.data = std::make_shared<TrackSegments>();
+  } else if (!track.data){
+    this->track.data = data;
+  }
   if (originalBox.IsValid() != track.statistics.bbox.IsValid() ||
       originalBox.GetMinCoord() != track.statistics.bbox.GetMinCoord() ||
       originalBox.GetMaxCoord() != track.statistics.bbox.GetMaxCoord() ){
@@ -187,23 +210,95 @@ void CollectionTrackModel::onTrackDataLoaded(Track track, bool complete, bool /*
   emit loadingChanged();
 }
 
+void CollectionTrackModel::onTrackDataChunkLoaded(Track track, TrackChunk chunk)
+{
+  if (track.id != this->track.id || chunk.requestId != requestId || !this->track.data || !chunk.points){
+    return;
+  }
+  TrackSegments &segments = *(this->track.data);
+  if (segments.size() <= chunk.segment){
+    segments.resize(chunk.segment + 1);
+  }
+  TrackPointBuffer &points = segments[chunk.segment];
+  if (points.size() != chunk.offset){
+    qWarning() << "Unexpected track chunk" << chunk.segment << chunk.offset << "/" << points.size();
+    return;
+  }
+  points.append(*(chunk.points));
+  emit segmentChunkLoaded(chunk.segment, chunk.offset, chunk.points->size());
+}
+
 int CollectionTrackModel::getSegmentCount() const
 {
-  return track.data ? track.data->segments.size() : 0;
+  return track.data ? track.data->size() : 0;
+}
+
+QVariantList CollectionTrackModel::getDays() const
+{
+  QVariantList result;
+  if (!track.segmentStatistics){
+    return result;
+  }
+
+  std::map<QDate, std::vector<TrackStatistics>> days;
+  for (const TrackStatistics &segment: *track.segmentStatistics){
+    if (segment.from.isValid()){
+      days[segment.from.date()].push_back(segment);
+    }
+  }
+
+  for (const auto &day: days){
+    TrackStatistics statistics = TrackStatisticsAccumulator::merge(day.second);
+    QVariantMap map;
+    map["date"] = day.first;
+    map["from"] = statistics.from;
+    map["to"] = statistics.to;
+    map["distance"] = statistics.distance.AsMeter();
+    map["rawDistance"] = statistics.rawDistance.AsMeter();
+    map["duration"] = (qint64)statistics.duration.count(); // ms
+    map["movingDuration"] = (qint64)statistics.movingDuration.count(); // ms
+    map["maxSpeed"] = statistics.maxSpeed; // m/s
+    map["ascent"] = statistics.ascent.AsMeter();
+    map["descent"] = statistics.descent.AsMeter();
+    map["segmentCount"] = (int)day.second.size();
+    result << map;
+  }
+  return result;
 }
 
 QObject* CollectionTrackModel::createOverlayForSegment(int segment)
 {
   if (!track.data)
     return nullptr;
-  if (segment < 0 || (size_t)segment >= track.data->segments.size())
+  if (segment < 0 || (size_t)segment >= track.data->size())
+    return nullptr;
+
+  const TrackPointBuffer &seg = (*track.data)[segment];
+  std::vector<osmscout::Point> points;
+  points.reserve(seg.size());
+  for (size_t i = 0; i < seg.size(); i++){
+    points.emplace_back(0, seg.coord(i));
+  }
+  return new OverlayWay(points);
+}
+
+QObject* CollectionTrackModel::createOverlayForChunk(int segment, int offset, int count)
+{
+  if (!track.data)
+    return nullptr;
+  if (segment < 0 || (size_t)segment >= track.data->size())
+    return nullptr;
+
+  const TrackPointBuffer &seg = (*track.data)[segment];
+  size_t from = offset > 0 ? offset - 1 : 0;
+  size_t to = std::min<size_t>(seg.size(), (size_t)offset + std::max(count, 0));
+  if (offset < 0 || to < from + 2)
     return nullptr;
 
-  gpx::TrackSegment &seg = track.data->segments[segment];
   std::vector<osmscout::Point> points;
-  points.reserve(seg.points.size());
-  for (auto const &p:seg.points){
-    points.emplace_back(0, p.coord);
+  points.reserve(to - from);
+  for (size_t i = from; i < to; i++){
+    points.emplace_back(0, seg.coord(i));
   }
   return new OverlayWay(points);
 }
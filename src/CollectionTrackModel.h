@@ -26,6 +26,7 @@
 #include <QObject>
 #include <QtCore/QAbstractItemModel>
 #include <QtCore/QSet>
+#include <QVariantList>
 
 class CollectionTrackModel : public QObject {
   Q_OBJECT
@@ -52,15 +53,29 @@ class CollectionTrackModel : public QObject {
   Q_PROPERTY(QObject *boundingBox READ getBBox NOTIFY bboxChanged)
   Q_PROPERTY(int segmentCount READ getSegmentCount NOTIFY loadingChanged)
 
+  /**
+   * statistics grouped by day, list of maps with keys: date, from, to, distance,
+   * rawDistance, duration, movingDuration, maxSpeed, ascent, descent, segmentCount
+   * (see getDays)
+   */
+  Q_PROPERTY(QVariantList days READ getDays NOTIFY loadingChanged)
+
 signals:
   void loadingChanged();
   void bboxChanged();
-  void trackDataRequest(Track track);
+  void trackDataRequest(Track track, qint64 requestId);
+
+  /**
+   * new chunk of segment points was loaded, its overlay should be added
+   * (see createOverlayForChunk)
+   */
+  void segmentChunkLoaded(int segment, int offset, int count);
 
 public slots:
   void storageInitialised();
   void storageInitialisationError(QString);
-  void onTrackDataLoaded(Track track, bool complete, bool ok);
+  void onTrackDataLoaded(Track track, qint64 requestId, bool complete, bool ok);
+  void onTrackDataChunkLoaded(Track track, TrackChunk chunk);
 
 public:
   CollectionTrackModel();
@@ -91,10 +106,25 @@ public:
 
   QObject *getBBox() const;
   int getSegmentCount() const;
+
+  /**
+   * Day-by-day breakdown computed from statistics of segments, points are not needed.
+   * Segment is counted to the (local) day of its start, segments without time are skipped.
+   * Segment values are computed in context of the track, so ascent of the day is counted
+   * from the last elevation of previous day.
+   */
+  QVariantList getDays() const;
   Q_INVOKABLE QObject* createOverlayForSegment(int segment);
 
+  /**
+   * Overlay of segment points [offset, offset + count), joined to the last point
+   * of previous chunk, so only the new points are added to the map.
+   */
+  Q_INVOKABLE QObject* createOverlayForChunk(int segment, int offset, int count);
+
 private:
   bool loading{false};
+  qint64 requestId{0}; // outstanding request, results of older ones are ignored
   Track track;
 };
 
@@ -0,0 +1,89 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ContentFingerprint.h"
+#include "TrackPointBuffer.h"
+
+#include <cmath>
+
+using namespace osmscout;
+
+namespace {
+  static constexpr uint64_t Seed = 0xcbf29ce484222325ULL;
+  static constexpr uint64_t Prime = 0x100000001b3ULL;
+  static constexpr uint64_t NoValue = 0x8000000000000000ULL; // marker of missing optional value
+
+  inline void mix(uint64_t &h, uint64_t value)
+  {
+    h = (h ^ value) * Prime;
+    h ^= h >> 29;
+  }
+
+  /**
+   * final avalanche, from splitmix64
+   */
+  inline int64_t finish(uint64_t h)
+  {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return int64_t(h);
+  }
+
+  inline void mixCoord(uint64_t &h, const GeoCoord &coord)
+  {
+    mix(h, uint64_t(std::llround(coord.GetLat() * TrackPointBuffer::CoordScale)));
+    mix(h, uint64_t(std::llround(coord.GetLon() * TrackPointBuffer::CoordScale)));
+  }
+
+  inline void mixTime(uint64_t &h, const gpx::Optional<Timestamp> &time)
+  {
+    if (time.hasValue()){
+      mix(h, uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(time.get().time_since_epoch()).count()));
+    } else {
+      mix(h, NoValue);
+    }
+  }
+}
+
+int64_t ContentFingerprint::waypoint(const gpx::Waypoint &waypoint)
+{
+  uint64_t h = Seed;
+  mixCoord(h, waypoint.coord);
+  mixTime(h, waypoint.time);
+  const std::string name = waypoint.name.getOrElse("");
+  mix(h, name.size());
+  for (unsigned char c: name){
+    mix(h, c);
+  }
+  return finish(h);
+}
+
+int64_t ContentFingerprint::segment(const std::vector<gpx::TrackPoint> &points)
+{
+  uint64_t h = Seed;
+  mix(h, points.size());
+  for (const auto &p: points){
+    mixCoord(h, p.coord);
+    mixTime(h, p.time);
+  }
+  return finish(h);
+}
@@ -0,0 +1,51 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_CONTENTFINGERPRINT_H
+#define OSMSCOUT_SAILFISH_CONTENTFINGERPRINT_H
+
+#include <osmscout/gpx/TrackPoint.h>
+#include <osmscout/gpx/Waypoint.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Stable 64 bit content hashes of imported objects, used for detecting
+ * duplicates when the same data are imported again.
+ *
+ * Coordinates are hashed with precision of stored track points (1e-7 degree),
+ * times in milliseconds. Hash doesn't depend on platform or library version,
+ * it is stored in database.
+ */
+class ContentFingerprint
+{
+public:
+  /**
+   * hash of waypoint position, time and name
+   */
+  static int64_t waypoint(const osmscout::gpx::Waypoint &waypoint);
+
+  /**
+   * hash of segment point positions and times
+   */
+  static int64_t segment(const std::vector<osmscout::gpx::TrackPoint> &points);
+};
+
+#endif //OSMSCOUT_SAILFISH_CONTENTFINGERPRINT_H
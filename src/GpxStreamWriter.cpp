@@ -0,0 +1,323 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "GpxStreamWriter.h"
+#include "TrackPointBlock.h"
+
+#include <QDebug>
+
+#include <cstdio>
+
+using namespace osmscout;
+
+namespace {
+  static constexpr int ChunkSize = 256 * 1024; // bytes passed to writer thread at once
+  static constexpr size_t QueueCapacity = 8; // chunks
+
+  /**
+   * civil date from days since 1970-01-01
+   * http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+   */
+  inline void civilFromDays(int64_t z, int64_t &y, unsigned &m, unsigned &d)
+  {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    y = static_cast<int64_t>(yoe) + era * 400;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y += (m <= 2);
+  }
+
+  /**
+   * append timestamp in UTC, in format yyyy-MM-ddThh:mm:ss.zzzZ
+   */
+  void appendTime(QByteArray &out, const Timestamp &timestamp)
+  {
+    int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(timestamp.time_since_epoch()).count();
+    int64_t days = millis / 86400000;
+    int64_t dayMillis = millis % 86400000;
+    if (dayMillis < 0){
+      days--;
+      dayMillis += 86400000;
+    }
+    int64_t year;
+    unsigned month, day;
+    civilFromDays(days, year, month, day);
+
+    char str[32];
+    std::snprintf(str, sizeof(str), "%04d-%02u-%02uT%02d:%02d:%02d.%03dZ",
+                  int(year), month, day,
+                  int(dayMillis / 3600000), int(dayMillis / 60000 % 60), int(dayMillis / 1000 % 60), int(dayMillis % 1000));
+    out.append(str);
+  }
+
+  inline void appendText(QByteArray &out, const char *element, const QString &text)
+  {
+    out.append('<').append(element).append('>');
+    out.append(text.toHtmlEscaped().toUtf8());
+    out.append("</").append(element).append('>');
+  }
+
+  inline void appendText(QByteArray &out, const char *element, const std::string &text)
+  {
+    appendText(out, element, QString::fromStdString(text));
+  }
+
+  inline void appendNumber(QByteArray &out, const char *element, double value)
+  {
+    out.append('<').append(element).append('>');
+    out.append(QByteArray::number(value, 'f', 2));
+    out.append("</").append(element).append('>');
+  }
+
+  inline void appendCoord(QByteArray &out, const GeoCoord &coord)
+  {
+    out.append(" lat=\"").append(QByteArray::number(coord.GetLat(), 'f', 7));
+    out.append("\" lon=\"").append(QByteArray::number(coord.GetLon(), 'f', 7)).append('"');
+  }
+}
+
+GpxStreamWriter::GpxStreamWriter(const QString &filePath):
+  file(filePath),
+  queue(QueueCapacity)
+{
+}
+
+GpxStreamWriter::~GpxStreamWriter()
+{
+  queue.close();
+  if (writer.joinable()){
+    writer.join();
+  }
+}
+
+bool GpxStreamWriter::open()
+{
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+    qWarning() << "Cannot open" << file.fileName() << file.errorString();
+    error = file.errorString();
+    failed = true;
+    return false;
+  }
+  buffer.reserve(ChunkSize + ChunkSize / 4);
+  writer = std::thread(&GpxStreamWriter::run, this);
+  return true;
+}
+
+bool GpxStreamWriter::finish()
+{
+  flush(true);
+  queue.close();
+  if (writer.joinable()){
+    writer.join();
+  }
+  if (file.isOpen()){
+    file.close();
+  }
+  return !failed;
+}
+
+bool GpxStreamWriter::hasFailed() const
+{
+  return failed;
+}
+
+QString GpxStreamWriter::errorString() const
+{
+  return failed ? error : QString();
+}
+
+void GpxStreamWriter::run()
+{
+  QByteArray chunk;
+  while (queue.pop(chunk)){
+    if (file.write(chunk) != chunk.size()){
+      qWarning() << "Writing to" << file.fileName() << "failed" << file.errorString();
+      error = file.errorString();
+      failed = true;
+      queue.close();
+      return;
+    }
+  }
+  if (!file.flush()){
+    error = file.errorString();
+    failed = true;
+  }
+}
+
+void GpxStreamWriter::append(const QByteArray &data)
+{
+  buffer.append(data);
+  flush();
+}
+
+void GpxStreamWriter::append(const char *data)
+{
+  buffer.append(data);
+  flush();
+}
+
+void GpxStreamWriter::flush(bool force)
+{
+  if (buffer.isEmpty() || (!force && buffer.size() < ChunkSize)){
+    return;
+  }
+  QByteArray chunk;
+  chunk.swap(buffer);
+  if (!failed){
+    queue.push(std::move(chunk));
+  }
+  buffer.reserve(ChunkSize + ChunkSize / 4);
+}
+
+void GpxStreamWriter::writeHeader(const QString &name, const QString &description)
+{
+  append("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\" ?>\n"
+         "<gpx xmlns=\"http://www.topografix.com/GPX/1/1\" creator=\"OSM Scout for Sailfish OS\" version=\"1.1\" "
+         "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+         "xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\">\n");
+  if (name.isEmpty() && description.isEmpty()){
+    return;
+  }
+  QByteArray out;
+  out.append(" <metadata>");
+  if (!name.isEmpty()){
+    appendText(out, "name", name);
+  }
+  if (!description.isEmpty()){
+    appendText(out, "desc", description);
+  }
+  out.append("</metadata>\n");
+  append(out);
+}
+
+void GpxStreamWriter::writeFooter()
+{
+  append("</gpx>\n");
+}
+
+void GpxStreamWriter::writeWaypoint(const gpx::Waypoint &wpt)
+{
+  QByteArray out;
+  out.append(" <wpt");
+  appendCoord(out, wpt.coord);
+  out.append('>');
+  // element order defined by GPX schema
+  if (wpt.elevation.hasValue()){
+    appendNumber(out, "ele", wpt.elevation.get());
+  }
+  if (wpt.time.hasValue()){
+    out.append("<time>");
+    appendTime(out, wpt.time.get());
+    out.append("</time>");
+  }
+  if (wpt.name.hasValue()){
+    appendText(out, "name", wpt.name.get());
+  }
+  if (wpt.description.hasValue()){
+    appendText(out, "desc", wpt.description.get());
+  }
+  if (wpt.symbol.hasValue()){
+    appendText(out, "sym", wpt.symbol.get());
+  }
+  out.append("</wpt>\n");
+  append(out);
+}
+
+void GpxStreamWriter::writeTrackStart(const QString &name, const QString &description)
+{
+  QByteArray out;
+  out.append(" <trk>");
+  if (!name.isEmpty()){
+    appendText(out, "name", name);
+  }
+  if (!description.isEmpty()){
+    appendText(out, "desc", description);
+  }
+  out.append('\n');
+  append(out);
+}
+
+void GpxStreamWriter::writeTrackEnd()
+{
+  append(" </trk>\n");
+}
+
+void GpxStreamWriter::writeSegmentStart()
+{
+  append("  <trkseg>\n");
+}
+
+void GpxStreamWriter::writeSegmentEnd()
+{
+  append("  </trkseg>\n");
+}
+
+void GpxStreamWriter::formatTrackPoints(const std::vector<gpx::TrackPoint> &points, QByteArray &out)
+{
+  out.reserve(out.size() + points.size() * 120);
+  for (const auto &p: points){
+    out.append("   <trkpt");
+    appendCoord(out, p.coord);
+    out.append('>');
+    if (p.elevation.hasValue()){
+      appendNumber(out, "ele", p.elevation.get());
+    }
+    if (p.time.hasValue()){
+      out.append("<time>");
+      appendTime(out, p.time.get());
+      out.append("</time>");
+    }
+    if (p.hdop.hasValue()){
+      appendNumber(out, "hdop", p.hdop.get());
+    }
+    if (p.vdop.hasValue()){
+      appendNumber(out, "vdop", p.vdop.get());
+    }
+    out.append("</trkpt>\n");
+  }
+}
+
+void GpxStreamWriter::writeTrackPoints(const std::vector<gpx::TrackPoint> &points)
+{
+  formatTrackPoints(points, buffer);
+  flush();
+}
+
+bool GpxStreamWriter::writeTrackPointBlocks(const std::vector<QByteArray> &blocks)
+{
+  std::vector<QByteArray> formatted(blocks.size());
+  std::vector<char> decoded(blocks.size(), 1);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < (int)blocks.size(); i++){
+    std::vector<gpx::TrackPoint> points;
+    decoded[i] = TrackPointBlock::decode(blocks[i], points);
+    formatTrackPoints(points, formatted[i]);
+  }
+  bool success = true;
+  for (size_t i = 0; i < blocks.size(); i++){
+    success = success && decoded[i];
+    append(formatted[i]);
+  }
+  return success;
+}
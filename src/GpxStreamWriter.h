@@ -0,0 +1,112 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_GPXSTREAMWRITER_H
+#define OSMSCOUT_SAILFISH_GPXSTREAMWRITER_H
+
+#include "BoundedQueue.h"
+
+#include <osmscout/gpx/TrackPoint.h>
+#include <osmscout/gpx/Waypoint.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * Streaming writer of GPX 1.1 file with bounded memory usage.
+ *
+ * Document is appended element by element, in document order.
+ * Formatted output is buffered to chunks, these are written to file
+ * by writer thread while caller continues with next elements.
+ * Encoded track point blocks (see TrackPointBlock) are decoded
+ * and formatted by worker threads in parallel.
+ */
+class GpxStreamWriter
+{
+public:
+  explicit GpxStreamWriter(const QString &filePath);
+
+  GpxStreamWriter(const GpxStreamWriter&) = delete;
+  GpxStreamWriter& operator=(const GpxStreamWriter&) = delete;
+
+  /**
+   * Stops writer thread, file may be incomplete when finish was not called
+   */
+  ~GpxStreamWriter();
+
+  /**
+   * open file and start writer thread
+   */
+  bool open();
+
+  /**
+   * append remaining data and wait until it is written
+   * @return true when whole document was written successfully
+   */
+  bool finish();
+
+  /**
+   * @return true when writing to file failed
+   */
+  bool hasFailed() const;
+
+  QString errorString() const;
+
+  void writeHeader(const QString &name, const QString &description);
+  void writeFooter();
+
+  void writeWaypoint(const osmscout::gpx::Waypoint &waypoint);
+
+  void writeTrackStart(const QString &name, const QString &description);
+  void writeTrackEnd();
+
+  void writeSegmentStart();
+  void writeSegmentEnd();
+
+  void writeTrackPoints(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * decode and format blocks in parallel, points are appended in order of blocks
+   * @return false when some block is corrupted
+   */
+  bool writeTrackPointBlocks(const std::vector<QByteArray> &blocks);
+
+  static void formatTrackPoints(const std::vector<osmscout::gpx::TrackPoint> &points, QByteArray &out);
+
+private:
+  void append(const QByteArray &data);
+  void append(const char *data);
+  void flush(bool force = false);
+  void run();
+
+private:
+  QFile file;
+  QByteArray buffer; // data not passed to writer thread yet
+  BoundedQueue<QByteArray> queue;
+  std::thread writer;
+  std::atomic_bool failed{false};
+  QString error; // written by writer thread, valid when failed is true
+};
+
+#endif //OSMSCOUT_SAILFISH_GPXSTREAMWRITER_H
@@ -0,0 +1,160 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ImportJob.h"
+
+#include <osmscout/gpx/Import.h>
+
+#include <QDebug>
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace osmscout;
+
+namespace {
+  // share of parsing in overall progress
+  static constexpr double ParseProgressShare = 0.3;
+
+  size_t windowSize()
+  {
+#ifdef _OPENMP
+    return std::max(1, omp_get_max_threads());
+#else
+    return 1;
+#endif
+  }
+}
+
+void ImportJob::ProgressCallback::Progress(double p)
+{
+  progress = std::max(0.0, std::min(1.0, p));
+}
+
+ImportJob::ImportJob(qint64 id,
+                     const QString &filePath,
+                     const TrackPreparer &preparer):
+  id(id),
+  filePath(filePath),
+  preparer(preparer),
+  callback(std::make_shared<ProgressCallback>()),
+  breaker(std::make_shared<ThreadedBreaker>()),
+  queue(windowSize())
+{
+}
+
+ImportJob::~ImportJob()
+{
+  cancel();
+  if (worker.joinable()){
+    worker.join();
+  }
+}
+
+void ImportJob::start()
+{
+  timer.start();
+  worker = std::thread(&ImportJob::run, this);
+}
+
+void ImportJob::cancel()
+{
+  breaker->Break();
+  queue.close();
+}
+
+bool ImportJob::isCancelled() const
+{
+  return breaker->IsAborted();
+}
+
+bool ImportJob::isParsed() const
+{
+  return parsed;
+}
+
+bool ImportJob::isParseOk() const
+{
+  return parseOk;
+}
+
+bool ImportJob::nextPreparedTrack(PreparedTrack &track)
+{
+  return queue.tryPop(track);
+}
+
+bool ImportJob::isPreparationDone() const
+{
+  return preparationFinished && queue.isDrained();
+}
+
+double ImportJob::getProgress() const
+{
+  if (!parsed){
+    return callback->progress * ParseProgressShare;
+  }
+  if (totalPoints == 0){
+    return phase == Phase::Done ? 1.0 : ParseProgressShare;
+  }
+  return ParseProgressShare + (1.0 - ParseProgressShare) * std::min(1.0, double(writtenPoints) / double(totalPoints));
+}
+
+std::shared_ptr<ErrorCallback> ImportJob::getCallback() const
+{
+  return callback;
+}
+
+void ImportJob::run()
+{
+  bool success = gpx::ImportGpx(filePath.toStdString(),
+                                gpxFile,
+                                breaker,
+                                std::static_pointer_cast<gpx::ProcessCallback, ProgressCallback>(callback));
+  parseOk = success && !isCancelled();
+  parsed = true;
+  if (!parseOk){
+    qWarning() << "Gpx import failed" << filePath;
+    preparationFinished = true;
+    queue.close();
+    return;
+  }
+
+  // prepare tracks in windows processed in parallel,
+  // results are pushed to queue in original order
+  const auto &tracks = gpxFile.tracks;
+  const size_t window = windowSize();
+  for (size_t windowStart = 0; windowStart < tracks.size() && !isCancelled(); windowStart += window){
+    size_t windowEnd = std::min(tracks.size(), windowStart + window);
+    std::vector<PreparedTrack> prepared(windowEnd - windowStart);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)prepared.size(); i++){
+      prepared[i] = preparer(tracks[windowStart + i]);
+    }
+    for (auto &trk: prepared){
+      if (!queue.push(std::move(trk))){
+        break;
+      }
+    }
+  }
+  preparationFinished = true;
+  queue.close();
+}
@@ -0,0 +1,155 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_IMPORTJOB_H
+#define OSMSCOUT_SAILFISH_IMPORTJOB_H
+
+#include "BoundedQueue.h"
+#include "Storage.h"
+
+#include <osmscout/gpx/GpxFile.h>
+#include <osmscout/util/Breaker.h>
+
+#include <QString>
+#include <QTime>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+/**
+ * State of one collection import, processed by Storage in bounded steps.
+ *
+ * Gpx file is parsed by the job's worker thread, which then prepares
+ * tracks (statistics, encoded point blocks) in parallel. Storage thread
+ * writes the collection, waypoints and prepared tracks step by step,
+ * other storage requests are served between steps.
+ */
+class ImportJob
+{
+public:
+  using TrackPreparer = std::function<PreparedTrack(const osmscout::gpx::Track&)>;
+
+  enum class Phase {
+    Parse,
+    Waypoints,
+    Tracks,
+    Done
+  };
+
+private:
+  class ProgressCallback: public ErrorCallback
+  {
+  public:
+    virtual void Progress(double p);
+
+  public:
+    std::atomic<double> progress{0};
+  };
+
+public:
+  ImportJob(qint64 id,
+            const QString &filePath,
+            const TrackPreparer &preparer);
+
+  ImportJob(const ImportJob&) = delete;
+  ImportJob& operator=(const ImportJob&) = delete;
+
+  /**
+   * Cancels the job and waits for the worker thread
+   */
+  ~ImportJob();
+
+  /**
+   * start worker thread, parsing gpx file and preparing its tracks
+   */
+  void start();
+
+  /**
+   * Request cancel. It may be called from any thread.
+   */
+  void cancel();
+
+  bool isCancelled() const;
+
+  /**
+   * @return true when parsing is done (successfully or not)
+   */
+  bool isParsed() const;
+
+  bool isParseOk() const;
+
+  /**
+   * Next prepared track, without blocking.
+   * @return false when no track is ready yet
+   */
+  bool nextPreparedTrack(PreparedTrack &track);
+
+  /**
+   * @return true when all tracks were prepared and taken by nextPreparedTrack
+   */
+  bool isPreparationDone() const;
+
+  /**
+   * @return import progress in range 0..1
+   */
+  double getProgress() const;
+
+  std::shared_ptr<ErrorCallback> getCallback() const;
+
+public:
+  const qint64 id;
+  const QString filePath;
+
+  // valid when isParsed() returns true, worker thread just reads tracks since that
+  osmscout::gpx::GpxFile gpxFile;
+
+  // writer state, accessed by Storage thread only
+  Phase phase{Phase::Parse};
+  qint64 collectionId{-1};
+  size_t nextWaypoint{0};
+  size_t trackIndex{0}; // index of current track in gpx file
+  bool hasTrack{false};
+  PreparedTrack track; // current track, when hasTrack is true
+  qint64 trackId{-1}; // current track in database, -1 when not inserted yet
+  size_t segmentIndex{0};
+  qint64 segmentId{-1}; // current segment in database, -1 when not inserted yet
+  size_t blockIndex{0};
+  size_t writtenPoints{0};
+  size_t totalPoints{0};
+  size_t duplicateWaypoints{0}; // skipped, already stored
+  size_t duplicateTracks{0};
+  double reportedProgress{-1}; // last progress emitted by Storage
+  QTime timer; // started with worker thread
+
+private:
+  void run();
+
+private:
+  TrackPreparer preparer;
+  std::shared_ptr<ProgressCallback> callback;
+  std::shared_ptr<osmscout::ThreadedBreaker> breaker;
+  BoundedQueue<PreparedTrack> queue;
+  std::thread worker;
+  std::atomic_bool parsed{false};
+  std::atomic_bool parseOk{false};
+  std::atomic_bool preparationFinished{false};
+};
+
+#endif //OSMSCOUT_SAILFISH_IMPORTJOB_H
@@ -42,6 +42,7 @@
 #include "Storage.h"
 #include "CollectionModel.h"
 #include "CollectionListModel.h"
+#include "CollectionSearchModel.h"
 #include "CollectionTrackModel.h"
 #include "CollectionMapBridge.h"
 
@@ -112,12 +113,22 @@ int main(int argc, char* argv[])
   OSMScoutQt::RegisterQmlTypes("harbour.osmscout.map", 1, 0);
 
   qRegisterMetaType<MapView*>("MapView*");
-  qRegisterMetaType<std::vector<Collection>>("std::vector<Collection>");
+  qRegisterMetaType<CollectionList>("CollectionList");
   qRegisterMetaType<Collection>("Collection");
   qRegisterMetaType<Track>("Track");
+  qRegisterMetaType<TrackChunk>("TrackChunk");
+  qRegisterMetaType<TrackLod>("TrackLod");
+  qRegisterMetaType<std::vector<osmscout::gpx::TrackPoint>>("std::vector<osmscout::gpx::TrackPoint>");
   qRegisterMetaType<Waypoint>("Waypoint");
+  qRegisterMetaType<TrackList>("TrackList");
+  qRegisterMetaType<WaypointList>("WaypointList");
+  qRegisterMetaType<osmscout::GeoBox>("osmscout::GeoBox");
+  qRegisterMetaType<std::vector<SearchResultItem>>("std::vector<SearchResultItem>");
+  qRegisterMetaType<QList<qint64>>("QList<qint64>");
+  qRegisterMetaType<DatabaseStats>("DatabaseStats");
 
   qmlRegisterType<CollectionListModel>("harbour.osmscout.map", 1, 0, "CollectionListModel");
+  qmlRegisterType<CollectionSearchModel>("harbour.osmscout.map", 1, 0, "CollectionSearchModel");
   qmlRegisterType<CollectionModel>("harbour.osmscout.map", 1, 0, "CollectionModel");
   qmlRegisterType<CollectionTrackModel>("harbour.osmscout.map", 1, 0, "CollectionTrackModel");
   qmlRegisterType<CollectionMapBridge>("harbour.osmscout.map", 1, 0, "CollectionMapBridge");
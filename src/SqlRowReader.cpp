@@ -0,0 +1,161 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "SqlRowReader.h"
+#include "QVariantConverters.h"
+
+#include <ctime>
+
+using namespace osmscout;
+
+namespace {
+  /**
+   * read fixed count of decimal digits
+   */
+  inline bool readNumber(const QChar *str, int count, int &result)
+  {
+    result = 0;
+    for (int i = 0; i < count; i++){
+      ushort c = str[i].unicode();
+      if (c < '0' || c > '9'){
+        return false;
+      }
+      result = result * 10 + (c - '0');
+    }
+    return true;
+  }
+
+  /**
+   * days since 1970-01-01 in proleptic Gregorian calendar
+   * http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+   */
+  inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)
+  {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+  }
+}
+
+bool TimestampParser::parse(const QString &str, Timestamp &timestamp)
+{
+  // yyyy-MM-ddThh:mm:ss
+  const int length = str.size();
+  if (length < 19){
+    return false;
+  }
+  const QChar *s = str.constData();
+  int year, month, day, hour, minute, second;
+  if (!readNumber(s, 4, year) || s[4] != '-' ||
+      !readNumber(s + 5, 2, month) || s[7] != '-' ||
+      !readNumber(s + 8, 2, day) || (s[10] != 'T' && s[10] != ' ') ||
+      !readNumber(s + 11, 2, hour) || s[13] != ':' ||
+      !readNumber(s + 14, 2, minute) || s[16] != ':' ||
+      !readNumber(s + 17, 2, second)){
+    return false;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60){
+    return false;
+  }
+
+  int pos = 19;
+  int64_t millis = 0;
+  if (pos < length && s[pos] == '.'){
+    pos++;
+    int digits = 0;
+    while (pos < length && s[pos].isDigit()){
+      if (digits < 3){
+        millis = millis * 10 + s[pos].digitValue();
+      }
+      digits++;
+      pos++;
+    }
+    for (; digits < 3; digits++){
+      millis *= 10;
+    }
+  }
+
+  int64_t seconds;
+  if (pos == length){
+    // local time
+    int64_t hourKey = ((int64_t(year) * 12 + month) * 31 + day) * 24 + hour;
+    if (hourKey != cachedHour){
+      std::tm tm{};
+      tm.tm_year = year - 1900;
+      tm.tm_mon = month - 1;
+      tm.tm_mday = day;
+      tm.tm_hour = hour;
+      tm.tm_isdst = -1;
+      std::time_t t = std::mktime(&tm);
+      if (t == std::time_t(-1)){
+        return false;
+      }
+      cachedHour = hourKey;
+      cachedHourEpoch = t;
+    }
+    seconds = cachedHourEpoch + minute * 60 + second;
+  } else {
+    seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    if (s[pos] == 'Z' && pos + 1 == length){
+      // UTC
+    } else if ((s[pos] == '+' || s[pos] == '-') && pos + 6 == length && s[pos + 3] == ':'){
+      int offsetHours, offsetMinutes;
+      if (!readNumber(s + pos + 1, 2, offsetHours) ||
+          !readNumber(s + pos + 4, 2, offsetMinutes)){
+        return false;
+      }
+      int offset = offsetHours * 3600 + offsetMinutes * 60;
+      seconds += (s[pos] == '+') ? -offset : offset;
+    } else {
+      return false;
+    }
+  }
+
+  timestamp = Timestamp(std::chrono::milliseconds(seconds * 1000 + millis));
+  return true;
+}
+
+gpx::Optional<Timestamp> SqlRowReader::getTimestampOpt(int column)
+{
+  QVariant var = query.value(column);
+  if (var.isNull()){
+    return gpx::Optional<Timestamp>();
+  }
+  if (var.type() == QVariant::String){
+    Timestamp timestamp;
+    if (timestampParser.parse(var.toString(), timestamp)){
+      return gpx::Optional<Timestamp>::of(timestamp);
+    }
+  }
+  // unexpected format, fallback to Qt conversion
+  QDateTime dateTime = converters::varToDateTime(var);
+  if (!dateTime.isValid()){
+    return gpx::Optional<Timestamp>();
+  }
+  return gpx::Optional<Timestamp>::of(converters::dateTimeToTimestamp(dateTime));
+}
+
+QDateTime SqlRowReader::getDateTime(int column)
+{
+  gpx::Optional<Timestamp> timestamp = getTimestampOpt(column);
+  return converters::timestampToDateTime(timestamp);
+}
@@ -0,0 +1,143 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_SQLROWREADER_H
+#define OSMSCOUT_SAILFISH_SQLROWREADER_H
+
+#include <osmscout/util/Time.h>
+#include <osmscout/gpx/Optional.h>
+
+#include <QtSql/QSqlQuery>
+#include <QVariant>
+#include <QDateTime>
+#include <QString>
+
+#include <string>
+
+/**
+ * Parser of date time strings written by Qt sqlite driver
+ * ("yyyy-MM-ddThh:mm:ss[.zzz][Z|+hh:mm]"), without QDateTime round trip.
+ *
+ * Strings without time zone are local time (same as QDateTime::fromString).
+ * Local time offset is computed once per hour, consecutive rows
+ * (track points, waypoints) usually share it.
+ */
+class TimestampParser
+{
+public:
+  /**
+   * @return false if string has unexpected format
+   */
+  bool parse(const QString &str, osmscout::Timestamp &timestamp);
+
+private:
+  int64_t cachedHour{-1};
+  int64_t cachedHourEpoch{0}; // seconds
+};
+
+/**
+ * Typed reader of query rows.
+ *
+ * Columns are accessed by index (order of columns in SELECT statement),
+ * so there is no by-name lookup per value, and values are converted
+ * to native types directly. Scalar values are stored inside QVariant
+ * without heap allocation, timestamps are parsed without QDateTime.
+ */
+class SqlRowReader
+{
+public:
+  explicit SqlRowReader(QSqlQuery &query):
+    query(query)
+  {}
+
+  bool next()
+  {
+    return query.next();
+  }
+
+  bool isNull(int column) const
+  {
+    return query.isNull(column);
+  }
+
+  qint64 getLong(int column, qint64 def = -1) const
+  {
+    bool ok;
+    qint64 val = query.value(column).toLongLong(&ok);
+    return ok ? val : def;
+  }
+
+  double getDouble(int column, double def = 0) const
+  {
+    QVariant var = query.value(column);
+    if (var.isNull()){
+      return def;
+    }
+    bool ok;
+    double val = var.toDouble(&ok);
+    return ok ? val : def;
+  }
+
+  osmscout::gpx::Optional<double> getDoubleOpt(int column) const
+  {
+    QVariant var = query.value(column);
+    if (var.isNull()){
+      return osmscout::gpx::Optional<double>();
+    }
+    bool ok;
+    double val = var.toDouble(&ok);
+    return ok ? osmscout::gpx::Optional<double>::of(val) : osmscout::gpx::Optional<double>();
+  }
+
+  bool getBool(int column, bool def = false) const
+  {
+    QVariant var = query.value(column);
+    return var.isNull() ? def : var.toBool();
+  }
+
+  QString getString(int column, const QString &def = "") const
+  {
+    QVariant var = query.value(column);
+    return var.isNull() ? def : var.toString();
+  }
+
+  osmscout::gpx::Optional<std::string> getStringOpt(int column) const
+  {
+    QVariant var = query.value(column);
+    if (var.isNull()){
+      return osmscout::gpx::Optional<std::string>();
+    }
+    return osmscout::gpx::Optional<std::string>::of(var.toString().toStdString());
+  }
+
+  QByteArray getBytes(int column) const
+  {
+    return query.value(column).toByteArray();
+  }
+
+  osmscout::gpx::Optional<osmscout::Timestamp> getTimestampOpt(int column);
+
+  QDateTime getDateTime(int column);
+
+private:
+  QSqlQuery &query;
+  TimestampParser timestampParser;
+};
+
+#endif //OSMSCOUT_SAILFISH_SQLROWREADER_H
@@ -18,21 +18,197 @@
 */
 
 #include "Storage.h"
+#include "BoundedQueue.h"
 #include "QVariantConverters.h"
+#include "TrackPointBlock.h"
+#include "SqlRowReader.h"
+#include "ImportJob.h"
+#include "GpxStreamWriter.h"
+#include "TrackSimplifier.h"
+#include "TrackStatisticsAccumulator.h"
+#include "ContentFingerprint.h"
 
 #include <osmscout/OSMScoutQt.h>
 #include <osmscout/gpx/GpxFile.h>
-#include <osmscout/gpx/Import.h>
 
 #include <QDebug>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QStorageInfo>
 #include <QThread>
+#include <QTimer>
 #include <QtSql/QSqlQuery>
-#include <osmscout/gpx/Export.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace {
-  static constexpr int DbSchema = 1;
-  static constexpr int TrackPointBatchSize = 10000;
-  static constexpr int WayPointBatchSize = 100;
+  static constexpr int DbSchema = 13;
+  static constexpr int DefaultTrackPointBatchSize = 10000;
+  static constexpr int TrackPointBlockSize = 2048;
+  static constexpr int TrackChunkSize = 5000; // points
+  static constexpr int TrackChunkInterval = 50; // ms
+  static constexpr int DefaultWayPointBatchSize = 100;
+  static constexpr int ImportPollInterval = 20; // ms, while import job waits for its worker thread
+  static constexpr double ImportProgressStep = 0.01; // minimal progress change reported
+  static constexpr size_t ExportBlockWindow = 4; // point blocks formatted in parallel, per thread
+  static constexpr int DefaultRecordingFlushInterval = 5000; // ms
+  static constexpr int BackgroundRetryDelay = 10000; // ms, when step of background job (geometry, statistics) fails
+
+  // revision of statistics rules (TrackStatisticsAccumulator), increase it when rules change,
+  // tracks with older stats_version are recomputed in background (see recomputeStatistics)
+  // 2: statistics of segments are stored, values of track statistics are not changed
+  // 3: distances by GetEllipsoidalDistance again, version 2 used approximated ones
+  static constexpr int StatisticsVersion = 3;
+  static constexpr int StatisticsBatchTracks = 32; // tracks recomputed in one step
+  static constexpr qint64 StatisticsBatchPoints = 200000; // points of tracks processed in one step
+
+  // rows inserted by single statement, sqlite limits statement to 999 parameters
+  static constexpr int MaxStatementParameters = 999;
+  static constexpr int TrackPointBlocksPerStatement = 32;
+
+  static constexpr int ReaderCount = 2; // read-only connections
+  static constexpr int ReadRetryCount = 2; // when writer commits during read
+  static constexpr qint64 MmapSize = 64 * 1024 * 1024; // bytes
+  static constexpr int CacheSize = 4 * 1024; // KiB, per connection
+  static constexpr int BusyTimeout = 5000; // ms
+
+  static constexpr int DefaultMaintenanceIdleDelay = 10000; // ms without requests
+  static constexpr int MaintenanceStepDelay = 100; // ms between vacuum steps
+  static constexpr int VacuumStepPages = 256; // 1 MiB with default page size
+  static constexpr qint64 AnalyzeChangeThreshold = 10000; // rows changed since last ANALYZE
+  static constexpr int AnalysisLimit = 1000; // rows examined per index by ANALYZE
+  static constexpr qint64 AutoVacuumIncremental = 2;
+
+  // track columns, in order of TrackColumn enum
+  static const char *TrackColumns =
+    "`id`, `collection_id`, `name`, `description`, `open`, `creation_time`, `modification_time`, "
+    "`from_time`, `to_time`, `distance`, `raw_distance`, `duration`, `moving_duration`, "
+    "`max_speed`, `average_speed`, `moving_average_speed`, `ascent`, `descent`, "
+    "`min_elevation`, `max_elevation`, "
+    "`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`";
+
+  enum TrackColumn {
+    TrkId = 0,
+    TrkCollectionId,
+    TrkName,
+    TrkDescription,
+    TrkOpen,
+    TrkCreationTime,
+    TrkModificationTime,
+    TrkFromTime,
+    TrkToTime,
+    TrkDistance,
+    TrkRawDistance,
+    TrkDuration,
+    TrkMovingDuration,
+    TrkMaxSpeed,
+    TrkAverageSpeed,
+    TrkMovingAverageSpeed,
+    TrkAscent,
+    TrkDescent,
+    TrkMinElevation,
+    TrkMaxElevation,
+    TrkBBoxMinLat,
+    TrkBBoxMinLon,
+    TrkBBoxMaxLat,
+    TrkBBoxMaxLon
+  };
+
+  // segment columns, in order of SegmentColumn enum,
+  // statistics are in the same order as in TrackColumns
+  static const char *SegmentColumns =
+    "`id`, `open`, `stats_version`, `statistics_state`, "
+    "`from_time`, `to_time`, `distance`, `raw_distance`, `duration`, `moving_duration`, "
+    "`max_speed`, `average_speed`, `moving_average_speed`, `ascent`, `descent`, "
+    "`min_elevation`, `max_elevation`, "
+    "`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`";
+
+  enum SegmentColumn {
+    SegId = 0,
+    SegOpen,
+    SegStatsVersion,
+    SegStatisticsState,
+    SegFromTime // first statistics column
+  };
+
+  // waypoint columns, in order of WaypointColumn enum
+  static const char *WaypointColumns =
+    "`id`, `collection_id`, `name`, `description`, `symbol`, `timestamp`, `modification_time`, "
+    "`latitude`, `longitude`, `elevation`";
+
+  enum WaypointColumn {
+    WptId = 0,
+    WptCollectionId,
+    WptName,
+    WptDescription,
+    WptSymbol,
+    WptTimestamp,
+    WptModificationTime,
+    WptLatitude,
+    WptLongitude,
+    WptElevation
+  };
+
+  /**
+   * INSERT statement for multiple rows with positional parameters
+   */
+  QString multiRowInsert(const QString &table, const QStringList &columns, int rows)
+  {
+    QString row = "(" + QString("?, ").repeated(columns.size() - 1) + "?)";
+    QString sql = QString("INSERT INTO `%1` (`%2`) VALUES ").arg(table, columns.join("`, `"));
+    sql.reserve(sql.size() + rows * (row.size() + 2));
+    for (int i = 0; i < rows; i++){
+      if (i > 0){
+        sql.append(", ");
+      }
+      sql.append(row);
+    }
+    sql.append(";");
+    return sql;
+  }
+
+  inline osmscout::gpx::Optional<osmscout::Distance> toDistanceOpt(const osmscout::gpx::Optional<double> &meters)
+  {
+    if (meters.hasValue()) {
+      return osmscout::gpx::Optional<osmscout::Distance>::of(osmscout::Distance::Of<osmscout::Meter>(meters.get()));
+    }
+    return osmscout::gpx::Optional<osmscout::Distance>();
+  }
+
+  /**
+   * statistics columns in order of TrackColumns, starting with from_time at column first
+   */
+  TrackStatistics readStatistics(SqlRowReader &row, int first)
+  {
+    auto column = [first](TrackColumn c){ return first + (c - TrkFromTime); };
+    return TrackStatistics(
+      row.getDateTime(column(TrkFromTime)),
+      row.getDateTime(column(TrkToTime)),
+      osmscout::Distance::Of<osmscout::Meter>(row.getDouble(column(TrkDistance))),
+      osmscout::Distance::Of<osmscout::Meter>(row.getDouble(column(TrkRawDistance))),
+      std::chrono::milliseconds(row.getLong(column(TrkDuration))),
+      std::chrono::milliseconds(row.getLong(column(TrkMovingDuration))),
+      row.getDouble(column(TrkMaxSpeed)),
+      row.getDouble(column(TrkAverageSpeed)),
+      row.getDouble(column(TrkMovingAverageSpeed)),
+      osmscout::Distance::Of<osmscout::Meter>(row.getDouble(column(TrkAscent))),
+      osmscout::Distance::Of<osmscout::Meter>(row.getDouble(column(TrkDescent))),
+      toDistanceOpt(row.getDoubleOpt(column(TrkMinElevation))),
+      toDistanceOpt(row.getDoubleOpt(column(TrkMaxElevation))),
+
+      osmscout::GeoBox(osmscout::GeoCoord(row.getDouble(column(TrkBBoxMinLat)),
+                                          row.getDouble(column(TrkBBoxMinLon))),
+                       osmscout::GeoCoord(row.getDouble(column(TrkBBoxMaxLat)),
+                                          row.getDouble(column(TrkBBoxMaxLon)))));
+  }
 }
 
 using namespace osmscout;
@@ -46,51 +222,18 @@ void ErrorCallback::Error(std::string err)
   emit error(QString::fromStdString(err));
 }
 
-void MaxSpeedBuffer::flush()
-{
-  lastPoint.reset();
-  bufferTime.zero();
-  bufferDistance = Distance::Of<Meter>(0);
-}
-
-void MaxSpeedBuffer::insert(const gpx::TrackPoint &p)
-{
-  if (!p.time.hasValue()){
-    return;
-  }
-  if (lastPoint){
-    std::chrono::milliseconds timeDiff = p.time.get() - lastPoint->time.get();
-    if (timeDiff.count() < 0){
-      qWarning() << "Traveling in time is not supported";
-      return;
-    }
-    Distance distanceDiff = GetEllipsoidalDistance(lastPoint->coord, p.coord);
-    distanceFifo.push_back(distanceDiff);
-    timeFifo.push_back(timeDiff);
-    bufferDistance += distanceDiff;
-    bufferTime += timeDiff;
-
-    while (bufferTime > std::chrono::milliseconds(5000) && !distanceFifo.empty()){
-      double speed = bufferDistance.AsMeter() / ((double)bufferTime.count() / 1000.0);
-      maxSpeed = std::max(maxSpeed, speed);
-      bufferDistance = bufferDistance - distanceFifo.front(); // it can be inaccurate!
-      bufferTime -= timeFifo.front();
-      distanceFifo.pop_front();
-      timeFifo.pop_front();
-    }
-  }
-  lastPoint=std::make_shared<osmscout::gpx::TrackPoint>(p);
-}
-
-double MaxSpeedBuffer::getMaxSpeed() const
-{
-  return maxSpeed;
-}
-
 Storage::Storage(QThread *thread,
-                 const QDir &directory)
+                 const QDir &directory,
+                 Storage *writer,
+                 int readerId)
   :thread(thread),
-   directory(directory)
+   directory(directory),
+   trackPointBatchSize(DefaultTrackPointBatchSize),
+   wayPointBatchSize(DefaultWayPointBatchSize),
+   writer(writer),
+   connectionName(writer == nullptr ? QString("storage") : QString("storage-reader-%1").arg(readerId)),
+   recordingFlushInterval(DefaultRecordingFlushInterval),
+   maintenanceIdleDelay(DefaultMaintenanceIdleDelay)
 {
 }
 
@@ -103,197 +246,844 @@ Storage::~Storage()
     thread->quit();
   }
 
+  // cancel import jobs and wait for their worker threads
+  importJobs.clear();
+
+  if (!recordings.empty() && ok){
+    flushRecordings();
+  }
+
   if (db.isValid()) {
     if (db.isOpen()) {
       db.close();
     }
     db = QSqlDatabase(); // invalidate instance
-    QSqlDatabase::removeDatabase("storage");
+    QSqlDatabase::removeDatabase(connectionName);
   }
   qDebug() << "Storage is closed";
 }
 
-bool Storage::updateSchema(){
-  int currentSchema=0;
-  QStringList tables = db.tables();
-
-  if (tables.contains("version")){
-    QString sql("SELECT MAX(`version`) AS `currentVersion` FROM `version`;");
-
-    QSqlQuery q = db.exec(sql);
-    if (!q.lastError().isValid()){
-      if (q.next()){
-        QVariant val = q.value(0);
-        if (!val.isNull()){
-          bool ok = false;
-          currentSchema = val.toInt(&ok);
-          if (!ok) {
-            qWarning() << "Loading currentSchema value failed" << val;
-          }
-          qDebug()<<"last schema: "<<currentSchema;
-        }
-      } else {
-        qWarning() << "Loading currentSchema value failed (no entry)";
+namespace {
+  /**
+   * Schema migration step. Steps are applied in order of version,
+   * every step in its own transaction together with version table update.
+   */
+  struct SchemaMigration
+  {
+    int version;
+    const char *description;
+    std::function<bool(QSqlDatabase &db)> apply;
+  };
+
+  bool execStatements(QSqlDatabase &db, const QStringList &statements)
+  {
+    for (const QString &sql: statements){
+      QSqlQuery q = db.exec(sql);
+      if (q.lastError().isValid()){
+        qWarning() << "Storage: statement" << sql << "failed" << q.lastError();
+        return false;
       }
-    }else{
-      qWarning() << "failed to get schema version " << q.lastError();
     }
+    return true;
   }
 
-  if (!tables.contains("version")){
-    QString sql("CREATE TABLE `version` ( `version` int NOT NULL);");
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Creating version table failed" << q.lastError();
-      db.close();
-      return false;
+  /**
+   * @return integer value of pragma, -1 on error
+   */
+  qint64 pragmaValue(QSqlDatabase &db, const QString &pragma)
+  {
+    QSqlQuery q = db.exec(QString("PRAGMA %1;").arg(pragma));
+    if (q.lastError().isValid() || !q.next()){
+      qWarning() << "Reading pragma" << pragma << "failed" << q.lastError();
+      return -1;
     }
+    return varToLong(q.value(0));
+  }
 
-    QSqlQuery sqlInsert(db);
-    sqlInsert.prepare("INSERT INTO `version` (`version`) VALUES (:version);");
-    sqlInsert.bindValue(":version", DbSchema);
-    sqlInsert.exec();
-    if (sqlInsert.lastError().isValid()){
-      qWarning() << "Creating version table entry failed" << sqlInsert.lastError();
-      db.close();
-      return false;
-    }
-    currentSchema = DbSchema;
+  /**
+   * Parts of collection_summary maintenance statements, used by triggers.
+   * Track just opened for recording has zero bounding box, it is not part of the summary.
+   */
+  QString trackHasBox(const QString &row)
+  {
+    return QString("(%1.`bbox_min_lat` != 0 OR %1.`bbox_max_lat` != 0 OR %1.`bbox_min_lon` != 0 OR %1.`bbox_max_lon` != 0)").arg(row);
   }
-  if (currentSchema > DbSchema) {
-    qWarning() << "newer database schema; " << currentSchema << " > " << DbSchema;
+
+  QString summaryTouched(const QString &row)
+  {
+    return QString("`modification_time` = max(coalesce(`modification_time`, %1.`modification_time`), %1.`modification_time`)").arg(row);
   }
 
-  if (!tables.contains("collection")){
-    qDebug()<< "creating collection table";
+  QString summaryTouchedNow()
+  {
+    return "`modification_time` = strftime('%Y-%m-%dT%H:%M:%f', 'now', 'localtime')";
+  }
 
-    QString sql("CREATE TABLE `collection`");
-    sql.append("(").append( "`id` INTEGER PRIMARY KEY");
-    sql.append(",").append( "`name` varchar(255) NOT NULL ");
-    sql.append(",").append( "`description` varchar(255) NULL ");
-    sql.append(",").append( "`visible` tinyint(1) NOT NULL");
-    sql.append(");");
+  QString summaryExpandBox(const QString &minLat, const QString &minLon, const QString &maxLat, const QString &maxLon)
+  {
+    return QString("`bbox_min_lat` = min(coalesce(`bbox_min_lat`, %1), %1), "
+                   "`bbox_min_lon` = min(coalesce(`bbox_min_lon`, %2), %2), "
+                   "`bbox_max_lat` = max(coalesce(`bbox_max_lat`, %3), %3), "
+                   "`bbox_max_lon` = max(coalesce(`bbox_max_lon`, %4), %4)")
+      .arg(minLat).arg(minLon).arg(maxLat).arg(maxLon);
+  }
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating collection table failed" << q.lastError();
-      db.close();
-      return false;
-    }
+  /**
+   * removed box may shrink the summary box only when it is touching its border
+   */
+  QString summaryBoxBorder(const QString &minLat, const QString &minLon, const QString &maxLat, const QString &maxLon)
+  {
+    return QString("(%1 <= `bbox_min_lat` OR %2 <= `bbox_min_lon` OR %3 >= `bbox_max_lat` OR %4 >= `bbox_max_lon`)")
+      .arg(minLat).arg(minLon).arg(maxLat).arg(maxLon);
   }
 
-  if (!tables.contains("track")){
-    qDebug()<< "creating track table";
-
-    QString sql("CREATE TABLE `track`");
-    sql.append("(").append( "`id` INTEGER PRIMARY KEY");
-    sql.append(",").append( "`collection_id` INTEGER NOT NULL REFERENCES collection(id) ON DELETE CASCADE");
-    sql.append(",").append( "`name` varchar(255) NOT NULL");
-    sql.append(",").append( "`description` varchar(255) NULL");
-    sql.append(",").append( "`open` tinyint(1) NOT NULL");
-    sql.append(",").append( "`creation_time` datetime NOT NULL");
-    sql.append(",").append( "`modification_time` datetime NOT NULL");
-
-    // statistics
-    sql.append(",").append( "`from_time` datetime NULL");
-    sql.append(",").append( "`to_time` datetime NULL");
-    sql.append(",").append( "`distance` DOUBLE NOT NULL");
-    sql.append(",").append( "`raw_distance` DOUBLE NOT NULL");
-    sql.append(",").append( "`duration` INTEGER NOT NULL");
-    sql.append(",").append( "`moving_duration` INTEGER NOT NULL");
-    sql.append(",").append( "`max_speed` DOUBLE NOT NULL");
-    sql.append(",").append( "`average_speed` DOUBLE NOT NULL");
-    sql.append(",").append( "`moving_average_speed` DOUBLE NOT NULL");
-    sql.append(",").append( "`ascent` DOUBLE NOT NULL");
-    sql.append(",").append( "`descent` DOUBLE NOT NULL");
-    sql.append(",").append( "`min_elevation` DOUBLE NULL");
-    sql.append(",").append( "`max_elevation` DOUBLE NULL");
-
-    // bbox
-    sql.append(",").append( "`bbox_min_lat` DOUBLE NOT NULL");
-    sql.append(",").append( "`bbox_min_lon` DOUBLE NOT NULL");
-    sql.append(",").append( "`bbox_max_lat` DOUBLE NOT NULL");
-    sql.append(",").append( "`bbox_max_lon` DOUBLE NOT NULL");
-
-    sql.append(");");
+  /**
+   * recompute summary box from tracks and waypoints of collection (indexed by collection_id),
+   * statement should be completed by WHERE clause
+   */
+  QString summaryRefreshBox(const QString &collectionId)
+  {
+    // lat/lon is never outside (-1000, 1000), it is used as placeholder for empty aggregate
+    QString trackFilter = QString("`collection_id` = %1 AND %2").arg(collectionId).arg(trackHasBox("`track`"));
+    QString waypointFilter = QString("`collection_id` = %1").arg(collectionId);
+    return QString("UPDATE `collection_summary` SET "
+                   "`bbox_min_lat` = nullif(min(coalesce((SELECT min(`bbox_min_lat`) FROM `track` WHERE %1), 1000), "
+                                               "coalesce((SELECT min(`latitude`) FROM `waypoint` WHERE %2), 1000)), 1000), "
+                   "`bbox_min_lon` = nullif(min(coalesce((SELECT min(`bbox_min_lon`) FROM `track` WHERE %1), 1000), "
+                                               "coalesce((SELECT min(`longitude`) FROM `waypoint` WHERE %2), 1000)), 1000), "
+                   "`bbox_max_lat` = nullif(max(coalesce((SELECT max(`bbox_max_lat`) FROM `track` WHERE %1), -1000), "
+                                               "coalesce((SELECT max(`latitude`) FROM `waypoint` WHERE %2), -1000)), -1000), "
+                   "`bbox_max_lon` = nullif(max(coalesce((SELECT max(`bbox_max_lon`) FROM `track` WHERE %1), -1000), "
+                                               "coalesce((SELECT max(`longitude`) FROM `waypoint` WHERE %2), -1000)), -1000) ")
+      .arg(trackFilter).arg(waypointFilter);
+  }
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating track table failed" << q.lastError();
-      db.close();
-      return false;
-    }
+  // name column is more relevant than description and symbol
+  static const char *SearchStatement =
+    "SELECT 0, w.`id`, w.`collection_id`, c.`name`, w.`name`, w.`description`, w.`symbol`, "
+    "w.`latitude`, w.`longitude`, w.`latitude`, w.`longitude`, bm25(`waypoint_fts`, 10.0, 1.0, 1.0) AS `rank` "
+    "FROM `waypoint_fts` JOIN `waypoint` w ON w.`id` = `waypoint_fts`.`rowid` JOIN `collection` c ON c.`id` = w.`collection_id` "
+    "WHERE `waypoint_fts` MATCH :waypointPattern "
+    "UNION ALL "
+    "SELECT 1, t.`id`, t.`collection_id`, c.`name`, t.`name`, t.`description`, NULL, "
+    "t.`bbox_min_lat`, t.`bbox_min_lon`, t.`bbox_max_lat`, t.`bbox_max_lon`, bm25(`track_fts`, 10.0, 1.0) AS `rank` "
+    "FROM `track_fts` JOIN `track` t ON t.`id` = `track_fts`.`rowid` JOIN `collection` c ON c.`id` = t.`collection_id` "
+    "WHERE `track_fts` MATCH :trackPattern "
+    "ORDER BY `rank` LIMIT :limit;";
+
+  // modification time is kept, recomputation is not user change,
+  // accumulator state is dropped, it is folded from segment states when needed
+  static const char *RecomputedStatisticsUpdate =
+    "UPDATE `track` SET `from_time` = :from_time, `to_time` = :to_time, `distance` = :distance, `raw_distance` = :raw_distance, "
+    "`duration` = :duration, `moving_duration` = :moving_duration, `max_speed` = :max_speed, `average_speed` = :average_speed, "
+    "`moving_average_speed` = :moving_average_speed, `ascent` = :ascent, `descent` = :descent, "
+    "`min_elevation` = :min_elevation, `max_elevation` = :max_elevation, "
+    "`bbox_min_lat` = :bboxMinLat, `bbox_min_lon` = :bboxMinLon, `bbox_max_lat` = :bboxMaxLat, `bbox_max_lon` = :bboxMaxLon, "
+    "`statistics_state` = NULL, `stats_version` = :version WHERE `id` = :trackId;";
+
+  static const char *SegmentStatisticsUpdate =
+    "UPDATE `track_segment` SET `from_time` = :from_time, `to_time` = :to_time, `distance` = :distance, `raw_distance` = :raw_distance, "
+    "`duration` = :duration, `moving_duration` = :moving_duration, `max_speed` = :max_speed, `average_speed` = :average_speed, "
+    "`moving_average_speed` = :moving_average_speed, `ascent` = :ascent, `descent` = :descent, "
+    "`min_elevation` = :min_elevation, `max_elevation` = :max_elevation, "
+    "`bbox_min_lat` = :bboxMinLat, `bbox_min_lon` = :bboxMinLon, `bbox_max_lat` = :bboxMaxLat, `bbox_max_lon` = :bboxMaxLon, "
+    "`statistics_state` = :statistics_state, `stats_version` = :version WHERE `id` = :segmentId;";
+
+  static const char *TrackStatisticsUpdate =
+    "UPDATE `track` SET `modification_time` = :modification_time, `from_time` = :from_time, `to_time` = :to_time, "
+    "`distance` = :distance, `raw_distance` = :raw_distance, `duration` = :duration, `moving_duration` = :moving_duration, "
+    "`max_speed` = :max_speed, `average_speed` = :average_speed, `moving_average_speed` = :moving_average_speed, "
+    "`ascent` = :ascent, `descent` = :descent, `min_elevation` = :min_elevation, `max_elevation` = :max_elevation, "
+    "`bbox_min_lat` = :bboxMinLat, `bbox_min_lon` = :bboxMinLon, `bbox_max_lat` = :bboxMaxLat, `bbox_max_lon` = :bboxMaxLon, "
+    "`statistics_state` = :statistics_state, `stats_version` = :stats_version WHERE `id` = :trackId;";
+
+  // statements executed on large tables, their query plans are verified by Storage::checkQueryPlans
+  static const char *SegmentBlocksStatement =
+    "SELECT `point_count`, `data` FROM `track_point_block` WHERE segment_id = :segmentId ORDER BY `seq`;";
+  static const char *TrackSegmentsStatement =
+    "SELECT `id` FROM `track_segment` WHERE track_id = :trackId ORDER BY `id`;";
+  static const char *TrackLodStatement =
+    "SELECT `track_segment`.`id`, `track_lod`.`data` FROM `track_segment` "
+    "LEFT JOIN `track_lod` ON `track_lod`.`segment_id` = `track_segment`.`id` AND `track_lod`.`level` = :level "
+    "WHERE `track_segment`.`track_id` = :trackId ORDER BY `track_segment`.`id`;";
+  static const char *OutdatedTracksStatement =
+    "SELECT `id`, `collection_id` FROM `track` WHERE `stats_version` < :version AND `open` = 0 LIMIT :limit;";
+  static const char *TrackVersionUpdate =
+    "UPDATE `track` SET `stats_version` = :version WHERE `id` = :trackId;";
+  static const char *SegmentBlocksFromStatement =
+    "SELECT `seq`, `point_count`, `data` FROM `track_point_block` WHERE `segment_id` = :segmentId AND `seq` >= :seq ORDER BY `seq`;";
+  static const char *SegmentVersionUpdate =
+    "UPDATE `track_segment` SET `stats_version` = :version WHERE `id` = :segmentId;";
+  static const char *TrackStatisticsStateStatement =
+    "SELECT `statistics_state` FROM `track` WHERE `id` = :trackId;";
+  static const char *TrackOpenStatement =
+    "SELECT `open` FROM `track` WHERE `id` = :trackId;";
+  static const char *TrackExistsStatement =
+    "SELECT 1 FROM `track` WHERE `id` = :trackId;";
+  static const char *CloseTrackStatement =
+    "UPDATE `track` SET `open` = 0, `modification_time` = :modification_time WHERE `id` = :trackId;";
+  static const char *CloseSegmentStatement =
+    "UPDATE `track_segment` SET `open` = 0 WHERE `id` = :segmentId;";
+  static const char *OpenSegmentBlocksStatement =
+    "SELECT `seq`, `point_count` FROM `track_point_block` WHERE `segment_id` = :segmentId ORDER BY `seq` DESC;";
+  static const char *StagedBlocksStatement =
+    "SELECT `data` FROM `track_point_block` WHERE `segment_id` = :segmentId AND `seq` >= :seq ORDER BY `seq`;";
+  static const char *DeleteStagedBlocksStatement =
+    "DELETE FROM `track_point_block` WHERE `segment_id` = :segmentId AND `seq` >= :seq;";
+  static const char *ClosedTrackStatement =
+    "SELECT `open` FROM `track` WHERE `id` = :trackId AND `collection_id` = :collectionId;";
+  static const char *DeleteSegmentStatement =
+    "DELETE FROM `track_segment` WHERE `id` = :segmentId AND `track_id` = :trackId;";
+  static const char *UpdateWaypointStatement =
+    "UPDATE `waypoint` SET `name` = :name, `description` = :description, `modification_time` = :modification_time "
+    "WHERE `id` = :id AND `collection_id` = :collection_id;";
+  static const char *UpdateTrackStatement =
+    "UPDATE `track` SET `name` = :name, `description` = :description, `modification_time` = :modification_time "
+    "WHERE `id` = :id AND `collection_id` = :collection_id;";
+  // %1 is table name (`waypoint` or `track`)
+  static const char *DeleteItemStatement =
+    "DELETE FROM `%1` WHERE `id` = :id AND `collection_id` = :collection_id;";
+  static const char *ItemCollectionStatement =
+    "SELECT `collection_id` FROM `%1` WHERE `id` = :id;";
+  static const char *MoveItemStatement =
+    "UPDATE `%1` SET `collection_id` = :collection_id WHERE `id` = :id;";
+  static const char *ExportWaypointsStatement =
+    "SELECT `name`, `description`, `symbol`, `timestamp`, `latitude`, `longitude`, `elevation` "
+    "FROM `waypoint` WHERE collection_id = :collectionId ORDER BY `id`;";
+  static const char *ExportTracksStatement =
+    "SELECT `id`, `name`, `description` FROM `track` WHERE collection_id = :collectionId ORDER BY `id`;";
+  static const char *ExportBlocksStatement =
+    "SELECT `data` FROM `track_point_block` WHERE segment_id = :segmentId ORDER BY `seq`;";
+  // %1 is list of placeholders
+  static const char *WaypointHashLookupStatement =
+    "SELECT `content_hash` FROM `waypoint` WHERE `content_hash` IN (%1);";
+  static const char *SegmentHashLookupStatement =
+    "SELECT 1 FROM `track_segment` WHERE `content_hash` = :hash LIMIT 1;";
+  static const char *DeleteCollectionSummaryStatement =
+    "DELETE FROM `collection_summary` WHERE `collection_id` = :id;";
+  static const char *DeletePendingLodStatement =
+    "DELETE FROM `track_lod_pending` WHERE `segment_id` = :segmentId;";
+  static const char *LegacyTrackPointsStatement =
+    "SELECT `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` "
+    "FROM `track_point` WHERE segment_id = :segmentId ORDER BY `rowid`;";
+  static const char *DeleteLegacyTrackPointsStatement =
+    "DELETE FROM `track_point` WHERE `segment_id` = :segmentId;";
+
+  QString collectionTracksStatement()
+  {
+    return QString("SELECT %1 FROM `track` WHERE collection_id = :collectionId;").arg(TrackColumns);
+  }
+
+  QString collectionWaypointsStatement()
+  {
+    return QString("SELECT %1 FROM `waypoint` WHERE collection_id = :collectionId;").arg(WaypointColumns);
   }
 
-  if (!tables.contains("track_segment")){
-    qDebug()<< "creating track_segment table";
+  QString trackStatement()
+  {
+    return QString("SELECT %1 FROM `track` WHERE id = :trackId;").arg(TrackColumns);
+  }
 
-    QString sql("CREATE TABLE `track_segment`");
-    sql.append("(").append( "`id` INTEGER PRIMARY KEY");
-    sql.append(",").append( "`track_id` INTEGER NOT NULL REFERENCES track(id) ON DELETE CASCADE");
-    sql.append(",").append( "`open` tinyint(1) NOT NULL");
-    sql.append(",").append( "`creation_time` datetime NOT NULL");
-    sql.append(",").append( "`distance` double NOT NULL");
-    sql.append(");");
+  QString trackSegmentStatisticsStatement()
+  {
+    return QString("SELECT %1 FROM `track_segment` WHERE `track_id` = :trackId ORDER BY `id`;").arg(SegmentColumns);
+  }
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating track segment table failed" << q.lastError();
-      db.close();
-      return false;
-    }
+  // r*tree stores coordinates as 32 bit floats (rounded outwards),
+  // candidates are filtered by exact bounding box of the track
+  QString tracksInBoxStatement()
+  {
+    return QString("SELECT %1 FROM `track` WHERE `id` IN (")
+      .arg(TrackColumns)
+      .append("SELECT `id` FROM `track_rtree` WHERE `max_lat` >= :minLat AND `min_lat` <= :maxLat AND `max_lon` >= :minLon AND `min_lon` <= :maxLon")
+      .append(") ")
+      .append("AND `bbox_max_lat` >= :exactMinLat AND `bbox_min_lat` <= :exactMaxLat AND `bbox_max_lon` >= :exactMinLon AND `bbox_min_lon` <= :exactMaxLon ")
+      .append("AND `collection_id` IN (SELECT `id` FROM `collection` WHERE `visible` = 1);");
   }
 
-  if (!tables.contains("track_point")){
-    qDebug()<< "creating track_point table";
+  QString waypointsInBoxStatement()
+  {
+    return QString("SELECT %1 FROM `waypoint` WHERE `id` IN (")
+      .arg(WaypointColumns)
+      .append("SELECT `id` FROM `waypoint_rtree` WHERE `max_lat` >= :minLat AND `min_lat` <= :maxLat AND `max_lon` >= :minLon AND `min_lon` <= :maxLon")
+      .append(") ")
+      .append("AND `latitude` >= :exactMinLat AND `latitude` <= :exactMaxLat AND `longitude` >= :exactMinLon AND `longitude` <= :exactMaxLon ")
+      .append("AND `collection_id` IN (SELECT `id` FROM `collection` WHERE `visible` = 1);");
+  }
 
-    QString sql("CREATE TABLE `track_point`");
-    sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
-    sql.append(",").append( "`timestamp` datetime NOT NULL");
-    sql.append(",").append( "`latitude` double NOT NULL");
-    sql.append(",").append( "`longitude` double NOT NULL");
-    sql.append(",").append( "`elevation` double NULL ");
-    sql.append(",").append( "`horiz_accuracy` double NULL ");
-    sql.append(",").append( "`vert_accuracy` double NULL ");
-    sql.append(");");
+  /**
+   * convert user input to fts5 query: every word is quoted
+   * (fts5 syntax in input is not interpreted) and matched as prefix
+   */
+  QString searchPattern(const QString &input)
+  {
+    QStringList terms;
+    for (QString word: input.split(QRegExp("\\s+"), QString::SkipEmptyParts)){
+      terms << "\"" + word.replace("\"", "\"\"") + "\"*";
+    }
+    return terms.join(" ");
+  }
 
-    // TODO: what satelites and compas?
+  const std::vector<SchemaMigration>& schemaMigrations()
+  {
+    static const std::vector<SchemaMigration> migrations{
+      {1, "initial schema", [](QSqlDatabase &db){
+        QStringList statements;
+
+        QString sql("CREATE TABLE IF NOT EXISTS `collection`");
+        sql.append("(").append( "`id` INTEGER PRIMARY KEY");
+        sql.append(",").append( "`name` varchar(255) NOT NULL ");
+        sql.append(",").append( "`description` varchar(255) NULL ");
+        sql.append(",").append( "`visible` tinyint(1) NOT NULL");
+        sql.append(");");
+        statements << sql;
+
+        sql = "CREATE TABLE IF NOT EXISTS `track`";
+        sql.append("(").append( "`id` INTEGER PRIMARY KEY");
+        sql.append(",").append( "`collection_id` INTEGER NOT NULL REFERENCES collection(id) ON DELETE CASCADE");
+        sql.append(",").append( "`name` varchar(255) NOT NULL");
+        sql.append(",").append( "`description` varchar(255) NULL");
+        sql.append(",").append( "`open` tinyint(1) NOT NULL");
+        sql.append(",").append( "`creation_time` datetime NOT NULL");
+        sql.append(",").append( "`modification_time` datetime NOT NULL");
+
+        // statistics
+        sql.append(",").append( "`from_time` datetime NULL");
+        sql.append(",").append( "`to_time` datetime NULL");
+        sql.append(",").append( "`distance` DOUBLE NOT NULL");
+        sql.append(",").append( "`raw_distance` DOUBLE NOT NULL");
+        sql.append(",").append( "`duration` INTEGER NOT NULL");
+        sql.append(",").append( "`moving_duration` INTEGER NOT NULL");
+        sql.append(",").append( "`max_speed` DOUBLE NOT NULL");
+        sql.append(",").append( "`average_speed` DOUBLE NOT NULL");
+        sql.append(",").append( "`moving_average_speed` DOUBLE NOT NULL");
+        sql.append(",").append( "`ascent` DOUBLE NOT NULL");
+        sql.append(",").append( "`descent` DOUBLE NOT NULL");
+        sql.append(",").append( "`min_elevation` DOUBLE NULL");
+        sql.append(",").append( "`max_elevation` DOUBLE NULL");
+
+        // bbox
+        sql.append(",").append( "`bbox_min_lat` DOUBLE NOT NULL");
+        sql.append(",").append( "`bbox_min_lon` DOUBLE NOT NULL");
+        sql.append(",").append( "`bbox_max_lat` DOUBLE NOT NULL");
+        sql.append(",").append( "`bbox_max_lon` DOUBLE NOT NULL");
+
+        sql.append(");");
+        statements << sql;
+
+        sql = "CREATE TABLE IF NOT EXISTS `track_segment`";
+        sql.append("(").append( "`id` INTEGER PRIMARY KEY");
+        sql.append(",").append( "`track_id` INTEGER NOT NULL REFERENCES track(id) ON DELETE CASCADE");
+        sql.append(",").append( "`open` tinyint(1) NOT NULL");
+        sql.append(",").append( "`creation_time` datetime NOT NULL");
+        sql.append(",").append( "`distance` double NOT NULL");
+        sql.append(");");
+        statements << sql;
+
+        sql = "CREATE TABLE IF NOT EXISTS `waypoint`";
+        sql.append("(").append( "`id` INTEGER PRIMARY KEY");
+        sql.append(",").append( "`collection_id` INTEGER NOT NULL REFERENCES collection(id) ON DELETE CASCADE");
+        sql.append(",").append( "`modification_time` datetime NOT NULL");
+        sql.append(",").append( "`timestamp` datetime NOT NULL");
+        sql.append(",").append( "`latitude` double NOT NULL");
+        sql.append(",").append( "`longitude` double NOT NULL");
+        sql.append(",").append( "`elevation` double NULL");
+        sql.append(",").append( "`name` varchar(255) NOT NULL ");
+        sql.append(",").append( "`description` varchar(255) NULL ");
+        sql.append(",").append( "`symbol` varchar(255) NULL ");
+        sql.append(");");
+        statements << sql;
+
+        return execStatements(db, statements);
+      }},
+
+      {2, "compressed track point blocks", [](QSqlDatabase &db){
+        QStringList statements;
+
+        QString sql("CREATE TABLE IF NOT EXISTS `track_point_block`");
+        sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
+        sql.append(",").append( "`seq` INTEGER NOT NULL");
+        sql.append(",").append( "`point_count` INTEGER NOT NULL");
+        sql.append(",").append( "`data` BLOB NOT NULL");
+        sql.append(",").append( "PRIMARY KEY (`segment_id`, `seq`)");
+        sql.append(");");
+        statements << sql;
+
+        // rows of old track_point table are converted in background (see migrateTrackPoints)
+        if (db.tables().contains("track_point")){
+          statements << "CREATE INDEX IF NOT EXISTS `track_point_segment_idx` ON `track_point` (`segment_id`);";
+        }
+        return execStatements(db, statements);
+      }},
+
+      {3, "foreign key indexes", [](QSqlDatabase &db){
+        return execStatements(db, QStringList()
+          << "CREATE INDEX IF NOT EXISTS `track_collection_idx` ON `track` (`collection_id`);"
+          << "CREATE INDEX IF NOT EXISTS `waypoint_collection_idx` ON `waypoint` (`collection_id`);"
+          << "CREATE INDEX IF NOT EXISTS `track_segment_track_idx` ON `track_segment` (`track_id`);");
+      }},
+
+      {4, "spatial index", [](QSqlDatabase &db){
+        // r*tree index of track bounding boxes and waypoint positions, kept in sync
+        // with base tables by triggers (deletes by cascade fire triggers too);
+        // collection (visibility) is resolved by join with base table, so moving
+        // object to another collection doesn't touch the index
+        return execStatements(db, QStringList()
+          << "CREATE VIRTUAL TABLE IF NOT EXISTS `track_rtree` USING rtree(`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`);"
+          << "CREATE VIRTUAL TABLE IF NOT EXISTS `waypoint_rtree` USING rtree(`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`);"
+
+          << "INSERT INTO `track_rtree` (`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`) "
+             "SELECT `id`, `bbox_min_lat`, `bbox_max_lat`, `bbox_min_lon`, `bbox_max_lon` FROM `track`;"
+          << "INSERT INTO `waypoint_rtree` (`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`) "
+             "SELECT `id`, `latitude`, `latitude`, `longitude`, `longitude` FROM `waypoint`;"
+
+          << "CREATE TRIGGER IF NOT EXISTS `track_rtree_insert` AFTER INSERT ON `track` BEGIN "
+             "INSERT INTO `track_rtree` (`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`) "
+             "VALUES (NEW.`id`, NEW.`bbox_min_lat`, NEW.`bbox_max_lat`, NEW.`bbox_min_lon`, NEW.`bbox_max_lon`); "
+             "END;"
+          << "CREATE TRIGGER IF NOT EXISTS `track_rtree_update` AFTER UPDATE OF `bbox_min_lat`, `bbox_max_lat`, `bbox_min_lon`, `bbox_max_lon` ON `track` BEGIN "
+             "UPDATE `track_rtree` SET `min_lat` = NEW.`bbox_min_lat`, `max_lat` = NEW.`bbox_max_lat`, "
+             "`min_lon` = NEW.`bbox_min_lon`, `max_lon` = NEW.`bbox_max_lon` WHERE `id` = NEW.`id`; "
+             "END;"
+          << "CREATE TRIGGER IF NOT EXISTS `track_rtree_delete` AFTER DELETE ON `track` BEGIN "
+             "DELETE FROM `track_rtree` WHERE `id` = OLD.`id`; "
+             "END;"
+
+          << "CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_insert` AFTER INSERT ON `waypoint` BEGIN "
+             "INSERT INTO `waypoint_rtree` (`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`) "
+             "VALUES (NEW.`id`, NEW.`latitude`, NEW.`latitude`, NEW.`longitude`, NEW.`longitude`); "
+             "END;"
+          << "CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_update` AFTER UPDATE OF `latitude`, `longitude` ON `waypoint` BEGIN "
+             "UPDATE `waypoint_rtree` SET `min_lat` = NEW.`latitude`, `max_lat` = NEW.`latitude`, "
+             "`min_lon` = NEW.`longitude`, `max_lon` = NEW.`longitude` WHERE `id` = NEW.`id`; "
+             "END;"
+          << "CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_delete` AFTER DELETE ON `waypoint` BEGIN "
+             "DELETE FROM `waypoint_rtree` WHERE `id` = OLD.`id`; "
+             "END;");
+      }},
+
+      {5, "simplified track geometry", [](QSqlDatabase &db){
+        QStringList statements;
+
+        QString sql("CREATE TABLE IF NOT EXISTS `track_lod`");
+        sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
+        sql.append(",").append( "`level` INTEGER NOT NULL");
+        sql.append(",").append( "`point_count` INTEGER NOT NULL");
+        sql.append(",").append( "`data` BLOB NOT NULL");
+        sql.append(",").append( "PRIMARY KEY (`segment_id`, `level`)");
+        sql.append(");");
+        statements << sql;
+
+        // geometry of existing segments is computed in background (see computeTrackLod)
+        statements << "CREATE TABLE IF NOT EXISTS `track_lod_pending` (`segment_id` INTEGER PRIMARY KEY REFERENCES track_segment(id) ON DELETE CASCADE);"
+                   << "INSERT INTO `track_lod_pending` (`segment_id`) SELECT `id` FROM `track_segment`;";
+        return execStatements(db, statements);
+      }},
+
+      {6, "incremental statistics state", [](QSqlDatabase &db){
+        // serialized TrackStatisticsAccumulator, NULL for tracks that were never extended
+        return execStatements(db, QStringList()
+          << "ALTER TABLE `track` ADD COLUMN `statistics_state` BLOB NULL;");
+      }},
+
+      {7, "collection summary", [](QSqlDatabase &db){
+        QStringList statements;
+
+        QString sql("CREATE TABLE IF NOT EXISTS `collection_summary`");
+        sql.append("(").append( "`collection_id` INTEGER PRIMARY KEY REFERENCES collection(id) ON DELETE CASCADE");
+        sql.append(",").append( "`track_count` INTEGER NOT NULL DEFAULT 0");
+        sql.append(",").append( "`waypoint_count` INTEGER NOT NULL DEFAULT 0");
+        sql.append(",").append( "`distance` DOUBLE NOT NULL DEFAULT 0");
+        sql.append(",").append( "`duration` INTEGER NOT NULL DEFAULT 0");
+
+        // union of track and waypoint boxes, NULL for empty collection
+        sql.append(",").append( "`bbox_min_lat` DOUBLE NULL");
+        sql.append(",").append( "`bbox_min_lon` DOUBLE NULL");
+        sql.append(",").append( "`bbox_max_lat` DOUBLE NULL");
+        sql.append(",").append( "`bbox_max_lon` DOUBLE NULL");
+        sql.append(",").append( "`modification_time` datetime NULL");
+        sql.append(");");
+        statements << sql;
+
+        statements << "INSERT INTO `collection_summary` (`collection_id`, `track_count`, `waypoint_count`, `distance`, `duration`, `modification_time`) "
+                      "SELECT `id`, "
+                      "(SELECT count(*) FROM `track` WHERE `collection_id` = `collection`.`id`), "
+                      "(SELECT count(*) FROM `waypoint` WHERE `collection_id` = `collection`.`id`), "
+                      "(SELECT coalesce(sum(`distance`), 0) FROM `track` WHERE `collection_id` = `collection`.`id`), "
+                      "(SELECT coalesce(sum(`duration`), 0) FROM `track` WHERE `collection_id` = `collection`.`id`), "
+                      "nullif(max(coalesce((SELECT max(`modification_time`) FROM `track` WHERE `collection_id` = `collection`.`id`), ''), "
+                                 "coalesce((SELECT max(`modification_time`) FROM `waypoint` WHERE `collection_id` = `collection`.`id`), '')), '') "
+                      "FROM `collection`;";
+        statements << summaryRefreshBox("`collection_summary`.`collection_id`") + ";";
+
+        statements << "CREATE TRIGGER IF NOT EXISTS `collection_summary_insert` AFTER INSERT ON `collection` BEGIN "
+                      "INSERT INTO `collection_summary` (`collection_id`) VALUES (NEW.`id`); "
+                      "END;";
+
+        // waypoints
+        QString waypointAdded = QString("UPDATE `collection_summary` SET `waypoint_count` = `waypoint_count` + 1, %1, %2 "
+                                        "WHERE `collection_id` = NEW.`collection_id`; ")
+          .arg(summaryTouched("NEW"))
+          .arg(summaryExpandBox("NEW.`latitude`", "NEW.`longitude`", "NEW.`latitude`", "NEW.`longitude`"));
+        QString waypointRemoved = QString("UPDATE `collection_summary` SET `waypoint_count` = `waypoint_count` - 1, %1 "
+                                          "WHERE `collection_id` = OLD.`collection_id`; ")
+          .arg(summaryTouchedNow())
+          + summaryRefreshBox("OLD.`collection_id`")
+          + QString("WHERE `collection_id` = OLD.`collection_id` AND %1; ")
+            .arg(summaryBoxBorder("OLD.`latitude`", "OLD.`longitude`", "OLD.`latitude`", "OLD.`longitude`"));
+
+        statements << "CREATE TRIGGER IF NOT EXISTS `waypoint_summary_insert` AFTER INSERT ON `waypoint` BEGIN "
+                      + waypointAdded + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `waypoint_summary_delete` AFTER DELETE ON `waypoint` BEGIN "
+                      + waypointRemoved + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `waypoint_summary_move` AFTER UPDATE OF `collection_id` ON `waypoint` "
+                      "WHEN OLD.`collection_id` != NEW.`collection_id` BEGIN "
+                      + waypointRemoved
+                      + QString("UPDATE `collection_summary` SET `waypoint_count` = `waypoint_count` + 1, %1, %2 "
+                                "WHERE `collection_id` = NEW.`collection_id`; ")
+                        .arg(summaryTouchedNow())
+                        .arg(summaryExpandBox("NEW.`latitude`", "NEW.`longitude`", "NEW.`latitude`", "NEW.`longitude`"))
+                      + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `waypoint_summary_update` AFTER UPDATE OF `latitude`, `longitude`, `modification_time` ON `waypoint` "
+                      "WHEN OLD.`collection_id` = NEW.`collection_id` BEGIN "
+                      + QString("UPDATE `collection_summary` SET %1, %2 WHERE `collection_id` = NEW.`collection_id`; ")
+                        .arg(summaryTouched("NEW"))
+                        .arg(summaryExpandBox("NEW.`latitude`", "NEW.`longitude`", "NEW.`latitude`", "NEW.`longitude`"))
+                      + summaryRefreshBox("NEW.`collection_id`")
+                      + QString("WHERE `collection_id` = NEW.`collection_id` AND %1 "
+                                "AND (OLD.`latitude` != NEW.`latitude` OR OLD.`longitude` != NEW.`longitude`); ")
+                        .arg(summaryBoxBorder("OLD.`latitude`", "OLD.`longitude`", "OLD.`latitude`", "OLD.`longitude`"))
+                      + "END;";
+
+        // tracks
+        QString trackAdded = QString("UPDATE `collection_summary` SET `track_count` = `track_count` + 1, "
+                                     "`distance` = `distance` + NEW.`distance`, `duration` = `duration` + NEW.`duration`, %1 "
+                                     "WHERE `collection_id` = NEW.`collection_id`; "
+                                     "UPDATE `collection_summary` SET %2 WHERE `collection_id` = NEW.`collection_id` AND %3; ");
+        QString newBox = summaryExpandBox("NEW.`bbox_min_lat`", "NEW.`bbox_min_lon`", "NEW.`bbox_max_lat`", "NEW.`bbox_max_lon`");
+        QString oldBoxBorder = summaryBoxBorder("OLD.`bbox_min_lat`", "OLD.`bbox_min_lon`", "OLD.`bbox_max_lat`", "OLD.`bbox_max_lon`");
+        QString trackRemoved = QString("UPDATE `collection_summary` SET `track_count` = `track_count` - 1, "
+                                       "`distance` = `distance` - OLD.`distance`, `duration` = `duration` - OLD.`duration`, %1 "
+                                       "WHERE `collection_id` = OLD.`collection_id`; ")
+          .arg(summaryTouchedNow())
+          + summaryRefreshBox("OLD.`collection_id`")
+          + QString("WHERE `collection_id` = OLD.`collection_id` AND %1 AND %2; ")
+            .arg(trackHasBox("OLD"))
+            .arg(oldBoxBorder);
+
+        statements << "CREATE TRIGGER IF NOT EXISTS `track_summary_insert` AFTER INSERT ON `track` BEGIN "
+                      + trackAdded.arg(summaryTouched("NEW")).arg(newBox).arg(trackHasBox("NEW"))
+                      + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_summary_delete` AFTER DELETE ON `track` BEGIN "
+                      + trackRemoved + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_summary_move` AFTER UPDATE OF `collection_id` ON `track` "
+                      "WHEN OLD.`collection_id` != NEW.`collection_id` BEGIN "
+                      + trackRemoved
+                      + trackAdded.arg(summaryTouchedNow()).arg(newBox).arg(trackHasBox("NEW"))
+                      + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_summary_update` AFTER UPDATE OF "
+                      "`distance`, `duration`, `bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`, `modification_time` ON `track` "
+                      "WHEN OLD.`collection_id` = NEW.`collection_id` BEGIN "
+                      + QString("UPDATE `collection_summary` SET "
+                                "`distance` = `distance` + NEW.`distance` - OLD.`distance`, "
+                                "`duration` = `duration` + NEW.`duration` - OLD.`duration`, %1 "
+                                "WHERE `collection_id` = NEW.`collection_id`; "
+                                "UPDATE `collection_summary` SET %2 WHERE `collection_id` = NEW.`collection_id` AND %3; ")
+                        .arg(summaryTouched("NEW")).arg(newBox).arg(trackHasBox("NEW"))
+                      // recompute only when old box was on the border and the track box shrank
+                      + summaryRefreshBox("NEW.`collection_id`")
+                      + QString("WHERE `collection_id` = NEW.`collection_id` AND %1 AND %2 AND "
+                                "(NEW.`bbox_min_lat` > OLD.`bbox_min_lat` OR NEW.`bbox_min_lon` > OLD.`bbox_min_lon` OR "
+                                "NEW.`bbox_max_lat` < OLD.`bbox_max_lat` OR NEW.`bbox_max_lon` < OLD.`bbox_max_lon` OR NOT %3); ")
+                        .arg(trackHasBox("OLD")).arg(oldBoxBorder).arg(trackHasBox("NEW"))
+                      + "END;";
+
+        return execStatements(db, statements);
+      }},
+
+      {8, "full-text search", [](QSqlDatabase &db){
+        // external content tables, index is maintained by triggers
+        // (waypoint and track ids are rowids of the index)
+        QStringList statements;
+        statements << "CREATE VIRTUAL TABLE IF NOT EXISTS `waypoint_fts` USING fts5("
+                      "`name`, `description`, `symbol`, content='waypoint', content_rowid='id', prefix='2 3');"
+                   << "CREATE VIRTUAL TABLE IF NOT EXISTS `track_fts` USING fts5("
+                      "`name`, `description`, content='track', content_rowid='id', prefix='2 3');"
+                   << "INSERT INTO `waypoint_fts`(`waypoint_fts`) VALUES ('rebuild');"
+                   << "INSERT INTO `track_fts`(`track_fts`) VALUES ('rebuild');";
+
+        QString waypointIndex("INSERT INTO `waypoint_fts` (`rowid`, `name`, `description`, `symbol`) "
+                              "VALUES (NEW.`id`, NEW.`name`, NEW.`description`, NEW.`symbol`); ");
+        QString waypointUnindex("INSERT INTO `waypoint_fts` (`waypoint_fts`, `rowid`, `name`, `description`, `symbol`) "
+                                "VALUES ('delete', OLD.`id`, OLD.`name`, OLD.`description`, OLD.`symbol`); ");
+        QString trackIndex("INSERT INTO `track_fts` (`rowid`, `name`, `description`) "
+                           "VALUES (NEW.`id`, NEW.`name`, NEW.`description`); ");
+        QString trackUnindex("INSERT INTO `track_fts` (`track_fts`, `rowid`, `name`, `description`) "
+                             "VALUES ('delete', OLD.`id`, OLD.`name`, OLD.`description`); ");
+
+        statements << "CREATE TRIGGER IF NOT EXISTS `waypoint_fts_insert` AFTER INSERT ON `waypoint` BEGIN "
+                      + waypointIndex + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `waypoint_fts_delete` AFTER DELETE ON `waypoint` BEGIN "
+                      + waypointUnindex + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `waypoint_fts_update` AFTER UPDATE OF `name`, `description`, `symbol` ON `waypoint` BEGIN "
+                      + waypointUnindex + waypointIndex + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_fts_insert` AFTER INSERT ON `track` BEGIN "
+                      + trackIndex + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_fts_delete` AFTER DELETE ON `track` BEGIN "
+                      + trackUnindex + "END;"
+                   << "CREATE TRIGGER IF NOT EXISTS `track_fts_update` AFTER UPDATE OF `name`, `description` ON `track` BEGIN "
+                      + trackUnindex + trackIndex + "END;";
+
+        return execStatements(db, statements);
+      }},
+
+      {9, "content fingerprints", [](QSqlDatabase &db){
+        // hashes of imported waypoints and segments (see ContentFingerprint),
+        // NULL for objects created before, recorded or created by user
+        return execStatements(db, QStringList()
+          << "ALTER TABLE `waypoint` ADD COLUMN `content_hash` INTEGER NULL;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `content_hash` INTEGER NULL;"
+          << "CREATE INDEX IF NOT EXISTS `waypoint_content_hash_idx` ON `waypoint` (`content_hash`) WHERE `content_hash` IS NOT NULL;"
+          << "CREATE INDEX IF NOT EXISTS `track_segment_content_hash_idx` ON `track_segment` (`content_hash`) WHERE `content_hash` IS NOT NULL;");
+      }},
+
+      {10, "incremental auto vacuum", [](QSqlDatabase &){
+        // free pages are reclaimed by Storage::maintenance, auto vacuum mode can't be changed
+        // in transaction: new database gets it in Storage::init, existing one is rebuilt
+        // on user request only (see Storage::rebuildDatabase)
+        return true;
+      }},
+
+      {11, "statistics version", [](QSqlDatabase &db){
+        // revision of rules used for track statistics (see StatisticsVersion),
+        // existing tracks are recomputed by Storage::recomputeStatistics
+        return execStatements(db, QStringList()
+          << "ALTER TABLE `track` ADD COLUMN `stats_version` INTEGER NOT NULL DEFAULT 0;"
+          << "CREATE INDEX IF NOT EXISTS `track_stats_version_idx` ON `track` (`stats_version`);");
+      }},
+
+      {12, "segment statistics", [](QSqlDatabase &db){
+        // statistics of segments are computed by Storage::recomputeStatistics together
+        // with their track, till then the stored distance is the raw one
+        return execStatements(db, QStringList()
+          << "ALTER TABLE `track_segment` ADD COLUMN `from_time` datetime NULL;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `to_time` datetime NULL;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `raw_distance` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `duration` INTEGER NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `moving_duration` INTEGER NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `max_speed` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `average_speed` DOUBLE NOT NULL DEFAULT -1;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `moving_average_speed` DOUBLE NOT NULL DEFAULT -1;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `ascent` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `descent` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `min_elevation` DOUBLE NULL;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `max_elevation` DOUBLE NULL;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `bbox_min_lat` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `bbox_min_lon` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `bbox_max_lat` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `bbox_max_lon` DOUBLE NOT NULL DEFAULT 0;"
+          << "ALTER TABLE `track_segment` ADD COLUMN `stats_version` INTEGER NOT NULL DEFAULT 0;"
+          << "UPDATE `track_segment` SET `raw_distance` = `distance`;");
+      }},
+
+      {13, "segment statistics state", [](QSqlDatabase &db){
+        // accumulator state after the segment (see TrackStatisticsAccumulator::appendSegment),
+        // segments without it are accumulated from points when the track is folded
+        return execStatements(db, QStringList()
+          << "ALTER TABLE `track_segment` ADD COLUMN `statistics_state` BLOB NULL;");
+      }}
+    };
+    return migrations;
+  }
+}
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating track node table failed" << q.lastError();
-      db.close();
-      return false;
+bool Storage::updateSchema(){
+  QSqlQuery q = db.exec("CREATE TABLE IF NOT EXISTS `version` ( `version` int NOT NULL);");
+  if (q.lastError().isValid()){
+    qWarning() << "Creating version table failed" << q.lastError();
+    db.close();
+    return false;
+  }
+
+  int currentSchema=0;
+  q = db.exec("SELECT MAX(`version`) AS `currentVersion` FROM `version`;");
+  if (!q.lastError().isValid()){
+    if (q.next()){
+      QVariant val = q.value(0);
+      if (!val.isNull()){
+        bool ok = false;
+        currentSchema = val.toInt(&ok);
+        if (!ok) {
+          qWarning() << "Loading currentSchema value failed" << val;
+        }
+        qDebug()<<"last schema: "<<currentSchema;
+      }
+    } else {
+      qWarning() << "Loading currentSchema value failed (no entry)";
     }
+  }else{
+    qWarning() << "failed to get schema version " << q.lastError();
+    db.close();
+    return false;
   }
+  q.finish();
 
-  if (!tables.contains("waypoint")){
-    qDebug()<< "creating waypoints table";
+  if (currentSchema > DbSchema) {
+    qWarning() << "newer database schema; " << currentSchema << " > " << DbSchema;
+  }
 
-    QString sql("CREATE TABLE `waypoint`");
-    sql.append("(").append( "`id` INTEGER PRIMARY KEY");
-    sql.append(",").append( "`collection_id` INTEGER NOT NULL REFERENCES collection(id) ON DELETE CASCADE");
-    sql.append(",").append( "`modification_time` datetime NOT NULL");
-    sql.append(",").append( "`timestamp` datetime NOT NULL");
-    sql.append(",").append( "`latitude` double NOT NULL");
-    sql.append(",").append( "`longitude` double NOT NULL");
-    sql.append(",").append( "`elevation` double NULL");
-    sql.append(",").append( "`name` varchar(255) NOT NULL ");
-    sql.append(",").append( "`description` varchar(255) NULL ");
-    sql.append(",").append( "`symbol` varchar(255) NULL ");
-    sql.append(");");
+  for (const SchemaMigration &migration: schemaMigrations()){
+    if (migration.version <= currentSchema){
+      continue;
+    }
+    qDebug() << "Migrating schema to version" << migration.version << "(" << migration.description << ")";
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating waypoints table failed" << q.lastError();
+    if (!db.transaction()){
+      qWarning() << "Starting transaction failed" << db.lastError();
+      db.close();
+      return false;
+    }
+    bool success = migration.apply(db);
+    if (success){
+      QSqlQuery sqlInsert(db);
+      sqlInsert.prepare("INSERT INTO `version` (`version`) VALUES (:version);");
+      sqlInsert.bindValue(":version", migration.version);
+      sqlInsert.exec();
+      if (sqlInsert.lastError().isValid()){
+        qWarning() << "Creating version table entry failed" << sqlInsert.lastError();
+        success = false;
+      }
+    }
+    if (!success){
+      qWarning() << "Schema migration to version" << migration.version << "failed";
+      if (!db.rollback()) {
+        qWarning() << "Transaction rollback failed" << db.lastError();
+      }
+      db.close();
+      return false;
+    }
+    if (!db.commit()) {
+      qWarning() << "Transaction commit failed" << db.lastError();
       db.close();
       return false;
     }
+    currentSchema = migration.version;
   }
 
   return true;
 }
 
+#ifdef STORAGE_QUERY_PLAN_CHECK
+bool Storage::checkQueryPlans()
+{
+  // tables that may grow large, queries should never scan them
+  static const QStringList largeTables{"track", "track_segment", "track_point", "track_point_block", "waypoint"};
+
+  // all statements from this file that touch large tables,
+  // including lookups executed by sqlite for foreign key actions
+  QStringList statements;
+  statements << collectionTracksStatement()
+             << collectionWaypointsStatement()
+             << SegmentBlocksStatement
+             << trackStatement()
+             << TrackSegmentsStatement
+             << TrackLodStatement
+             << tracksInBoxStatement()
+             << waypointsInBoxStatement()
+             << SearchStatement;
+
+  // export
+  statements << ExportWaypointsStatement
+             << ExportTracksStatement
+             << ExportBlocksStatement;
+
+  // editing
+  statements << UpdateWaypointStatement
+             << UpdateTrackStatement;
+  for (const QString &table: {QString("waypoint"), QString("track")}){
+    statements << QString(DeleteItemStatement).arg(table)
+               << QString(ItemCollectionStatement).arg(table)
+               << QString(MoveItemStatement).arg(table);
+  }
+  statements << ClosedTrackStatement
+             << DeleteSegmentStatement;
+
+  // statistics and recording
+  statements << TrackStatisticsStateStatement
+             << trackSegmentStatisticsStatement()
+             << SegmentStatisticsUpdate
+             << TrackStatisticsUpdate
+             << TrackOpenStatement
+             << TrackExistsStatement
+             << CloseTrackStatement
+             << CloseSegmentStatement
+             << OpenSegmentBlocksStatement
+             << StagedBlocksStatement
+             << DeleteStagedBlocksStatement;
+
+  // statistics recomputation
+  statements << OutdatedTracksStatement
+             << RecomputedStatisticsUpdate
+             << TrackVersionUpdate
+             << SegmentBlocksFromStatement
+             << SegmentVersionUpdate;
+
+  // import deduplication
+  statements << QString(WaypointHashLookupStatement).arg(":hash1, :hash2")
+             << SegmentHashLookupStatement;
+
+  // collection summary triggers
+  statements << summaryRefreshBox(":collectionId") + "WHERE `collection_id` = :collectionId;"
+             << DeleteCollectionSummaryStatement;
+
+  // foreign key actions
+  statements << "SELECT 1 FROM `track` WHERE `collection_id` = :id;"
+             << "SELECT 1 FROM `waypoint` WHERE `collection_id` = :id;"
+             << "SELECT 1 FROM `track_segment` WHERE `track_id` = :id;"
+             << "SELECT 1 FROM `track_point_block` WHERE `segment_id` = :id;"
+             << "SELECT 1 FROM `track_lod` WHERE `segment_id` = :id;";
+
+  if (pendingTrackLod){
+    statements << DeletePendingLodStatement
+               << "SELECT 1 FROM `track_lod_pending` WHERE `segment_id` = :id;";
+  }
+
+  if (legacyTrackPoints){
+    statements << LegacyTrackPointsStatement
+               << DeleteLegacyTrackPointsStatement;
+  }
+
+  QRegExp scanExp("^SCAN (TABLE )?(\\w+)");
+  bool result = true;
+  for (const QString &statement: statements){
+    QSqlQuery sql(db);
+    if (!sql.prepare("EXPLAIN QUERY PLAN " + statement)){
+      qWarning() << "Query plan check: preparing" << statement << "failed" << sql.lastError();
+      result = false;
+      continue;
+    }
+    for (const QString &placeholder: sql.boundValues().keys()){
+      sql.bindValue(placeholder, 0);
+    }
+    sql.exec();
+    if (sql.lastError().isValid()){
+      qWarning() << "Query plan check:" << statement << "failed" << sql.lastError();
+      result = false;
+      continue;
+    }
+    while (sql.next()){
+      QString detail = varToString(sql.value("detail"));
+      if (scanExp.indexIn(detail) == 0 && largeTables.contains(scanExp.cap(2))){
+        qWarning() << "Query plan check:" << statement << "scans large table:" << detail;
+        result = false;
+      }
+    }
+  }
+  qDebug() << "Query plan check" << (result ? "passed" : "failed") << "for" << statements.size() << "statements";
+  return result;
+}
+#endif
+
 void Storage::init()
 {
   if (!checkAccess("init", false)){
@@ -301,7 +1091,7 @@ void Storage::init()
   }
 
   // Find QSLite driver
-  db = QSqlDatabase::addDatabase("QSQLITE", "storage");
+  db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
   if (!db.isValid()){
     qWarning() << "Could not find QSQLITE backend";
     emit initialisationError("Could not find QSQLITE backend");
@@ -316,13 +1106,38 @@ void Storage::init()
   path.append(QDir::separator()).append("storage.db");
   path = QDir::toNativeSeparators(path);
   db.setDatabaseName(path);
+  db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BusyTimeout));
 
   if (!db.open()){
     qWarning() << "Open database failed" << db.lastError();
     emit initialisationError(db.lastError().text());
     return;
   }
-  qDebug() << "Storage database opened:" << path;
+  qDebug() << "Storage database opened:" << path << "(" << connectionName << ")";
+
+  if (isReader()){
+    ok = configureConnection();
+    emit initialised();
+    return;
+  }
+
+  // auto vacuum mode of new database may be set before its first page is written,
+  // existing database has to be rebuilt (see rebuildDatabase)
+  if (pragmaValue(db, "page_count") == 0){
+    QSqlQuery autoVacuum = db.exec("PRAGMA auto_vacuum = INCREMENTAL;");
+    if (autoVacuum.lastError().isValid()){
+      qWarning() << "Enabling incremental vacuum fails:" << autoVacuum.lastError();
+    }
+  }
+
+  // journal mode is persistent, it have to be set before readers are opened
+  QSqlQuery journal = db.exec("PRAGMA journal_mode = WAL;");
+  if (journal.lastError().isValid() || !journal.next() ||
+      varToString(journal.value(0)).toLower() != "wal"){
+    qWarning() << "Switching to WAL journal fails:" << journal.lastError();
+  }
+  journal.finish();
+
   if (!updateSchema()){
     emit initialisationError("update schema");
     return;
@@ -332,1078 +1147,3244 @@ void Storage::init()
   if (q.lastError().isValid()){
     qWarning() << "Enabling foreign keys fails:" << q.lastError();
   }
+  configureConnection();
+
+  legacyTrackPoints = db.tables().contains("track_point");
+  pendingTrackLod = db.tables().contains("track_lod_pending");
+
+#ifdef STORAGE_QUERY_PLAN_CHECK
+  if (!checkQueryPlans()){
+    emit initialisationError("query plan check");
+    return;
+  }
+#endif
+
+  // readers are opened when schema is up to date
+  for (Storage *reader: readers){
+    QMetaObject::invokeMethod(reader, "init", Qt::BlockingQueuedConnection);
+    if (!(*reader)){
+      qWarning() << "Opening reader connection" << reader->connectionName << "failed";
+      emit initialisationError("open reader connection");
+      return;
+    }
+  }
 
   ok = db.isValid() && db.isOpen();
   emit initialised();
+
+  if (ok && legacyTrackPoints){
+    QMetaObject::invokeMethod(this, "migrateTrackPoints", Qt::QueuedConnection);
+  }
+  if (ok && pendingTrackLod){
+    QMetaObject::invokeMethod(this, "computeTrackLod", Qt::QueuedConnection);
+  }
+  if (ok){
+    QMetaObject::invokeMethod(this, "recomputeStatistics", Qt::QueuedConnection);
+  }
+
+  QSqlQuery stat = db.exec("SELECT 1 FROM `sqlite_master` WHERE `name` = 'sqlite_stat1';");
+  analyzed = !stat.lastError().isValid() && stat.next();
+  stat.finish();
+  analyzedChanges = 0;
+  lastActivity.start();
+  if (ok){
+    scheduleMaintenance(maintenanceIdleDelay);
+  }
 }
 
-bool Storage::checkAccess(QString slotName, bool requireOpen)
+bool Storage::enableIncrementalVacuum()
 {
-  if (thread != QThread::currentThread()){
-    qWarning() << this << "::" << slotName << "from non incorrect thread;" << thread << "!=" << QThread::currentThread();
+  if (pragmaValue(db, "auto_vacuum") == AutoVacuumIncremental){
+    return true;
+  }
+
+  // VACUUM writes copy of the database to temporary file and then to the log
+  qint64 dbSize = QFileInfo(db.databaseName()).size();
+  qint64 available = QStorageInfo(directory).bytesAvailable();
+  if (available >= 0 && available < 2 * dbSize){
+    qWarning() << "Not enough free space for database rebuild:" << available << "bytes available," << (2 * dbSize) << "required";
+    emit error(tr("Not enough free space to enable incremental vacuum of database (%1 MiB required)")
+                 .arg((2 * dbSize) / (1024 * 1024)));
     return false;
   }
-  if (requireOpen && !ok){
-    qWarning() << "Database is not open, " << this << "::" << slotName << "";
+
+  // one time rebuild of database, requested by user
+  QTime timer;
+  timer.start();
+  QStringList statements;
+  statements << "PRAGMA auto_vacuum = INCREMENTAL;"
+             << "VACUUM;";
+  if (!execStatements(db, statements)){
+    qWarning() << "Enabling incremental vacuum failed";
+    emit error(tr("Enabling incremental vacuum of database failed: %1").arg(db.lastError().text()));
     return false;
   }
+  qDebug() << "Database rebuilt with incremental auto vacuum in" << timer.elapsed() << "ms";
   return true;
 }
 
-void Storage::loadCollections()
+bool Storage::configureConnection()
 {
-  if (!checkAccess("loadCollections")){
-    emit collectionsLoaded(std::vector<Collection>(), false);
-    return;
+  QStringList pragmas;
+  pragmas << QString("PRAGMA mmap_size = %1;").arg(MmapSize)
+          << QString("PRAGMA cache_size = -%1;").arg(CacheSize) // negative value is in KiB
+          << "PRAGMA temp_store = MEMORY;";
+  if (isReader()){
+    pragmas << "PRAGMA query_only = ON;";
+  } else {
+    // in WAL mode, NORMAL is safe from corruption, last transactions may be rolled back on power loss
+    pragmas << "PRAGMA synchronous = NORMAL;";
   }
 
-  QString sql("SELECT `id`, `visible`, `name`, `description` FROM `collection`;");
-
-  QSqlQuery q = db.exec(sql);
-  if (q.lastError().isValid()) {
-    emit collectionsLoaded(std::vector<Collection>(), false);
+  bool result = true;
+  for (const auto &pragma: pragmas){
+    QSqlQuery q = db.exec(pragma);
+    if (q.lastError().isValid()){
+      qWarning() << pragma << "fails:" << q.lastError();
+      result = false;
+    }
   }
-  std::vector<Collection> result;
-  while (q.next()) {
-    result.emplace_back(
-      varToLong(q.value("id")),
-      varToBool(q.value("visible")),
-      varToString(q.value("name")),
-      varToString(q.value("description"))
-    );
-  }
-  emit collectionsLoaded(result, true);
-}
-
-Track Storage::makeTrack(QSqlQuery &sqlTrack) const
-{
-  return Track(varToLong(sqlTrack.value("id")),
-               varToLong(sqlTrack.value("collection_id")),
-               varToString(sqlTrack.value("name")),
-               varToString(sqlTrack.value("description")),
-               varToBool(sqlTrack.value("open")),
-               varToDateTime(sqlTrack.value("creation_time")),
-               varToDateTime(sqlTrack.value("modification_time")),
-               TrackStatistics(
-                 varToDateTime(sqlTrack.value("from_time")),
-                 varToDateTime(sqlTrack.value("to_time")),
-                 Distance::Of<Meter>(varToDouble(sqlTrack.value("distance"))),
-                 Distance::Of<Meter>(varToDouble(sqlTrack.value("raw_distance"))),
-                 std::chrono::milliseconds(varToLong(sqlTrack.value("duration"))),
-                 std::chrono::milliseconds(varToLong(sqlTrack.value("moving_duration"))),
-                 varToDouble(sqlTrack.value("max_speed")),
-                 varToDouble(sqlTrack.value("average_speed")),
-                 varToDouble(sqlTrack.value("moving_average_speed")),
-                 Distance::Of<Meter>(varToDouble(sqlTrack.value("ascent"))),
-                 Distance::Of<Meter>(varToDouble(sqlTrack.value("descent"))),
-                 varToDistanceOpt(sqlTrack.value("min_elevation")),
-                 varToDistanceOpt(sqlTrack.value("max_elevation")),
-
-                 GeoBox(GeoCoord(varToDouble(sqlTrack.value("bbox_min_lat")),
-                                                     varToDouble(sqlTrack.value("bbox_min_lon"))),
-                                  GeoCoord(varToDouble(sqlTrack.value("bbox_max_lat")),
-                                                     varToDouble(sqlTrack.value("bbox_max_lon"))))
-                                                   ));
-}
-
-std::shared_ptr<std::vector<Track>> Storage::loadTracks(qint64 collectionId)
+  return result && db.isValid() && db.isOpen();
+}
+
+bool Storage::isReader() const
 {
-  QSqlQuery sqlTrack(db);
-  sqlTrack.prepare("SELECT * FROM `track` WHERE collection_id = :collectionId;");
-  sqlTrack.bindValue(":collectionId", collectionId);
-  sqlTrack.exec();
+  return writer != nullptr;
+}
 
-  if (sqlTrack.lastError().isValid()) {
-    qWarning() << "Loading tracks for collection id" << collectionId << "fails";
-    emit error(tr("Loading tracks for collection id %1 fails").arg(collectionId));
-    return nullptr;
-  }
+bool Storage::hasLegacyTrackPoints() const
+{
+  return isReader() ? writer->legacyTrackPoints.load() : legacyTrackPoints.load();
+}
 
-  std::shared_ptr<std::vector<Track>> result = std::make_shared<std::vector<Track>>();
-  while (sqlTrack.next()) {
-    result->emplace_back(makeTrack(sqlTrack));
+qint64 Storage::dataVersion()
+{
+  QSqlQuery q = db.exec("PRAGMA data_version;");
+  if (q.lastError().isValid() || !q.next()){
+    return -1;
   }
-  return result;
+  return varToLong(q.value(0));
 }
 
-std::shared_ptr<std::vector<Waypoint>> Storage::loadWaypoints(qint64 collectionId)
+bool Storage::consistentRead(const std::function<bool()> &read, bool retryOnChange)
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `id`, `name`, `description`, `symbol`, `timestamp`, `modification_time`, `latitude`, `longitude`, `elevation` FROM `waypoint` WHERE collection_id = :collectionId;");
-  sql.bindValue(":collectionId", collectionId);
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading waypoints for collection id" << collectionId << "fails";
-    emit error(tr("Loading waypoints for collection id %1 fails").arg(collectionId));
-    return nullptr;
+  if (!isReader()){
+    // writer's own reads are always up to date
+    return read();
   }
 
-  std::shared_ptr<std::vector<Waypoint>> result = std::make_shared<std::vector<Waypoint>>();
-  while (sql.next()) {
-    gpx::Waypoint wpt(GeoCoord(
-      varToDouble(sql.value("latitude")),
-      varToDouble(sql.value("longitude"))
-      ));
-
-    wpt.name = varToStringOpt(varToString(sql.value("name")));
-    wpt.description = varToStringOpt(sql.value("description"));
-    wpt.symbol = varToStringOpt(sql.value("symbol"));
-
-    wpt.time = gpx::Optional<Timestamp>::of(dateTimeToTimestamp(varToDateTime(sql.value("timestamp"))));
-    wpt.elevation = varToDoubleOpt(sql.value("elevation"));
-
-    result->emplace_back(varToLong(sql.value("id")), varToDateTime(sql.value("modification_time")), std::move(wpt));
+  // reader sees snapshot of database from start of transaction,
+  // when writer commits meanwhile, result may be older than writer's
+  // notification emitted already, read it again in such case
+  for (int attempt = 0; ; attempt++){
+    qint64 version = dataVersion();
+    db.transaction();
+    bool result = read();
+    db.commit();
+    if (!result || !retryOnChange || attempt >= ReadRetryCount || dataVersion() == version){
+      return result;
+    }
+    qDebug() << "Database was modified during read, reading again";
   }
-  return result;
 }
 
-bool Storage::loadCollectionDetailsPrivate(Collection &collection)
+bool Storage::checkAccess(QString slotName, bool requireOpen)
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `name`, `description`, `visible` FROM `collection` WHERE id = :collectionId;");
-  sql.bindValue(":collectionId", collection.id);
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading collection id" << collection.id << "fails";
-    emit error(tr("Loading collection id %1 fails").arg(collection.id));
+  if (thread != QThread::currentThread()){
+    qWarning() << this << "::" << slotName << "from non incorrect thread;" << thread << "!=" << QThread::currentThread();
     return false;
   }
-  std::vector<Collection> result;
-  if (!sql.next()) {
-    qWarning() << "Collection id" << collection.id << "don't exists";
-    emit error(tr("Collection id %1 don't exists").arg(collection.id));
+  if (requireOpen && !ok){
+    qWarning() << "Database is not open, " << this << "::" << slotName << "";
     return false;
   }
-
-  collection.name = varToString(sql.value("name"));
-  collection.description = varToString(sql.value("description"));
-  collection.visible = varToBool(sql.value("visible"));
-
-  collection.tracks = loadTracks(collection.id);
-  collection.waypoints = loadWaypoints(collection.id);
+  if (ok && !isReader()){
+    // maintenance waits until writer is idle
+    lastActivity.restart();
+    scheduleMaintenance(maintenanceIdleDelay);
+  }
   return true;
 }
 
-void Storage::loadCollectionDetails(Collection collection)
+void Storage::setMaintenanceIdleDelay(int ms)
 {
-  if (!checkAccess("loadCollectionDetails")){
-    emit collectionDetailsLoaded(collection, false);
-    return;
-  }
+  maintenanceIdleDelay = ms;
+}
 
-  if (loadCollectionDetailsPrivate(collection)) {
-    emit collectionDetailsLoaded(collection, true);
-  }else{
-    emit collectionDetailsLoaded(collection, false);
+void Storage::scheduleMaintenance(int delay)
+{
+  if (maintenanceScheduled){
+    return;
   }
+  maintenanceScheduled = true;
+  QTimer::singleShot(delay, this, SLOT(maintenance()));
 }
 
-void Storage::loadTrackPoints(qint64 segmentId, gpx::TrackSegment &segment)
+void Storage::maintenance()
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` FROM `track_point` WHERE segment_id = :segmentId;");
-  sql.bindValue(":segmentId", segmentId);
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
-    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+  maintenanceScheduled = false;
+  if (thread != QThread::currentThread() || !ok || isReader()){
+    return;
+  }
+  int idleDelay = maintenanceIdleDelay;
+  qint64 idle = lastActivity.elapsed();
+  if (idle < idleDelay){
+    scheduleMaintenance(idleDelay - idle);
+    return;
+  }
+  if (!importJobs.empty()){
+    // scheduled again by request when import is finished
     return;
   }
 
-  while (sql.next()) {
-    gpx::TrackPoint point(GeoCoord(
-      varToDouble(sql.value("latitude")),
-      varToDouble(sql.value("longitude"))
-    ));
-
-    point.time = gpx::Optional<Timestamp>::of(dateTimeToTimestamp(varToDateTime(sql.value("timestamp"))));
-    point.elevation = varToDoubleOpt(sql.value("elevation"));
-
-    // see TrackPoint notes
-    point.hdop = varToDoubleOpt(sql.value("horiz_accuracy"));
-    point.vdop = varToDoubleOpt(sql.value("vert_accuracy"));
+  // database created without incremental auto vacuum stays in that mode,
+  // its free pages are not reclaimed until user requests rebuildDatabase
 
-    segment.points.push_back(std::move(point));
+  // rows changed by this connection, including changes by triggers and cascades
+  qint64 changes = -1;
+  QSqlQuery sqlChanges = db.exec("SELECT total_changes();");
+  if (!sqlChanges.lastError().isValid() && sqlChanges.next()){
+    changes = varToLong(sqlChanges.value(0));
   }
-}
+  sqlChanges.finish();
+  if (!analyzed || (changes >= 0 && changes - analyzedChanges >= AnalyzeChangeThreshold)){
+    if (analyze()){
+      analyzed = true;
+      analyzedChanges = changes;
+    }
+    scheduleMaintenance(MaintenanceStepDelay);
+    return;
+  }
+
+  bool morePages = false;
+  if (vacuumStep(morePages) && morePages){
+    scheduleMaintenance(MaintenanceStepDelay);
+  }
+}
+
+bool Storage::analyze()
+{
+  QTime timer;
+  timer.start();
+  // analysis limit is ignored by sqlite older than 3.32, full analyze is done then
+  QStringList statements;
+  statements << QString("PRAGMA analysis_limit = %1;").arg(AnalysisLimit)
+             << "ANALYZE;";
+  if (!execStatements(db, statements)){
+    qWarning() << "Analyze failed";
+    return false;
+  }
+  qDebug() << "Database analyzed in" << timer.elapsed() << "ms";
+  return true;
+}
+
+bool Storage::vacuumStep(bool &morePages)
+{
+  morePages = false;
+  qint64 freePages = pragmaValue(db, "freelist_count");
+  if (freePages <= 0 || pragmaValue(db, "auto_vacuum") != AutoVacuumIncremental){
+    return freePages == 0;
+  }
+
+  QTime timer;
+  timer.start();
+  int pages = std::min<qint64>(freePages, VacuumStepPages);
+  db.transaction();
+  // QSQLITE steps pragma statement once per exec (it doesn't return
+  // columns), every step reclaims one page
+  QSqlQuery sql(db);
+  sql.prepare("PRAGMA incremental_vacuum(1);");
+  for (int i = 0; i < pages; i++){
+    if (!sql.exec()){
+      qWarning() << "Incremental vacuum failed" << sql.lastError();
+      if (!db.rollback()) {
+        qWarning() << "Transaction rollback failed" << db.lastError();
+      }
+      return false;
+    }
+  }
+  if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    return false;
+  }
+
+  qint64 remaining = pragmaValue(db, "freelist_count");
+  morePages = remaining > 0 && remaining < freePages;
+  if (!morePages){
+    // move reclaimed pages from log to database file, so it shrinks
+    QSqlQuery checkpoint = db.exec("PRAGMA wal_checkpoint(PASSIVE);");
+    if (checkpoint.lastError().isValid()){
+      qWarning() << "Checkpoint failed" << checkpoint.lastError();
+    }
+  }
+  qDebug() << "Reclaimed" << (freePages - remaining) << "pages in" << timer.elapsed() << "ms," << remaining << "free pages remaining";
+  return true;
+}
+
+void Storage::loadDatabaseStats()
+{
+  DatabaseStats stats;
+  if (!checkAccess("loadDatabaseStats")){
+    emit databaseStatsLoaded(stats);
+    return;
+  }
+
+  stats.fileSize = QFileInfo(db.databaseName()).size();
+  stats.walSize = QFileInfo(db.databaseName() + "-wal").size();
+  stats.pageSize = pragmaValue(db, "page_size");
+  stats.pageCount = pragmaValue(db, "page_count");
+  stats.freePages = pragmaValue(db, "freelist_count");
+  stats.incrementalVacuum = pragmaValue(db, "auto_vacuum") == AutoVacuumIncremental;
+  emit databaseStatsLoaded(stats);
+}
+
+void Storage::rebuildDatabase()
+{
+  if (!checkAccess("rebuildDatabase")){
+    emit databaseRebuilt(false);
+    return;
+  }
+
+  if (!importJobs.empty() || !recordings.empty() || legacyTrackPoints){
+    qWarning() << "Database can't be rebuilt while tracks are recorded, imported or migrated";
+    emit error(tr("Database can't be rebuilt while tracks are recorded or imported"));
+    emit databaseRebuilt(false);
+    return;
+  }
+
+  bool success = enableIncrementalVacuum();
+  emit databaseRebuilt(success);
+  loadDatabaseStats();
+}
+
+void Storage::loadCollections()
+{
+  if (!checkAccess("loadCollections")){
+    emit collectionsLoaded(std::make_shared<const std::vector<Collection>>(), false);
+    return;
+  }
+
+  std::vector<Collection> result;
+  bool success = consistentRead([&]() {
+    result.clear();
+    QString sql("SELECT c.`id`, c.`visible`, c.`name`, c.`description`, "
+                "s.`track_count`, s.`waypoint_count`, s.`distance`, s.`duration`, "
+                "s.`bbox_min_lat`, s.`bbox_min_lon`, s.`bbox_max_lat`, s.`bbox_max_lon`, s.`modification_time` "
+                "FROM `collection` c LEFT JOIN `collection_summary` s ON s.`collection_id` = c.`id`;");
+
+    QSqlQuery q = db.exec(sql);
+    if (q.lastError().isValid()) {
+      qWarning() << "Loading collections fails:" << q.lastError();
+      return false;
+    }
+    SqlRowReader row(q);
+    while (row.next()) {
+      result.emplace_back(
+        row.getLong(0),
+        row.getBool(1),
+        row.getString(2),
+        row.getString(3)
+      );
+      Collection &collection = result.back();
+      collection.trackCount = row.getLong(4, 0);
+      collection.waypointCount = row.getLong(5, 0);
+      collection.distance = Distance::Of<Meter>(row.getDouble(6));
+      collection.duration = std::chrono::milliseconds(row.getLong(7, 0));
+      if (!row.isNull(8)){
+        collection.bbox = GeoBox(GeoCoord(row.getDouble(8), row.getDouble(9)),
+                                 GeoCoord(row.getDouble(10), row.getDouble(11)));
+      }
+      collection.lastModification = row.getDateTime(12);
+    }
+    return true;
+  });
+  emit collectionsLoaded(std::make_shared<const std::vector<Collection>>(std::move(result)), success);
+}
 
-bool Storage::loadTrackDataPrivate(Track &track)
+Track Storage::makeTrack(SqlRowReader &row) const
+{
+  return Track(row.getLong(TrkId),
+               row.getLong(TrkCollectionId),
+               row.getString(TrkName),
+               row.getString(TrkDescription),
+               row.getBool(TrkOpen),
+               row.getDateTime(TrkCreationTime),
+               row.getDateTime(TrkModificationTime),
+               readStatistics(row, TrkFromTime));
+}
+
+TrackList Storage::loadTracks(qint64 collectionId)
 {
   QSqlQuery sqlTrack(db);
-  sqlTrack.prepare("SELECT * FROM `track` WHERE id = :trackId;");
-  sqlTrack.bindValue(":trackId", track.id);
+  sqlTrack.setForwardOnly(true);
+  sqlTrack.prepare(collectionTracksStatement());
+  sqlTrack.bindValue(":collectionId", collectionId);
   sqlTrack.exec();
 
   if (sqlTrack.lastError().isValid()) {
-    qWarning() << "Loading track id" << track.id << "fails: " << sqlTrack.lastError();
-    emit error(tr("Loading track id %1 fails").arg(track.id));
+    qWarning() << "Loading tracks for collection id" << collectionId << "fails";
+    emit error(tr("Loading tracks for collection id %1 fails").arg(collectionId));
+    return nullptr;
+  }
+
+  std::shared_ptr<std::vector<Track>> result = std::make_shared<std::vector<Track>>();
+  SqlRowReader row(sqlTrack);
+  while (row.next()) {
+    result->emplace_back(makeTrack(row));
+  }
+  return result;
+}
+
+Waypoint Storage::makeWaypoint(SqlRowReader &row) const
+{
+  gpx::Waypoint wpt(GeoCoord(
+    row.getDouble(WptLatitude),
+    row.getDouble(WptLongitude)
+    ));
+
+  wpt.name = gpx::Optional<std::string>::of(row.getString(WptName).toStdString());
+  wpt.description = row.getStringOpt(WptDescription);
+  wpt.symbol = row.getStringOpt(WptSymbol);
+
+  wpt.time = row.getTimestampOpt(WptTimestamp);
+  wpt.elevation = row.getDoubleOpt(WptElevation);
+
+  return Waypoint(row.getLong(WptId), row.getLong(WptCollectionId), row.getDateTime(WptModificationTime), std::move(wpt));
+}
+
+WaypointList Storage::loadWaypoints(qint64 collectionId)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(collectionWaypointsStatement());
+  sql.bindValue(":collectionId", collectionId);
+  sql.exec();
+
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading waypoints for collection id" << collectionId << "fails";
+    emit error(tr("Loading waypoints for collection id %1 fails").arg(collectionId));
+    return nullptr;
+  }
+
+  std::shared_ptr<std::vector<Waypoint>> result = std::make_shared<std::vector<Waypoint>>();
+  SqlRowReader row(sql);
+  while (row.next()) {
+    result->push_back(makeWaypoint(row));
+  }
+  return result;
+}
+
+bool Storage::loadCollectionDetailsPrivate(Collection &collection)
+{
+  QSqlQuery sql(db);
+  sql.prepare("SELECT `name`, `description`, `visible` FROM `collection` WHERE id = :collectionId;");
+  sql.bindValue(":collectionId", collection.id);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading collection id" << collection.id << "fails";
+    emit error(tr("Loading collection id %1 fails").arg(collection.id));
+    return false;
+  }
+  std::vector<Collection> result;
+  if (!sql.next()) {
+    qWarning() << "Collection id" << collection.id << "don't exists";
+    emit error(tr("Collection id %1 don't exists").arg(collection.id));
+    return false;
+  }
+
+  collection.name = varToString(sql.value("name"));
+  collection.description = varToString(sql.value("description"));
+  collection.visible = varToBool(sql.value("visible"));
+
+  collection.tracks = loadTracks(collection.id);
+  collection.waypoints = loadWaypoints(collection.id);
+  return true;
+}
+
+void Storage::loadCollectionDetails(Collection collection)
+{
+  if (!checkAccess("loadCollectionDetails")){
+    emit collectionDetailsLoaded(collection, false);
+    return;
+  }
+
+  if (consistentRead([&]() { return loadCollectionDetailsPrivate(collection); })) {
+    emit collectionDetailsLoaded(collection, true);
+  }else{
+    emit collectionDetailsLoaded(collection, false);
+  }
+}
+
+bool Storage::loadTrackPoints(qint64 segmentId, gpx::TrackSegment &segment)
+{
+  TrackPointBuffer buffer;
+  if (!loadTrackPoints(segmentId, buffer)){
+    return false;
+  }
+  segment.points.reserve(segment.points.size() + buffer.size());
+  for (size_t i = 0; i < buffer.size(); i++){
+    segment.points.push_back(buffer.point(i));
+  }
+  return true;
+}
+
+bool Storage::loadTrackPoints(qint64 segmentId, TrackPointBuffer &points)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(SegmentBlocksStatement);
+  sql.bindValue(":segmentId", segmentId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+    return false;
+  }
+
+  SqlRowReader row(sql);
+  while (row.next()) {
+    points.reserve(points.size() + row.getLong(0, 0)); // point_count
+    if (!TrackPointBlock::decode(row.getBytes(1), points)){
+      qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+      emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+      return false;
+    }
+  }
+
+  if (hasLegacyTrackPoints()){
+    gpx::TrackSegment segment;
+    if (!loadLegacyTrackPoints(segmentId, segment)){
+      return false;
+    }
+    for (const auto &p: segment.points){
+      points.append(p);
+    }
+  }
+  return true;
+}
+
+bool Storage::loadLegacyTrackPoints(qint64 segmentId, gpx::TrackSegment &segment)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(LegacyTrackPointsStatement);
+  sql.bindValue(":segmentId", segmentId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+    return false;
+  }
+
+  SqlRowReader row(sql);
+  while (row.next()) {
+    gpx::TrackPoint point(GeoCoord(
+      row.getDouble(1), // latitude
+      row.getDouble(2) // longitude
+    ));
+
+    point.time = row.getTimestampOpt(0);
+    point.elevation = row.getDoubleOpt(3);
+
+    // see TrackPoint notes
+    point.hdop = row.getDoubleOpt(4);
+    point.vdop = row.getDoubleOpt(5);
+
+    segment.points.push_back(std::move(point));
+  }
+  return true;
+}
+
+void Storage::migrateTrackPoints()
+{
+  if (!checkAccess("migrateTrackPoints") || !legacyTrackPoints){
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.prepare("SELECT `segment_id` FROM `track_point` LIMIT 1;");
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading legacy track points failed" << sql.lastError();
+    return;
+  }
+
+  if (!sql.next()) {
+    sql.finish();
+    QSqlQuery q = db.exec("DROP TABLE `track_point`;");
+    if (q.lastError().isValid()){
+      qWarning() << "Dropping legacy track point table failed" << q.lastError();
+      return;
+    }
+    legacyTrackPoints = false;
+    qDebug() << "Migration of track points is done";
+    QMetaObject::invokeMethod(this, "recomputeStatistics", Qt::QueuedConnection);
+    return;
+  }
+  qint64 segmentId = varToLong(sql.value("segment_id"));
+  sql.finish();
+
+  // convert one segment in single transaction, other storage requests
+  // are processed before next segment
+  QTime timer;
+  timer.start();
+
+  gpx::TrackSegment segment;
+  db.transaction();
+  bool success = loadLegacyTrackPoints(segmentId, segment);
+  if (success){
+    std::vector<EncodedTrackPointBlock> blocks = TrackPointBlock::encodeBlocks(segment.points, TrackPointBlockSize);
+    success = insertTrackPointBlocks(blocks, 0, blocks.size(), segmentId);
+  }
+  if (!success) {
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    return;
+  }
+
+  QSqlQuery sqlDelete(db);
+  sqlDelete.prepare(DeleteLegacyTrackPointsStatement);
+  sqlDelete.bindValue(":segmentId", segmentId);
+  sqlDelete.exec();
+  if (sqlDelete.lastError().isValid()) {
+    qWarning() << "Deleting legacy track points failed" << sqlDelete.lastError();
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    return;
+  }
+  if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    return;
+  }
+  qDebug() << "Migrated" << segment.points.size() << "points of segment" << segmentId << "in" << timer.elapsed() << "ms";
+
+  QMetaObject::invokeMethod(this, "migrateTrackPoints", Qt::QueuedConnection);
+}
+
+void Storage::computeTrackLod()
+{
+  if (!checkAccess("computeTrackLod") || !pendingTrackLod){
+    return;
+  }
+
+  // step is repeated later when it fails, pending row is deleted
+  // together with computed geometry only
+  auto retry = [this](){
+    QTimer::singleShot(BackgroundRetryDelay, this, SLOT(computeTrackLod()));
+  };
+
+  QSqlQuery sql(db);
+  sql.prepare("SELECT `segment_id` FROM `track_lod_pending` LIMIT 1;");
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading segments without simplified geometry failed" << sql.lastError();
+    retry();
+    return;
+  }
+
+  if (!sql.next()) {
+    sql.finish();
+    QSqlQuery q = db.exec("DROP TABLE `track_lod_pending`;");
+    if (q.lastError().isValid()){
+      qWarning() << "Dropping pending geometry table failed" << q.lastError();
+      retry();
+      return;
+    }
+    pendingTrackLod = false;
+    qDebug() << "Simplified geometry of all segments is computed";
+    return;
+  }
+  qint64 segmentId = varToLong(sql.value(0));
+  sql.finish();
+
+  // one segment in single transaction, other storage requests
+  // are processed before next segment
+  QTime timer;
+  timer.start();
+
+  db.transaction();
+  gpx::TrackSegment segment;
+  bool ok = loadTrackPoints(segmentId, segment) &&
+            insertSegmentLod(segmentId, encodeLod(segment.points));
+  QSqlQuery sqlDelete(db);
+  if (ok) {
+    sqlDelete.prepare(DeletePendingLodStatement);
+    sqlDelete.bindValue(":segmentId", segmentId);
+    sqlDelete.exec();
+    ok = !sqlDelete.lastError().isValid();
+  }
+  if (!ok) {
+    qWarning() << "Computing simplified geometry of segment" << segmentId << "failed" << sqlDelete.lastError();
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    retry();
+    return;
+  }
+  if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    retry();
+    return;
+  }
+  qDebug() << "Computed simplified geometry of segment" << segmentId << "(" << segment.points.size() << "points) in" << timer.elapsed() << "ms";
+
+  QMetaObject::invokeMethod(this, "computeTrackLod", Qt::QueuedConnection);
+}
+
+namespace {
+  /**
+   * point blocks of one outdated track read by storage thread in one recomputation step,
+   * segments follow each other in track order
+   */
+  struct StatisticsWork
+  {
+    struct Segment
+    {
+      size_t index{0}; // in track
+      bool continued{false}; // blocks continue segment accumulated partially by previous step
+      bool complete{false}; // blocks up to the segment end
+      std::vector<QByteArray> blocks;
+    };
+
+    size_t track{0}; // index of track in step
+    QByteArray entry; // accumulator state before the first segment, empty at track start
+    std::vector<Segment> segments;
+  };
+
+  /**
+   * statistics accumulated by worker thread from StatisticsWork
+   */
+  struct StatisticsResult
+  {
+    struct Segment
+    {
+      TrackStatistics statistics;
+      QByteArray state;
+    };
+
+    bool ok{false}; // entry state and all blocks are decoded
+    std::vector<Segment> segments; // complete segments of the work
+    TrackStatistics statistics; // of the track, valid when its last segment is complete
+    QByteArray state; // after the last block
+  };
+
+  StatisticsResult accumulateStatistics(const StatisticsWork &work)
+  {
+    StatisticsResult result;
+    TrackStatisticsAccumulator accumulator;
+    if (!work.entry.isEmpty() && !accumulator.deserialize(work.entry)){
+      return result;
+    }
+    std::vector<gpx::TrackPoint> points;
+    points.reserve(TrackPointBlockSize);
+    for (const auto &segment: work.segments){
+      if (segment.index > 0 && !segment.continued){
+        accumulator.startSegment();
+      }
+      for (const QByteArray &block: segment.blocks){
+        points.clear();
+        if (!TrackPointBlock::decode(block, points)){
+          return result;
+        }
+        accumulator.append(points);
+      }
+      if (segment.complete){
+        result.segments.push_back(StatisticsResult::Segment{accumulator.segmentStatistics(), accumulator.serialize()});
+      }
+    }
+    result.ok = true;
+    result.statistics = accumulator.statistics();
+    result.state = accumulator.serialize();
+    return result;
+  }
+}
+
+void Storage::recomputeStatistics()
+{
+  if (!checkAccess("recomputeStatistics") || legacyTrackPoints){
+    // started again when legacy track points are migrated
+    return;
+  }
+
+  struct OutdatedTrack {
+    qint64 id;
+    qint64 collectionId;
+    std::vector<StoredSegment> segments;
+    size_t firstSegment{0}; // first segment accumulated by this step
+    bool finished{false}; // all segments are accumulated
+  };
+
+  // step is repeated later when outdated tracks can't be loaded,
+  // other storage requests are not blocked by the failing one
+  auto retry = [this](){
+    QTimer::singleShot(BackgroundRetryDelay, this, SLOT(recomputeStatistics()));
+  };
+
+  QTime timer;
+  timer.start();
+
+  // open tracks are updated by recording, they are recomputed after close.
+  // Order of outdated tracks is stable, track split by previous step is the first one
+  std::vector<OutdatedTrack> tracks;
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(OutdatedTracksStatement);
+  sql.bindValue(":version", StatisticsVersion);
+  sql.bindValue(":limit", StatisticsBatchTracks);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading tracks with outdated statistics failed" << sql.lastError();
+    emit error(tr("Loading tracks with outdated statistics failed: %1").arg(sql.lastError().text()));
+    retry();
+    return;
+  }
+  while (sql.next()) {
+    OutdatedTrack track;
+    track.id = varToLong(sql.value(0));
+    track.collectionId = varToLong(sql.value(1));
+    tracks.push_back(std::move(track));
+  }
+  sql.finish();
+
+  if (tracks.empty()) {
+    statisticsProgress = StatisticsProgress();
+    if (!recomputedCollections.isEmpty()){
+      emitCollectionDetails(recomputedCollections);
+      recomputedCollections.clear();
+      loadCollections();
+      qDebug() << "Statistics of all tracks are recomputed";
+    }
+    return;
+  }
+
+  // point blocks are read by this thread (database connection is bound to it) and handed
+  // over to worker threads track by track. Workers decode blocks and accumulate tracks
+  // in parallel, segments of one track are accumulated in order, because statistics
+  // continue over segments. Step is limited by count of points: segments accumulated
+  // by previous steps are continued from their state, segment that reaches the limit
+  // is continued by the next step from the accumulator state (statisticsProgress)
+  const size_t workerCount = std::min<size_t>(tracks.size(), std::max(1u, std::thread::hardware_concurrency()));
+  BoundedQueue<StatisticsWork> queue(workerCount);
+  std::vector<StatisticsResult> results(tracks.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < workerCount; i++){
+    workers.emplace_back([&queue, &results](){
+      StatisticsWork work;
+      while (queue.pop(work)){
+        results[work.track] = accumulateStatistics(work);
+      }
+    });
+  }
+
+  QSqlQuery sqlBlocks(db);
+  sqlBlocks.setForwardOnly(true);
+  sqlBlocks.prepare(SegmentBlocksFromStatement);
+
+  StatisticsProgress progress; // of this step
+  qint64 points = 0;
+  size_t loaded = 0;
+  size_t segmentCount = 0;
+  bool success = true;
+  for (; success && loaded < tracks.size() && points < StatisticsBatchPoints; loaded++){
+    OutdatedTrack &track = tracks[loaded];
+    if (!loadSegmentStatistics(track.id, track.segments)){
+      success = false;
+      break;
+    }
+
+    StatisticsWork work;
+    work.track = loaded;
+    size_t next = 0;
+    while (next < track.segments.size() && !track.segments[next].outdated && !track.segments[next].state.isEmpty()){
+      next++;
+    }
+    TrackStatisticsAccumulator entry;
+    if (next > 0 && !entry.deserialize(track.segments[next - 1].state)){
+      next = 0; // state of older version, track is accumulated from start
+    }
+    if (next > 0){
+      work.entry = track.segments[next - 1].state;
+    }
+    qint64 seq = 0;
+    bool continued = false;
+    if (next < track.segments.size() &&
+        statisticsProgress.trackId == track.id &&
+        statisticsProgress.segmentId == track.segments[next].id){
+      work.entry = statisticsProgress.state;
+      seq = statisticsProgress.nextSeq;
+      continued = true;
+    }
+    track.firstSegment = next;
+
+    for (; next < track.segments.size() && points < StatisticsBatchPoints; next++){
+      StatisticsWork::Segment segment;
+      segment.index = next;
+      segment.continued = continued;
+      qint64 segmentId = track.segments[next].id;
+      sqlBlocks.bindValue(":segmentId", segmentId);
+      sqlBlocks.bindValue(":seq", seq);
+      sqlBlocks.exec();
+      if (sqlBlocks.lastError().isValid()) {
+        qWarning() << "Loading nodes for segment id" << segmentId << "failed" << sqlBlocks.lastError();
+        emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlBlocks.lastError().text()));
+        success = false;
+        break;
+      }
+      qint64 nextSeq = seq;
+      segment.complete = true;
+      SqlRowReader row(sqlBlocks);
+      while (row.next()) {
+        if (points >= StatisticsBatchPoints){
+          segment.complete = false;
+          break;
+        }
+        nextSeq = row.getLong(0) + 1;
+        points += row.getLong(1);
+        segment.blocks.push_back(row.getBytes(2));
+      }
+      sqlBlocks.finish();
+      if (!segment.complete){
+        progress.trackId = track.id;
+        progress.segmentId = segmentId;
+        progress.nextSeq = nextSeq;
+      }
+      work.segments.push_back(std::move(segment));
+      seq = 0;
+      continued = false;
+    }
+    if (!success){
+      break;
+    }
+    track.finished = next == track.segments.size() &&
+                     (work.segments.empty() || work.segments.back().complete);
+    segmentCount += work.segments.size();
+    queue.push(std::move(work));
+  }
+  queue.close();
+  for (std::thread &worker: workers){
+    worker.join();
+  }
+  if (!success){
+    retry();
+    return;
+  }
+  tracks.resize(loaded);
+
+  // results of the step are written in single transaction,
+  // other storage requests are processed before the next step
+  db.transaction();
+  auto rollback = [this](){
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+  };
+
+  QSqlQuery sqlSegUpdate(db);
+  sqlSegUpdate.prepare(SegmentStatisticsUpdate);
+  QSqlQuery sqlUpdate(db);
+  sqlUpdate.prepare(RecomputedStatisticsUpdate);
+  QSqlQuery sqlVersion(db);
+  sqlVersion.prepare(TrackVersionUpdate);
+  for (size_t i = 0; i < tracks.size(); i++){
+    const OutdatedTrack &track = tracks[i];
+    const StatisticsResult &result = results[i];
+    if (result.ok){
+      for (size_t s = 0; s < result.segments.size(); s++){
+        qint64 segmentId = track.segments[track.firstSegment + s].id;
+        bindTrackStatistics(sqlSegUpdate, result.segments[s].statistics);
+        sqlSegUpdate.bindValue(":statistics_state", result.segments[s].state);
+        sqlSegUpdate.bindValue(":version", StatisticsVersion);
+        sqlSegUpdate.bindValue(":segmentId", segmentId);
+        sqlSegUpdate.exec();
+        if (sqlSegUpdate.lastError().isValid()) {
+          qWarning() << "Updating statistics of segment id" << segmentId << "failed" << sqlSegUpdate.lastError();
+          emit error(tr("Updating statistics of segment id %1 failed: %2").arg(segmentId).arg(sqlSegUpdate.lastError().text()));
+          rollback();
+          retry();
+          return;
+        }
+      }
+      if (!track.finished){
+        // continued by the next step
+        if (progress.trackId == track.id){
+          progress.state = result.state;
+        }
+        continue;
+      }
+    } else {
+      // statistics are kept, track is not processed again
+      qWarning() << "Decoding nodes of track id" << track.id << "failed, statistics are not recomputed";
+      if (progress.trackId == track.id){
+        progress = StatisticsProgress();
+      }
+    }
+
+    QSqlQuery &q = result.ok ? sqlUpdate : sqlVersion;
+    if (result.ok){
+      bindTrackStatistics(q, result.statistics);
+    }
+    q.bindValue(":version", StatisticsVersion);
+    q.bindValue(":trackId", track.id);
+    q.exec();
+    if (q.lastError().isValid()) {
+      qWarning() << "Updating statistics of track id" << track.id << "failed" << q.lastError();
+      emit error(tr("Updating statistics of track id %1 failed: %2").arg(track.id).arg(q.lastError().text()));
+      rollback();
+      retry();
+      return;
+    }
+    recomputedCollections.insert(track.collectionId);
+  }
+  if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    emit error(tr("Storing recomputed statistics failed: %1").arg(db.lastError().text()));
+    retry();
+    return;
+  }
+  statisticsProgress = progress;
+  qDebug() << "Recomputed statistics of" << segmentCount << "segments of" << tracks.size() << "tracks (" << points << "points) by"
+           << workerCount << "threads in" << timer.elapsed() << "ms";
+
+  QMetaObject::invokeMethod(this, "recomputeStatistics", Qt::QueuedConnection);
+}
+
+bool Storage::streamTrackPoints(const Track &track, qint64 requestId, size_t segmentIndex, qint64 segmentId)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(SegmentBlocksStatement);
+  sql.bindValue(":segmentId", segmentId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+    return false;
+  }
+
+  TrackPointBuffer points;
+  size_t offset = 0;
+  QTime timer;
+  timer.start();
+
+  auto emitChunk = [&](){
+    if (points.empty()){
+      return;
+    }
+    size_t count = points.size();
+    emit trackDataChunkLoaded(track, TrackChunk(requestId, segmentIndex, offset, std::move(points)));
+    points = TrackPointBuffer();
+    offset += count;
+    timer.restart();
+  };
+
+  SqlRowReader row(sql);
+  while (row.next()) {
+    if (!TrackPointBlock::decode(row.getBytes(1), points)){
+      qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+      emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+      emitChunk();
+      return false;
+    }
+    // first block of segment is emitted immediately, so the first pixels may be rendered soon
+    if (offset == 0 ||
+        points.size() >= (size_t)TrackChunkSize ||
+        timer.elapsed() >= TrackChunkInterval) {
+      emitChunk();
+    }
+  }
+
+  if (hasLegacyTrackPoints()){
+    gpx::TrackSegment segment;
+    if (!loadLegacyTrackPoints(segmentId, segment)){
+      emitChunk();
+      return false;
+    }
+    for (const auto &p: segment.points){
+      points.append(p);
+    }
+  }
+  emitChunk();
+  return true;
+}
+
+bool Storage::loadTrackDataPrivate(Track &track, qint64 requestId, bool stream)
+{
+  QSqlQuery sqlTrack(db);
+  sqlTrack.prepare(trackStatement());
+  sqlTrack.bindValue(":trackId", track.id);
+  sqlTrack.exec();
+
+  if (sqlTrack.lastError().isValid()) {
+    qWarning() << "Loading track id" << track.id << "fails: " << sqlTrack.lastError();
+    emit error(tr("Loading track id %1 fails").arg(track.id));
+    return false;
+  }
+
+  if (!sqlTrack.next()) {
+    qWarning() << "Track id" << track.id << "don't exists";
+    emit error(tr("Track id %1 don't exists").arg(track.id));
+    return false;
+  }
+  SqlRowReader row(sqlTrack);
+  track = makeTrack(row);
+  sqlTrack.finish();
+
+  // reader can't update segments computed by older rules, they are refreshed
+  // by the writer (recomputeStatistics) and emitted later
+  std::vector<StoredSegment> segments;
+  if (loadSegmentStatistics(track.id, segments)){
+    auto segmentStatistics = std::make_shared<std::vector<TrackStatistics>>();
+    segmentStatistics->reserve(segments.size());
+    for (const StoredSegment &segment: segments){
+      segmentStatistics->push_back(segment.statistics);
+    }
+    track.segmentStatistics = segmentStatistics;
+  }
+
+  emit trackDataLoaded(track, requestId, false, true);
+
+  if (!stream) {
+    track.data = std::make_shared<TrackSegments>();
+  }
+
+  QSqlQuery sql(db);
+  sql.prepare(TrackSegmentsStatement);
+  sql.bindValue(":trackId", track.id);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading segments for track id" << track.id << "failed";
+    emit error(tr("Loading segments for track id %1 failed: %2").arg(track.id).arg(sql.lastError().text()));
+    return false;
+  }else{
+    size_t segmentIndex = 0;
+    while (sql.next()) {
+      long segmentId = varToLong(sql.value("id"));
+      if (stream) {
+        if (!streamTrackPoints(track, requestId, segmentIndex, segmentId)) {
+          return false;
+        }
+      } else {
+        TrackPointBuffer points;
+        if (!loadTrackPoints(segmentId, points)) {
+          return false;
+        }
+        track.data->push_back(std::move(points));
+      }
+      segmentIndex++;
+    }
+  }
+  return true;
+}
+
+void Storage::loadTrackData(Track track, qint64 requestId)
+{
+  if (!checkAccess("loadTrackData")){
+    emit trackDataLoaded(track, requestId, true, false);
+    return;
+  }
+
+  if (consistentRead([&]() { return loadTrackDataPrivate(track, requestId); }, false)) {
+    emit trackDataLoaded(track, requestId, true, true);
+  }else{
+    emit trackDataLoaded(track, requestId, true, false);
+  }
+}
+
+void Storage::streamTrackData(Track track, qint64 requestId)
+{
+  if (!checkAccess("streamTrackData")){
+    emit trackDataLoaded(track, requestId, true, false);
+    return;
+  }
+
+  QTime timer;
+  timer.start();
+  track.data.reset();
+  bool success = consistentRead([&]() { return loadTrackDataPrivate(track, requestId, true); }, false);
+  qDebug() << "Track" << track.id << "streamed in" << timer.elapsed() << "ms";
+  emit trackDataLoaded(track, requestId, true, success);
+}
+
+void Storage::loadTrackLod(Track track, int level)
+{
+  if (!checkAccess("loadTrackLod")){
+    emit trackLodLoaded(track, TrackLod());
+    return;
+  }
+
+  level = std::max(1, std::min(level, (int)TrackSimplifier::LevelCount));
+  std::vector<std::vector<GeoCoord>> segments;
+  bool ok = consistentRead([&](){
+    segments.clear();
+    QSqlQuery sql(db);
+    sql.setForwardOnly(true);
+    sql.prepare(TrackLodStatement);
+    sql.bindValue(":level", level);
+    sql.bindValue(":trackId", track.id);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Loading simplified geometry of track id" << track.id << "failed" << sql.lastError();
+      emit error(tr("Loading simplified geometry of track id %1 failed: %2").arg(track.id).arg(sql.lastError().text()));
+      return false;
+    }
+
+    SqlRowReader row(sql);
+    std::vector<gpx::TrackPoint> points;
+    while (row.next()) {
+      qint64 segmentId = row.getLong(0);
+      points.clear();
+      if (row.isNull(1)) {
+        // geometry is not computed yet (see computeTrackLod), simplify raw points
+        gpx::TrackSegment segment;
+        if (!loadTrackPoints(segmentId, segment)) {
+          return false;
+        }
+        points = TrackSimplifier::simplify(segment.points, TrackSimplifier::levelTolerance(level));
+      } else if (!TrackPointBlock::decode(row.getBytes(1), points)) {
+        qWarning() << "Decoding simplified geometry of segment id" << segmentId << "failed";
+        emit error(tr("Decoding simplified geometry of segment id %1 failed").arg(segmentId));
+        return false;
+      }
+      std::vector<GeoCoord> coords;
+      coords.reserve(points.size());
+      for (const auto &p: points){
+        coords.push_back(p.coord);
+      }
+      segments.push_back(std::move(coords));
+    }
+    return true;
+  });
+
+  emit trackLodLoaded(track, ok ? TrackLod(level, std::move(segments)) : TrackLod());
+}
+
+void Storage::loadTracksInBox(GeoBox box)
+{
+  if (!checkAccess("loadTracksInBox")){
+    emit tracksInBoxLoaded(box, std::make_shared<const std::vector<Track>>(), false);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(tracksInBoxStatement());
+
+  std::vector<Track> tracks;
+  bool ok = consistentRead([&](){
+    tracks.clear();
+    sql.bindValue(":minLat", box.GetMinLat());
+    sql.bindValue(":maxLat", box.GetMaxLat());
+    sql.bindValue(":minLon", box.GetMinLon());
+    sql.bindValue(":maxLon", box.GetMaxLon());
+    sql.bindValue(":exactMinLat", box.GetMinLat());
+    sql.bindValue(":exactMaxLat", box.GetMaxLat());
+    sql.bindValue(":exactMinLon", box.GetMinLon());
+    sql.bindValue(":exactMaxLon", box.GetMaxLon());
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Loading tracks in box failed" << sql.lastError();
+      emit error(tr("Loading tracks in box failed: %1").arg(sql.lastError().text()));
+      return false;
+    }
+    SqlRowReader row(sql);
+    while (row.next()) {
+      tracks.push_back(makeTrack(row));
+    }
+    sql.finish();
+    return true;
+  });
+
+  emit tracksInBoxLoaded(box, std::make_shared<const std::vector<Track>>(std::move(tracks)), ok);
+}
+
+void Storage::loadWaypointsInBox(GeoBox box)
+{
+  if (!checkAccess("loadWaypointsInBox")){
+    emit waypointsInBoxLoaded(box, std::make_shared<const std::vector<Waypoint>>(), false);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(waypointsInBoxStatement());
+
+  std::vector<Waypoint> waypoints;
+  bool ok = consistentRead([&](){
+    waypoints.clear();
+    sql.bindValue(":minLat", box.GetMinLat());
+    sql.bindValue(":maxLat", box.GetMaxLat());
+    sql.bindValue(":minLon", box.GetMinLon());
+    sql.bindValue(":maxLon", box.GetMaxLon());
+    sql.bindValue(":exactMinLat", box.GetMinLat());
+    sql.bindValue(":exactMaxLat", box.GetMaxLat());
+    sql.bindValue(":exactMinLon", box.GetMinLon());
+    sql.bindValue(":exactMaxLon", box.GetMaxLon());
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Loading waypoints in box failed" << sql.lastError();
+      emit error(tr("Loading waypoints in box failed: %1").arg(sql.lastError().text()));
+      return false;
+    }
+    SqlRowReader row(sql);
+    while (row.next()) {
+      waypoints.push_back(makeWaypoint(row));
+    }
+    sql.finish();
+    return true;
+  });
+
+  emit waypointsInBoxLoaded(box, std::make_shared<const std::vector<Waypoint>>(std::move(waypoints)), ok);
+}
+
+void Storage::searchItems(QString pattern, int limit)
+{
+  if (!checkAccess("searchItems")){
+    emit searchFinished(pattern, std::vector<SearchResultItem>(), false);
+    return;
+  }
+
+  QString ftsPattern = searchPattern(pattern);
+  if (ftsPattern.isEmpty()){
+    emit searchFinished(pattern, std::vector<SearchResultItem>(), true);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(SearchStatement);
+
+  std::vector<SearchResultItem> items;
+  bool ok = consistentRead([&](){
+    items.clear();
+    sql.bindValue(":waypointPattern", ftsPattern);
+    sql.bindValue(":trackPattern", ftsPattern);
+    sql.bindValue(":limit", limit);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Search failed" << sql.lastError();
+      emit error(tr("Search failed: %1").arg(sql.lastError().text()));
+      return false;
+    }
+    SqlRowReader row(sql);
+    while (row.next()) {
+      SearchResultItem item;
+      item.type = row.getLong(0) == SearchResultItem::TrackType ? SearchResultItem::TrackType : SearchResultItem::WaypointType;
+      item.id = row.getLong(1);
+      item.collectionId = row.getLong(2);
+      item.collectionName = row.getString(3);
+      item.name = row.getString(4);
+      item.description = row.getString(5);
+      item.symbol = row.getString(6);
+      item.bbox = GeoBox(GeoCoord(row.getDouble(7), row.getDouble(8)),
+                         GeoCoord(row.getDouble(9), row.getDouble(10)));
+      item.rank = row.getDouble(11);
+      items.push_back(std::move(item));
+    }
+    sql.finish();
+    return true;
+  });
+
+  emit searchFinished(pattern, items, ok);
+}
+
+void Storage::updateOrCreateCollection(Collection collection)
+{
+  if (!checkAccess("updateOrCreateCollection")){
+    emit collectionsLoaded(std::make_shared<const std::vector<Collection>>(), false);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  if (collection.id < 0){
+    sql.prepare(
+      "INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, :visible);");
+    sql.bindValue(":name", collection.name);
+    sql.bindValue(":description", collection.description);
+    sql.bindValue(":visible", collection.visible);
+  }else {
+    sql.prepare(
+      "UPDATE `collection` SET `name` = :name, `description` = :description, `visible` = :visible WHERE (`id` = :id);");
+    sql.bindValue(":id", collection.id);
+    sql.bindValue(":name", collection.name);
+    sql.bindValue(":description", collection.description);
+    sql.bindValue(":visible", collection.visible);
+  }
+  sql.exec();
+  if (sql.lastError().isValid()){
+    if (collection.id < 0) {
+      qWarning() << "Creating collection failed: " << sql.lastError();
+      emit error(tr("Creating collection failed: %1").arg(sql.lastError().text()));
+    }else {
+      qWarning() << "Updating collection failed: " << sql.lastError();
+      emit error(tr("Updating collection failed: %1").arg(sql.lastError().text()));
+    }
+  }
+
+  loadCollections();
+}
+
+void Storage::deleteCollection(qint64 id)
+{
+  if (!checkAccess("deleteCollection")){
+    emit collectionsLoaded(std::make_shared<const std::vector<Collection>>(), false);
+    return;
+  }
+
+  deleteCollectionPrivate(id);
+  loadCollections();
+}
+
+bool Storage::deleteCollectionPrivate(qint64 id)
+{
+  // summary is removed first, so the triggers of cascade deleted tracks
+  // and waypoints don't recompute its bounding box row by row
+  db.transaction();
+  QSqlQuery sqlSummary(db);
+  sqlSummary.prepare(DeleteCollectionSummaryStatement);
+  sqlSummary.bindValue(":id", id);
+  sqlSummary.exec();
+
+  QSqlQuery sql(db);
+  sql.prepare(
+    "DELETE FROM `collection` WHERE (`id` = :id)");
+  sql.bindValue(":id", id);
+  sql.exec();
+  QSqlError err = sqlSummary.lastError().isValid() ? sqlSummary.lastError() : sql.lastError();
+  bool success = false;
+  if (err.isValid()){
+    qWarning() << "Deleting collection failed: " << err;
+    emit error(tr("Deleting collection failed: %1").arg(err.text()));
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+  } else if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    emit error(tr("Deleting collection failed: %1").arg(db.lastError().text()));
+  } else {
+    success = true;
+  }
+  forgetDeletedRecordings();
+  return success;
+}
+
+bool Storage::insertWaypoints(const std::vector<gpx::Waypoint> &waypoints,
+                              size_t from, size_t to,
+                              qint64 collectionId,
+                              const QDateTime &now,
+                              size_t &duplicates)
+{
+  static const QStringList columns{"collection_id", "timestamp", "modification_time", "latitude", "longitude", "elevation", "name", "description", "symbol", "content_hash"};
+
+  // skip waypoints already stored, including duplicates inside this range
+  std::vector<qint64> rangeHashes;
+  rangeHashes.reserve(to - from);
+  for (size_t i = from; i < to; i++){
+    rangeHashes.push_back(ContentFingerprint::waypoint(waypoints[i]));
+  }
+  std::vector<size_t> inserted;
+  std::vector<qint64> hashes;
+  inserted.reserve(to - from);
+  hashes.reserve(to - from);
+  {
+    QSet<qint64> existing;
+    for (size_t lookupFrom = from; lookupFrom < to; lookupFrom += MaxStatementParameters){
+      size_t lookupTo = std::min<size_t>(to, lookupFrom + MaxStatementParameters);
+      QStringList placeholders;
+      for (size_t i = lookupFrom; i < lookupTo; i++){
+        placeholders << "?";
+      }
+      QSqlQuery sqlLookup(db);
+      sqlLookup.setForwardOnly(true);
+      sqlLookup.prepare(QString(WaypointHashLookupStatement).arg(placeholders.join(", ")));
+      for (size_t i = lookupFrom; i < lookupTo; i++){
+        sqlLookup.addBindValue(rangeHashes[i - from]);
+      }
+      sqlLookup.exec();
+      if (sqlLookup.lastError().isValid()) {
+        qWarning() << "Import of waypoints failed" << sqlLookup.lastError();
+        emit error(tr("Import of waypoints failed: %1").arg(sqlLookup.lastError().text()));
+        return false;
+      }
+      while (sqlLookup.next()){
+        existing << varToLong(sqlLookup.value(0));
+      }
+    }
+    for (size_t i = from; i < to; i++){
+      qint64 hash = rangeHashes[i - from];
+      if (existing.contains(hash)){
+        duplicates++;
+        continue;
+      }
+      existing << hash;
+      inserted.push_back(i);
+      hashes.push_back(hash);
+    }
+  }
+
+  const QVariant nullValue;
+  const int rowsPerStatement = std::max<int>(1, std::min<size_t>(inserted.size(), MaxStatementParameters / columns.size()));
+  QSqlQuery sqlBatch(db);
+  sqlBatch.prepare(multiRowInsert("waypoint", columns, rowsPerStatement));
+
+  size_t next = 0;
+  while (next < inserted.size()) {
+    int rows = std::min<size_t>(rowsPerStatement, inserted.size() - next);
+    QSqlQuery sqlTail(db);
+    if (rows < rowsPerStatement){
+      sqlTail.prepare(multiRowInsert("waypoint", columns, rows));
+    }
+    QSqlQuery &sqlWpt = rows < rowsPerStatement ? sqlTail : sqlBatch;
+
+    for (int row = 0; row < rows; row++, next++) {
+      const auto &wpt = waypoints[inserted[next]];
+      size_t wptNum = inserted[next] + 1;
+
+      QString wptName = QString::fromStdString(wpt.name.getOrElse(""));
+      if (wptName.isEmpty())
+        wptName = tr("waypoint %1").arg(wptNum);
+
+      sqlWpt.addBindValue(collectionId);
+      sqlWpt.addBindValue(wpt.time.hasValue() ? timestampToDateTime(wpt.time) : now);
+      sqlWpt.addBindValue(now);
+      sqlWpt.addBindValue(wpt.coord.GetLat());
+      sqlWpt.addBindValue(wpt.coord.GetLon());
+      sqlWpt.addBindValue(wpt.elevation.hasValue() ? QVariant(wpt.elevation.get()) : nullValue);
+      sqlWpt.addBindValue(wptName);
+      sqlWpt.addBindValue(wpt.description.hasValue() ? QVariant(QString::fromStdString(wpt.description.get())) : nullValue);
+      sqlWpt.addBindValue(wpt.symbol.hasValue() ? QVariant(QString::fromStdString(wpt.symbol.get())) : nullValue);
+      sqlWpt.addBindValue(hashes[next]);
+    }
+
+    sqlWpt.exec();
+    if (sqlWpt.lastError().isValid()) {
+      qWarning() << "Import of waypoints failed" << sqlWpt.lastError();
+      emit error(tr("Import of waypoints failed: %1").arg(sqlWpt.lastError().text()));
+      return false;
+    }
+  }
+  return true;
+}
+
+qint64 Storage::insertCollection(const gpx::GpxFile &gpxFile, const QString &filePath)
+{
+  QSqlQuery sql(db);
+  sql.prepare("INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, 0);");
+  sql.bindValue(":name", gpxFile.name.hasValue() ?
+                         QString::fromStdString(gpxFile.name.get()) : QFileInfo(filePath).baseName());
+  sql.bindValue(":description", gpxFile.desc.hasValue() && !gpxFile.desc.get().empty() ?
+                                QString::fromStdString(gpxFile.desc.get()) :
+                                tr("Imported from %1").arg(filePath));
+
+  sql.exec();
+  if (sql.lastError().isValid()){
+    qWarning() << "Creating collection failed" << sql.lastError();
+    emit error(tr("Creating collection failed: %1").arg(sql.lastError().text()));
+    return -1;
+  }
+  qint64 collectionId = varToLong(sql.lastInsertId());
+  if (collectionId < 0){
+    qWarning() << "Invalid collection id" << collectionId;
+    emit error(tr("Invalid collection id: %1").arg(collectionId));
+  }
+  return collectionId;
+}
+
+void Storage::bindTrackStatistics(QSqlQuery &sql, const TrackStatistics &stat)
+{
+  sql.bindValue(":from_time", stat.from);
+  sql.bindValue(":to_time", stat.to);
+  sql.bindValue(":distance", stat.distance.AsMeter());
+  sql.bindValue(":raw_distance", stat.rawDistance.AsMeter());
+  sql.bindValue(":duration", (qint64)stat.duration.count());
+  sql.bindValue(":moving_duration", (qint64)stat.movingDuration.count());
+  sql.bindValue(":max_speed", stat.maxSpeed);
+  sql.bindValue(":average_speed", stat.averageSpeed);
+  sql.bindValue(":moving_average_speed", stat.movingAverageSpeed);
+  sql.bindValue(":ascent", stat.ascent.AsMeter());
+  sql.bindValue(":descent", stat.descent.AsMeter());
+  sql.bindValue(":min_elevation", stat.minElevation.hasValue() ? QVariant::fromValue(stat.minElevation.get().AsMeter()) : QVariant());
+  sql.bindValue(":max_elevation", stat.maxElevation.hasValue() ? QVariant::fromValue(stat.maxElevation.get().AsMeter()) : QVariant());
+
+  sql.bindValue(":bboxMinLat", stat.bbox.GetMinLat());
+  sql.bindValue(":bboxMinLon", stat.bbox.GetMinLon());
+  sql.bindValue(":bboxMaxLat", stat.bbox.GetMaxLat());
+  sql.bindValue(":bboxMaxLon", stat.bbox.GetMaxLon());
+}
+
+bool Storage::loadStatisticsAccumulator(qint64 trackId, std::vector<StoredSegment> &segments,
+                                        TrackStatisticsAccumulator &accumulator)
+{
+  QSqlQuery sql(db);
+  sql.prepare(TrackStatisticsStateStatement);
+  sql.bindValue(":trackId", trackId);
+  sql.exec();
+  if (sql.lastError().isValid() || !sql.next()) {
+    qWarning() << "Loading statistics state of track id" << trackId << "failed" << sql.lastError();
+    emit error(tr("Loading statistics state of track id %1 failed: %2").arg(trackId).arg(sql.lastError().text()));
+    return false;
+  }
+  QVariant state = sql.value(0);
+  sql.finish();
+
+  // closed segments computed by older rules are computed again together with the state
+  bool outdated = std::any_of(segments.begin(), segments.end(),
+                              [](const StoredSegment &segment){ return !segment.open && segment.outdated; });
+  if (!state.isNull() && !outdated && accumulator.deserialize(state.toByteArray())){
+    return true;
+  }
+
+  // track was never extended, or the state is not usable - fold segments
+  qDebug() << "Folding statistics of track id" << trackId;
+  accumulator = TrackStatisticsAccumulator();
+  return foldTrackStatistics(trackId, segments, accumulator);
+}
+
+bool Storage::foldTrackStatistics(qint64 trackId, std::vector<StoredSegment> &segments,
+                                  TrackStatisticsAccumulator &accumulator)
+{
+  qint64 points = 0;
+  size_t accumulated = 0;
+  bool decoded = true;
+  for (size_t i = 0; i < segments.size(); i++){
+    StoredSegment &segment = segments[i];
+    if (i > 0){
+      accumulator.startSegment();
+    }
+    TrackStatisticsAccumulator exit;
+    if (!segment.outdated && !segment.state.isEmpty() &&
+        exit.deserialize(segment.state) && accumulator.appendSegment(exit)){
+      continue;
+    }
+
+    // state is missing or it was computed from different entry boundary
+    bool segmentDecoded;
+    if (!accumulateSegmentStatistics(segment.id, accumulator, points, segmentDecoded)){
+      return false;
+    }
+    decoded = decoded && segmentDecoded;
+    segment.statistics = accumulator.segmentStatistics();
+    segment.state = accumulator.serialize();
+    if (!updateSegmentStatistics(segment.id, segment.statistics, segment.state)){
+      return false;
+    }
+    segment.outdated = false;
+    accumulated++;
+  }
+  if (!decoded){
+    qWarning() << "Decoding nodes of track id" << trackId << "failed, statistics are incomplete";
+  }
+  qDebug() << "Folded statistics of track id" << trackId << "," << accumulated << "of" << segments.size()
+           << "segments accumulated from points (" << points << "points)";
+  return true;
+}
+
+bool Storage::accumulateSegmentStatistics(qint64 segmentId, TrackStatisticsAccumulator &accumulator,
+                                          qint64 &points, bool &decoded)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(SegmentBlocksStatement);
+  sql.bindValue(":segmentId", segmentId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed" << sql.lastError();
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+    return false;
+  }
+
+  std::vector<gpx::TrackPoint> block;
+  block.reserve(TrackPointBlockSize);
+  decoded = true;
+  SqlRowReader row(sql);
+  while (row.next()) {
+    block.clear();
+    if (!TrackPointBlock::decode(row.getBytes(1), block)){
+      qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+      decoded = false;
+      return true;
+    }
+    points += block.size();
+    accumulator.append(block);
+  }
+  return true;
+}
+
+bool Storage::loadSegmentStatistics(qint64 trackId, std::vector<StoredSegment> &segments)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare(trackSegmentStatisticsStatement());
+  sql.bindValue(":trackId", trackId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Loading segments of track id" << trackId << "failed" << sql.lastError();
+    emit error(tr("Loading segments of track id %1 failed: %2").arg(trackId).arg(sql.lastError().text()));
+    return false;
+  }
+  SqlRowReader row(sql);
+  while (row.next()) {
+    StoredSegment segment;
+    segment.id = row.getLong(SegId);
+    segment.open = row.getBool(SegOpen);
+    segment.outdated = row.getLong(SegStatsVersion, 0) < StatisticsVersion;
+    segment.state = row.getBytes(SegStatisticsState);
+    segment.statistics = readStatistics(row, SegFromTime);
+    const GeoBox &box = segment.statistics.bbox;
+    if (box.GetMinLat() == 0 && box.GetMinLon() == 0 && box.GetMaxLat() == 0 && box.GetMaxLon() == 0){
+      // segment without points (see trackHasBox)
+      segment.statistics.bbox = GeoBox();
+    }
+    segments.push_back(std::move(segment));
+  }
+  return true;
+}
+
+bool Storage::updateSegmentStatistics(qint64 segmentId, const TrackStatistics &statistics, const QByteArray &state)
+{
+  QSqlQuery sql(db);
+  sql.prepare(SegmentStatisticsUpdate);
+  bindTrackStatistics(sql, statistics);
+  sql.bindValue(":statistics_state", state);
+  sql.bindValue(":version", StatisticsVersion);
+  sql.bindValue(":segmentId", segmentId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Updating statistics of segment id" << segmentId << "failed" << sql.lastError();
+    emit error(tr("Updating statistics of segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
+    return false;
+  }
+  return true;
+}
+
+bool Storage::updateTrackStatistics(qint64 trackId, const TrackStatistics &statistics, const QVariant &state)
+{
+  QSqlQuery sql(db);
+  sql.prepare(TrackStatisticsUpdate);
+
+  sql.bindValue(":modification_time", QDateTime::currentDateTime());
+  bindTrackStatistics(sql, statistics);
+  sql.bindValue(":statistics_state", state);
+  sql.bindValue(":stats_version", StatisticsVersion);
+  sql.bindValue(":trackId", trackId);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Updating statistics of track id" << trackId << "failed" << sql.lastError();
+    emit error(tr("Updating statistics of track id %1 failed: %2").arg(trackId).arg(sql.lastError().text()));
+    return false;
+  }
+  return true;
+}
+
+bool Storage::updateRecordingStatistics(const TrackRecording &rec)
+{
+  // state after the open segment is the state of the track
+  QByteArray state = rec.statistics.serialize();
+  if (!updateSegmentStatistics(rec.segmentId, rec.statistics.segmentStatistics(), state)){
+    return false;
+  }
+  return updateTrackStatistics(rec.trackId, rec.statistics.statistics(), state);
+}
+
+qint64 Storage::insertTrack(const gpx::Track &trk, size_t trkNum, const TrackStatistics &stat, qint64 collectionId,
+                            bool open)
+{
+  QSqlQuery sqlTrk(db);
+  sqlTrk.prepare(QString("INSERT INTO `track` (")
+    .append("`collection_id`, `name`, `description`, `open`, `creation_time`, `modification_time`, ")
+    .append("`from_time`, ")
+    .append("`to_time`, ")
+    .append("`distance`, ")
+    .append("`raw_distance`, ")
+    .append("`duration`, ")
+    .append("`moving_duration`, ")
+    .append("`max_speed`, ")
+    .append("`average_speed`, ")
+    .append("`moving_average_speed`, ")
+    .append("`ascent`, ")
+    .append("`descent`, ")
+    .append("`min_elevation`, ")
+    .append("`max_elevation`, ")
+    .append("`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`, ")
+    .append("`stats_version`")
+    .append(") ")
+    .append("VALUES (")
+    .append(":collection_id,  :name,  :description,  :open,  :creation_time,  :modification_time, ")
+    .append(":from_time, ")
+    .append(":to_time, ")
+    .append(":distance, ")
+    .append(":raw_distance, ")
+    .append(":duration, ")
+    .append(":moving_duration, ")
+    .append(":max_speed, ")
+    .append(":average_speed, ")
+    .append(":moving_average_speed, ")
+    .append(":ascent, ")
+    .append(":descent, ")
+    .append(":min_elevation, ")
+    .append(":max_elevation, ")
+    .append(":bboxMinLat, :bboxMinLon, :bboxMaxLat, :bboxMaxLon, ")
+    .append(":stats_version")
+    .append(")"));
+
+  QString trackName = QString::fromStdString(trk.name.getOrElse(""));
+  if (trackName.isEmpty())
+    trackName = tr("track %1").arg(trkNum);
+
+  sqlTrk.bindValue(":collection_id", collectionId);
+  sqlTrk.bindValue(":name", trackName);
+  sqlTrk.bindValue(":description",
+                   (trk.desc.hasValue() ? QString::fromStdString(trk.desc.get()) : QVariant()));
+  sqlTrk.bindValue(":open", open);
+
+  sqlTrk.bindValue(":creation_time", QDateTime::currentDateTime());
+  sqlTrk.bindValue(":modification_time", QDateTime::currentDateTime());
+
+  bindTrackStatistics(sqlTrk, stat);
+  sqlTrk.bindValue(":stats_version", StatisticsVersion);
+
+  sqlTrk.exec();
+  if (sqlTrk.lastError().isValid()) {
+    qWarning() << "Import of tracks failed" << sqlTrk.lastError();
+    emit error(tr("Import of tracks failed: %1").arg(sqlTrk.lastError().text()));
+    return -1;
+  }
+  return varToLong(sqlTrk.lastInsertId());
+}
+
+qint64 Storage::insertSegment(qint64 trackId, const PreparedTrack::Segment &segment, bool open)
+{
+  QSqlQuery sqlSeg(db);
+  sqlSeg.prepare(QString("INSERT INTO `track_segment` (")
+    .append("`track_id`, `open`, `creation_time`, `content_hash`, ")
+    .append("`from_time`, `to_time`, `distance`, `raw_distance`, `duration`, `moving_duration`, ")
+    .append("`max_speed`, `average_speed`, `moving_average_speed`, `ascent`, `descent`, ")
+    .append("`min_elevation`, `max_elevation`, ")
+    .append("`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`, ")
+    .append("`statistics_state`, `stats_version`")
+    .append(") ")
+    .append("VALUES (")
+    .append(":track_id, :open, :creation_time, :content_hash, ")
+    .append(":from_time, :to_time, :distance, :raw_distance, :duration, :moving_duration, ")
+    .append(":max_speed, :average_speed, :moving_average_speed, :ascent, :descent, ")
+    .append(":min_elevation, :max_elevation, ")
+    .append(":bboxMinLat, :bboxMinLon, :bboxMaxLat, :bboxMaxLon, ")
+    .append(":statistics_state, :stats_version")
+    .append(")"));
+  sqlSeg.bindValue(":track_id", trackId);
+  sqlSeg.bindValue(":open", open);
+  sqlSeg.bindValue(":content_hash", segment.hasFingerprint ? QVariant(segment.fingerprint) : QVariant());
+  sqlSeg.bindValue(":creation_time", QDateTime::currentDateTime());
+  bindTrackStatistics(sqlSeg, segment.statistics);
+  sqlSeg.bindValue(":statistics_state", segment.state.isEmpty() ? QVariant() : QVariant(segment.state));
+  sqlSeg.bindValue(":stats_version", StatisticsVersion);
+  sqlSeg.exec();
+  if (sqlSeg.lastError().isValid()) {
+    qWarning() << "Import of segments failed" << sqlSeg.lastError();
+    emit error(tr("Import of segments failed: %1").arg(sqlSeg.lastError().text()));
+    return -1;
+  }
+  return varToLong(sqlSeg.lastInsertId());
+}
+
+bool Storage::isDuplicateTrack(const PreparedTrack &track, bool &duplicate)
+{
+  // track is duplicate when all its segments with points are stored already
+  duplicate = false;
+  QSqlQuery sql(db);
+  sql.prepare(SegmentHashLookupStatement);
+  for (const auto &segment: track.segments){
+    if (!segment.hasFingerprint){
+      continue;
+    }
+    sql.bindValue(":hash", segment.fingerprint);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Import of tracks failed" << sql.lastError();
+      emit error(tr("Import of tracks failed: %1").arg(sql.lastError().text()));
+      return false;
+    }
+    if (!sql.next()){
+      duplicate = false;
+      return true;
+    }
+    sql.finish();
+    duplicate = true;
+  }
+  return true;
+}
+
+PreparedTrack Storage::prepareTrack(const gpx::Track &trk) const
+{
+  QTime timer;
+  timer.start();
+
+  PreparedTrack prepared;
+  TrackStatisticsAccumulator statistics;
+  prepared.segments.reserve(trk.segments.size());
+  for (auto const &seg: trk.segments){
+    PreparedTrack::Segment preparedSeg;
+    if (!prepared.segments.empty()){
+      statistics.startSegment();
+    }
+    statistics.append(seg.points);
+    preparedSeg.statistics = statistics.segmentStatistics();
+    preparedSeg.state = statistics.serialize();
+    if (!seg.points.empty()){
+      preparedSeg.hasFingerprint = true;
+      preparedSeg.fingerprint = ContentFingerprint::segment(seg.points);
+    }
+    preparedSeg.blocks = TrackPointBlock::encodeBlocks(seg.points, TrackPointBlockSize);
+    preparedSeg.lod = encodeLod(seg.points);
+    prepared.segments.push_back(std::move(preparedSeg));
+  }
+  prepared.statistics = statistics.statistics();
+
+  qDebug() << "Track preparation (statistics, encoding) tooks" << timer.elapsed() << "ms";
+  return prepared;
+}
+
+std::vector<EncodedTrackPointBlock> Storage::encodeLod(const std::vector<gpx::TrackPoint> &points)
+{
+  std::vector<EncodedTrackPointBlock> result;
+  result.reserve(TrackSimplifier::LevelCount);
+  for (const auto &level: TrackSimplifier::pyramid(points)){
+    EncodedTrackPointBlock block;
+    block.pointCount = level.size();
+    block.data = TrackPointBlock::encode(level.begin(), level.end());
+    result.push_back(std::move(block));
+  }
+  return result;
+}
+
+bool Storage::insertSegmentLod(qint64 segmentId, const std::vector<EncodedTrackPointBlock> &lod)
+{
+  if (lod.empty()){
+    return true;
+  }
+  static const QStringList columns{"segment_id", "level", "point_count", "data"};
+  QSqlQuery sql(db);
+  sql.prepare(multiRowInsert("track_lod", columns, lod.size()));
+  for (size_t i = 0; i < lod.size(); i++){
+    sql.addBindValue(segmentId);
+    sql.addBindValue((int)i + 1);
+    sql.addBindValue(lod[i].pointCount);
+    sql.addBindValue(lod[i].data);
+  }
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Import of simplified geometry failed" << sql.lastError();
+    emit error(tr("Import of simplified geometry failed: %1").arg(sql.lastError().text()));
+    return false;
+  }
+  return true;
+}
+
+bool Storage::insertTrackPointBlocks(const std::vector<EncodedTrackPointBlock> &blocks,
+                                     size_t from, size_t to,
+                                     qint64 segmentId,
+                                     qint64 firstSeq)
+{
+  static const QStringList columns{"segment_id", "seq", "point_count", "data"};
+
+  QSqlQuery sqlBatch(db);
+  if (to - from >= (size_t)TrackPointBlocksPerStatement){
+    sqlBatch.prepare(multiRowInsert("track_point_block", columns, TrackPointBlocksPerStatement));
+  }
+
+  size_t seq = from;
+  while (seq < to){
+    int rows = std::min<size_t>(TrackPointBlocksPerStatement, to - seq);
+    QSqlQuery sqlTail(db);
+    if (rows < TrackPointBlocksPerStatement){
+      sqlTail.prepare(multiRowInsert("track_point_block", columns, rows));
+    }
+    QSqlQuery &sql = rows < TrackPointBlocksPerStatement ? sqlTail : sqlBatch;
+
+    for (int row = 0; row < rows; row++, seq++){
+      const auto &block = blocks[seq];
+      sql.addBindValue(segmentId);
+      sql.addBindValue(firstSeq + (qint64)seq);
+      sql.addBindValue(block.pointCount);
+      sql.addBindValue(block.data);
+    }
+
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Import of track points failed" << sql.lastError();
+      emit error(tr("Import of track points failed: %1").arg(sql.lastError().text()));
+      return false;
+    }
+  }
+  return true;
+}
+
+void Storage::setTrackPointBatchSize(int size)
+{
+  trackPointBatchSize = size;
+}
+
+void Storage::setWayPointBatchSize(int size)
+{
+  wayPointBatchSize = size;
+}
+
+void Storage::setRecordingFlushInterval(int ms)
+{
+  recordingFlushInterval = ms;
+}
+
+void Storage::setRecordingSync(bool sync)
+{
+  recordingSync = sync;
+}
+
+void Storage::importCollection(QString filePath)
+{
+  if (!checkAccess("importCollection")){
+    emit collectionsLoaded(std::make_shared<const std::vector<Collection>>(), false);
+    return;
+  }
+
+  auto job = std::make_shared<ImportJob>(nextImportJobId++, filePath,
+                                         [this](const gpx::Track &trk){ return prepareTrack(trk); });
+  connect(job->getCallback().get(), SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+  qDebug() << "Import job" << job->id << "queued for" << filePath;
+
+  importJobs.push_back(job);
+  if (importJobs.size() == 1){
+    startImportJob();
+  }
+}
+
+void Storage::cancelImport(qint64 jobId)
+{
+  for (auto it = importJobs.begin(); it != importJobs.end(); ++it){
+    if ((*it)->id != jobId){
+      continue;
+    }
+    if (it == importJobs.begin()){
+      // running job is finished by next processImportJob step
+      (*it)->cancel();
+    } else {
+      std::shared_ptr<ImportJob> job = *it;
+      importJobs.erase(it);
+      qDebug() << "Import job" << job->id << "cancelled before start";
+      emit importFinished(job->id, job->filePath, false, true, 0);
+    }
+    return;
+  }
+  qWarning() << "Import job" << jobId << "doesn't exist";
+}
+
+void Storage::startImportJob()
+{
+  assert(!importJobs.empty());
+  ImportJob &job = *importJobs.front();
+  qDebug() << "Importing collection from" << job.filePath;
+  job.start();
+  reportImportProgress(job);
+  scheduleImportJob();
+}
+
+void Storage::scheduleImportJob(int delay)
+{
+  if (delay > 0){
+    QTimer::singleShot(delay, this, SLOT(processImportJob()));
+  } else {
+    QMetaObject::invokeMethod(this, "processImportJob", Qt::QueuedConnection);
+  }
+}
+
+void Storage::reportImportProgress(ImportJob &job)
+{
+  double progress = job.getProgress();
+  if (std::abs(progress - job.reportedProgress) >= ImportProgressStep){
+    job.reportedProgress = progress;
+    emit importProgress(job.id, job.filePath, progress);
+  }
+}
+
+void Storage::processImportJob()
+{
+  if (importJobs.empty()){
+    return;
+  }
+  ImportJob &job = *importJobs.front();
+  if (job.isCancelled()){
+    finishImportJob(false);
+    return;
+  }
+
+  if (job.phase == ImportJob::Phase::Parse){
+    if (!job.isParsed()){
+      // gpx file is parsed by job's worker thread, check it later
+      reportImportProgress(job);
+      scheduleImportJob(ImportPollInterval);
+      return;
+    }
+    if (!job.isParseOk()){
+      finishImportJob(false);
+      return;
+    }
+  }
+
+  if (job.phase == ImportJob::Phase::Tracks && !job.hasTrack){
+    if (job.nextPreparedTrack(job.track)){
+      job.hasTrack = true;
+      job.trackId = -1;
+      job.segmentIndex = 0;
+      job.segmentId = -1;
+      job.blockIndex = 0;
+    } else if (job.isPreparationDone()){
+      job.phase = ImportJob::Phase::Done;
+      finishImportJob(true);
+      return;
+    } else {
+      // next track is not prepared yet
+      scheduleImportJob(ImportPollInterval);
+      return;
+    }
+  }
+
+  // every step is committed in its own transaction,
+  // other requests are processed before next step
+  db.transaction();
+  if (!importStep(job)){
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    finishImportJob(false);
+    return;
+  }
+  if (!db.commit()) {
+    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+    qWarning() << "Transaction commit failed" << db.lastError();
+    finishImportJob(false);
+    return;
+  }
+
+  reportImportProgress(job);
+  scheduleImportJob();
+}
+
+bool Storage::importStep(ImportJob &job)
+{
+  switch (job.phase){
+    case ImportJob::Phase::Parse: {
+      job.collectionId = insertCollection(job.gpxFile, job.filePath);
+      if (job.collectionId < 0){
+        return false;
+      }
+      job.totalPoints = job.gpxFile.waypoints.size();
+      for (const auto &trk: job.gpxFile.tracks){
+        for (const auto &seg: trk.segments){
+          job.totalPoints += seg.points.size();
+        }
+      }
+      job.phase = ImportJob::Phase::Waypoints;
+      return true;
+    }
+
+    case ImportJob::Phase::Waypoints: {
+      const auto &waypoints = job.gpxFile.waypoints;
+      size_t to = std::min(waypoints.size(), job.nextWaypoint + std::max(1, wayPointBatchSize.load()));
+      if (!insertWaypoints(waypoints, job.nextWaypoint, to, job.collectionId, QDateTime::currentDateTime(),
+                           job.duplicateWaypoints)){
+        return false;
+      }
+      job.writtenPoints += to - job.nextWaypoint;
+      job.nextWaypoint = to;
+      if (to == waypoints.size()){
+        qDebug() << "Imported" << waypoints.size() << "waypoints to collection" << job.collectionId << "from" << job.filePath;
+        job.phase = ImportJob::Phase::Tracks;
+      }
+      return true;
+    }
+
+    case ImportJob::Phase::Tracks: {
+      assert(job.hasTrack);
+      assert(job.trackIndex < job.gpxFile.tracks.size());
+      const gpx::Track &trk = job.gpxFile.tracks[job.trackIndex];
+      assert(job.track.segments.size() == trk.segments.size());
+      if (job.trackId < 0){
+        bool duplicate;
+        if (!isDuplicateTrack(job.track, duplicate)){
+          return false;
+        }
+        if (duplicate){
+          qDebug() << "Track" << job.trackIndex << "from" << job.filePath << "is already imported";
+          for (const auto &seg: trk.segments){
+            job.writtenPoints += seg.points.size();
+          }
+          job.duplicateTracks++;
+          job.hasTrack = false;
+          job.track = PreparedTrack();
+          job.trackIndex++;
+          return true;
+        }
+        job.trackId = insertTrack(trk, job.trackIndex + 1, job.track.statistics, job.collectionId);
+        if (job.trackId < 0){
+          return false;
+        }
+      }
+
+      // insert blocks of trackPointBatchSize points at most (one block at least)
+      const size_t batchSize = std::max(1, trackPointBatchSize.load());
+      size_t written = 0;
+      while (job.segmentIndex < job.track.segments.size() && written < batchSize){
+        const auto &segment = job.track.segments[job.segmentIndex];
+        if (job.segmentId < 0){
+          job.segmentId = insertSegment(job.trackId, segment);
+          if (job.segmentId < 0 || !insertSegmentLod(job.segmentId, segment.lod)){
+            return false;
+          }
+        }
+        size_t to = job.blockIndex;
+        while (to < segment.blocks.size() && written < batchSize){
+          written += segment.blocks[to].pointCount;
+          to++;
+        }
+        if (!insertTrackPointBlocks(segment.blocks, job.blockIndex, to, job.segmentId)){
+          return false;
+        }
+        job.blockIndex = to;
+        if (to == segment.blocks.size()){
+          qDebug() << "Imported" << trk.segments[job.segmentIndex].points.size() << "points to segment" << job.segmentId << "for track" << job.trackId;
+          job.segmentIndex++;
+          job.segmentId = -1;
+          job.blockIndex = 0;
+        }
+      }
+      job.writtenPoints += written;
+
+      if (job.segmentIndex == job.track.segments.size()){
+        qDebug() << "Imported track " << job.trackId;
+        job.hasTrack = false;
+        job.track = PreparedTrack();
+        job.trackIndex++;
+      }
+      return true;
+    }
+
+    case ImportJob::Phase::Done:
+      return true;
+  }
+  return true;
+}
+
+void Storage::finishImportJob(bool success)
+{
+  assert(!importJobs.empty());
+  std::shared_ptr<ImportJob> job = importJobs.front();
+  importJobs.pop_front();
+
+  bool cancelled = job->isCancelled();
+  if (cancelled && job->collectionId >= 0){
+    // remove partially imported collection
+    deleteCollectionPrivate(job->collectionId);
+  }
+
+  if (cancelled){
+    qDebug() << "Import from" << job->filePath << "cancelled";
+  } else if (success){
+    qDebug() << "Imported" << job->gpxFile.tracks.size() << "tracks to collection" << job->collectionId
+             << "from" << job->filePath << "in" << job->timer.elapsed() << "ms, skipped"
+             << job->duplicateTracks << "duplicate tracks and" << job->duplicateWaypoints << "waypoints";
+  } else {
+    qWarning() << "Import from" << job->filePath << "failed";
+  }
+  emit importFinished(job->id, job->filePath, success && !cancelled, cancelled,
+                      job->duplicateTracks + job->duplicateWaypoints);
+
+  // cancel and join job's worker thread
+  job.reset();
+
+  loadCollections();
+
+  if (!importJobs.empty()){
+    startImportJob();
+  }
+}
+
+void Storage::deleteWaypoint(qint64 collectionId, qint64 waypointId)
+{
+  deleteWaypoints(collectionId, QList<qint64>() << waypointId);
+}
+
+void Storage::deleteWaypoints(qint64 collectionId, QList<qint64> waypointIds)
+{
+  if (!checkAccess("deleteWaypoints")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlError err = deleteItems("waypoint", collectionId, waypointIds);
+  if (err.isValid()) {
+    qWarning() << "Deleting waypoints failed" << err;
+    emit error(tr("Deleting waypoint failed: %1").arg(err.text()));
+  }
+
+  loadCollectionDetails(Collection(collectionId));
+}
+
+void Storage::createWaypoint(qint64 collectionId, double lat, double lon, QString name, QString description)
+{
+  if (!checkAccess("deleteTrack")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlQuery sqlWpt(db);
+  sqlWpt.prepare(
+    "INSERT INTO `waypoint` (`collection_id`, `timestamp`, `modification_time`, `latitude`, `longitude`, `name`, `description`) "
+    "VALUES                 (:collection_id,  :timestamp,  :modification_time,  :latitude,  :longitude,  :name,  :description)");
+
+  sqlWpt.bindValue(":collection_id", collectionId);
+  sqlWpt.bindValue(":timestamp", QDateTime::currentDateTime());
+  sqlWpt.bindValue(":modification_time", QDateTime::currentDateTime());
+  sqlWpt.bindValue(":latitude", lat);
+  sqlWpt.bindValue(":longitude", lon);
+  sqlWpt.bindValue(":name", name);
+  sqlWpt.bindValue(":description", (description.isEmpty() ? QVariant() : description));
+
+  sqlWpt.exec();
+  if (sqlWpt.lastError().isValid()) {
+    qWarning() << "Creation of waypoint failed" << sqlWpt.lastError();
+    emit error(tr("Creation of waypoint failed: %1").arg(sqlWpt.lastError().text()));
+  }
+
+  loadCollectionDetails(Collection(collectionId));
+}
+
+void Storage::deleteTrack(qint64 collectionId, qint64 trackId)
+{
+  deleteTracks(collectionId, QList<qint64>() << trackId);
+}
+
+void Storage::deleteTracks(qint64 collectionId, QList<qint64> trackIds)
+{
+  if (!checkAccess("deleteTracks")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlError err = deleteItems("track", collectionId, trackIds);
+  if (err.isValid()) {
+    qWarning() << "Deleting tracks failed" << err;
+    emit error(tr("Deleting track failed: %1").arg(err.text()));
+  }
+  forgetDeletedRecordings();
+
+  loadCollectionDetails(Collection(collectionId));
+}
+
+void Storage::editWaypoint(qint64 collectionId, qint64 id, QString name, QString description)
+{
+  if (!checkAccess("editWaypoint")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.prepare(UpdateWaypointStatement);
+  sql.bindValue(":id", id);
+  sql.bindValue(":collection_id", collectionId);
+  sql.bindValue(":name", name);
+  sql.bindValue(":description", description);
+  sql.bindValue(":modification_time", QDateTime::currentDateTime());
+  sql.exec();
+
+  if (sql.lastError().isValid()) {
+    qWarning() << "Edit waypoint failed" << sql.lastError();
+    emit error(tr("Edit waypoint failed: %1").arg(sql.lastError().text()));
+    loadCollectionDetails(Collection(collectionId));
+  }
+
+  loadCollectionDetails(Collection(collectionId));
+}
+
+void Storage::editTrack(qint64 collectionId, qint64 id, QString name, QString description)
+{
+  if (!checkAccess("editTrack")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlQuery sql(db);
+  sql.prepare(UpdateTrackStatement);
+  sql.bindValue(":id", id);
+  sql.bindValue(":collection_id", collectionId);
+  sql.bindValue(":name", name);
+  sql.bindValue(":description", description);
+  sql.bindValue(":modification_time", QDateTime::currentDateTime());
+  sql.exec();
+
+  if (sql.lastError().isValid()) {
+    qWarning() << "Edit track failed" << sql.lastError();
+    emit error(tr("Edit track failed: %1").arg(sql.lastError().text()));
+    loadCollectionDetails(Collection(collectionId));
+  }
+
+  loadCollectionDetails(Collection(collectionId));
+}
+
+bool Storage::exportCollectionPrivate(qint64 collectionId, GpxStreamWriter &writer)
+{
+  // collection
+  QSqlQuery sqlCollection(db);
+  sqlCollection.setForwardOnly(true);
+  sqlCollection.prepare("SELECT `name`, `description` FROM `collection` WHERE `id` = :collectionId;");
+  sqlCollection.bindValue(":collectionId", collectionId);
+  sqlCollection.exec();
+  if (sqlCollection.lastError().isValid()) {
+    qWarning() << "Loading collection id" << collectionId << "failed:" << sqlCollection.lastError();
+    emit error(tr("Loading collection id %1 failed: %2").arg(collectionId).arg(sqlCollection.lastError().text()));
+    return false;
+  }
+  if (!sqlCollection.next()) {
+    qWarning() << "Collection id" << collectionId << "don't exists";
+    emit error(tr("Collection id %1 don't exists").arg(collectionId));
+    return false;
+  }
+  {
+    SqlRowReader row(sqlCollection);
+    writer.writeHeader(row.getString(0), row.getString(1));
+  }
+  sqlCollection.finish();
+
+  // waypoints
+  QSqlQuery sqlWpt(db);
+  sqlWpt.setForwardOnly(true);
+  sqlWpt.prepare(ExportWaypointsStatement);
+  sqlWpt.bindValue(":collectionId", collectionId);
+  sqlWpt.exec();
+  if (sqlWpt.lastError().isValid()) {
+    qWarning() << "Loading waypoints for collection id" << collectionId << "fails";
+    emit error(tr("Loading waypoints for collection id %1 fails").arg(collectionId));
+    return false;
+  }
+  SqlRowReader wptRow(sqlWpt);
+  while (wptRow.next()) {
+    gpx::Waypoint wpt(GeoCoord(
+      wptRow.getDouble(4), // latitude
+      wptRow.getDouble(5) // longitude
+      ));
+
+    wpt.name = gpx::Optional<std::string>::of(wptRow.getString(0).toStdString());
+    wpt.description = wptRow.getStringOpt(1);
+    wpt.symbol = wptRow.getStringOpt(2);
+    wpt.time = wptRow.getTimestampOpt(3);
+    wpt.elevation = wptRow.getDoubleOpt(6);
+
+    writer.writeWaypoint(wpt);
+  }
+  sqlWpt.finish();
+
+  // tracks, point blocks of every segment are formatted in windows by worker threads
+  size_t windowSize = ExportBlockWindow;
+#ifdef _OPENMP
+  windowSize *= std::max(1, omp_get_max_threads());
+#endif
+
+  QSqlQuery sqlTrk(db);
+  sqlTrk.setForwardOnly(true);
+  sqlTrk.prepare(ExportTracksStatement);
+  sqlTrk.bindValue(":collectionId", collectionId);
+  sqlTrk.exec();
+  if (sqlTrk.lastError().isValid()) {
+    qWarning() << "Loading tracks for collection id" << collectionId << "fails";
+    emit error(tr("Loading tracks for collection id %1 fails").arg(collectionId));
     return false;
   }
 
-  if (!sqlTrack.next()) {
-    qWarning() << "Track id" << track.id << "don't exists";
-    emit error(tr("Track id %1 don't exists").arg(track.id));
-    return false;
-  }
-  track = makeTrack(sqlTrack);
+  QSqlQuery sqlSeg(db);
+  sqlSeg.setForwardOnly(true);
+  sqlSeg.prepare(TrackSegmentsStatement);
+
+  QSqlQuery sqlBlock(db);
+  sqlBlock.setForwardOnly(true);
+  sqlBlock.prepare(ExportBlocksStatement);
+
+  SqlRowReader trkRow(sqlTrk);
+  while (trkRow.next()) {
+    qint64 trackId = trkRow.getLong(0);
+    writer.writeTrackStart(trkRow.getString(1), trkRow.getString(2));
+
+    sqlSeg.bindValue(":trackId", trackId);
+    sqlSeg.exec();
+    if (sqlSeg.lastError().isValid()) {
+      qWarning() << "Loading segments for track id" << trackId << "failed";
+      emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sqlSeg.lastError().text()));
+      return false;
+    }
+    std::vector<qint64> segmentIds;
+    while (sqlSeg.next()) {
+      segmentIds.push_back(varToLong(sqlSeg.value(0)));
+    }
+    sqlSeg.finish();
 
-  emit trackDataLoaded(track, false, true);
+    for (qint64 segmentId: segmentIds) {
+      writer.writeSegmentStart();
 
-  track.data = std::make_shared<gpx::Track>();
+      sqlBlock.bindValue(":segmentId", segmentId);
+      sqlBlock.exec();
+      if (sqlBlock.lastError().isValid()) {
+        qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+        emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlBlock.lastError().text()));
+        return false;
+      }
+      std::vector<QByteArray> blocks;
+      blocks.reserve(windowSize);
+      bool hasNext = sqlBlock.next();
+      while (hasNext) {
+        blocks.push_back(sqlBlock.value(0).toByteArray());
+        hasNext = sqlBlock.next();
+        if (blocks.size() == windowSize || !hasNext) {
+          if (!writer.writeTrackPointBlocks(blocks)) {
+            qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+            emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+            return false;
+          }
+          blocks.clear();
+        }
+      }
+      sqlBlock.finish();
 
-  track.data->name = gpx::Optional<std::string>::of(track.name.toStdString());
-  track.data->desc = gpx::Optional<std::string>::of(track.description.toStdString());
+      if (hasLegacyTrackPoints()){
+        gpx::TrackSegment segment;
+        loadLegacyTrackPoints(segmentId, segment);
+        writer.writeTrackPoints(segment.points);
+      }
 
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `id` FROM `track_segment` WHERE track_id = :trackId;");
-  sql.bindValue(":trackId", track.id);
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading segments for track id" << track.id << "failed";
-    emit error(tr("Loading segments for track id %1 failed: %2").arg(track.id).arg(sql.lastError().text()));
-  }else{
-    while (sql.next()) {
-      gpx::TrackSegment segment;
-      long segmentId = varToLong(sql.value("id"));
-      loadTrackPoints(segmentId, segment);
-      track.data->segments.push_back(std::move(segment));
+      writer.writeSegmentEnd();
+      if (writer.hasFailed()) {
+        return false;
+      }
     }
+    writer.writeTrackEnd();
   }
+
+  writer.writeFooter();
   return true;
 }
 
-void Storage::loadTrackData(Track track)
+void Storage::exportCollection(qint64 collectionId, QString file)
 {
-  if (!checkAccess("loadTrackData")){
-    emit trackDataLoaded(track, true, false);
+  if (!checkAccess("exportCollection")){
+    emit collectionExported(false);
     return;
   }
 
-  if (loadTrackDataPrivate(track)) {
-    emit trackDataLoaded(track, true, true);
-  }else{
-    emit trackDataLoaded(track, true, false);
+  QTime timer;
+  timer.start();
+  qDebug() << "Exporting collection" << collectionId << "to" << file;
+
+  // data are streamed from database to the file, so read can't be repeated
+  // when database is modified meanwhile; read transaction keeps consistent snapshot
+  GpxStreamWriter writer(file);
+  if (!writer.open()){
+    emit error(tr("Export to %1 failed: %2").arg(file).arg(writer.errorString()));
+    emit collectionExported(false);
+    return;
+  }
+
+  bool success = consistentRead([&]() {
+    return exportCollectionPrivate(collectionId, writer);
+  }, false);
+
+  if (!writer.finish()){
+    qWarning() << "Writing gpx file" << file << "failed" << writer.errorString();
+    emit error(tr("Export to %1 failed: %2").arg(file).arg(writer.errorString()));
+    success = false;
   }
+
+  qDebug() << "Exported in" << timer.elapsed() << "ms";
+
+  emit collectionExported(success);
 }
 
-void Storage::updateOrCreateCollection(Collection collection)
+void Storage::moveWaypoint(qint64 waypointId, qint64 collectionId)
 {
-  if (!checkAccess("updateOrCreateCollection")){
-    emit collectionsLoaded(std::vector<Collection>(), false);
+  moveWaypoints(QList<qint64>() << waypointId, collectionId);
+}
+
+void Storage::moveWaypoints(QList<qint64> waypointIds, qint64 collectionId)
+{
+  if (!checkAccess("moveWaypoints")){
     return;
   }
 
-  QSqlQuery sql(db);
-  if (collection.id < 0){
-    sql.prepare(
-      "INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, :visible);");
-    sql.bindValue(":name", collection.name);
-    sql.bindValue(":description", collection.description);
-    sql.bindValue(":visible", collection.visible);
-  }else {
-    sql.prepare(
-      "UPDATE `collection` SET `name` = :name, `description` = :description, `visible` = :visible WHERE (`id` = :id);");
-    sql.bindValue(":id", collection.id);
-    sql.bindValue(":name", collection.name);
-    sql.bindValue(":description", collection.description);
-    sql.bindValue(":visible", collection.visible);
-  }
-  sql.exec();
-  if (sql.lastError().isValid()){
-    if (collection.id < 0) {
-      qWarning() << "Creating collection failed: " << sql.lastError();
-      emit error(tr("Creating collection failed: %1").arg(sql.lastError().text()));
-    }else {
-      qWarning() << "Updating collection failed: " << sql.lastError();
-      emit error(tr("Updating collection failed: %1").arg(sql.lastError().text()));
-    }
+  qDebug() << "Moving" << waypointIds.size() << "waypoints to collection" << collectionId;
+
+  QSet<qint64> affected;
+  QSqlError err = moveItems("waypoint", waypointIds, collectionId, affected);
+  if (err.isValid()) {
+    qWarning() << "Move waypoints fails" << err;
+    emit error(tr("Move waypoints fails: %1").arg(err.text()));
   }
 
-  loadCollections();
+  affected << collectionId;
+  emitCollectionDetails(affected);
 }
 
-void Storage::deleteCollection(qint64 id)
+void Storage::moveTrack(qint64 trackId, qint64 collectionId)
 {
-  if (!checkAccess("deleteCollection")){
-    emit collectionsLoaded(std::vector<Collection>(), false);
+  moveTracks(QList<qint64>() << trackId, collectionId);
+}
+
+void Storage::moveTracks(QList<qint64> trackIds, qint64 collectionId)
+{
+  if (!checkAccess("moveTracks")){
     return;
   }
 
-  QSqlQuery sql(db);
-  sql.prepare(
-    "DELETE FROM `collection` WHERE (`id` = :id)");
-  sql.bindValue(":id", id);
-  sql.exec();
-  if (sql.lastError().isValid()){
-    qWarning() << "Deleting collection failed: " << sql.lastError();
-    emit error(tr("Deleting collection failed: %1").arg(sql.lastError().text()));
+  qDebug() << "Moving" << trackIds.size() << "tracks to collection" << collectionId;
+
+  QSet<qint64> affected;
+  QSqlError err = moveItems("track", trackIds, collectionId, affected);
+  if (err.isValid()) {
+    qWarning() << "Move tracks fails" << err;
+    emit error(tr("Move tracks fails: %1").arg(err.text()));
   }
 
-  loadCollections();
+  affected << collectionId;
+  emitCollectionDetails(affected);
 }
 
-bool Storage::importWaypoints(const gpx::GpxFile &gpxFile, qint64 collectionId)
+void Storage::deleteTrackSegment(qint64 collectionId, qint64 trackId, int segment)
 {
-  int wptNum = 0;
+  if (!checkAccess("deleteTrackSegment")){
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+
+  QSqlQuery sqlTrk(db);
+  sqlTrk.prepare(ClosedTrackStatement);
+  sqlTrk.bindValue(":trackId", trackId);
+  sqlTrk.bindValue(":collectionId", collectionId);
+  sqlTrk.exec();
+  if (sqlTrk.lastError().isValid() || !sqlTrk.next() || sqlTrk.value(0).toBool()) {
+    qWarning() << "Track" << trackId << "is open or don't exists" << sqlTrk.lastError();
+    emit error(tr("Deleting segment of track %1 failed").arg(trackId));
+    emit collectionDetailsLoaded(Collection(collectionId), false);
+    return;
+  }
+  sqlTrk.finish();
+
+  // segments before the deleted one are folded from their state,
+  // following ones are accumulated from points until their entry boundary is the same
   db.transaction();
-  QSqlQuery sqlWpt(db);
-  sqlWpt.prepare(
-    "INSERT INTO `waypoint` (`collection_id`, `timestamp`, `modification_time`, `latitude`, `longitude`, `elevation`, `name`, `description`, `symbol`) "
-    "VALUES                 (:collection_id,  :timestamp,  :modification_time,  :latitude,  :longitude,  :elevation,  :name,  :description,  :symbol)");
-  for (const auto &wpt: gpxFile.waypoints) {
-    wptNum++;
-
-    QString wptName = QString::fromStdString(wpt.name.getOrElse(""));
-    if (wptName.isEmpty())
-      wptName = tr("waypoint %1").arg(wptNum);
-
-    sqlWpt.bindValue(":collection_id", collectionId);
-    sqlWpt.bindValue(":timestamp",
-                     wpt.time.hasValue() ? timestampToDateTime(wpt.time) : QDateTime::currentDateTime());
-    sqlWpt.bindValue(":modification_time", QDateTime::currentDateTime());
-    sqlWpt.bindValue(":latitude", wpt.coord.GetLat());
-    sqlWpt.bindValue(":longitude", wpt.coord.GetLon());
-    sqlWpt.bindValue(":elevation", (wpt.elevation.hasValue() ? wpt.elevation.get() : QVariant()));
-    sqlWpt.bindValue(":name", wptName);
-    sqlWpt.bindValue(":description",
-                     (wpt.description.hasValue() ? QString::fromStdString(wpt.description.get()) : QVariant()));
-    sqlWpt.bindValue(":symbol", (wpt.symbol.hasValue() ? QString::fromStdString(wpt.symbol.get()) : QVariant()));
+  std::vector<StoredSegment> segments;
+  bool success = loadSegmentStatistics(trackId, segments);
+  if (success && (segment < 0 || (size_t)segment >= segments.size())){
+    qWarning() << "Track" << trackId << "has no segment" << segment;
+    emit error(tr("Track %1 has no segment %2").arg(trackId).arg(segment));
+    success = false;
+  }
+  if (success){
+    QSqlQuery sql(db);
+    sql.prepare(DeleteSegmentStatement);
+    sql.bindValue(":segmentId", segments[segment].id);
+    sql.bindValue(":trackId", trackId);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Deleting segment" << segments[segment].id << "failed" << sql.lastError();
+      emit error(tr("Deleting segment %1 failed: %2").arg(segments[segment].id).arg(sql.lastError().text()));
+      success = false;
+    }
+  }
+  if (success){
+    segments.erase(segments.begin() + segment);
+    TrackStatisticsAccumulator accumulator;
+    success = foldTrackStatistics(trackId, segments, accumulator) &&
+              updateTrackStatistics(trackId, accumulator.statistics(), QVariant());
+  }
+  if (!success || !db.commit()) {
+    qWarning() << "Deleting segment of track" << trackId << "failed" << db.lastError();
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+  }
 
-    sqlWpt.exec();
-    if (sqlWpt.lastError().isValid()) {
-      qWarning() << "Import of waypoints failed" << sqlWpt.lastError();
-      emit error(tr("Import of waypoints failed: %1").arg(sqlWpt.lastError().text()));
+  loadCollectionDetails(Collection(collectionId));
+}
+
+QSqlError Storage::deleteItems(const QString &table, qint64 collectionId, const QList<qint64> &ids)
+{
+  if (!db.transaction()){
+    return db.lastError();
+  }
+
+  QSqlQuery sql(db);
+  sql.prepare(QString(DeleteItemStatement).arg(table));
+  for (qint64 id: ids){
+    sql.bindValue(":id", id);
+    sql.bindValue(":collection_id", collectionId);
+    if (!sql.exec()){
+      QSqlError err = sql.lastError();
       if (!db.rollback()) {
         qWarning() << "Transaction rollback failed" << db.lastError();
       }
-      return false;
-    }
-    // commit batch WayPointBatchSize queries
-    if (wptNum % WayPointBatchSize == 0) {
-      if (!db.commit()) {
-        emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-        qWarning() << "Transaction commit failed" << db.lastError();
-        return false;
-      }
-      db.transaction();
+      return err;
     }
   }
-  if (!db.commit()) {
-    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-    qWarning() << "Transaction commit failed" << db.lastError();
-    return false;
+
+  if (!db.commit()){
+    return db.lastError();
   }
-  return true;
+  return QSqlError();
 }
 
-TrackStatistics Storage::computeTrackStatistics(const gpx::Track &trk) const
+QSqlError Storage::moveItems(const QString &table, const QList<qint64> &ids, qint64 collectionId, QSet<qint64> &sourceCollections)
 {
-  QTime timer;
-  timer.restart();
-
-  qDebug() << "Computing track statistics...";
+  if (!db.transaction()){
+    return db.lastError();
+  }
 
-  // filter inaccurate nodes - filter nodes with dilution > 30 and with delta (from previous) less than 5 m
-  QTime filterTimer;
-  filterTimer.restart();
-  gpx::Track filtered(trk);
-  filtered.FilterPoints([](std::vector<gpx::TrackPoint> &points){
-    gpx::FilterInaccuratePoints(points, 30);
-    gpx::FilterNearPoints(points, Distance::Of<Meter>(5));
-  });
-  qDebug() << "Filtering nodes" << filterTimer.elapsed() << "ms";
+  QSqlQuery sqlSource(db);
+  sqlSource.prepare(QString(ItemCollectionStatement).arg(table));
+  QSqlQuery sqlUpdate(db);
+  sqlUpdate.prepare(QString(MoveItemStatement).arg(table));
 
-  // time - just time diference between first and last node
-  std::chrono::milliseconds duration(0);
-  gpx::Optional<Timestamp> from;
-  gpx::Optional<Timestamp> to;
-  for (const auto &seg:trk.segments){
-    if (!seg.points.empty()){
-      from = seg.points.begin()->time;
-      break;
-    }
-  }
-  for (auto it = trk.segments.rbegin(); it != trk.segments.rend(); it++){
-    if (!it->points.empty()){
-      to = it->points.rbegin()->time;
+  QSqlError err;
+  for (qint64 id: ids){
+    sqlSource.bindValue(":id", id);
+    if (!sqlSource.exec()){
+      err = sqlSource.lastError();
       break;
     }
-  }
-  if (from.hasValue() && to.hasValue()){
-    duration = to.get() - from.get();
-  }
-
-  // moving time - sum time of segments when time difference between two points
-  // (of filtered track) is less then 5 minutes.
-  // ...filters are removing points with same coordinates - when there is no move.
-
-  QTime movingTimeTimer;
-  movingTimeTimer.restart();
-
-  // with moving duration is computed maximum speed...
-  MaxSpeedBuffer maxSpeedBuf;
-  std::chrono::milliseconds movingDuration(0); // ms
-  for (const auto &seg:filtered.segments) {
-    if (seg.points.empty()){
+    if (!sqlSource.next()){
+      qWarning() << "Moved" << table << "id" << id << "not found";
       continue;
     }
-    if (!seg.points.begin()->time.hasValue()){
-      // first point of segment has no time - don't count it to statistics, sorry
+    qint64 sourceId = varToLong(sqlSource.value(0));
+    sqlSource.finish();
+    if (sourceId == collectionId){
       continue;
     }
-    Timestamp from = seg.points.begin()->time.get();
-    Timestamp previous = from;
-    for (const auto &p:seg.points) {
-      if (!p.time.hasValue()){
-        continue;
-      }
-      Timestamp current = p.time.get();
-      if (current - previous > std::chrono::minutes(5)){
-        movingDuration += previous - from;
-        from = current;
-        previous = from;
-        maxSpeedBuf.flush();
-      }else{
-        previous = current;
-      }
-      maxSpeedBuf.insert(p);
-    }
-    movingDuration += previous - from;
-    maxSpeedBuf.flush();
-  }
-  qDebug() << "Moving time" << movingTimeTimer.elapsed() << "ms";
-
-  // elevation
-  QTime elevationTimer;
-  elevationTimer.restart();
-
-  gpx::Optional<Distance> minElevation;
-  gpx::Optional<Distance> maxElevation;
-  double ascent=0;
-  double descent=0;
-  bool first = true;
-  double previous = 0;
-  for (const auto &seg:filtered.segments) {
-    for (const auto &p:seg.points) {
-      if (!p.elevation.hasValue()){
-        continue;
-      }
-      if (p.vdop.hasValue() && p.vdop.get() > 50.0){
-        // when vertical accuracy is too low, ignore in statistics
-        continue;
-      }
-      double current = p.elevation.get();
-      if (!minElevation.hasValue() || minElevation.get().AsMeter() > current){
-        minElevation = gpx::Optional<Distance>::of(Distance::Of<Meter>(current));
-      }
-      if (!maxElevation.hasValue() || maxElevation.get().AsMeter() < current){
-        maxElevation = gpx::Optional<Distance>::of(Distance::Of<Meter>(current));
-      }
-      if (first){
-        first=false;
-        previous=current;
-      }else{
-        // when difference is less than 9 meters, don't count to ascent/descent
-        // this threshold was experimentally set to get similar ascent like on strava.com :-)
-        if (std::abs(current - previous) >= 9.0) {
-          if (current > previous) {
-            ascent += (current - previous);
-          } else {
-            descent += (previous - current);
-          }
-          previous = current;
-        }
-      }
+
+    sqlUpdate.bindValue(":id", id);
+    sqlUpdate.bindValue(":collection_id", collectionId);
+    if (!sqlUpdate.exec()){
+      err = sqlUpdate.lastError();
+      break;
     }
+    sourceCollections << sourceId;
   }
-  qDebug() << "Elevation" << elevationTimer.elapsed() << "ms";
 
-  // compute bbox
-  QTime bboxTimer;
-  bboxTimer.restart();
-  GeoBox bbox;
-  for (const auto &seg:trk.segments){
-    for (const auto &p:seg.points){
-      bbox.Include(GeoBox(p.coord, p.coord));
+  if (err.isValid()){
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
     }
+    return err;
   }
-  qDebug() << "BBox" << bboxTimer.elapsed() << "ms";
-
-  Distance length = filtered.GetLength();
-  double durationInSeconds = ((double)duration.count() / 1000.0);
-  double movingDurationInSeconds = ((double)movingDuration.count() / 1000.0);
-
-  qDebug() << "Track statistics computation tooks" << timer.elapsed() << "ms";
-
-  return TrackStatistics(
-    timestampToDateTime(from),
-    timestampToDateTime(to),
-    length,
-    /*rawDistance*/ trk.GetLength(),
-    duration,
-    movingDuration,
-    maxSpeedBuf.getMaxSpeed(),
-    /*averageSpeed*/ durationInSeconds == 0 ? -1 : length.AsMeter() / durationInSeconds,
-    /*movingAverageSpeed*/ movingDurationInSeconds == 0 ? -1 : length.AsMeter() / movingDurationInSeconds,
-    Distance::Of<Meter>(ascent),
-    Distance::Of<Meter>(descent),
-    minElevation,
-    maxElevation,
-    bbox);
+  if (!db.commit()){
+    return db.lastError();
+  }
+  return QSqlError();
 }
 
-bool Storage::importTracks(const gpx::GpxFile &gpxFile, qint64 collectionId)
+void Storage::emitCollectionDetails(const QSet<qint64> &collectionIds)
 {
-  int trkNum = 0;
-  QSqlQuery sqlTrk(db);
-  QSqlQuery sqlSeg(db);
-  sqlTrk.prepare(QString("INSERT INTO `track` (")
-    .append("`collection_id`, `name`, `description`, `open`, `creation_time`, `modification_time`, ")
-    .append("`from_time`, ")
-    .append("`to_time`, ")
-    .append("`distance`, ")
-    .append("`raw_distance`, ")
-    .append("`duration`, ")
-    .append("`moving_duration`, ")
-    .append("`max_speed`, ")
-    .append("`average_speed`, ")
-    .append("`moving_average_speed`, ")
-    .append("`ascent`, ")
-    .append("`descent`, ")
-    .append("`min_elevation`, ")
-    .append("`max_elevation`, ")
-    .append("`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`")
-    .append(") ")
-    .append("VALUES (")
-    .append(":collection_id,  :name,  :description,  :open,  :creation_time,  :modification_time, ")
-    .append(":from_time, ")
-    .append(":to_time, ")
-    .append(":distance, ")
-    .append(":raw_distance, ")
-    .append(":duration, ")
-    .append(":moving_duration, ")
-    .append(":max_speed, ")
-    .append(":average_speed, ")
-    .append(":moving_average_speed, ")
-    .append(":ascent, ")
-    .append(":descent, ")
-    .append(":min_elevation, ")
-    .append(":max_elevation, ")
-    .append(":bboxMinLat, :bboxMinLon, :bboxMaxLat, :bboxMaxLon")
-    .append(")"));
-
-  sqlSeg.prepare("INSERT INTO `track_segment` (`track_id`, `open`, `creation_time`, `distance`) VALUES (:track_id, :open, :creation_time, :distance)");
-  for (const auto &trk: gpxFile.tracks){
-    trkNum++;
-
-    QString trackName = QString::fromStdString(trk.name.getOrElse(""));
-    if (trackName.isEmpty())
-      trackName = tr("track %1").arg(trkNum);
-
-    sqlTrk.bindValue(":collection_id", collectionId);
-    sqlTrk.bindValue(":name", trackName);
-    sqlTrk.bindValue(":description",
-                     (trk.desc.hasValue() ? QString::fromStdString(trk.desc.get()) : QVariant()));
-    sqlTrk.bindValue(":open", false);
-
-    TrackStatistics stat = computeTrackStatistics(trk);
-    sqlTrk.bindValue(":creation_time", QDateTime::currentDateTime());
-    sqlTrk.bindValue(":modification_time", QDateTime::currentDateTime());
-
-    sqlTrk.bindValue(":from_time", stat.from);
-    sqlTrk.bindValue(":to_time", stat.to);
-    sqlTrk.bindValue(":distance", stat.distance.AsMeter());
-    sqlTrk.bindValue(":raw_distance", stat.rawDistance.AsMeter());
-    sqlTrk.bindValue(":duration", (qint64)stat.duration.count());
-    sqlTrk.bindValue(":moving_duration", (qint64)stat.movingDuration.count());
-    sqlTrk.bindValue(":max_speed", stat.maxSpeed);
-    sqlTrk.bindValue(":average_speed", stat.averageSpeed);
-    sqlTrk.bindValue(":moving_average_speed", stat.movingAverageSpeed);
-    sqlTrk.bindValue(":ascent", stat.ascent.AsMeter());
-    sqlTrk.bindValue(":descent", stat.descent.AsMeter());
-    sqlTrk.bindValue(":min_elevation", stat.minElevation.hasValue() ? QVariant::fromValue(stat.minElevation.get().AsMeter()) : QVariant());
-    sqlTrk.bindValue(":max_elevation", stat.maxElevation.hasValue() ? QVariant::fromValue(stat.maxElevation.get().AsMeter()) : QVariant());
-
-    sqlTrk.bindValue(":bboxMinLat", stat.bbox.GetMinLat());
-    sqlTrk.bindValue(":bboxMinLon", stat.bbox.GetMinLon());
-    sqlTrk.bindValue(":bboxMaxLat", stat.bbox.GetMaxLat());
-    sqlTrk.bindValue(":bboxMaxLon", stat.bbox.GetMaxLon());
-
-    sqlTrk.exec();
-    if (sqlTrk.lastError().isValid()) {
-      qWarning() << "Import of tracks failed" << sqlTrk.lastError();
-      emit error(tr("Import of tracks failed: %1").arg(sqlTrk.lastError().text()));
-      return false;
-    }
-
-    qint64 trackId = varToLong(sqlTrk.lastInsertId());
+  for (qint64 collectionId: collectionIds){
+    Collection collection(collectionId);
+    bool ok = loadCollectionDetailsPrivate(collection);
+    emit collectionDetailsLoaded(collection, ok);
+  }
+}
 
-    for (auto const &seg: trk.segments){
-      sqlSeg.bindValue(":track_id", trackId);
-      sqlSeg.bindValue(":open", false);
+Storage::operator bool() const
+{
+  return ok;
+}
 
-      // TODO: do we need segment statics?
-      sqlSeg.bindValue(":creation_time", QDateTime::currentDateTime());
-      sqlSeg.bindValue(":distance", seg.GetLength().AsMeter());
-      sqlSeg.exec();
-      if (sqlSeg.lastError().isValid()) {
-        qWarning() << "Import of segments failed" << sqlSeg.lastError();
-        emit error(tr("Import of segments failed: %1").arg(sqlSeg.lastError().text()));
-        return false;
-      }
-      qint64 segmentId = varToLong(sqlSeg.lastInsertId());
+Storage* Storage::getInstance()
+{
+  return storage;
+}
 
-      if (!importTrackPoints(seg.points, segmentId)){
-        qWarning() << "Import of track points failed" << sqlSeg.lastError();
-        emit error(tr("Import of track points failed: %1").arg(sqlSeg.lastError().text()));
-        return false;
-      }
-      qDebug() << "Imported" << seg.points.size() << "points to segment" << segmentId << "for track" << trackId;
-    }
-    qDebug() << "Imported track " << trackId;
+Storage* Storage::getReader()
+{
+  static std::atomic_uint next{0};
+  if (storage == nullptr || storage->readers.empty()){
+    return storage;
   }
-  return true;
+  return storage->readers[next++ % storage->readers.size()];
 }
 
-bool Storage::importTrackPoints(const std::vector<gpx::TrackPoint> &points, qint64 segmentId)
+qint64 Storage::newRequestId()
 {
-  size_t pointNum = 0;
-  db.transaction();
-  QSqlQuery sql(db);
-  sql.prepare("INSERT INTO `track_point` (`segment_id`, `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy`) VALUES (:segment_id, :timestamp, :latitude, :longitude, :elevation, :horiz_accuracy, :vert_accuracy)");
+  static std::atomic<qint64> next{1};
+  return next++;
+}
 
-  for (const auto &point: points){
-    pointNum ++;
+void Storage::initInstance(const QDir &directory)
+{
+  if (storage == nullptr){
+    QThread *thread = OSMScoutQt::GetInstance().makeThread("Storage");
+    storage = new Storage(thread, directory);
+    storage->moveToThread(thread);
 
-    if (!point.time.hasValue()){
-      qWarning() << "Track point without timestammp";
-      continue;
+    // readers are initialised by writer, when database schema is ready
+    for (int i = 0; i < ReaderCount; i++){
+      QThread *readerThread = OSMScoutQt::GetInstance().makeThread(QString("StorageReader%1").arg(i));
+      Storage *reader = new Storage(readerThread, directory, storage, i);
+      reader->moveToThread(readerThread);
+
+      // results of reads are delivered by writer signals, so clients
+      // don't need to care which connection served the request
+      connect(reader, SIGNAL(collectionsLoaded(CollectionList, bool)),
+              storage, SIGNAL(collectionsLoaded(CollectionList, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(collectionDetailsLoaded(Collection, bool)),
+              storage, SIGNAL(collectionDetailsLoaded(Collection, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(trackDataLoaded(Track, qint64, bool, bool)),
+              storage, SIGNAL(trackDataLoaded(Track, qint64, bool, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(trackDataChunkLoaded(Track, TrackChunk)),
+              storage, SIGNAL(trackDataChunkLoaded(Track, TrackChunk)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(trackLodLoaded(Track, TrackLod)),
+              storage, SIGNAL(trackLodLoaded(Track, TrackLod)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(collectionExported(bool)),
+              storage, SIGNAL(collectionExported(bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(tracksInBoxLoaded(osmscout::GeoBox, TrackList, bool)),
+              storage, SIGNAL(tracksInBoxLoaded(osmscout::GeoBox, TrackList, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(waypointsInBoxLoaded(osmscout::GeoBox, WaypointList, bool)),
+              storage, SIGNAL(waypointsInBoxLoaded(osmscout::GeoBox, WaypointList, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(searchFinished(QString, std::vector<SearchResultItem>, bool)),
+              storage, SIGNAL(searchFinished(QString, std::vector<SearchResultItem>, bool)),
+              Qt::DirectConnection);
+      connect(reader, SIGNAL(error(QString)),
+              storage, SIGNAL(error(QString)),
+              Qt::DirectConnection);
+
+      readerThread->start();
+      storage->readers.push_back(reader);
     }
-    sql.bindValue(":segment_id", segmentId);
-    sql.bindValue(":timestamp", timestampToDateTime(point.time));
-    sql.bindValue(":latitude", point.coord.GetLat());
-    sql.bindValue(":longitude", point.coord.GetLon());
-    sql.bindValue(":elevation", point.elevation.hasValue() ? point.elevation.get() : QVariant());
-    // read TrackPoint notes
-    sql.bindValue(":horiz_accuracy", point.hdop.hasValue() ? point.hdop.get() : QVariant());
-    sql.bindValue(":vert_accuracy", point.vdop.hasValue() ? point.vdop.get(): QVariant());
 
-    sql.exec();
-    if (sql.lastError().isValid()) {
-      qWarning() << "Import of track points failed" << sql.lastError();
-      emit error(tr("Import of track points failed: %1").arg(sql.lastError().text()));
-      if (!db.rollback()) {
-        qWarning() << "Transaction rollback failed" << db.lastError();
-      }
-      return false;
-    }
-    // commit batch TrackPointBatchSize queries
-    if (pointNum % TrackPointBatchSize == 0) {
-      if (!db.commit()) {
-        emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-        qWarning() << "Transaction commit failed" << db.lastError();
-        return false;
-      }
-      db.transaction();
-    }
+    connect(thread, SIGNAL(started()),
+            storage, SLOT(init()));
+    thread->start();
   }
-  if (!db.commit()) {
-    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-    qWarning() << "Transaction commit failed" << db.lastError();
-    return false;
+}
+
+void Storage::clearInstance()
+{
+  if (storage != nullptr){
+    for (Storage *reader: storage->readers){
+      reader->deleteLater();
+    }
+    storage->readers.clear();
+    storage->deleteLater();
+    storage = nullptr;
   }
-  return true;
 }
 
-void Storage::importCollection(QString filePath)
+void Storage::openTrack(qint64 collectionId, QString name, QString description)
 {
-  if (!checkAccess("importCollection")){
-    emit collectionsLoaded(std::vector<Collection>(), false);
+  if (!checkAccess("openTrack")){
+    emit trackOpened(collectionId, -1, false);
     return;
   }
 
-  QTime timer;
-  timer.start();
-  qDebug() << "Importing collection from" << filePath;
-
-  gpx::GpxFile gpxFile;
-  std::shared_ptr<ErrorCallback> callback = std::make_shared<ErrorCallback>();
-  connect(callback.get(), SIGNAL(error(QString)), this, SIGNAL(error(QString)));
-
-  if (!gpx::ImportGpx(filePath.toStdString(),
-                      gpxFile,
-                      nullptr,
-                      std::static_pointer_cast<gpx::ProcessCallback, ErrorCallback>(callback))){
+  gpx::Track trk;
+  if (!name.isEmpty()){
+    trk.name = gpx::Optional<std::string>::of(name.toStdString());
+  }
+  if (!description.isEmpty()){
+    trk.desc = gpx::Optional<std::string>::of(description.toStdString());
+  }
 
-    qWarning() << "Gpx import failed " << filePath;
-    loadCollections();
+  TrackRecording rec;
+  db.transaction();
+  rec.trackId = insertTrack(trk, 1, rec.statistics.statistics(), collectionId, /*open*/ true);
+  if (rec.trackId >= 0){
+    rec.segmentId = insertSegment(rec.trackId, PreparedTrack::Segment(), /*open*/ true);
+  }
+  if (rec.trackId < 0 || rec.segmentId < 0 || !updateRecordingStatistics(rec)){
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    emit trackOpened(collectionId, -1, false);
+    return;
+  }
+  if (!db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    emit error(tr("Opening track failed: %1").arg(db.lastError().text()));
+    emit trackOpened(collectionId, -1, false);
     return;
   }
 
-  // import collection
-  QSqlQuery sql(db);
-  sql.prepare("INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, 0);");
-  sql.bindValue(":name", gpxFile.name.hasValue() ?
-                         QString::fromStdString(gpxFile.name.get()) : QFileInfo(filePath).baseName());
-  sql.bindValue(":description", gpxFile.desc.hasValue() && !gpxFile.desc.get().empty() ?
-                                QString::fromStdString(gpxFile.desc.get()) :
-                                tr("Imported from %1").arg(filePath));
+  qDebug() << "Track" << rec.trackId << "opened for recording";
+  qint64 trackId = rec.trackId;
+  recordings[trackId] = std::move(rec);
+  emit trackOpened(collectionId, trackId, true);
+  loadCollectionDetails(Collection(collectionId));
+}
 
-  sql.exec();
-  if (sql.lastError().isValid()){
-    qWarning() << "Creating collection failed" << sql.lastError();
-    emit error(tr("Creating collection failed: %1").arg(sql.lastError().text()));
-    loadCollections();
+void Storage::openSegment(qint64 trackId)
+{
+  if (!checkAccess("openSegment")){
     return;
   }
-  qint64 collectionId = varToLong(sql.lastInsertId());
-  if (collectionId < 0){
-    qWarning() << "Invalid collection id" << collectionId;
-    emit error(tr("Invalid collection id: %1").arg(collectionId));
-    loadCollections();
+  TrackRecording *rec = recording(trackId);
+  if (rec == nullptr){
     return;
   }
-
-  // import waypoints
-  if (!gpxFile.waypoints.empty()) {
-    if (!importWaypoints(gpxFile, collectionId)){
-      loadCollections();
-      return;
-    }
+  flushRecordings();
+  if (!rec->pending.empty()){
+    // flush failed, keep the segment open
+    return;
   }
-  qDebug() << "Imported" << gpxFile.waypoints.size() << "waypoints to collection" << collectionId << "from" << filePath;
 
-  // import tracks
-  if (!gpxFile.tracks.empty()) {
-    if (!importTracks(gpxFile, collectionId)){
-      loadCollections();
-      return;
+  TrackRecording updated = *rec;
+  db.transaction();
+  bool success = closeRecordingSegment(updated);
+  if (success){
+    updated.segmentId = insertSegment(trackId, PreparedTrack::Segment(), /*open*/ true);
+    updated.nextSeq = 0;
+    updated.firstStagedSeq = 0;
+    updated.stagedPoints = 0;
+    updated.statistics.startSegment();
+    success = updated.segmentId >= 0 && updateRecordingStatistics(updated);
+  }
+  if (!success || !db.commit()) {
+    qWarning() << "Opening segment of track" << trackId << "failed" << db.lastError();
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
     }
+    return;
   }
-  qDebug() << "Imported" << gpxFile.tracks.size() << "tracks to collection" << collectionId
-           << "from" << filePath << "in" << timer.elapsed() << "ms";
-
-  loadCollections();
+  *rec = std::move(updated);
 }
 
-void Storage::deleteWaypoint(qint64 collectionId, qint64 waypointId)
+void Storage::appendTrackPoints(qint64 trackId, std::vector<osmscout::gpx::TrackPoint> points)
 {
-  if (!checkAccess("deleteWaypoint")){
-    emit collectionDetailsLoaded(Collection(collectionId), false);
+  if (!checkAccess("appendTrackPoints")){
     return;
   }
-
-  QSqlQuery sql(db);
-  sql.prepare("DELETE FROM `waypoint` WHERE `id` = :id AND `collection_id` = :collection_id;");
-  sql.bindValue(":id", waypointId);
-  sql.bindValue(":collection_id", collectionId);
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Deleting waypoint failed" << sql.lastError();
-    emit error(tr("Deleting waypoint failed: %1").arg(sql.lastError().text()));
-    loadCollectionDetails(Collection(collectionId));
+  TrackRecording *rec = recording(trackId);
+  if (rec == nullptr){
+    return;
+  }
+  rec->pending.insert(rec->pending.end(), points.begin(), points.end());
+  if (!recordingFlushScheduled){
+    recordingFlushScheduled = true;
+    QTimer::singleShot(recordingFlushInterval, this, SLOT(flushRecordings()));
   }
-
-  loadCollectionDetails(Collection(collectionId));
 }
 
-void Storage::createWaypoint(qint64 collectionId, double lat, double lon, QString name, QString description)
+void Storage::closeTrack(qint64 trackId)
 {
-  if (!checkAccess("deleteTrack")){
-    emit collectionDetailsLoaded(Collection(collectionId), false);
+  if (!checkAccess("closeTrack")){
+    emit trackClosed(trackId, false);
     return;
   }
-
-  QSqlQuery sqlWpt(db);
-  sqlWpt.prepare(
-    "INSERT INTO `waypoint` (`collection_id`, `timestamp`, `modification_time`, `latitude`, `longitude`, `name`, `description`) "
-    "VALUES                 (:collection_id,  :timestamp,  :modification_time,  :latitude,  :longitude,  :name,  :description)");
-
-  sqlWpt.bindValue(":collection_id", collectionId);
-  sqlWpt.bindValue(":timestamp", QDateTime::currentDateTime());
-  sqlWpt.bindValue(":modification_time", QDateTime::currentDateTime());
-  sqlWpt.bindValue(":latitude", lat);
-  sqlWpt.bindValue(":longitude", lon);
-  sqlWpt.bindValue(":name", name);
-  sqlWpt.bindValue(":description", (description.isEmpty() ? QVariant() : description));
-
-  sqlWpt.exec();
-  if (sqlWpt.lastError().isValid()) {
-    qWarning() << "Creation of waypoint failed" << sqlWpt.lastError();
-    emit error(tr("Creation of waypoint failed: %1").arg(sqlWpt.lastError().text()));
+  TrackRecording *rec = recording(trackId);
+  if (rec == nullptr){
+    emit trackClosed(trackId, false);
+    return;
   }
-
-  loadCollectionDetails(Collection(collectionId));
-}
-
-void Storage::deleteTrack(qint64 collectionId, qint64 trackId)
-{
-  if (!checkAccess("deleteTrack")){
-    emit collectionDetailsLoaded(Collection(collectionId), false);
+  flushRecordings();
+  if (!rec->pending.empty()){
+    emit trackClosed(trackId, false);
     return;
   }
 
+  db.transaction();
+  bool success = closeRecordingSegment(*rec);
   QSqlQuery sql(db);
-  sql.prepare("DELETE FROM `track` WHERE `id` = :id AND `collection_id` = :collection_id;");
-  sql.bindValue(":id", trackId);
-  sql.bindValue(":collection_id", collectionId);
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Deleting track failed" << sql.lastError();
-    emit error(tr("Deleting track failed: %1").arg(sql.lastError().text()));
-    loadCollectionDetails(Collection(collectionId));
+  if (success){
+    sql.prepare(CloseTrackStatement);
+    sql.bindValue(":modification_time", QDateTime::currentDateTime());
+    sql.bindValue(":trackId", trackId);
+    sql.exec();
+    success = !sql.lastError().isValid();
   }
-
-  loadCollectionDetails(Collection(collectionId));
-}
-
-void Storage::editWaypoint(qint64 collectionId, qint64 id, QString name, QString description)
-{
-  if (!checkAccess("editWaypoint")){
-    emit collectionDetailsLoaded(Collection(collectionId), false);
+  if (!success || !db.commit()) {
+    qWarning() << "Closing track" << trackId << "failed" << sql.lastError() << db.lastError();
+    emit error(tr("Closing track %1 failed").arg(trackId));
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    // in-memory state was modified, it is restored from database on next use
+    recordings.erase(trackId);
+    emit trackClosed(trackId, false);
     return;
   }
-
-  QSqlQuery sql(db);
-  sql.prepare("UPDATE `waypoint` SET `name` = :name, `description` = :description, `modification_time` = :modification_time WHERE `id` = :id AND `collection_id` = :collection_id;");
-  sql.bindValue(":id", id);
-  sql.bindValue(":collection_id", collectionId);
-  sql.bindValue(":name", name);
-  sql.bindValue(":description", description);
-  sql.bindValue(":modification_time", QDateTime::currentDateTime());
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Edit waypoint failed" << sql.lastError();
-    emit error(tr("Edit waypoint failed: %1").arg(sql.lastError().text()));
-    loadCollectionDetails(Collection(collectionId));
+  recordings.erase(trackId);
+  qDebug() << "Track" << trackId << "closed";
+  emit trackClosed(trackId, true);
+
+  QSqlQuery sqlCollection(db);
+  sqlCollection.prepare(QString(ItemCollectionStatement).arg("track"));
+  sqlCollection.bindValue(":id", trackId);
+  sqlCollection.exec();
+  if (sqlCollection.next()){
+    loadCollectionDetails(Collection(varToLong(sqlCollection.value(0))));
   }
-
-  loadCollectionDetails(Collection(collectionId));
 }
 
-void Storage::editTrack(qint64 collectionId, qint64 id, QString name, QString description)
+void Storage::flushRecordings()
 {
-  if (!checkAccess("editTrack")){
-    emit collectionDetailsLoaded(Collection(collectionId), false);
+  recordingFlushScheduled = false;
+  if (!checkAccess("flushRecordings")){
     return;
   }
 
-  QSqlQuery sql(db);
-  sql.prepare("UPDATE `track` SET `name` = :name, `description` = :description, `modification_time` = :modification_time WHERE `id` = :id AND `collection_id` = :collection_id;");
-  sql.bindValue(":id", id);
-  sql.bindValue(":collection_id", collectionId);
-  sql.bindValue(":name", name);
-  sql.bindValue(":description", description);
-  sql.bindValue(":modification_time", QDateTime::currentDateTime());
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Edit track failed" << sql.lastError();
-    emit error(tr("Edit track failed: %1").arg(sql.lastError().text()));
-    loadCollectionDetails(Collection(collectionId));
+  std::vector<TrackRecording> updated;
+  for (const auto &entry: recordings){
+    if (!entry.second.pending.empty()){
+      updated.push_back(entry.second);
+    }
   }
-
-  loadCollectionDetails(Collection(collectionId));
-}
-
-void Storage::exportCollection(qint64 collectionId, QString file)
-{
-  if (!checkAccess("exportCollection")){
-    emit collectionExported(false);
+  if (updated.empty()){
     return;
   }
 
   QTime timer;
   timer.start();
-  qDebug() << "Exporting collection" << collectionId << "to" << file;
-
-  // load data
-  Collection collection(collectionId);
-  gpx::GpxFile gpxFile;
-  if (!loadCollectionDetailsPrivate(collection)){
-    emit collectionExported(false);
-    return;
+  if (recordingSync){
+    db.exec("PRAGMA synchronous = FULL;");
   }
 
-  if (!collection.name.isEmpty()) {
-    gpxFile.name = gpx::Optional<std::string>::of(collection.name.toStdString());
+  // all pending points in single transaction (group commit), in-memory state
+  // is updated when the transaction is committed
+  db.transaction();
+  bool success = true;
+  for (auto &rec: updated){
+    success = success && flushRecording(rec);
   }
-  if (!collection.description.isEmpty()) {
-    gpxFile.desc = gpx::Optional<std::string>::of(collection.description.toStdString());
+  if (success && !db.commit()) {
+    qWarning() << "Transaction commit failed" << db.lastError();
+    success = false;
   }
-
-  assert(collection.waypoints);
-  gpxFile.waypoints.reserve(collection.waypoints->size());
-  for (const Waypoint &w: *(collection.waypoints)){
-    gpxFile.waypoints.push_back(w.data);
+  if (!success && !db.rollback()) {
+    qWarning() << "Transaction rollback failed" << db.lastError();
+  }
+  if (recordingSync){
+    db.exec("PRAGMA synchronous = NORMAL;");
   }
-  collection.waypoints.reset();
 
-  // load track data
-  assert(collection.tracks);
-  gpxFile.tracks.reserve(collection.tracks->size());
-  for (Track &t : *(collection.tracks)){
-    qDebug() << "Loading track data" << t.id;
-    if (!loadTrackDataPrivate(t)){
-      emit collectionExported(false);
-      return;
+  if (!success){
+    // pending points are kept, next flush will try it again
+    if (!recordingFlushScheduled){
+      recordingFlushScheduled = true;
+      QTimer::singleShot(recordingFlushInterval, this, SLOT(flushRecordings()));
     }
-    assert(t.data);
-    gpxFile.tracks.push_back(*(t.data));
-    t.data.reset();
+    return;
   }
 
-  // export
-  qDebug() << "Writing gpx file" << file;
-  std::shared_ptr<ErrorCallback> callback = std::make_shared<ErrorCallback>();
-  connect(callback.get(), SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+  for (auto &rec: updated){
+    TrackRecording &current = recordings[rec.trackId];
+    int flushed = current.pending.size();
+    current = std::move(rec);
+    emit trackPointsFlushed(current.trackId, flushed);
+  }
+  qDebug() << "Flushed" << updated.size() << "recorded tracks in" << timer.elapsed() << "ms";
+}
 
-  bool success = gpx::ExportGpx(gpxFile,
-                                file.toStdString(),
-                                nullptr,
-                                std::static_pointer_cast<gpx::ProcessCallback, ErrorCallback>(callback));
+bool Storage::flushRecording(TrackRecording &rec)
+{
+  if (rec.pending.empty()){
+    return true;
+  }
 
-  qDebug() << "Exported in" << timer.elapsed() << "ms";
+  std::vector<EncodedTrackPointBlock> blocks(1);
+  blocks[0].pointCount = rec.pending.size();
+  blocks[0].data = TrackPointBlock::encode(rec.pending.begin(), rec.pending.end());
+  if (!insertTrackPointBlocks(blocks, 0, 1, rec.segmentId, rec.nextSeq)){
+    return false;
+  }
+  rec.nextSeq++;
+  rec.stagedPoints += blocks[0].pointCount;
 
-  emit collectionExported(success);
+  rec.statistics.append(rec.pending);
+  rec.pending.clear();
+
+  if (rec.stagedPoints >= TrackPointBlockSize && !compactRecording(rec)){
+    return false;
+  }
+  return updateRecordingStatistics(rec);
 }
 
-void Storage::moveWaypoint(qint64 waypointId, qint64 collectionId)
+bool Storage::compactRecording(TrackRecording &rec)
 {
-  if (!checkAccess("moveWaypoint")){
-    return;
+  if (rec.nextSeq - rec.firstStagedSeq < 2){
+    return true;
   }
 
   QSqlQuery sql(db);
-  sql.prepare("SELECT `collection_id` FROM `waypoint` WHERE `id` = :id;");
-  sql.bindValue(":id", waypointId);
+  sql.setForwardOnly(true);
+  sql.prepare(StagedBlocksStatement);
+  sql.bindValue(":segmentId", rec.segmentId);
+  sql.bindValue(":seq", rec.firstStagedSeq);
   sql.exec();
-
   if (sql.lastError().isValid()) {
-    qWarning() << "Loading waypoint id" << waypointId << "fails";
-    emit error(tr("Loading waypoint id %1 fails").arg(waypointId));
-    return;
+    qWarning() << "Loading staged points of segment" << rec.segmentId << "failed" << sql.lastError();
+    emit error(tr("Loading staged points of segment %1 failed: %2").arg(rec.segmentId).arg(sql.lastError().text()));
+    return false;
   }
-
-  if (!sql.next()) {
-    qWarning() << "Waypoint id" << waypointId << "not found";
-    emit error(tr("Waypoint id %1 not found").arg(waypointId));
-    return;
+  std::vector<gpx::TrackPoint> points;
+  points.reserve(rec.stagedPoints);
+  while (sql.next()) {
+    if (!TrackPointBlock::decode(sql.value(0).toByteArray(), points)){
+      qWarning() << "Decoding staged points of segment" << rec.segmentId << "failed";
+      emit error(tr("Decoding staged points of segment %1 failed").arg(rec.segmentId));
+      return false;
+    }
   }
-  qint64 sourceCollectionId = varToLong(sql.value("collection_id"));
-
-  qDebug() << "Moving waypoint" << waypointId << "from collection" << sourceCollectionId << "to" << collectionId;
-
-  QSqlQuery sqlUpdate(db);
-  sqlUpdate.prepare("UPDATE `waypoint` SET `collection_id` = :collection_id  WHERE `id` = :id;");
-  sqlUpdate.bindValue(":id", waypointId);
-  sqlUpdate.bindValue(":collection_id", collectionId);
-  sqlUpdate.exec();
-
-  if (sqlUpdate.lastError().isValid()) {
-    qWarning() << "Move waypoint id" << waypointId << "fails";
-    emit error(tr("Move waypoint id %1 fails").arg(waypointId));
-    return;
+  sql.finish();
+
+  QSqlQuery sqlDelete(db);
+  sqlDelete.prepare(DeleteStagedBlocksStatement);
+  sqlDelete.bindValue(":segmentId", rec.segmentId);
+  sqlDelete.bindValue(":seq", rec.firstStagedSeq);
+  sqlDelete.exec();
+  if (sqlDelete.lastError().isValid()) {
+    qWarning() << "Deleting staged points of segment" << rec.segmentId << "failed" << sqlDelete.lastError();
+    emit error(tr("Deleting staged points of segment %1 failed: %2").arg(rec.segmentId).arg(sqlDelete.lastError().text()));
+    return false;
   }
 
-  Collection collection(sourceCollectionId);
-  if (loadCollectionDetailsPrivate(collection)) {
-    emit collectionDetailsLoaded(collection, true);
-  }else{
-    emit collectionDetailsLoaded(collection, false);
+  std::vector<EncodedTrackPointBlock> blocks = TrackPointBlock::encodeBlocks(points, TrackPointBlockSize);
+  if (!insertTrackPointBlocks(blocks, 0, blocks.size(), rec.segmentId, rec.firstStagedSeq)){
+    return false;
   }
-
-  collection.id = collectionId;
-  if (loadCollectionDetailsPrivate(collection)) {
-    emit collectionDetailsLoaded(collection, true);
-  }else{
-    emit collectionDetailsLoaded(collection, false);
+  rec.nextSeq = rec.firstStagedSeq + blocks.size();
+  if (!blocks.empty() && blocks.back().pointCount < TrackPointBlockSize){
+    // last block is not full, it will be merged with next points
+    rec.firstStagedSeq = rec.nextSeq - 1;
+    rec.stagedPoints = blocks.back().pointCount;
+  } else {
+    rec.firstStagedSeq = rec.nextSeq;
+    rec.stagedPoints = 0;
   }
+  return true;
 }
 
-void Storage::moveTrack(qint64 trackId, qint64 collectionId)
+bool Storage::closeRecordingSegment(TrackRecording &rec)
 {
-  if (!checkAccess("moveTrack")){
-    return;
+  if (!compactRecording(rec)){
+    return false;
+  }
+
+  gpx::TrackSegment segment;
+  if (!loadTrackPoints(rec.segmentId, segment) ||
+      !insertSegmentLod(rec.segmentId, encodeLod(segment.points))){
+    return false;
   }
 
   QSqlQuery sql(db);
-  sql.prepare("SELECT `collection_id` FROM `track` WHERE `id` = :id;");
-  sql.bindValue(":id", trackId);
+  sql.prepare(CloseSegmentStatement);
+  sql.bindValue(":segmentId", rec.segmentId);
   sql.exec();
-
   if (sql.lastError().isValid()) {
-    qWarning() << "Loading track id" << trackId << "fails";
-    emit error(tr("Loading track id %1 fails").arg(trackId));
-    return;
+    qWarning() << "Closing segment" << rec.segmentId << "failed" << sql.lastError();
+    emit error(tr("Closing segment %1 failed: %2").arg(rec.segmentId).arg(sql.lastError().text()));
+    return false;
   }
+  return true;
+}
 
-  if (!sql.next()) {
-    qWarning() << "Track id" << trackId << "not found";
-    emit error(tr("Track id %1 not found").arg(trackId));
-    return;
+TrackRecording* Storage::recording(qint64 trackId)
+{
+  auto it = recordings.find(trackId);
+  if (it != recordings.end()){
+    return &(it->second);
   }
-  qint64 sourceCollectionId = varToLong(sql.value("collection_id"));
-
-  qDebug() << "Moving track" << trackId << "from collection" << sourceCollectionId << "to" << collectionId;
-
-  QSqlQuery sqlUpdate(db);
-  sqlUpdate.prepare("UPDATE `track` SET `collection_id` = :collection_id  WHERE `id` = :id;");
-  sqlUpdate.bindValue(":id", trackId);
-  sqlUpdate.bindValue(":collection_id", collectionId);
-  sqlUpdate.exec();
-
-  if (sqlUpdate.lastError().isValid()) {
-    qWarning() << "Move track id" << trackId << "fails";
-    emit error(tr("Move track id %1 fails").arg(trackId));
-    return;
+  TrackRecording rec;
+  if (!restoreRecording(trackId, rec)){
+    return nullptr;
   }
+  return &(recordings[trackId] = std::move(rec));
+}
 
-  Collection collection(sourceCollectionId);
-  if (loadCollectionDetailsPrivate(collection)) {
-    emit collectionDetailsLoaded(collection, true);
-  }else{
-    emit collectionDetailsLoaded(collection, false);
+bool Storage::restoreRecording(qint64 trackId, TrackRecording &rec)
+{
+  QSqlQuery sqlTrk(db);
+  sqlTrk.prepare(TrackOpenStatement);
+  sqlTrk.bindValue(":trackId", trackId);
+  sqlTrk.exec();
+  if (sqlTrk.lastError().isValid() || !sqlTrk.next() || !sqlTrk.value(0).toBool()) {
+    qWarning() << "Track" << trackId << "is not open for recording" << sqlTrk.lastError();
+    emit error(tr("Track %1 is not open for recording").arg(trackId));
+    return false;
   }
+  sqlTrk.finish();
 
-  collection.id = collectionId;
-  if (loadCollectionDetailsPrivate(collection)) {
-    emit collectionDetailsLoaded(collection, true);
-  }else{
-    emit collectionDetailsLoaded(collection, false);
+  rec.trackId = trackId;
+  std::vector<StoredSegment> segments;
+  if (!loadSegmentStatistics(trackId, segments) ||
+      !loadStatisticsAccumulator(trackId, segments, rec.statistics)){
+    return false;
   }
-}
-
-Storage::operator bool() const
-{
-  return ok;
-}
 
-Storage* Storage::getInstance()
-{
-  return storage;
-}
+  // statistics of the open segment are continued, it is the last one
+  auto open = std::find_if(segments.rbegin(), segments.rend(),
+                           [](const StoredSegment &segment){ return segment.open; });
+  if (open == segments.rend()){
+    if (!segments.empty()){
+      rec.statistics.startSegment();
+    }
+    rec.segmentId = insertSegment(trackId, PreparedTrack::Segment(), /*open*/ true);
+    return rec.segmentId >= 0 && updateRecordingStatistics(rec);
+  }
+  rec.segmentId = open->id;
+  if (open->outdated && !updateRecordingStatistics(rec)){
+    return false;
+  }
 
-void Storage::initInstance(const QDir &directory)
-{
-  if (storage == nullptr){
-    QThread *thread = OSMScoutQt::GetInstance().makeThread("OverlayTileLoader");
-    storage = new Storage(thread, directory);
-    storage->moveToThread(thread);
-    connect(thread, SIGNAL(started()),
-            storage, SLOT(init()));
-    thread->start();
+  // staged blocks are at the end of segment, after the last full block
+  QSqlQuery sqlBlocks(db);
+  sqlBlocks.setForwardOnly(true);
+  sqlBlocks.prepare(OpenSegmentBlocksStatement);
+  sqlBlocks.bindValue(":segmentId", rec.segmentId);
+  sqlBlocks.exec();
+  if (sqlBlocks.lastError().isValid()) {
+    qWarning() << "Loading blocks of segment" << rec.segmentId << "failed" << sqlBlocks.lastError();
+    return false;
+  }
+  bool last = true;
+  while (sqlBlocks.next()){
+    qint64 seq = varToLong(sqlBlocks.value(0));
+    qint64 pointCount = varToLong(sqlBlocks.value(1));
+    if (last){
+      last = false;
+      rec.nextSeq = seq + 1;
+      rec.firstStagedSeq = rec.nextSeq;
+    }
+    if (pointCount >= TrackPointBlockSize){
+      break;
+    }
+    rec.firstStagedSeq = seq;
+    rec.stagedPoints += pointCount;
   }
+  qDebug() << "Recording of track" << trackId << "restored, segment" << rec.segmentId
+           << "with" << rec.stagedPoints << "staged points";
+  return true;
 }
 
-void Storage::clearInstance()
+void Storage::forgetDeletedRecordings()
 {
-  if (storage != nullptr){
-    storage->deleteLater();
-    storage = nullptr;
+  for (auto it = recordings.begin(); it != recordings.end();){
+    QSqlQuery sql(db);
+    sql.prepare(TrackExistsStatement);
+    sql.bindValue(":trackId", it->first);
+    sql.exec();
+    if (!sql.lastError().isValid() && !sql.next()){
+      qDebug() << "Recorded track" << it->first << "was deleted";
+      it = recordings.erase(it);
+    } else {
+      it++;
+    }
   }
 }
@@ -25,14 +25,28 @@
 #include <osmscout/gpx/GpxFile.h>
 #include <osmscout/util/GeoBox.h>
 
+#include "TrackPointBlock.h"
+#include "TrackPointBuffer.h"
+#include "TrackStatisticsAccumulator.h"
+
 #include <QObject>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlError>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QSet>
 #include <QtCore/QDateTime>
 
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+
+class SqlRowReader;
+class ImportJob;
+class GpxStreamWriter;
+class QSqlQuery;
 
 class ErrorCallback: public QObject, public osmscout::gpx::ProcessCallback
 {
@@ -84,23 +98,6 @@ public:
     bbox(bbox)
   {};
 
-  TrackStatistics(const TrackStatistics &o):
-    from(o.from),
-    to(o.to),
-    distance(o.distance),
-    rawDistance(o.rawDistance),
-    duration(o.duration),
-    movingDuration(o.movingDuration),
-    maxSpeed(o.maxSpeed),
-    averageSpeed(o.averageSpeed),
-    movingAverageSpeed(o.movingAverageSpeed),
-    ascent(o.ascent),
-    descent(o.descent),
-    minElevation(o.minElevation),
-    maxElevation(o.maxElevation),
-    bbox(o.bbox)
-  {};
-
 public:
   QDateTime from;
   QDateTime to;
@@ -118,6 +115,17 @@ public:
   osmscout::GeoBox   bbox;
 };
 
+/**
+ * points of track segments, in compact form (see TrackPointBuffer)
+ */
+using TrackSegments = std::vector<TrackPointBuffer>;
+
+/**
+ * statistics of track segments, in track order. They are computed in context
+ * of the track (see TrackStatisticsAccumulator::segmentStatistics).
+ */
+using SegmentStatisticsList = std::shared_ptr<const std::vector<TrackStatistics>>;
+
 class Track
 {
 public:
@@ -130,12 +138,6 @@ public:
     statistics(statistics)
   {};
 
-  Track(const Track &o):
-    id(o.id), collectionId(o.collectionId), name(o.name), description(o.description), open(o.open),
-    creationTime(o.creationTime), lastModification(o.lastModification),
-    statistics(o.statistics), data(o.data)
-  {};
-
 public:
   qint64 id{-1};
   qint64 collectionId{-1};
@@ -146,7 +148,47 @@ public:
   QDateTime lastModification;
 
   TrackStatistics statistics;
-  std::shared_ptr<osmscout::gpx::Track> data;
+  SegmentStatisticsList segmentStatistics; // loaded with track data
+  std::shared_ptr<TrackSegments> data;
+};
+
+/**
+ * Part of track points, emitted by Storage::streamTrackData
+ */
+class TrackChunk
+{
+public:
+  TrackChunk() = default;
+
+  TrackChunk(qint64 requestId, size_t segment, size_t offset, TrackPointBuffer &&points):
+    requestId(requestId), segment(segment), offset(offset),
+    points(std::make_shared<TrackPointBuffer>(std::move(points)))
+  {}
+
+public:
+  qint64 requestId{0}; // passed to Storage::streamTrackData
+  size_t segment{0}; // index of segment in track
+  size_t offset{0}; // index of first chunk point in segment
+  std::shared_ptr<TrackPointBuffer> points;
+};
+
+/**
+ * Simplified geometry of track, emitted by Storage::loadTrackLod
+ * (see TrackSimplifier). Segments are null when loading failed.
+ */
+class TrackLod
+{
+public:
+  TrackLod() = default;
+
+  TrackLod(int level, std::vector<std::vector<osmscout::GeoCoord>> &&segments):
+    level(level),
+    segments(std::make_shared<std::vector<std::vector<osmscout::GeoCoord>>>(std::move(segments)))
+  {}
+
+public:
+  int level{0};
+  std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord>>> segments;
 };
 
 class Waypoint
@@ -154,20 +196,30 @@ class Waypoint
 public:
   Waypoint() = default;
 
-  Waypoint(qint64 id, const QDateTime &lastModification, const osmscout::gpx::Waypoint &data):
-    id(id), lastModification(lastModification), data(data)
+  Waypoint(qint64 id, qint64 collectionId, const QDateTime &lastModification, const osmscout::gpx::Waypoint &data):
+    id(id), collectionId(collectionId), lastModification(lastModification), data(data)
   {}
 
-  Waypoint(qint64 id, const QDateTime &lastModification, osmscout::gpx::Waypoint &&data):
-    id(id), lastModification(lastModification), data(std::move(data))
+  Waypoint(qint64 id, qint64 collectionId, const QDateTime &lastModification, osmscout::gpx::Waypoint &&data):
+    id(id), collectionId(collectionId), lastModification(lastModification), data(std::move(data))
   {}
 
 public:
   qint64 id{-1};
+  qint64 collectionId{-1};
   QDateTime lastModification;
   osmscout::gpx::Waypoint data{osmscout::GeoCoord()};
 };
 
+/**
+ * Immutable lists shared by all receivers of storage signals.
+ * Qt copies arguments of queued signal for every connected receiver,
+ * copy of the list is just a pointer copy. List is never modified
+ * after it is emitted, changed data are emitted as a new list.
+ */
+using TrackList = std::shared_ptr<const std::vector<Track>>;
+using WaypointList = std::shared_ptr<const std::vector<Waypoint>>;
+
 class Collection
 {
 public:
@@ -189,28 +241,134 @@ public:
   QString name;
   QString description;
 
-  std::shared_ptr<std::vector<Track>> tracks;
-  std::shared_ptr<std::vector<Waypoint>> waypoints;
+  // summary maintained by database (collection_summary table)
+  qint64 trackCount{0};
+  qint64 waypointCount{0};
+  osmscout::Distance distance;
+  std::chrono::milliseconds duration{0};
+  osmscout::GeoBox bbox; // invalid for empty collection
+  QDateTime lastModification;
+
+  TrackList tracks;
+  WaypointList waypoints;
 };
 
-class MaxSpeedBuffer{
+using CollectionList = std::shared_ptr<const std::vector<Collection>>;
+
+/**
+ * Track or waypoint found by full-text search, emitted by Storage::searchItems
+ */
+class SearchResultItem
+{
 public:
-  MaxSpeedBuffer() = default;
-  ~MaxSpeedBuffer() = default;
+  enum Type {
+    WaypointType = 0,
+    TrackType = 1
+  };
 
-  void flush();
-  void insert(const osmscout::gpx::TrackPoint &p);
+public:
+  Type type{WaypointType};
+  qint64 id{-1};
+  qint64 collectionId{-1};
+  QString collectionName;
+  QString name;
+  QString description;
+  QString symbol;
+  osmscout::GeoBox bbox; // waypoint position or track bounding box
+  double rank{0}; // bm25 score, lower is better
+};
 
-  // return maximum computed speed in m / s
-  double getMaxSpeed() const;
+/**
+ * Size of database files, emitted by Storage::loadDatabaseStats
+ */
+class DatabaseStats
+{
+public:
+  /**
+   * share of unused pages in database file (0..1),
+   * they are reclaimed by incremental vacuum when storage is idle
+   */
+  double fragmentation() const
+  {
+    return pageCount > 0 ? double(freePages) / double(pageCount) : 0;
+  }
 
-private:
-  QList<osmscout::Distance> distanceFifo;
-  QList<std::chrono::milliseconds> timeFifo;
-  osmscout::Distance bufferDistance;
-  std::chrono::milliseconds bufferTime{0};
-  std::shared_ptr<osmscout::gpx::TrackPoint> lastPoint;
-  double maxSpeed{0}; // m / s
+public:
+  qint64 fileSize{0}; // bytes, main database file
+  qint64 walSize{0}; // bytes, write-ahead log
+  qint64 pageSize{0}; // bytes
+  qint64 pageCount{0};
+  qint64 freePages{0};
+  bool incrementalVacuum{false}; // auto_vacuum mode of database
+};
+
+/**
+ * Track prepared for import by worker threads:
+ * statistics and encoded point blocks of every segment
+ */
+class PreparedTrack
+{
+public:
+  class Segment
+  {
+  public:
+    TrackStatistics statistics{TrackStatisticsAccumulator().statistics()};
+    QByteArray state; // statistics state after the segment, see StoredSegment
+    std::vector<EncodedTrackPointBlock> blocks;
+    std::vector<EncodedTrackPointBlock> lod; // simplified geometry, levels 1..TrackSimplifier::LevelCount
+    bool hasFingerprint{false}; // false for empty segment
+    qint64 fingerprint{0}; // see ContentFingerprint::segment
+  };
+
+public:
+  TrackStatistics statistics;
+  std::vector<Segment> segments;
+};
+
+/**
+ * Statistics of track segment stored in track_segment table
+ */
+class StoredSegment
+{
+public:
+  qint64 id{-1};
+  bool open{false};
+  bool outdated{true}; // computed by older rules (see StatisticsVersion in Storage.cpp)
+  TrackStatistics statistics;
+  QByteArray state; // TrackStatisticsAccumulator state after the segment, empty when unknown
+};
+
+/**
+ * Segment accumulated partially by step of statistics recomputation
+ * (see Storage::recomputeStatistics), it is continued by the next step
+ */
+class StatisticsProgress
+{
+public:
+  qint64 trackId{-1};
+  qint64 segmentId{-1};
+  qint64 nextSeq{0}; // first block that is not accumulated yet
+  QByteArray state; // TrackStatisticsAccumulator state after accumulated blocks
+};
+
+/**
+ * Track opened for recording (see Storage::openTrack).
+ *
+ * Points appended to the track are kept in memory until next flush,
+ * then they are written as one small block to the end of the open segment.
+ * These small (staged) blocks are merged to full blocks when there are
+ * enough points, so cost of every flush is bounded.
+ */
+class TrackRecording
+{
+public:
+  qint64 trackId{-1};
+  qint64 segmentId{-1};
+  qint64 nextSeq{0}; // sequence number of the next block in segment
+  qint64 firstStagedSeq{0}; // first block of segment that is not full
+  qint64 stagedPoints{0}; // points in blocks from firstStagedSeq
+  TrackStatisticsAccumulator statistics; // of the track, its current segment is the open one
+  std::vector<osmscout::gpx::TrackPoint> pending; // points that are not flushed yet
 };
 
 class Storage : public QObject{
@@ -219,15 +377,30 @@ class Storage : public QObject{
 
 private:
   bool updateSchema();
+#ifdef STORAGE_QUERY_PLAN_CHECK
+  bool checkQueryPlans();
+#endif
 
 signals:
   void initialised();
   void initialisationError(QString error);
 
-  void collectionsLoaded(std::vector<Collection> collections, bool ok);
+  void collectionsLoaded(CollectionList collections, bool ok);
   void collectionDetailsLoaded(Collection collection, bool ok);
-  void trackDataLoaded(Track track, bool complete, bool ok);
+  void trackDataLoaded(Track track, qint64 requestId, bool complete, bool ok);
+  void trackDataChunkLoaded(Track track, TrackChunk chunk);
+  void trackLodLoaded(Track track, TrackLod lod);
   void collectionExported(bool success);
+  void tracksInBoxLoaded(osmscout::GeoBox box, TrackList tracks, bool ok);
+  void waypointsInBoxLoaded(osmscout::GeoBox box, WaypointList waypoints, bool ok);
+  void searchFinished(QString pattern, std::vector<SearchResultItem> items, bool ok);
+  void importProgress(qint64 jobId, QString filePath, double progress);
+  void importFinished(qint64 jobId, QString filePath, bool success, bool cancelled, int duplicates);
+  void trackOpened(qint64 collectionId, qint64 trackId, bool ok);
+  void trackPointsFlushed(qint64 trackId, int pointCount);
+  void trackClosed(qint64 trackId, bool ok);
+  void databaseStatsLoaded(DatabaseStats stats);
+  void databaseRebuilt(bool success);
   void error(QString);
 
 public slots:
@@ -246,10 +419,48 @@ public slots:
   void loadCollectionDetails(Collection collection);
 
   /**
-   * load track data
+   * load track data, requestId is echoed in trackDataLoaded (see newRequestId)
    * emits trackDataLoaded
    */
-  void loadTrackData(Track track);
+  void loadTrackData(Track track, qint64 requestId);
+
+  /**
+   * load track data progressively, track points are emitted in chunks
+   * as they are read from database. Results of several requests for the same
+   * track may interleave, requestId (see newRequestId) is echoed
+   * in trackDataLoaded and in every chunk to tell them apart.
+   * emits trackDataLoaded (metadata), trackDataChunkLoaded for every chunk
+   * and trackDataLoaded without data when all chunks are emitted
+   */
+  void streamTrackData(Track track, qint64 requestId);
+
+  /**
+   * load simplified track geometry of given level (1..TrackSimplifier::LevelCount),
+   * segments without stored geometry are simplified on the fly
+   * emits trackLodLoaded
+   */
+  void loadTrackLod(Track track, int level);
+
+  /**
+   * load tracks with bounding box intersecting given box,
+   * from all visible collections. Tracks are loaded without data.
+   * emits tracksInBoxLoaded
+   */
+  void loadTracksInBox(osmscout::GeoBox box);
+
+  /**
+   * load waypoints inside given box, from all visible collections
+   * emits waypointsInBoxLoaded
+   */
+  void loadWaypointsInBox(osmscout::GeoBox box);
+
+  /**
+   * full-text search of tracks and waypoints in all collections,
+   * by name, description and symbol. Every word of pattern is matched
+   * as prefix, results are ordered by relevance.
+   * emits searchFinished
+   */
+  void searchItems(QString pattern, int limit);
 
   /**
    * update collection or create it (if id < 0)
@@ -264,11 +475,22 @@ public slots:
   void deleteCollection(qint64 id);
 
   /**
-   * import collection from gpx file
-   * emits collectionsLoaded signal
+   * import collection from gpx file. Import is queued as a job,
+   * it is processed in steps and other requests are served between them.
+   * Waypoints and tracks that are stored already (with the same content
+   * fingerprint) are skipped, their count is reported by importFinished.
+   * emits importProgress while job is running, importFinished
+   * and collectionsLoaded when it is done
    */
   void importCollection(QString filePath);
 
+  /**
+   * cancel running or queued import job,
+   * collection partially imported is removed
+   * emits importFinished
+   */
+  void cancelImport(qint64 jobId);
+
   /**
    * delete waypoint
    * emits collectionDetailsLoaded
@@ -276,11 +498,23 @@ public slots:
   void deleteWaypoint(qint64 collectionId, qint64 waypointId);
 
   /**
-   * delete waypoint
+   * delete waypoints of collection in one transaction
+   * emits collectionDetailsLoaded once
+   */
+  void deleteWaypoints(qint64 collectionId, QList<qint64> waypointIds);
+
+  /**
+   * delete track
    * emits collectionDetailsLoaded
    */
   void deleteTrack(qint64 collectionId, qint64 trackId);
 
+  /**
+   * delete tracks of collection in one transaction
+   * emits collectionDetailsLoaded once
+   */
+  void deleteTracks(qint64 collectionId, QList<qint64> trackIds);
+
   /**
    * create waypoint
    * emits collectionDetailsLoaded
@@ -313,35 +547,314 @@ public slots:
   void moveWaypoint(qint64 waypointId, qint64 collectionId);
   void moveTrack(qint64 trackId, qint64 collectionId);
 
+  /**
+   * move waypoints (tracks) to collection in one transaction,
+   * waypoints may come from different collections
+   * emits collectionDetailsLoaded once for every source and target collection
+   */
+  void moveWaypoints(QList<qint64> waypointIds, qint64 collectionId);
+  void moveTracks(QList<qint64> trackIds, qint64 collectionId);
+
+  /**
+   * delete segment (by index) of closed track. Track statistics are folded
+   * from states of remaining segments, just segments with changed entry
+   * boundary (elevation reference, maximum speed window) are accumulated
+   * from points again
+   * emits collectionDetailsLoaded
+   */
+  void deleteTrackSegment(qint64 collectionId, qint64 trackId, int segment);
+
+  /**
+   * create open track with one open segment for recording
+   * emits trackOpened and collectionDetailsLoaded
+   */
+  void openTrack(qint64 collectionId, QString name, QString description);
+
+  /**
+   * close current segment of recorded track and open new one
+   */
+  void openSegment(qint64 trackId);
+
+  /**
+   * append points to the open segment of recorded track. Points are
+   * written to database in group with other appended points, after flush
+   * interval (see setRecordingFlushInterval). Track may be open in previous
+   * application run, its recording continues then.
+   * emits trackPointsFlushed when points are written
+   */
+  void appendTrackPoints(qint64 trackId, std::vector<osmscout::gpx::TrackPoint> points);
+
+  /**
+   * write pending points, close the segment and the track
+   * emits trackClosed and collectionDetailsLoaded
+   */
+  void closeTrack(qint64 trackId);
+
+  /**
+   * emits databaseStatsLoaded
+   */
+  void loadDatabaseStats();
+
+  /**
+   * rebuild database created without incremental auto vacuum
+   * (see DatabaseStats::incrementalVacuum), so free pages are reclaimed
+   * by idle maintenance. Whole database is copied and storage is blocked
+   * meanwhile, so it is executed on user request only, and it is refused
+   * while some track is recorded or imported.
+   * emits databaseRebuilt and databaseStatsLoaded
+   */
+  void rebuildDatabase();
+
+private slots:
+  /**
+   * convert track points of one segment from legacy track_point table
+   * to compressed blocks and schedule itself for next segment
+   */
+  void migrateTrackPoints();
+
+  /**
+   * compute simplified geometry of one segment imported before
+   * geometry levels were introduced and schedule itself for next segment.
+   * On failure the segment stays pending and the step is repeated later.
+   */
+  void computeTrackLod();
+
+  /**
+   * recompute statistics of tracks computed by older rules (stats_version),
+   * one batch of tracks, and schedule itself for next batch. Point blocks are read
+   * by storage thread, tracks are decoded and accumulated by worker threads in parallel.
+   * Step is limited by count of points, track is split between steps: accumulated
+   * segments are stored with their state, partially accumulated segment is continued
+   * from accumulator state kept in memory (statisticsProgress).
+   * On failure error is emitted and the step is repeated later.
+   * emits collectionDetailsLoaded for affected collections and collectionsLoaded
+   * when all tracks are recomputed
+   */
+  void recomputeStatistics();
+
+  /**
+   * process one step of the first import job and schedule itself
+   * for next step
+   */
+  void processImportJob();
+
+  /**
+   * write pending points of all recorded tracks in single transaction
+   */
+  void flushRecordings();
+
+  /**
+   * idle-time maintenance: one time rebuild of database without incremental
+   * auto vacuum, ANALYZE after bulk changes and reclaiming
+   * of free pages by small incremental vacuum steps. It is scheduled
+   * by every request and it waits until storage is idle (see setMaintenanceIdleDelay),
+   * reschedules itself while there are free pages.
+   */
+  void maintenance();
+
 public:
+  /**
+   * @param thread thread where this instance lives
+   * @param directory database directory
+   * @param writer when not null, instance is read-only connection
+   * (reader) serving read slots only: loadCollections, loadCollectionDetails,
+   * loadTrackData, streamTrackData, loadTrackLod, loadTracksInBox,
+   * loadWaypointsInBox and exportCollection
+   * @param readerId reader number, for connection name
+   */
   Storage(QThread *thread,
-          const QDir &directory);
+          const QDir &directory,
+          Storage *writer = nullptr,
+          int readerId = 0);
   virtual ~Storage();
 
   operator bool() const;
 
   static void initInstance(const QDir &directory);
+
+  /**
+   * Storage instance with single writer connection. All mutations
+   * have to be requested from this instance. Results of reads
+   * served by readers are emitted by writer signals too.
+   */
   static Storage* getInstance();
+
+  /**
+   * One of the read-only connections living on its own thread,
+   * read requests may be served in parallel with long writes (import).
+   * Returns writer instance when there are no readers.
+   */
+  static Storage* getReader();
+
+  /**
+   * unique id of track data request, for any thread
+   * (see streamTrackData)
+   */
+  static qint64 newRequestId();
+
   static void clearInstance();
 
+  /**
+   * Count of track points (waypoints) committed in one transaction
+   * during import. Bigger batches are faster, smaller keeps
+   * the write lock shorter. It may be changed from any thread.
+   */
+  void setTrackPointBatchSize(int size);
+  void setWayPointBatchSize(int size);
+
+  /**
+   * Interval (ms) between writes of recorded track points. Points appended
+   * meanwhile are committed in one transaction, application crash
+   * loses at most this interval. When sync is enabled, every flush waits
+   * until data are on disk, otherwise last flushes may be lost on power loss.
+   * It may be changed from any thread.
+   */
+  void setRecordingFlushInterval(int ms);
+  void setRecordingSync(bool sync);
+
+  /**
+   * Time (ms) without requests before maintenance starts.
+   * It may be changed from any thread.
+   */
+  void setMaintenanceIdleDelay(int ms);
+
 private:
-  Track makeTrack(QSqlQuery &sqlTrack) const;
-  std::shared_ptr<std::vector<Track>> loadTracks(qint64 collectionId);
-  std::shared_ptr<std::vector<Waypoint>> loadWaypoints(qint64 collectionId);
-  void loadTrackPoints(qint64 segmentId, osmscout::gpx::TrackSegment &segment);
+  Track makeTrack(SqlRowReader &row) const;
+  Waypoint makeWaypoint(SqlRowReader &row) const;
+  TrackList loadTracks(qint64 collectionId);
+  WaypointList loadWaypoints(qint64 collectionId);
+  /**
+   * append points of segment, error is emitted on failure
+   * @return false on failure
+   */
+  bool loadTrackPoints(qint64 segmentId, osmscout::gpx::TrackSegment &segment);
+  bool loadTrackPoints(qint64 segmentId, TrackPointBuffer &points);
+  bool loadLegacyTrackPoints(qint64 segmentId, osmscout::gpx::TrackSegment &segment);
   bool checkAccess(QString slotName, bool requireOpen = true);
-  bool importWaypoints(const osmscout::gpx::GpxFile &file, qint64 collectionId);
-  bool importTracks(const osmscout::gpx::GpxFile &file, qint64 collectionId);
-  bool importTrackPoints(const std::vector<osmscout::gpx::TrackPoint> &points, qint64 segId);
-  TrackStatistics computeTrackStatistics(const osmscout::gpx::Track &trk) const;
+  bool configureConnection();
+  bool enableIncrementalVacuum();
+  void scheduleMaintenance(int delay);
+  bool analyze();
+  bool vacuumStep(bool &morePages);
+  bool isReader() const;
+  bool hasLegacyTrackPoints() const;
+  qint64 dataVersion();
+
+  /**
+   * execute read in single read transaction on reader connection
+   * @param retryOnChange read again when database was modified by writer meanwhile
+   */
+  bool consistentRead(const std::function<bool()> &read, bool retryOnChange = true);
+  bool insertWaypoints(const std::vector<osmscout::gpx::Waypoint> &waypoints,
+                       size_t from, size_t to,
+                       qint64 collectionId,
+                       const QDateTime &now,
+                       size_t &duplicates);
+  bool insertTrackPointBlocks(const std::vector<EncodedTrackPointBlock> &blocks,
+                              size_t from, size_t to,
+                              qint64 segId,
+                              qint64 firstSeq = 0);
+  qint64 insertCollection(const osmscout::gpx::GpxFile &file, const QString &filePath);
+  qint64 insertTrack(const osmscout::gpx::Track &trk, size_t trkNum, const TrackStatistics &stat, qint64 collectionId,
+                     bool open = false);
+  static void bindTrackStatistics(QSqlQuery &sql, const TrackStatistics &stat);
+
+  /**
+   * restore incremental statistics of the track. When the track has no usable state,
+   * statistics are folded from its segments (see foldTrackStatistics)
+   */
+  bool loadStatisticsAccumulator(qint64 trackId, std::vector<StoredSegment> &segments,
+                                 TrackStatisticsAccumulator &accumulator);
+
+  /**
+   * fold statistics of segments to accumulator, in track order. Segment with stored
+   * state computed from the same entry boundary is appended by its state, without points.
+   * Other segments are accumulated from points, their statistics and state are updated.
+   * @return false on database error
+   */
+  bool foldTrackStatistics(qint64 trackId, std::vector<StoredSegment> &segments,
+                           TrackStatisticsAccumulator &accumulator);
+
+  /**
+   * append points of stored segment to accumulator, block by block
+   * @param points incremented by count of appended points
+   * @param decoded false when some block can't be decoded, accumulator is incomplete then
+   * @return false on database error
+   */
+  bool accumulateSegmentStatistics(qint64 segmentId, TrackStatisticsAccumulator &accumulator,
+                                   qint64 &points, bool &decoded);
+
+  /**
+   * statistics of track segments as they are stored, in track order
+   */
+  bool loadSegmentStatistics(qint64 trackId, std::vector<StoredSegment> &segments);
+
+  bool updateSegmentStatistics(qint64 segmentId, const TrackStatistics &statistics, const QByteArray &state);
+
+  /**
+   * store track statistics and accumulator state of open track
+   */
+  bool updateTrackStatistics(qint64 trackId, const TrackStatistics &statistics, const QVariant &state);
+
+  /**
+   * store statistics and state of the open segment and of the track extended by new points
+   */
+  bool updateRecordingStatistics(const TrackRecording &recording);
+
+  TrackRecording* recording(qint64 trackId);
+  bool restoreRecording(qint64 trackId, TrackRecording &recording);
+  bool flushRecording(TrackRecording &recording);
+  bool compactRecording(TrackRecording &recording);
+  bool closeRecordingSegment(TrackRecording &recording);
+  void forgetDeletedRecordings();
+
+  /**
+   * delete collection with its summary, tracks and waypoints (by cascade)
+   */
+  bool deleteCollectionPrivate(qint64 id);
+  QSqlError deleteItems(const QString &table, qint64 collectionId, const QList<qint64> &ids);
+  QSqlError moveItems(const QString &table, const QList<qint64> &ids, qint64 collectionId, QSet<qint64> &sourceCollections);
+  void emitCollectionDetails(const QSet<qint64> &collectionIds);
+  qint64 insertSegment(qint64 trackId, const PreparedTrack::Segment &segment, bool open = false);
+  bool insertSegmentLod(qint64 segmentId, const std::vector<EncodedTrackPointBlock> &lod);
+  static std::vector<EncodedTrackPointBlock> encodeLod(const std::vector<osmscout::gpx::TrackPoint> &points);
+  bool importStep(ImportJob &job);
+  void startImportJob();
+  void scheduleImportJob(int delay = 0);
+  void reportImportProgress(ImportJob &job);
+  void finishImportJob(bool success);
+  PreparedTrack prepareTrack(const osmscout::gpx::Track &trk) const;
+  bool isDuplicateTrack(const PreparedTrack &track, bool &duplicate);
   bool loadCollectionDetailsPrivate(Collection &collection);
-  bool loadTrackDataPrivate(Track &track);
+  bool exportCollectionPrivate(qint64 collectionId, GpxStreamWriter &writer);
+  bool loadTrackDataPrivate(Track &track, qint64 requestId, bool stream = false);
+  bool streamTrackPoints(const Track &track, qint64 requestId, size_t segmentIndex, qint64 segmentId);
 
 private :
   QSqlDatabase db;
   QThread *thread;
   QDir directory;
   std::atomic_bool ok{false};
+  std::atomic_bool legacyTrackPoints{false};
+  bool pendingTrackLod{false}; // some segments are without simplified geometry
+  QSet<qint64> recomputedCollections; // with recomputed track statistics, not emitted yet
+  StatisticsProgress statisticsProgress; // segment split by the last recomputation step
+  std::atomic_int trackPointBatchSize;
+  std::atomic_int wayPointBatchSize;
+  Storage *writer{nullptr};
+  std::vector<Storage*> readers;
+  QString connectionName;
+  std::deque<std::shared_ptr<ImportJob>> importJobs; // first job is running
+  qint64 nextImportJobId{1};
+  std::map<qint64, TrackRecording> recordings; // by track id
+  bool recordingFlushScheduled{false};
+  std::atomic_int recordingFlushInterval;
+  std::atomic_bool recordingSync{false};
+  QElapsedTimer lastActivity; // since last request to writer
+  bool maintenanceScheduled{false};
+  std::atomic_int maintenanceIdleDelay;
+  bool analyzed{false}; // database has statistics for query planner
+  qint64 analyzedChanges{0}; // total_changes() when ANALYZE was executed
 };
 
 #endif //OSMSCOUT_SAILFISH_STORAGE_H
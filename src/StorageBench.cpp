@@ -0,0 +1,514 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "Storage.h"
+#include "StorageFixture.h"
+
+#include <osmscout/gpx/Export.h>
+#include <osmscout/gpx/GpxFile.h>
+#include <osmscout/util/CmdLineParsing.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+
+/*
+  End-to-end benchmark of collection storage with synthetic data.
+
+  Generates gpx files (one per collection) with noisy tracks and waypoints,
+  then runs the whole collection workflow against temporary database:
+  import, loading of collection list, details and track data, export,
+  moves and deletes. Result is printed (or written to file) as JSON
+  with latency percentiles of every operation, throughput, peak memory
+  and database size, so runs may be compared by scripts.
+
+  src/StorageBench --collections 10 --tracks 5 --points 10000 --waypoints 20
+  src/StorageBench --collections 2 --tracks 50 --points 1000 --output bench.json
+*/
+
+using namespace osmscout;
+
+struct Arguments
+{
+  bool        help=false;
+  size_t      collections=10;
+  size_t      tracks=5; // per collection
+  size_t      points=10000; // per track
+  size_t      waypoints=20; // per track
+  size_t      repeat=5; // repeat of read operations
+  size_t      seed=1;
+  std::string output; // stdout when empty
+};
+
+namespace {
+
+constexpr double MetersPerDegree = 111320.0;
+
+/**
+ * Latency samples of one operation, in milliseconds
+ */
+class Samples
+{
+public:
+  void add(double millis)
+  {
+    samples.push_back(millis);
+  }
+
+  double total() const
+  {
+    double sum = 0;
+    for (double s: samples){
+      sum += s;
+    }
+    return sum;
+  }
+
+  /**
+   * nearest-rank percentile
+   */
+  double percentile(double p) const
+  {
+    if (samples.empty()){
+      return 0;
+    }
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+  }
+
+  /**
+   * @param items processed by all samples (points, objects...), for throughput
+   * @param unit of items
+   */
+  QJsonObject toJson(double items = 0, const QString &unit = QString()) const
+  {
+    QJsonObject result;
+    result["count"] = double(samples.size());
+    result["total_ms"] = total();
+    result["p50_ms"] = percentile(50);
+    result["p90_ms"] = percentile(90);
+    result["p99_ms"] = percentile(99);
+    result["max_ms"] = percentile(100);
+    if (items > 0 && total() > 0){
+      result["throughput"] = items / (total() / 1000.0);
+      result["throughput_unit"] = unit + "/s";
+    }
+    return result;
+  }
+
+private:
+  std::vector<double> samples;
+};
+
+/**
+ * Random walk of moving person with gps noise: speed changes, stops,
+ * heading drift, elevation trend and signal gaps splitting track to segments.
+ */
+gpx::Track generateTrack(std::mt19937 &rng, const std::string &name, size_t count, Timestamp &time)
+{
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> gpsNoise(0.0, 3.0); // meters
+  std::normal_distribution<double> elevationNoise(0.0, 1.5); // meters
+  std::normal_distribution<double> headingDrift(0.0, 0.08); // radians per second
+
+  gpx::Track track;
+  track.name = gpx::Optional<std::string>::of(name);
+
+  double lat = 45.0 + uniform(rng) * 10.0;
+  double lon = 5.0 + uniform(rng) * 20.0;
+  double elevation = 200.0 + uniform(rng) * 800.0;
+  double heading = uniform(rng) * 2 * M_PI;
+  double speed = 1.0 + uniform(rng) * 6.0; // m/s, walk to bike
+  size_t stop = 0;
+
+  gpx::TrackSegment segment;
+  for (size_t i = 0; i < count; i++){
+    double seconds = 1.0 + std::floor(uniform(rng) * 1.1); // 1 Hz with occasional skipped fix
+    time += std::chrono::milliseconds(int64_t(seconds * 1000));
+
+    if (stop > 0){
+      stop--;
+    } else if (uniform(rng) < 0.001){
+      stop = 30 + size_t(uniform(rng) * 90);
+    } else {
+      speed = std::max(0.5, std::min(12.0, speed + (uniform(rng) - 0.5) * 0.3));
+      heading += headingDrift(rng) * seconds;
+      double distance = speed * seconds;
+      lat += std::cos(heading) * distance / MetersPerDegree;
+      lon += std::sin(heading) * distance / (MetersPerDegree * std::cos(lat * M_PI / 180.0));
+      elevation += std::sin(i / 600.0) * 0.2 * seconds;
+    }
+
+    // signal lost in tunnel or in the building
+    if (!segment.points.empty() && uniform(rng) < 0.0002){
+      track.segments.push_back(std::move(segment));
+      segment = gpx::TrackSegment();
+      time += std::chrono::minutes(5);
+    }
+
+    double noiseLat = gpsNoise(rng) / MetersPerDegree;
+    double noiseLon = gpsNoise(rng) / (MetersPerDegree * std::cos(lat * M_PI / 180.0));
+    gpx::TrackPoint p(GeoCoord(lat + noiseLat, lon + noiseLon));
+    p.time = gpx::Optional<Timestamp>::of(time);
+    p.elevation = gpx::Optional<double>::of(elevation + elevationNoise(rng));
+    p.hdop = gpx::Optional<double>::of(1.0 + uniform(rng) * 4.0);
+    segment.points.push_back(std::move(p));
+  }
+  if (!segment.points.empty()){
+    track.segments.push_back(std::move(segment));
+  }
+  return track;
+}
+
+bool writeCollection(const QString &file, const Arguments &args, size_t collection, std::mt19937 &rng)
+{
+  gpx::GpxFile gpxFile;
+  gpxFile.name = gpx::Optional<std::string>::of("bench collection " + std::to_string(collection));
+
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  auto time = Timestamp(std::chrono::milliseconds(int64_t(1530000000) * 1000));
+  time += std::chrono::hours(24 * collection);
+  for (size_t t = 0; t < args.tracks; t++){
+    gpx::Track track = generateTrack(rng,
+                                     "bench track " + std::to_string(collection) + "-" + std::to_string(t),
+                                     args.points, time);
+    time += std::chrono::hours(1);
+
+    // waypoints near the track
+    for (size_t w = 0; w < args.waypoints && !track.segments.empty(); w++){
+      const auto &points = track.segments.front().points;
+      const gpx::TrackPoint &p = points[size_t(uniform(rng) * points.size()) % points.size()];
+      gpx::Waypoint wpt(GeoCoord(p.coord.GetLat() + (uniform(rng) - 0.5) * 0.001,
+                                 p.coord.GetLon() + (uniform(rng) - 0.5) * 0.001));
+      wpt.time = p.time;
+      wpt.elevation = p.elevation;
+      wpt.name = gpx::Optional<std::string>::of("waypoint " + std::to_string(t) + "-" + std::to_string(w));
+      wpt.symbol = gpx::Optional<std::string>::of(std::string("Flag"));
+      gpxFile.waypoints.push_back(std::move(wpt));
+    }
+    gpxFile.tracks.push_back(std::move(track));
+  }
+
+  return gpx::ExportGpx(gpxFile, file.toStdString(), nullptr, nullptr);
+}
+
+QJsonObject statsToJson(const DatabaseStats &stats)
+{
+  QJsonObject result;
+  result["file_bytes"] = double(stats.fileSize);
+  result["wal_bytes"] = double(stats.walSize);
+  result["pages"] = double(stats.pageCount);
+  result["free_pages"] = double(stats.freePages);
+  return result;
+}
+
+template<typename Fn>
+double measure(Fn fn)
+{
+  QElapsedTimer timer;
+  timer.start();
+  fn();
+  return timer.nsecsElapsed() / 1e6;
+}
+
+int run(const Arguments &args)
+{
+  StorageFixture fixture;
+  if (!fixture.isValid()){
+    return 1;
+  }
+
+  std::mt19937 rng(args.seed);
+  QStringList files;
+  std::cerr << "Generating " << args.collections << " collections..." << std::endl;
+  for (size_t c = 0; c < args.collections; c++){
+    QString file = fixture.filePath(QString("collection%1.gpx").arg(c));
+    if (!writeCollection(file, args, c, rng)){
+      std::cerr << "Cannot write gpx file" << std::endl;
+      return 1;
+    }
+    files << file;
+  }
+
+  // storage is used directly from this thread, only import is asynchronous
+  if (!fixture.initStorage()){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+  bool failed = false; // operation reported failure, storage errors are in fixture
+
+  CollectionList collections;
+  QObject::connect(&storage, &Storage::collectionsLoaded, [&collections, &failed](CollectionList loaded, bool ok){
+    collections = loaded;
+    failed = failed || !ok;
+  });
+  Collection details;
+  QObject::connect(&storage, &Storage::collectionDetailsLoaded, [&details, &failed](Collection loaded, bool ok){
+    details = loaded;
+    failed = failed || !ok;
+  });
+  size_t loadedPoints = 0;
+  QObject::connect(&storage, &Storage::trackDataLoaded, [&loadedPoints, &failed](Track track, qint64, bool, bool ok){
+    if (track.data){
+      for (const auto &segment: *track.data){
+        loadedPoints += segment.size();
+      }
+    }
+    failed = failed || !ok;
+  });
+  bool exported = false;
+  QObject::connect(&storage, &Storage::collectionExported, [&exported](bool success){
+    exported = success;
+  });
+  DatabaseStats dbStats;
+  QObject::connect(&storage, &Storage::databaseStatsLoaded, [&dbStats](DatabaseStats loaded){
+    dbStats = loaded;
+  });
+
+  QJsonObject operations;
+  size_t objectsPerCollection = args.tracks * (args.points + args.waypoints);
+
+  std::cerr << "Importing..." << std::endl;
+  Samples importSamples;
+  for (const QString &file: files){
+    importSamples.add(measure([&](){
+      failed = !fixture.importCollection(file) || failed;
+    }));
+    if (fixture.failed() || failed){
+      return 1;
+    }
+  }
+  operations["importCollection"] = importSamples.toJson(double(objectsPerCollection * files.size()), "objects");
+  storage.loadDatabaseStats();
+  QJsonObject imported = statsToJson(dbStats);
+
+  Samples collectionsSamples;
+  for (size_t i = 0; i < args.repeat; i++){
+    collectionsSamples.add(measure([&](){ storage.loadCollections(); }));
+  }
+  operations["loadCollections"] = collectionsSamples.toJson();
+  if (fixture.failed() || failed || !collections || collections->size() != args.collections){
+    std::cerr << "Loading collections failed" << std::endl;
+    return 1;
+  }
+  CollectionList importedCollections = collections;
+
+  std::cerr << "Loading..." << std::endl;
+  Samples detailsSamples;
+  Samples trackSamples;
+  std::vector<Track> tracks;
+  std::vector<QList<qint64>> waypointIds; // per collection
+  size_t waypointCount = 0;
+  size_t trackPoints = 0;
+  for (const Collection &collection: *importedCollections){
+    for (size_t i = 0; i < args.repeat; i++){
+      detailsSamples.add(measure([&](){ storage.loadCollectionDetails(collection); }));
+    }
+    if (fixture.failed() || failed || !details.tracks || !details.waypoints){
+      return 1;
+    }
+    tracks.insert(tracks.end(), details.tracks->begin(), details.tracks->end());
+    QList<qint64> ids;
+    for (const Waypoint &waypoint: *details.waypoints){
+      ids << waypoint.id;
+    }
+    waypointIds.push_back(ids);
+    waypointCount += ids.size();
+  }
+  operations["loadCollectionDetails"] = detailsSamples.toJson();
+  for (const Track &track: tracks){
+    loadedPoints = 0;
+    trackSamples.add(measure([&](){ storage.loadTrackData(track, Storage::newRequestId()); }));
+    if (fixture.failed() || failed){
+      return 1;
+    }
+    trackPoints += loadedPoints;
+  }
+  operations["loadTrackData"] = trackSamples.toJson(double(trackPoints), "points");
+
+  std::cerr << "Exporting..." << std::endl;
+  Samples exportSamples;
+  QString exportPath = fixture.filePath("export.gpx");
+  for (const Collection &collection: *importedCollections){
+    exported = false;
+    exportSamples.add(measure([&](){ storage.exportCollection(collection.id, exportPath); }));
+    if (fixture.failed() || failed || !exported){
+      std::cerr << "Export failed" << std::endl;
+      return 1;
+    }
+  }
+  operations["exportCollection"] = exportSamples.toJson(double(trackPoints), "points");
+
+  // every track and waypoint is moved to the next collection
+  std::cerr << "Moving and deleting..." << std::endl;
+  std::map<qint64, qint64> nextCollection;
+  for (size_t c = 0; c < importedCollections->size(); c++){
+    nextCollection[(*importedCollections)[c].id] = (*importedCollections)[(c + 1) % importedCollections->size()].id;
+  }
+  Samples moveTrackSamples;
+  for (const Track &track: tracks){
+    moveTrackSamples.add(measure([&](){ storage.moveTrack(track.id, nextCollection[track.collectionId]); }));
+  }
+  operations["moveTrack"] = moveTrackSamples.toJson();
+  Samples moveWaypointsSamples;
+  for (size_t c = 0; c < importedCollections->size(); c++){
+    if (waypointIds[c].isEmpty()){
+      continue;
+    }
+    qint64 target = nextCollection[(*importedCollections)[c].id];
+    moveWaypointsSamples.add(measure([&](){ storage.moveWaypoints(waypointIds[c], target); }));
+  }
+  operations["moveWaypoints"] = moveWaypointsSamples.toJson(double(waypointCount), "waypoints");
+
+  // half of tracks one by one, the rest with their collections
+  Samples deleteTrackSamples;
+  for (size_t i = 0; i < tracks.size(); i += 2){
+    deleteTrackSamples.add(measure([&](){ storage.deleteTrack(nextCollection[tracks[i].collectionId], tracks[i].id); }));
+  }
+  operations["deleteTrack"] = deleteTrackSamples.toJson();
+  Samples deleteCollectionSamples;
+  for (const Collection &collection: *importedCollections){
+    deleteCollectionSamples.add(measure([&](){ storage.deleteCollection(collection.id); }));
+  }
+  operations["deleteCollection"] = deleteCollectionSamples.toJson();
+  if (fixture.failed() || failed){
+    return 1;
+  }
+  storage.loadDatabaseStats();
+
+  QJsonObject config;
+  config["collections"] = double(args.collections);
+  config["tracks_per_collection"] = double(args.tracks);
+  config["points_per_track"] = double(args.points);
+  config["waypoints_per_track"] = double(args.waypoints);
+  config["repeat"] = double(args.repeat);
+  config["seed"] = double(args.seed);
+
+  QJsonObject database;
+  database["imported"] = imported;
+  database["deleted"] = statsToJson(dbStats);
+
+  QJsonObject result;
+  result["config"] = config;
+  result["operations"] = operations;
+  result["database"] = database;
+  result["peak_rss_kib"] = double(peakRss());
+
+  QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+  if (args.output.empty()){
+    std::cout << json.toStdString();
+    return 0;
+  }
+  QFile output(QString::fromStdString(args.output));
+  if (!output.open(QIODevice::WriteOnly) || output.write(json) != json.size()){
+    std::cerr << "Cannot write " << args.output << std::endl;
+    return 1;
+  }
+  return 0;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  osmscout::CmdLineParser   argParser("StorageBench",
+                                      argc,argv);
+  std::vector<std::string>  helpArgs{"h","help"};
+  Arguments                 args;
+
+  argParser.AddOption(osmscout::CmdLineFlag([&args](const bool& value) {
+                        args.help=value;
+                      }),
+                      helpArgs,
+                      "Return argument help",
+                      true);
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.collections=value;
+                      }),
+                      "collections",
+                      "Count of collections");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.tracks=value;
+                      }),
+                      "tracks",
+                      "Count of tracks in every collection");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.points=value;
+                      }),
+                      "points",
+                      "Count of points in every track");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.waypoints=value;
+                      }),
+                      "waypoints",
+                      "Count of waypoints per track");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.repeat=value;
+                      }),
+                      "repeat",
+                      "Count of repeat of read operations");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.seed=value;
+                      }),
+                      "seed",
+                      "Seed of random generator, the same seed generates the same data");
+
+  argParser.AddOption(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                        args.output=value;
+                      }),
+                      "output",
+                      "Write JSON result to file instead of standard output");
+
+  osmscout::CmdLineParseResult result=argParser.Parse();
+
+  if (result.HasError()) {
+    std::cerr << "ERROR: " << result.GetErrorDescription() << std::endl;
+    std::cout << argParser.GetHelp() << std::endl;
+    return 1;
+  }
+
+  if (args.help) {
+    std::cout << argParser.GetHelp() << std::endl;
+    return 0;
+  }
+
+  if (args.collections == 0 || args.tracks == 0 || args.points == 0) {
+    std::cerr << "Collections, tracks and points should be positive" << std::endl;
+    return 1;
+  }
+
+  return run(args);
+}
@@ -0,0 +1,120 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "StorageFixture.h"
+
+#include <QEventLoop>
+#include <QFile>
+#include <QThread>
+
+#include <iostream>
+
+StorageFixture::StorageFixture()
+{
+  if (!dir.isValid()){
+    std::cerr << "Cannot create temporary directory" << std::endl;
+  }
+}
+
+bool StorageFixture::isValid() const
+{
+  return dir.isValid();
+}
+
+QString StorageFixture::filePath(const QString &name) const
+{
+  return dir.path() + "/" + name;
+}
+
+bool StorageFixture::initStorage(const QString &dbName, const std::function<void(Storage&)> &setup)
+{
+  storagePtr.reset();
+  lastCollections.reset();
+  dbPath = filePath(dbName);
+
+  storagePtr.reset(new Storage(QThread::currentThread(), QDir(dbPath)));
+  QObject::connect(storagePtr.get(), &Storage::error, [this](QString message){
+    std::cerr << "Storage error: " << message.toStdString() << std::endl;
+    error = true;
+  });
+  QObject::connect(storagePtr.get(), &Storage::collectionsLoaded, [this](CollectionList collections, bool){
+    lastCollections = collections;
+  });
+  if (setup){
+    setup(*storagePtr);
+  }
+  storagePtr->init();
+  if (!*storagePtr){
+    std::cerr << "Storage initialisation failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+QString StorageFixture::databaseFile() const
+{
+  return QDir(dbPath).filePath("storage.db");
+}
+
+bool StorageFixture::importCollection(const QString &gpxPath, int *duplicates)
+{
+  // import is processed in steps by storage event loop
+  QEventLoop loop;
+  bool success = false;
+  QMetaObject::Connection connection =
+    QObject::connect(storagePtr.get(), &Storage::importFinished,
+                     [&](qint64, QString, bool ok, bool, int skipped){
+      success = ok;
+      if (duplicates != nullptr){
+        *duplicates = skipped;
+      }
+      loop.quit();
+    });
+  storagePtr->importCollection(gpxPath);
+  loop.exec();
+  QObject::disconnect(connection);
+  return success && !error;
+}
+
+qint64 StorageFixture::firstCollectionId() const
+{
+  return lastCollections && !lastCollections->empty() ? lastCollections->front().id : -1;
+}
+
+qint64 peakRss()
+{
+  QFile status("/proc/self/status");
+  if (!status.open(QIODevice::ReadOnly)){
+    return 0;
+  }
+  for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine()){
+    if (line.startsWith("VmHWM:")){
+      return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+  }
+  return 0;
+}
+
+void resetPeakRss()
+{
+  QFile clearRefs("/proc/self/clear_refs");
+  if (clearRefs.open(QIODevice::WriteOnly)){
+    clearRefs.write("5");
+  }
+}
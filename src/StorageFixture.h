@@ -0,0 +1,106 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_STORAGEFIXTURE_H
+#define OSMSCOUT_SAILFISH_STORAGEFIXTURE_H
+
+#include "Storage.h"
+
+#include <QString>
+#include <QTemporaryDir>
+
+#include <functional>
+#include <memory>
+
+/**
+ * Storage on temporary database for benchmarks, used directly from current thread.
+ * Storage errors are printed to stderr and remembered (see failed).
+ */
+class StorageFixture
+{
+public:
+  StorageFixture();
+
+  /**
+   * false when temporary directory cannot be created
+   */
+  bool isValid() const;
+
+  /**
+   * path of file in temporary directory
+   */
+  QString filePath(const QString &name) const;
+
+  /**
+   * Create and initialise storage in given subdirectory, previous storage is destroyed.
+   * Setup is called before initialisation (batch sizes...).
+   */
+  bool initStorage(const QString &dbName = "db",
+                   const std::function<void(Storage&)> &setup = std::function<void(Storage&)>());
+
+  Storage& storage()
+  {
+    return *storagePtr;
+  }
+
+  QString databaseFile() const;
+
+  /**
+   * Import gpx file and wait until import job is finished.
+   * @param duplicates skipped by import, when not null
+   */
+  bool importCollection(const QString &gpxPath, int *duplicates = nullptr);
+
+  /**
+   * collections emitted by storage last time
+   */
+  CollectionList collections() const
+  {
+    return lastCollections;
+  }
+
+  /**
+   * id of first collection, -1 if there is no collection
+   */
+  qint64 firstCollectionId() const;
+
+  bool failed() const
+  {
+    return error;
+  }
+
+private:
+  QTemporaryDir dir;
+  QString dbPath;
+  std::unique_ptr<Storage> storagePtr;
+  CollectionList lastCollections;
+  bool error{false};
+};
+
+/**
+ * peak resident set size of this process in KiB (Linux only)
+ */
+qint64 peakRss();
+
+/**
+ * reset peak resident set size to current value (Linux only)
+ */
+void resetPeakRss();
+
+#endif //OSMSCOUT_SAILFISH_STORAGEFIXTURE_H
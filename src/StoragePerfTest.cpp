@@ -0,0 +1,1357 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "BatchDistance.h"
+#include "QVariantConverters.h"
+#include "SqlRowReader.h"
+#include "Storage.h"
+#include "StorageFixture.h"
+#include "TrackPointBlock.h"
+#include "TrackStatisticsAccumulator.h"
+
+#include <osmscout/gpx/Export.h>
+#include <osmscout/gpx/Import.h>
+#include <osmscout/gpx/TrackPoint.h>
+#include <osmscout/gpx/Utils.h>
+#include <osmscout/util/CmdLineParsing.h>
+#include <osmscout/util/Geometry.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QThread>
+#include <QTemporaryDir>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <random>
+
+/*
+  Micro-benchmarks of storage hot paths, executed against temporary database.
+
+  src/StoragePerfTest rows --points 1000000
+  src/StoragePerfTest import --points 1000000 --waypoints 10000
+  src/StoragePerfTest export --points 1000000 --waypoints 10000
+  src/StoragePerfTest record --points 86400 --flushPoints 5
+  src/StoragePerfTest search --points 1000 --waypoints 100000
+  src/StoragePerfTest memory --points 1000000
+  src/StoragePerfTest alloc --points 10000 --waypoints 1000 --receivers 4
+  src/StoragePerfTest vacuum --points 1000000 --waypoints 10000
+  src/StoragePerfTest distance --points 1000000
+  src/StoragePerfTest statistics --points 1000000
+
+  Import throughput target: 1M points (with statistics computation)
+  imported with at least 200 000 points/s on desktop class cpu.
+  Every run imports the file twice, the second import should skip
+  all tracks and waypoints as duplicates.
+
+  Export test imports track with some points without timestamp, these
+  are stored since block storage (former import skipped them), exported
+  file is read back and compared with the generated points.
+
+  Record test simulates 1 Hz position feed (24 hours by default),
+  flush latency should not grow with track length.
+
+  Search test should answer in few milliseconds with 100k waypoints.
+
+  Memory test compares resident memory of decoded points, compact
+  TrackPointBuffer should take at least 4x less than gpx::TrackPoint vector.
+
+  Vacuum test deletes imported collection and runs maintenance steps,
+  every step should take few milliseconds and database file should shrink
+  back close to its empty size.
+
+  Distance test compares BatchDistance with GetEllipsoidalDistance,
+  on consecutive track points and on random pairs up to 100 km
+  (all latitudes). It fails when difference exceeds documented bound.
+
+  Statistics test compares single pass TrackStatisticsAccumulator::compute
+  with the former multi-pass computation (copy of track, filters, separate
+  passes with GetEllipsoidalDistance), for the whole track and for every
+  segment alone. All values must be bitwise identical.
+
+  Alloc test counts heap allocations (glibc only) of loadCollectionDetails
+  round trip delivered to several queued receivers. Delivery cost should
+  not depend on count of tracks and waypoints in the collection.
+*/
+
+using namespace osmscout;
+using namespace converters;
+
+struct Arguments
+{
+  bool        help=false;
+  std::string test;
+  size_t      points=1000000;
+  size_t      repeat=3;
+  size_t      waypoints=0;
+  size_t      trackPointBatch=0;
+  size_t      wayPointBatch=0;
+  size_t      flushPoints=5;
+  size_t      receivers=4;
+};
+
+#ifdef __GLIBC__
+namespace {
+std::atomic<size_t> allocationCount{0};
+}
+
+// count heap allocations of the whole process, operator new uses malloc too
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+
+void* malloc(size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+namespace {
+
+/**
+ * synthetic track, every untimedEvery-th point is without timestamp (when non zero)
+ */
+std::vector<gpx::TrackPoint> generatePoints(size_t count, size_t untimedEvery = 0)
+{
+  std::vector<gpx::TrackPoint> points;
+  points.reserve(count);
+  double lat = 50.0;
+  double lon = 14.0;
+  double ele = 300.0;
+  auto time = Timestamp(std::chrono::milliseconds(int64_t(1530000000) * 1000));
+  for (size_t i = 0; i < count; i++){
+    lat += ((int)((i * 7919) % 13) - 6) * 0.000003;
+    lon += ((int)((i * 104729) % 11) - 5) * 0.000004;
+    ele += ((int)((i * 31) % 7) - 3) * 0.1;
+    time += std::chrono::milliseconds(1000 + (i % 3) * 10);
+    gpx::TrackPoint p(GeoCoord(lat, lon));
+    if (untimedEvery == 0 || (i + 1) % untimedEvery != 0){
+      p.time = gpx::Optional<Timestamp>::of(time);
+    }
+    p.elevation = gpx::Optional<double>::of(ele);
+    p.hdop = gpx::Optional<double>::of(3 + (i % 5));
+    points.push_back(std::move(p));
+  }
+  return points;
+}
+
+bool createRowTable(QSqlDatabase &db, const std::vector<gpx::TrackPoint> &points)
+{
+  // same layout and value bindings as track_point table before block storage
+  QSqlQuery create = db.exec("CREATE TABLE `track_point` ("
+                             "`segment_id` INTEGER NOT NULL, `timestamp` datetime NOT NULL, "
+                             "`latitude` DOUBLE NOT NULL, `longitude` DOUBLE NOT NULL, "
+                             "`elevation` DOUBLE NULL, `horiz_accuracy` DOUBLE NULL, `vert_accuracy` DOUBLE NULL);");
+  if (create.lastError().isValid()){
+    std::cerr << "Create table failed: " << create.lastError().text().toStdString() << std::endl;
+    return false;
+  }
+
+  db.transaction();
+  QSqlQuery sql(db);
+  sql.prepare("INSERT INTO `track_point` (`segment_id`, `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy`) "
+              "VALUES (:segment_id, :timestamp, :latitude, :longitude, :elevation, :horiz_accuracy, :vert_accuracy);");
+  for (const auto &p: points){
+    sql.bindValue(":segment_id", 1);
+    sql.bindValue(":timestamp", timestampToDateTime(p.time));
+    sql.bindValue(":latitude", p.coord.GetLat());
+    sql.bindValue(":longitude", p.coord.GetLon());
+    sql.bindValue(":elevation", p.elevation.hasValue() ? QVariant(p.elevation.get()) : QVariant());
+    sql.bindValue(":horiz_accuracy", p.hdop.hasValue() ? QVariant(p.hdop.get()) : QVariant());
+    sql.bindValue(":vert_accuracy", p.vdop.hasValue() ? QVariant(p.vdop.get()) : QVariant());
+    if (!sql.exec()){
+      std::cerr << "Insert failed: " << sql.lastError().text().toStdString() << std::endl;
+      db.rollback();
+      return false;
+    }
+  }
+  return db.commit();
+}
+
+bool createBlockTable(QSqlDatabase &db, const std::vector<gpx::TrackPoint> &points)
+{
+  QSqlQuery create = db.exec("CREATE TABLE `track_point_block` ("
+                             "`segment_id` INTEGER NOT NULL, `seq` INTEGER NOT NULL, "
+                             "`point_count` INTEGER NOT NULL, `data` BLOB NOT NULL);");
+  if (create.lastError().isValid()){
+    std::cerr << "Create table failed: " << create.lastError().text().toStdString() << std::endl;
+    return false;
+  }
+
+  db.transaction();
+  QSqlQuery sql(db);
+  sql.prepare("INSERT INTO `track_point_block` (`segment_id`, `seq`, `point_count`, `data`) VALUES (?, ?, ?, ?);");
+  size_t seq = 0;
+  for (auto it = points.begin(); it != points.end(); seq++){
+    auto end = it + std::min<size_t>(2048, points.end() - it);
+    sql.addBindValue(1);
+    sql.addBindValue(qint64(seq));
+    sql.addBindValue(qint64(end - it));
+    sql.addBindValue(TrackPointBlock::encode(it, end));
+    if (!sql.exec()){
+      std::cerr << "Insert failed: " << sql.lastError().text().toStdString() << std::endl;
+      db.rollback();
+      return false;
+    }
+    it = end;
+  }
+  return db.commit();
+}
+
+/**
+ * row decoding used by Storage before SqlRowReader
+ */
+void readByName(QSqlDatabase &db, std::vector<gpx::TrackPoint> &points)
+{
+  QSqlQuery sql(db);
+  sql.prepare("SELECT `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` FROM `track_point` WHERE segment_id = :segmentId ORDER BY `rowid`;");
+  sql.bindValue(":segmentId", 1);
+  sql.exec();
+  while (sql.next()) {
+    gpx::TrackPoint point(GeoCoord(
+      varToDouble(sql.value("latitude")),
+      varToDouble(sql.value("longitude"))
+    ));
+
+    point.time = gpx::Optional<Timestamp>::of(dateTimeToTimestamp(varToDateTime(sql.value("timestamp"))));
+    point.elevation = varToDoubleOpt(sql.value("elevation"));
+    point.hdop = varToDoubleOpt(sql.value("horiz_accuracy"));
+    point.vdop = varToDoubleOpt(sql.value("vert_accuracy"));
+
+    points.push_back(std::move(point));
+  }
+}
+
+void readTyped(QSqlDatabase &db, std::vector<gpx::TrackPoint> &points)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare("SELECT `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` FROM `track_point` WHERE segment_id = :segmentId ORDER BY `rowid`;");
+  sql.bindValue(":segmentId", 1);
+  sql.exec();
+  SqlRowReader row(sql);
+  while (row.next()) {
+    gpx::TrackPoint point(GeoCoord(row.getDouble(1), row.getDouble(2)));
+
+    point.time = row.getTimestampOpt(0);
+    point.elevation = row.getDoubleOpt(3);
+    point.hdop = row.getDoubleOpt(4);
+    point.vdop = row.getDoubleOpt(5);
+
+    points.push_back(std::move(point));
+  }
+}
+
+void readBlocks(QSqlDatabase &db, std::vector<gpx::TrackPoint> &points)
+{
+  QSqlQuery sql(db);
+  sql.setForwardOnly(true);
+  sql.prepare("SELECT `point_count`, `data` FROM `track_point_block` WHERE segment_id = :segmentId ORDER BY `seq`;");
+  sql.bindValue(":segmentId", 1);
+  sql.exec();
+  SqlRowReader row(sql);
+  while (row.next()) {
+    points.reserve(points.size() + row.getLong(0, 0));
+    TrackPointBlock::decode(row.getBytes(1), points);
+  }
+}
+
+size_t countDifferences(const std::vector<gpx::TrackPoint> &a, const std::vector<gpx::TrackPoint> &b)
+{
+  if (a.size() != b.size()){
+    return std::max(a.size(), b.size());
+  }
+  size_t diff = 0;
+  for (size_t i = 0; i < a.size(); i++){
+    if (std::abs(a[i].coord.GetLat() - b[i].coord.GetLat()) > 1e-6 ||
+        std::abs(a[i].coord.GetLon() - b[i].coord.GetLon()) > 1e-6 ||
+        a[i].time.hasValue() != b[i].time.hasValue() ||
+        (a[i].time.hasValue() && a[i].time.get() != b[i].time.get()) ||
+        a[i].elevation.hasValue() != b[i].elevation.hasValue() ||
+        a[i].hdop.hasValue() != b[i].hdop.hasValue() ||
+        a[i].vdop.hasValue() != b[i].vdop.hasValue()){
+      diff++;
+    }
+  }
+  return diff;
+}
+
+void measure(const std::string &name,
+             size_t repeat,
+             const std::function<void(std::vector<gpx::TrackPoint>&)> &read,
+             const std::vector<gpx::TrackPoint> &reference)
+{
+  double best = std::numeric_limits<double>::max();
+  std::vector<gpx::TrackPoint> points;
+  for (size_t i = 0; i < repeat; i++){
+    points.clear();
+    points.shrink_to_fit();
+    QElapsedTimer timer;
+    timer.start();
+    read(points);
+    best = std::min(best, timer.nsecsElapsed() / 1e9);
+  }
+  std::cout << std::left << std::setw(24) << name
+            << std::right << std::setw(12) << std::fixed << std::setprecision(0) << (points.size() / best) << " rows/s"
+            << std::setw(10) << std::setprecision(3) << best << " s"
+            << "   differences: " << countDifferences(reference, points)
+            << std::endl;
+}
+
+int rowsTest(const Arguments &args)
+{
+  QTemporaryDir dir;
+  if (!dir.isValid()){
+    std::cerr << "Cannot create temporary directory" << std::endl;
+    return 1;
+  }
+
+  QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "perftest");
+  db.setDatabaseName(dir.path() + "/perftest.db");
+  if (!db.open()){
+    std::cerr << "Cannot open database: " << db.lastError().text().toStdString() << std::endl;
+    return 1;
+  }
+
+  std::vector<gpx::TrackPoint> points = generatePoints(args.points);
+  std::cout << "Preparing database with " << points.size() << " points..." << std::endl;
+  if (!createRowTable(db, points) || !createBlockTable(db, points)){
+    return 1;
+  }
+
+  // reference for comparison is the original decoding path
+  std::vector<gpx::TrackPoint> reference;
+  readByName(db, reference);
+
+  measure("by name (QVariant)", args.repeat, [&](std::vector<gpx::TrackPoint> &p){ readByName(db, p); }, reference);
+  measure("typed row reader", args.repeat, [&](std::vector<gpx::TrackPoint> &p){ readTyped(db, p); }, reference);
+  measure("point blocks", args.repeat, [&](std::vector<gpx::TrackPoint> &p){ readBlocks(db, p); }, reference);
+
+  db.close();
+  return 0;
+}
+
+/**
+ * pseudo word from syllables, 1000 distinct words
+ */
+std::string syntheticWord(size_t i)
+{
+  static const char *syllables[] = {"ba", "ko", "ri", "ne", "lu", "sa", "to", "mi", "de", "fa"};
+  return std::string(syllables[i % 10]) + syllables[(i / 10) % 10] + syllables[(i / 100) % 10];
+}
+
+bool writeGpx(const QString &file, const Arguments &args, bool namedWaypoints = false, size_t untimedEvery = 0)
+{
+  gpx::GpxFile gpxFile;
+  gpxFile.name = gpx::Optional<std::string>::of(std::string("perftest"));
+
+  gpx::Track track;
+  track.name = gpx::Optional<std::string>::of(std::string("perftest track"));
+  gpx::TrackSegment segment;
+  segment.points = generatePoints(args.points, untimedEvery);
+  track.segments.push_back(std::move(segment));
+  gpxFile.tracks.push_back(std::move(track));
+
+  std::vector<gpx::TrackPoint> wptCoords = generatePoints(args.waypoints);
+  gpxFile.waypoints.reserve(wptCoords.size());
+  for (const auto &p: wptCoords){
+    gpx::Waypoint wpt(p.coord);
+    wpt.time = p.time;
+    wpt.elevation = p.elevation;
+    wpt.symbol = gpx::Optional<std::string>::of(std::string("Flag"));
+    if (namedWaypoints){
+      size_t i = gpxFile.waypoints.size();
+      wpt.name = gpx::Optional<std::string>::of(syntheticWord(i * 7919) + " " + syntheticWord(i));
+      wpt.description = gpx::Optional<std::string>::of(syntheticWord(i * 31) + " " + syntheticWord(i * 131) + " " + syntheticWord(i * 541));
+    }
+    gpxFile.waypoints.push_back(std::move(wpt));
+  }
+
+  return gpx::ExportGpx(gpxFile, file.toStdString(), nullptr, nullptr);
+}
+
+/**
+ * write generated gpx file to fixture directory and import it
+ */
+bool importGenerated(StorageFixture &fixture, const Arguments &args, bool namedWaypoints = false, size_t untimedEvery = 0)
+{
+  QString gpxPath = fixture.filePath("perftest.gpx");
+  std::cout << "Writing gpx file with " << args.points << " points and " << args.waypoints
+            << (namedWaypoints ? " named" : "") << " waypoints..." << std::endl;
+  if (!writeGpx(gpxPath, args, namedWaypoints, untimedEvery)){
+    std::cerr << "Cannot write gpx file" << std::endl;
+    return false;
+  }
+
+  std::cout << "Importing..." << std::endl;
+  if (!fixture.importCollection(gpxPath) || fixture.firstCollectionId() < 0){
+    std::cerr << "Import failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int importTest(const Arguments &args)
+{
+  StorageFixture fixture;
+  if (!fixture.isValid()){
+    return 1;
+  }
+
+  QString gpxPath = fixture.filePath("perftest.gpx");
+  std::cout << "Writing gpx file with " << args.points << " points and " << args.waypoints << " waypoints..." << std::endl;
+  if (!writeGpx(gpxPath, args)){
+    std::cerr << "Cannot write gpx file" << std::endl;
+    return 1;
+  }
+
+  double best = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < args.repeat; i++){
+    bool initialised = fixture.initStorage(QString("db%1").arg(i), [&args](Storage &storage){
+      if (args.trackPointBatch > 0){
+        storage.setTrackPointBatchSize(args.trackPointBatch);
+      }
+      if (args.wayPointBatch > 0){
+        storage.setWayPointBatchSize(args.wayPointBatch);
+      }
+    });
+    if (!initialised){
+      return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    bool imported = fixture.importCollection(gpxPath);
+    double seconds = timer.nsecsElapsed() / 1e9;
+    if (!imported){
+      return 1;
+    }
+    qint64 dbSize = QFileInfo(fixture.databaseFile()).size();
+
+    // the same file again, everything should be skipped as duplicate
+    int duplicates = 0;
+    timer.restart();
+    imported = fixture.importCollection(gpxPath, &duplicates);
+    double reimportSeconds = timer.nsecsElapsed() / 1e9;
+    if (!imported){
+      return 1;
+    }
+
+    best = std::min(best, seconds);
+    std::cout << "run " << i << ": " << std::fixed << std::setprecision(3) << seconds << " s, database size "
+              << (dbSize / 1024) << " KiB, reimport " << reimportSeconds << " s, " << duplicates << " duplicates, database size "
+              << (QFileInfo(fixture.databaseFile()).size() / 1024) << " KiB" << std::endl;
+  }
+
+  std::cout << "import:" << std::setw(12) << std::fixed << std::setprecision(0)
+            << (args.points / best) << " points/s"
+            << std::setw(12) << ((args.points + args.waypoints) / best) << " objects/s"
+            << std::setw(10) << std::setprecision(3) << best << " s" << std::endl;
+  return 0;
+}
+
+
+int exportTest(const Arguments &args)
+{
+  // points without timestamp are stored since block storage, they have to survive the round trip
+  static constexpr size_t UntimedEvery = 1000;
+
+  StorageFixture fixture;
+  if (!fixture.isValid() || !fixture.initStorage() || !importGenerated(fixture, args, false, UntimedEvery)){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+  qint64 collectionId = fixture.firstCollectionId();
+
+  bool exported = false;
+  QObject::connect(&storage, &Storage::collectionExported, [&exported](bool success){
+    exported = success;
+  });
+
+  // peak memory should not depend on collection size
+  QString exportPath = fixture.filePath("export.gpx");
+  double best = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < args.repeat; i++){
+    resetPeakRss();
+    qint64 rssBefore = peakRss();
+    QElapsedTimer timer;
+    timer.start();
+    storage.exportCollection(collectionId, exportPath);
+    double seconds = timer.nsecsElapsed() / 1e9;
+    if (fixture.failed() || !exported){
+      std::cerr << "Export failed" << std::endl;
+      return 1;
+    }
+    best = std::min(best, seconds);
+    std::cout << "run " << i << ": " << std::fixed << std::setprecision(3) << seconds << " s, file size "
+              << (QFileInfo(exportPath).size() / 1024) << " KiB, peak memory +"
+              << (peakRss() - rssBefore) << " KiB" << std::endl;
+  }
+
+  std::cout << "export:" << std::setw(12) << std::fixed << std::setprecision(0)
+            << (args.points / best) << " points/s"
+            << std::setw(10) << std::setprecision(3) << best << " s" << std::endl;
+
+  gpx::GpxFile exportedFile;
+  if (!gpx::ImportGpx(exportPath.toStdString(), exportedFile, nullptr, nullptr)){
+    std::cerr << "Cannot read exported file" << std::endl;
+    return 1;
+  }
+  std::vector<gpx::TrackPoint> exportedPoints;
+  for (const auto &track: exportedFile.tracks){
+    for (const auto &segment: track.segments){
+      exportedPoints.insert(exportedPoints.end(), segment.points.begin(), segment.points.end());
+    }
+  }
+  std::vector<gpx::TrackPoint> reference = generatePoints(args.points, UntimedEvery);
+  size_t untimed = std::count_if(exportedPoints.begin(), exportedPoints.end(),
+                                 [](const gpx::TrackPoint &p){ return !p.time.hasValue(); });
+  size_t differences = countDifferences(reference, exportedPoints);
+  std::cout << "round trip: " << exportedPoints.size() << " points, " << untimed << " without timestamp, "
+            << differences << " differences" << std::endl;
+  if (differences > 0){
+    std::cerr << "Exported points differ from imported ones" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int memoryTest(const Arguments &args)
+{
+  std::vector<EncodedTrackPointBlock> blocks;
+  {
+    std::vector<gpx::TrackPoint> points = generatePoints(args.points);
+    blocks = TrackPointBlock::encodeBlocks(points, 2048);
+  }
+
+  // compact buffer is measured first, memory released by gpx points
+  // would be reused by the buffer otherwise
+  resetPeakRss();
+  qint64 rssBefore = peakRss();
+  QElapsedTimer timer;
+  timer.start();
+  size_t bufferUsage = 0;
+  {
+    TrackPointBuffer buffer;
+    buffer.reserve(args.points);
+    for (const auto &block: blocks){
+      TrackPointBlock::decode(block.data, buffer);
+    }
+    bufferUsage = buffer.memoryUsage();
+  }
+  double bufferSeconds = timer.nsecsElapsed() / 1e9;
+  qint64 bufferRss = peakRss() - rssBefore;
+
+  resetPeakRss();
+  rssBefore = peakRss();
+  timer.restart();
+  {
+    std::vector<gpx::TrackPoint> points;
+    points.reserve(args.points);
+    for (const auto &block: blocks){
+      TrackPointBlock::decode(block.data, points);
+    }
+  }
+  double gpxSeconds = timer.nsecsElapsed() / 1e9;
+  qint64 gpxRss = peakRss() - rssBefore;
+
+  std::cout << "TrackPointBuffer: " << std::setw(10) << bufferRss << " KiB peak, "
+            << std::fixed << std::setprecision(1) << (double(bufferUsage) / args.points) << " B/point, "
+            << std::setprecision(3) << bufferSeconds << " s" << std::endl;
+  std::cout << "gpx::TrackPoint:  " << std::setw(10) << gpxRss << " KiB peak, "
+            << std::fixed << std::setprecision(1) << double(sizeof(gpx::TrackPoint)) << " B/point, "
+            << std::setprecision(3) << gpxSeconds << " s" << std::endl;
+  return 0;
+}
+
+int searchTest(const Arguments &args)
+{
+  StorageFixture fixture;
+  if (!fixture.isValid() || !fixture.initStorage() || !importGenerated(fixture, args, true)){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+
+  size_t resultCount = 0;
+  bool failed = false;
+  QObject::connect(&storage, &Storage::searchFinished,
+                   [&resultCount, &failed](QString, std::vector<SearchResultItem> items, bool ok){
+    resultCount = items.size();
+    failed = failed || !ok;
+  });
+
+  // from short prefixes (many matches to rank) to exact words
+  static const QStringList patterns{"ba", "bak", "bako", "bakori", "ko ri", "perftest", "nothing"};
+  for (const QString &pattern: patterns){
+    double best = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < args.repeat; i++){
+      QElapsedTimer timer;
+      timer.start();
+      storage.searchItems(pattern, 100);
+      best = std::min(best, timer.nsecsElapsed() / 1e6);
+      if (failed || fixture.failed()){
+        return 1;
+      }
+    }
+    std::cout << std::setw(10) << pattern.toStdString() << ": " << std::setw(4) << resultCount << " results, "
+              << std::fixed << std::setprecision(3) << best << " ms" << std::endl;
+  }
+  return 0;
+}
+
+int allocTest(const Arguments &args)
+{
+#ifndef __GLIBC__
+  std::cerr << "Allocation counting is supported with glibc only" << std::endl;
+  return 1;
+#else
+  qRegisterMetaType<Collection>("Collection");
+
+  StorageFixture fixture;
+  if (!fixture.isValid() || !fixture.initStorage() || !importGenerated(fixture, args)){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+  Collection collection = fixture.collections()->front();
+
+  // receivers simulate map bridge and collection models living in another thread
+  std::vector<std::unique_ptr<QObject>> receivers;
+  size_t delivered = 0;
+  size_t entries = 0;
+  for (size_t i = 0; i < args.receivers; i++){
+    receivers.push_back(std::unique_ptr<QObject>(new QObject()));
+    QObject::connect(&storage, &Storage::collectionDetailsLoaded, receivers.back().get(),
+                     [&delivered, &entries](Collection loaded, bool){
+      delivered++;
+      entries = (loaded.tracks ? loaded.tracks->size() : 0) + (loaded.waypoints ? loaded.waypoints->size() : 0);
+    }, Qt::QueuedConnection);
+  }
+
+  size_t bestLoad = std::numeric_limits<size_t>::max();
+  size_t bestDelivery = std::numeric_limits<size_t>::max();
+  for (size_t i = 0; i < args.repeat; i++){
+    delivered = 0;
+    size_t before = allocationCount.load();
+    storage.loadCollectionDetails(collection);
+    size_t loaded = allocationCount.load();
+    QCoreApplication::sendPostedEvents();
+    size_t after = allocationCount.load();
+    if (fixture.failed() || delivered != receivers.size()){
+      std::cerr << "Loading collection details failed" << std::endl;
+      return 1;
+    }
+    bestLoad = std::min(bestLoad, loaded - before);
+    bestDelivery = std::min(bestDelivery, after - loaded);
+    std::cout << "run " << i << ": load " << (loaded - before) << " allocations, delivery to "
+              << receivers.size() << " receivers " << (after - loaded) << " allocations" << std::endl;
+  }
+
+  std::cout << "alloc: " << entries << " tracks and waypoints, load " << bestLoad << ", delivery " << bestDelivery
+            << " (" << std::fixed << std::setprecision(1) << (double(bestDelivery) / std::max<size_t>(1, receivers.size()))
+            << " per receiver) allocations" << std::endl;
+  return 0;
+#endif
+}
+
+void printDatabaseStats(const std::string &label, const DatabaseStats &stats)
+{
+  std::cout << std::setw(8) << label << ": file " << std::setw(8) << (stats.fileSize / 1024) << " KiB, wal "
+            << std::setw(8) << (stats.walSize / 1024) << " KiB, " << stats.pageCount << " pages, "
+            << stats.freePages << " free (" << std::fixed << std::setprecision(1) << (stats.fragmentation() * 100) << " %)"
+            << (stats.incrementalVacuum ? "" : ", incremental vacuum disabled") << std::endl;
+}
+
+int vacuumTest(const Arguments &args)
+{
+  StorageFixture fixture;
+  if (!fixture.isValid() || !fixture.initStorage()){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+  DatabaseStats stats;
+  QObject::connect(&storage, &Storage::databaseStatsLoaded, [&stats](DatabaseStats loaded){
+    stats = loaded;
+  });
+  storage.loadDatabaseStats();
+  printDatabaseStats("empty", stats);
+
+  if (!importGenerated(fixture, args)){
+    return 1;
+  }
+  qint64 collectionId = fixture.firstCollectionId();
+  storage.loadDatabaseStats();
+  printDatabaseStats("imported", stats);
+
+  QElapsedTimer timer;
+  timer.start();
+  storage.deleteCollection(collectionId);
+  std::cout << "delete: " << std::fixed << std::setprecision(3) << (timer.nsecsElapsed() / 1e6) << " ms" << std::endl;
+  storage.loadDatabaseStats();
+  printDatabaseStats("deleted", stats);
+
+  // maintenance steps are invoked directly, without waiting for idle delay
+  storage.setMaintenanceIdleDelay(0);
+  double sum = 0;
+  double max = 0;
+  size_t steps = 0;
+  size_t stalled = 0; // steps without freed pages, analyze steps
+  qint64 freePages = stats.freePages;
+  for (;;){
+    timer.restart();
+    QMetaObject::invokeMethod(&storage, "maintenance", Qt::DirectConnection);
+    double millis = timer.nsecsElapsed() / 1e6;
+    if (fixture.failed()){
+      return 1;
+    }
+    sum += millis;
+    max = std::max(max, millis);
+    steps++;
+    storage.loadDatabaseStats();
+    storage.setMaintenanceIdleDelay(0);
+    stalled = stats.freePages < freePages ? 0 : stalled + 1;
+    if (stats.freePages == 0 || stalled > 2){
+      break;
+    }
+    freePages = stats.freePages;
+  }
+  std::cout << "maintenance: " << steps << " steps, avg " << std::fixed << std::setprecision(3)
+            << (sum / steps) << " ms, max " << max << " ms" << std::endl;
+  printDatabaseStats("vacuumed", stats);
+  return stats.freePages == 0 ? 0 : 1;
+}
+
+int distanceTest(const Arguments &args)
+{
+  std::vector<gpx::TrackPoint> points = generatePoints(std::max<size_t>(args.points, 2));
+  size_t n = points.size();
+  std::vector<double> lat(n);
+  std::vector<double> lon(n);
+  for (size_t i = 0; i < n; i++){
+    lat[i] = points[i].coord.GetLat();
+    lon[i] = points[i].coord.GetLon();
+  }
+
+  std::vector<double> batch(n - 1);
+  std::vector<double> exact(n - 1);
+  double batchBest = std::numeric_limits<double>::max();
+  double exactBest = std::numeric_limits<double>::max();
+  for (size_t r = 0; r < args.repeat; r++){
+    QElapsedTimer timer;
+    timer.start();
+    BatchDistance::consecutive(lat.data(), lon.data(), n, batch.data());
+    batchBest = std::min(batchBest, timer.nsecsElapsed() / 1e9);
+
+    timer.restart();
+    for (size_t i = 0; i + 1 < n; i++){
+      exact[i] = GetEllipsoidalDistance(points[i].coord, points[i + 1].coord).AsMeter();
+    }
+    exactBest = std::min(exactBest, timer.nsecsElapsed() / 1e9);
+  }
+
+  // random pairs, log-uniform distance from 1 cm to 100 km
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  for (size_t i = 0; i < n; i++){
+    double latA = -89.9 + uniform(rng) * 179.8;
+    double lonA = -180.0 + uniform(rng) * 360.0;
+    double meters = std::pow(10.0, uniform(rng) * 7.0 - 2.0);
+    double heading = uniform(rng) * 2 * M_PI;
+    double latB = std::max(-89.9, std::min(89.9, latA + meters * std::cos(heading) / 111320.0));
+    double lonB = lonA + meters * std::sin(heading) / (111320.0 * std::max(0.01, std::cos(latA * M_PI / 180.0)));
+    batch.push_back(0);
+    BatchDistance::distances(&latA, &lonA, &latB, &lonB, 1, &batch.back());
+    exact.push_back(GetEllipsoidalDistance(GeoCoord(latA, lonA), GeoCoord(latB, lonB)).AsMeter());
+  }
+
+  double maxRelative = 0;
+  double maxAbsolute = 0;
+  size_t violations = 0;
+  for (size_t i = 0; i < batch.size(); i++){
+    double diff = std::abs(batch[i] - exact[i]);
+    maxAbsolute = std::max(maxAbsolute, diff);
+    if (exact[i] >= 1.0){
+      maxRelative = std::max(maxRelative, diff / exact[i]);
+    }
+    if (diff > BatchDistance::RelativeError * exact[i] + BatchDistance::AbsoluteError){
+      violations++;
+    }
+  }
+
+  std::cout << "batch (" << BatchDistance::implementation() << "): " << std::fixed << std::setprecision(1)
+            << (batchBest * 1e9 / (n - 1)) << " ns/pair" << std::endl;
+  std::cout << "GetEllipsoidalDistance: " << (exactBest * 1e9 / (n - 1)) << " ns/pair" << std::endl;
+  std::cout << "max difference: " << std::scientific << std::setprecision(2) << maxAbsolute << " m, "
+            << maxRelative << " relative (distances >= 1 m), " << violations << " pairs out of bound" << std::endl;
+  return violations == 0 ? 0 : 1;
+}
+
+/**
+ * MaxSpeedBuffer as it was before TrackStatisticsAccumulator (former Storage.cpp),
+ * reference for statistics test
+ */
+class LegacyMaxSpeedBuffer{
+public:
+  void flush()
+  {
+    lastPoint.reset();
+    bufferTime.zero();
+    bufferDistance = Distance::Of<Meter>(0);
+  }
+
+  void insert(const gpx::TrackPoint &p)
+  {
+    if (!p.time.hasValue()){
+      return;
+    }
+    if (lastPoint){
+      std::chrono::milliseconds timeDiff = p.time.get() - lastPoint->time.get();
+      if (timeDiff.count() < 0){
+        qWarning() << "Traveling in time is not supported";
+        return;
+      }
+      Distance distanceDiff = GetEllipsoidalDistance(lastPoint->coord, p.coord);
+      distanceFifo.push_back(distanceDiff);
+      timeFifo.push_back(timeDiff);
+      bufferDistance += distanceDiff;
+      bufferTime += timeDiff;
+
+      while (bufferTime > std::chrono::milliseconds(5000) && !distanceFifo.empty()){
+        double speed = bufferDistance.AsMeter() / ((double)bufferTime.count() / 1000.0);
+        maxSpeed = std::max(maxSpeed, speed);
+        bufferDistance = bufferDistance - distanceFifo.front(); // it can be inaccurate!
+        bufferTime -= timeFifo.front();
+        distanceFifo.pop_front();
+        timeFifo.pop_front();
+      }
+    }
+    lastPoint=std::make_shared<osmscout::gpx::TrackPoint>(p);
+  }
+
+  double getMaxSpeed() const
+  {
+    return maxSpeed;
+  }
+
+private:
+  QList<osmscout::Distance> distanceFifo;
+  QList<std::chrono::milliseconds> timeFifo;
+  osmscout::Distance bufferDistance;
+  std::chrono::milliseconds bufferTime{0};
+  std::shared_ptr<osmscout::gpx::TrackPoint> lastPoint;
+  double maxSpeed{0}; // m / s
+};
+
+/**
+ * former Storage::computeTrackStatistics without debug output: copy of the track,
+ * filters, then pass for every metric
+ */
+TrackStatistics legacyStatistics(const gpx::Track &trk)
+{
+  // filter inaccurate nodes - filter nodes with dilution > 30 and with delta (from previous) less than 5 m
+  gpx::Track filtered(trk);
+  filtered.FilterPoints([](std::vector<gpx::TrackPoint> &points){
+    gpx::FilterInaccuratePoints(points, 30);
+    gpx::FilterNearPoints(points, Distance::Of<Meter>(5));
+  });
+
+  // time - just time diference between first and last node
+  std::chrono::milliseconds duration(0);
+  gpx::Optional<Timestamp> from;
+  gpx::Optional<Timestamp> to;
+  for (const auto &seg:trk.segments){
+    if (!seg.points.empty()){
+      from = seg.points.begin()->time;
+      break;
+    }
+  }
+  for (auto it = trk.segments.rbegin(); it != trk.segments.rend(); it++){
+    if (!it->points.empty()){
+      to = it->points.rbegin()->time;
+      break;
+    }
+  }
+  if (from.hasValue() && to.hasValue()){
+    duration = to.get() - from.get();
+  }
+
+  // moving time - sum time of segments when time difference between two points
+  // (of filtered track) is less then 5 minutes.
+  // ...filters are removing points with same coordinates - when there is no move.
+
+  // with moving duration is computed maximum speed...
+  LegacyMaxSpeedBuffer maxSpeedBuf;
+  std::chrono::milliseconds movingDuration(0); // ms
+  for (const auto &seg:filtered.segments) {
+    if (seg.points.empty()){
+      continue;
+    }
+    if (!seg.points.begin()->time.hasValue()){
+      // first point of segment has no time - don't count it to statistics, sorry
+      continue;
+    }
+    Timestamp from = seg.points.begin()->time.get();
+    Timestamp previous = from;
+    for (const auto &p:seg.points) {
+      if (!p.time.hasValue()){
+        continue;
+      }
+      Timestamp current = p.time.get();
+      if (current - previous > std::chrono::minutes(5)){
+        movingDuration += previous - from;
+        from = current;
+        previous = from;
+        maxSpeedBuf.flush();
+      }else{
+        previous = current;
+      }
+      maxSpeedBuf.insert(p);
+    }
+    movingDuration += previous - from;
+    maxSpeedBuf.flush();
+  }
+
+  // elevation
+  gpx::Optional<Distance> minElevation;
+  gpx::Optional<Distance> maxElevation;
+  double ascent=0;
+  double descent=0;
+  bool first = true;
+  double previous = 0;
+  for (const auto &seg:filtered.segments) {
+    for (const auto &p:seg.points) {
+      if (!p.elevation.hasValue()){
+        continue;
+      }
+      if (p.vdop.hasValue() && p.vdop.get() > 50.0){
+        // when vertical accuracy is too low, ignore in statistics
+        continue;
+      }
+      double current = p.elevation.get();
+      if (!minElevation.hasValue() || minElevation.get().AsMeter() > current){
+        minElevation = gpx::Optional<Distance>::of(Distance::Of<Meter>(current));
+      }
+      if (!maxElevation.hasValue() || maxElevation.get().AsMeter() < current){
+        maxElevation = gpx::Optional<Distance>::of(Distance::Of<Meter>(current));
+      }
+      if (first){
+        first=false;
+        previous=current;
+      }else{
+        // when difference is less than 9 meters, don't count to ascent/descent
+        // this threshold was experimentally set to get similar ascent like on strava.com :-)
+        if (std::abs(current - previous) >= 9.0) {
+          if (current > previous) {
+            ascent += (current - previous);
+          } else {
+            descent += (previous - current);
+          }
+          previous = current;
+        }
+      }
+    }
+  }
+
+  // compute bbox
+  GeoBox bbox;
+  for (const auto &seg:trk.segments){
+    for (const auto &p:seg.points){
+      bbox.Include(GeoBox(p.coord, p.coord));
+    }
+  }
+
+  Distance length = filtered.GetLength();
+  double durationInSeconds = ((double)duration.count() / 1000.0);
+  double movingDurationInSeconds = ((double)movingDuration.count() / 1000.0);
+
+  return TrackStatistics(
+    timestampToDateTime(from),
+    timestampToDateTime(to),
+    length,
+    /*rawDistance*/ trk.GetLength(),
+    duration,
+    movingDuration,
+    maxSpeedBuf.getMaxSpeed(),
+    /*averageSpeed*/ durationInSeconds == 0 ? -1 : length.AsMeter() / durationInSeconds,
+    /*movingAverageSpeed*/ movingDurationInSeconds == 0 ? -1 : length.AsMeter() / movingDurationInSeconds,
+    Distance::Of<Meter>(ascent),
+    Distance::Of<Meter>(descent),
+    minElevation,
+    maxElevation,
+    bbox);
+}
+
+bool sameOptional(const gpx::Optional<Distance> &a, const gpx::Optional<Distance> &b)
+{
+  return a.hasValue() == b.hasValue() && (!a.hasValue() || a.get().AsMeter() == b.get().AsMeter());
+}
+
+/**
+ * bitwise comparison of statistics computed from the same points
+ */
+bool sameStatistics(const TrackStatistics &a, const TrackStatistics &b)
+{
+  return a.from == b.from && a.to == b.to &&
+         a.distance.AsMeter() == b.distance.AsMeter() && a.rawDistance.AsMeter() == b.rawDistance.AsMeter() &&
+         a.duration == b.duration && a.movingDuration == b.movingDuration &&
+         a.maxSpeed == b.maxSpeed && a.averageSpeed == b.averageSpeed && a.movingAverageSpeed == b.movingAverageSpeed &&
+         a.ascent.AsMeter() == b.ascent.AsMeter() && a.descent.AsMeter() == b.descent.AsMeter() &&
+         sameOptional(a.minElevation, b.minElevation) && sameOptional(a.maxElevation, b.maxElevation) &&
+         a.bbox.GetMinLat() == b.bbox.GetMinLat() && a.bbox.GetMinLon() == b.bbox.GetMinLon() &&
+         a.bbox.GetMaxLat() == b.bbox.GetMaxLat() && a.bbox.GetMaxLon() == b.bbox.GetMaxLon();
+}
+
+void printStatistics(const std::string &label, const TrackStatistics &s)
+{
+  std::cout << label << std::fixed << std::setprecision(6)
+            << " distance " << s.distance.AsMeter() << " m, raw " << s.rawDistance.AsMeter() << " m"
+            << ", moving " << s.movingDuration.count() << " ms, max speed " << s.maxSpeed << " m/s"
+            << ", ascent " << s.ascent.AsMeter() << " m, descent " << s.descent.AsMeter() << " m" << std::endl;
+}
+
+int statisticsTest(const Arguments &args)
+{
+  // four segments, with inaccurate points, points without elevation and pauses,
+  // moving north with variable speed (near points are filtered)
+  std::vector<gpx::TrackPoint> points = generatePoints(args.points);
+  gpx::Track track;
+  const size_t segments = 4;
+  std::chrono::milliseconds shift(0);
+  double drift = 0;
+  for (size_t i = 0; i < points.size(); i++){
+    gpx::TrackPoint &p = points[i];
+    drift += (i % 600) * 0.0000001;
+    p.coord = GeoCoord(p.coord.GetLat() + drift, p.coord.GetLon());
+    p.elevation = gpx::Optional<double>::of(p.elevation.get() + 50 * std::sin(i / 500.0));
+    if (i % 101 == 0){
+      p.hdop = gpx::Optional<double>::of(40);
+    }
+    if (i % 53 == 0){
+      p.elevation = gpx::Optional<double>();
+    }
+    if (i % 37 == 0){
+      p.vdop = gpx::Optional<double>::of(60);
+    }
+    if (i % 10007 == 0){
+      shift += std::chrono::minutes(10);
+    }
+    p.time = gpx::Optional<Timestamp>::of(p.time.get() + shift);
+    if (i * segments / points.size() >= track.segments.size()){
+      track.segments.emplace_back();
+    }
+    track.segments.back().points.push_back(p);
+  }
+
+  double legacyBest = std::numeric_limits<double>::max();
+  double fusedBest = std::numeric_limits<double>::max();
+  size_t fusedAllocations = std::numeric_limits<size_t>::max();
+  TrackStatistics legacy;
+  TrackStatistics fused;
+  for (size_t r = 0; r < args.repeat; r++){
+    QElapsedTimer timer;
+    timer.start();
+    legacy = legacyStatistics(track);
+    legacyBest = std::min(legacyBest, timer.nsecsElapsed() / 1e9);
+
+#ifdef __GLIBC__
+    size_t before = allocationCount.load();
+#endif
+    timer.restart();
+    fused = TrackStatisticsAccumulator::compute(track);
+    fusedBest = std::min(fusedBest, timer.nsecsElapsed() / 1e9);
+#ifdef __GLIBC__
+    fusedAllocations = std::min(fusedAllocations, allocationCount.load() - before);
+#endif
+  }
+
+  printStatistics("multi-pass:", legacy);
+  printStatistics("single pass:", fused);
+  std::cout << "multi-pass: " << std::fixed << std::setprecision(3) << legacyBest << " s" << std::endl;
+  std::cout << "single pass: " << fusedBest << " s, " << std::setprecision(1) << (legacyBest / fusedBest) << "x";
+#ifdef __GLIBC__
+  std::cout << ", " << fusedAllocations << " heap allocations";
+#endif
+  std::cout << std::endl;
+
+  if (!sameStatistics(legacy, fused)){
+    std::cerr << "Statistics of track differ" << std::endl;
+    return 1;
+  }
+  for (size_t i = 0; i < track.segments.size(); i++){
+    gpx::Track segmentTrack;
+    segmentTrack.segments.push_back(track.segments[i]);
+    if (!sameStatistics(legacyStatistics(segmentTrack), TrackStatisticsAccumulator::compute(track.segments[i].points))){
+      std::cerr << "Statistics of segment " << i << " differ" << std::endl;
+      return 1;
+    }
+  }
+
+  // track folded from states stored with segments, without points
+  std::vector<QByteArray> states;
+  TrackStatisticsAccumulator accumulator;
+  for (size_t i = 0; i < track.segments.size(); i++){
+    if (i > 0){
+      accumulator.startSegment();
+    }
+    accumulator.append(track.segments[i].points);
+    states.push_back(accumulator.serialize());
+  }
+  TrackStatisticsAccumulator folded;
+  for (size_t i = 0; i < states.size(); i++){
+    if (i > 0){
+      folded.startSegment();
+    }
+    TrackStatisticsAccumulator exit;
+    if (!exit.deserialize(states[i]) || !folded.appendSegment(exit)){
+      std::cerr << "Segment " << i << " can't be folded" << std::endl;
+      return 1;
+    }
+  }
+  if (!sameStatistics(folded.statistics(), fused)){
+    std::cerr << "Folded statistics of track differ" << std::endl;
+    return 1;
+  }
+
+  // second segment deleted, like by Storage::deleteTrackSegment: segments with
+  // changed entry boundary are accumulated from points, others are folded
+  gpx::Track edited = track;
+  edited.segments.erase(edited.segments.begin() + 1);
+  TrackStatisticsAccumulator refolded;
+  size_t accumulated = 0;
+  for (size_t i = 0; i < track.segments.size(); i++){
+    if (i == 1){
+      continue;
+    }
+    if (i > 0){
+      refolded.startSegment();
+    }
+    TrackStatisticsAccumulator exit;
+    if (!exit.deserialize(states[i]) || !refolded.appendSegment(exit)){
+      refolded.append(track.segments[i].points);
+      accumulated++;
+    }
+  }
+  std::cout << "segment deleted: " << accumulated << " of " << edited.segments.size() << " segments accumulated from points" << std::endl;
+  if (!sameStatistics(refolded.statistics(), TrackStatisticsAccumulator::compute(edited))){
+    std::cerr << "Statistics of edited track differ" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int recordTest(const Arguments &args)
+{
+  StorageFixture fixture;
+  if (!fixture.isValid() || !fixture.initStorage()){
+    return 1;
+  }
+  Storage &storage = fixture.storage();
+
+  Collection collection;
+  collection.name = "record";
+  storage.updateOrCreateCollection(collection);
+  qint64 collectionId = fixture.firstCollectionId();
+
+  qint64 trackId = -1;
+  QObject::connect(&storage, &Storage::trackOpened, [&trackId](qint64, qint64 id, bool){
+    trackId = id;
+  });
+  storage.openTrack(collectionId, "record", "");
+  if (fixture.failed() || trackId < 0){
+    std::cerr << "Opening track failed" << std::endl;
+    return 1;
+  }
+
+  // flushes are invoked directly, points of one flush interval at once
+  std::vector<gpx::TrackPoint> points = generatePoints(args.points);
+  const size_t flushPoints = std::max<size_t>(1, args.flushPoints);
+  const size_t reportPoints = 3600; // one hour of 1 Hz feed
+  double sum = 0;
+  double max = 0;
+  size_t flushes = 0;
+  for (size_t i = 0; i < points.size(); i += flushPoints){
+    size_t to = std::min(points.size(), i + flushPoints);
+    storage.appendTrackPoints(trackId, std::vector<gpx::TrackPoint>(points.begin() + i, points.begin() + to));
+    QElapsedTimer timer;
+    timer.start();
+    QMetaObject::invokeMethod(&storage, "flushRecordings", Qt::DirectConnection);
+    double millis = timer.nsecsElapsed() / 1e6;
+    if (fixture.failed()){
+      return 1;
+    }
+    sum += millis;
+    max = std::max(max, millis);
+    flushes++;
+    if (to % reportPoints < flushPoints || to == points.size()){
+      std::cout << std::setw(8) << to << " points: flush avg " << std::fixed << std::setprecision(3)
+                << (sum / flushes) << " ms, max " << max << " ms" << std::endl;
+      sum = 0;
+      max = 0;
+      flushes = 0;
+    }
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  storage.closeTrack(trackId);
+  std::cout << "close: " << std::fixed << std::setprecision(3) << (timer.nsecsElapsed() / 1e6) << " ms, database size "
+            << (QFileInfo(fixture.databaseFile()).size() / 1024) << " KiB" << std::endl;
+  return fixture.failed() ? 1 : 0;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  osmscout::CmdLineParser   argParser("StoragePerfTest",
+                                      argc,argv);
+  std::vector<std::string>  helpArgs{"h","help"};
+  Arguments                 args;
+
+  argParser.AddOption(osmscout::CmdLineFlag([&args](const bool& value) {
+                        args.help=value;
+                      }),
+                      helpArgs,
+                      "Return argument help",
+                      true);
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.points=value;
+                      }),
+                      "points",
+                      "Count of track points");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.repeat=value;
+                      }),
+                      "repeat",
+                      "Count of repeat for performance test, best run is reported");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.waypoints=value;
+                      }),
+                      "waypoints",
+                      "Count of waypoints (import, export and search test)");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.trackPointBatch=value;
+                      }),
+                      "trackPointBatch",
+                      "Count of track points committed in one transaction (import test)");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.wayPointBatch=value;
+                      }),
+                      "wayPointBatch",
+                      "Count of waypoints committed in one transaction (import test)");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.flushPoints=value;
+                      }),
+                      "flushPoints",
+                      "Count of track points written by one flush (record test)");
+
+  argParser.AddOption(osmscout::CmdLineSizeTOption([&args](size_t value) {
+                        args.receivers=value;
+                      }),
+                      "receivers",
+                      "Count of queued receivers of collection details (alloc test)");
+
+  argParser.AddPositional(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                            args.test=value;
+                          }),
+                          "TEST",
+                          "Test to run: rows, import, export, record, search, memory, alloc, vacuum, distance, statistics");
+
+  osmscout::CmdLineParseResult result=argParser.Parse();
+
+  if (result.HasError()) {
+    std::cerr << "ERROR: " << result.GetErrorDescription() << std::endl;
+    std::cout << argParser.GetHelp() << std::endl;
+    return 1;
+  }
+
+  if (args.help) {
+    std::cout << argParser.GetHelp() << std::endl;
+    return 0;
+  }
+
+  if (args.test == "rows") {
+    return rowsTest(args);
+  }
+  if (args.test == "import") {
+    return importTest(args);
+  }
+  if (args.test == "export") {
+    return exportTest(args);
+  }
+  if (args.test == "record") {
+    return recordTest(args);
+  }
+  if (args.test == "search") {
+    return searchTest(args);
+  }
+  if (args.test == "memory") {
+    return memoryTest(args);
+  }
+  if (args.test == "alloc") {
+    return allocTest(args);
+  }
+  if (args.test == "vacuum") {
+    return vacuumTest(args);
+  }
+  if (args.test == "distance") {
+    return distanceTest(args);
+  }
+  if (args.test == "statistics") {
+    return statisticsTest(args);
+  }
+
+  std::cerr << "Unknown test: " << args.test << std::endl;
+  std::cout << argParser.GetHelp() << std::endl;
+  return 1;
+}
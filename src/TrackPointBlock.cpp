@@ -0,0 +1,374 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackPointBlock.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace osmscout;
+
+namespace {
+  static constexpr uint8_t FormatVersion = 1;
+  // the same precision as TrackPointBuffer, decoding to the buffer is lossless
+  static constexpr double CoordScale = TrackPointBuffer::CoordScale;
+  static constexpr double ValueScale = TrackPointBuffer::ValueScale;
+
+  enum PresenceMode: uint8_t {
+    NonePresent = 0,
+    AllPresent = 1,
+    BitmapPresent = 2
+  };
+
+  class BlockWriter
+  {
+  public:
+    std::vector<uint8_t> buffer;
+
+    void writeByte(uint8_t b)
+    {
+      buffer.push_back(b);
+    }
+
+    void writeVarUInt(uint64_t v)
+    {
+      while (v >= 0x80){
+        buffer.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+      }
+      buffer.push_back(uint8_t(v));
+    }
+
+    void writeVarInt(int64_t v)
+    {
+      writeVarUInt((uint64_t(v) << 1) ^ uint64_t(v >> 63));
+    }
+  };
+
+  class BlockReader
+  {
+  public:
+    BlockReader(const uint8_t *data, size_t size):
+      data(data), size(size)
+    {}
+
+    bool readByte(uint8_t &b)
+    {
+      if (pos >= size){
+        return false;
+      }
+      b = data[pos++];
+      return true;
+    }
+
+    bool readVarUInt(uint64_t &v)
+    {
+      uint64_t result = 0;
+      for (int shift = 0; shift < 64; shift += 7){
+        uint8_t b;
+        if (!readByte(b)){
+          return false;
+        }
+        result |= uint64_t(b & 0x7f) << shift;
+        if ((b & 0x80) == 0){
+          v = result;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool readVarInt(int64_t &v)
+    {
+      uint64_t u;
+      if (!readVarUInt(u)){
+        return false;
+      }
+      v = int64_t(u >> 1) ^ -int64_t(u & 1);
+      return true;
+    }
+
+    bool readBytes(size_t count, const uint8_t *&ptr)
+    {
+      if (size - pos < count){
+        return false;
+      }
+      ptr = data + pos;
+      pos += count;
+      return true;
+    }
+
+  private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos{0};
+  };
+
+  class Presence
+  {
+  public:
+    uint8_t mode{NonePresent};
+    const uint8_t *bitmap{nullptr};
+
+    bool read(BlockReader &reader, size_t count)
+    {
+      if (!reader.readByte(mode)){
+        return false;
+      }
+      if (mode == BitmapPresent){
+        return reader.readBytes((count + 7) / 8, bitmap);
+      }
+      return mode == NonePresent || mode == AllPresent;
+    }
+
+    bool isPresent(size_t i) const
+    {
+      switch (mode){
+        case AllPresent: return true;
+        case BitmapPresent: return (bitmap[i >> 3] & (1 << (i & 7))) != 0;
+        default: return false;
+      }
+    }
+  };
+
+  void writePresence(BlockWriter &writer,
+                     TrackPointBlock::PointIterator begin,
+                     TrackPointBlock::PointIterator end,
+                     const std::function<bool(const gpx::TrackPoint&)> &hasValue)
+  {
+    size_t count = end - begin;
+    size_t present = 0;
+    for (auto it = begin; it != end; ++it){
+      if (hasValue(*it)){
+        present++;
+      }
+    }
+    if (present == 0){
+      writer.writeByte(NonePresent);
+      return;
+    }
+    if (present == count){
+      writer.writeByte(AllPresent);
+      return;
+    }
+    writer.writeByte(BitmapPresent);
+    size_t offset = writer.buffer.size();
+    writer.buffer.resize(offset + (count + 7) / 8, 0);
+    size_t i = 0;
+    for (auto it = begin; it != end; ++it, ++i){
+      if (hasValue(*it)){
+        writer.buffer[offset + (i >> 3)] |= uint8_t(1 << (i & 7));
+      }
+    }
+  }
+
+  inline int64_t toFixed(double value, double scale)
+  {
+    return std::llround(value * scale);
+  }
+}
+
+QByteArray TrackPointBlock::encode(PointIterator begin, PointIterator end)
+{
+  BlockWriter writer;
+  size_t count = end - begin;
+  writer.buffer.reserve(count * 8 + 16);
+
+  writer.writeByte(FormatVersion);
+  writer.writeVarUInt(count);
+
+  writePresence(writer, begin, end, [](const gpx::TrackPoint &p){ return p.time.hasValue(); });
+  writePresence(writer, begin, end, [](const gpx::TrackPoint &p){ return p.elevation.hasValue(); });
+  writePresence(writer, begin, end, [](const gpx::TrackPoint &p){ return p.hdop.hasValue(); });
+  writePresence(writer, begin, end, [](const gpx::TrackPoint &p){ return p.vdop.hasValue(); });
+
+  int64_t last = 0;
+  for (auto it = begin; it != end; ++it){
+    int64_t current = toFixed(it->coord.GetLat(), CoordScale);
+    writer.writeVarInt(current - last);
+    last = current;
+  }
+  last = 0;
+  for (auto it = begin; it != end; ++it){
+    int64_t current = toFixed(it->coord.GetLon(), CoordScale);
+    writer.writeVarInt(current - last);
+    last = current;
+  }
+  last = 0;
+  for (auto it = begin; it != end; ++it){
+    if (it->time.hasValue()){
+      int64_t current = it->time.get().time_since_epoch().count();
+      writer.writeVarInt(current - last);
+      last = current;
+    }
+  }
+  last = 0;
+  for (auto it = begin; it != end; ++it){
+    if (it->elevation.hasValue()){
+      int64_t current = toFixed(it->elevation.get(), ValueScale);
+      writer.writeVarInt(current - last);
+      last = current;
+    }
+  }
+  for (auto it = begin; it != end; ++it){
+    if (it->hdop.hasValue()){
+      writer.writeVarInt(toFixed(it->hdop.get(), ValueScale));
+    }
+  }
+  for (auto it = begin; it != end; ++it){
+    if (it->vdop.hasValue()){
+      writer.writeVarInt(toFixed(it->vdop.get(), ValueScale));
+    }
+  }
+
+  return qCompress(writer.buffer.data(), int(writer.buffer.size()));
+}
+
+std::vector<EncodedTrackPointBlock> TrackPointBlock::encodeBlocks(const std::vector<gpx::TrackPoint> &points,
+                                                                  size_t blockSize)
+{
+  std::vector<EncodedTrackPointBlock> blocks;
+  blocks.reserve((points.size() + blockSize - 1) / blockSize);
+  for (auto begin = points.begin(); begin != points.end();){
+    auto end = begin + std::min<size_t>(blockSize, points.end() - begin);
+    EncodedTrackPointBlock block;
+    block.pointCount = end - begin;
+    block.data = encode(begin, end);
+    blocks.push_back(std::move(block));
+    begin = end;
+  }
+  return blocks;
+}
+
+bool TrackPointBlock::decode(const QByteArray &data, std::vector<gpx::TrackPoint> &points)
+{
+  TrackPointBuffer buffer;
+  if (!decode(data, buffer)){
+    return false;
+  }
+  points.reserve(points.size() + buffer.size());
+  for (size_t i = 0; i < buffer.size(); i++){
+    points.push_back(buffer.point(i));
+  }
+  return true;
+}
+
+bool TrackPointBlock::decode(const QByteArray &data, TrackPointBuffer &points)
+{
+  QByteArray raw = qUncompress(data);
+  if (raw.isEmpty()){
+    qWarning() << "Track point block decompression failed";
+    return false;
+  }
+  BlockReader reader(reinterpret_cast<const uint8_t*>(raw.constData()), size_t(raw.size()));
+
+  uint8_t version;
+  uint64_t count;
+  if (!reader.readByte(version) || version != FormatVersion){
+    qWarning() << "Unsupported track point block version";
+    return false;
+  }
+  if (!reader.readVarUInt(count) || count > uint64_t(raw.size())){
+    return false;
+  }
+
+  Presence timePresence;
+  Presence elevationPresence;
+  Presence hdopPresence;
+  Presence vdopPresence;
+  if (!timePresence.read(reader, count) ||
+      !elevationPresence.read(reader, count) ||
+      !hdopPresence.read(reader, count) ||
+      !vdopPresence.read(reader, count)){
+    return false;
+  }
+
+  std::vector<int32_t> latitudes;
+  latitudes.reserve(count);
+  int64_t value = 0;
+  int64_t delta;
+  for (size_t i = 0; i < count; i++){
+    if (!reader.readVarInt(delta)){
+      return false;
+    }
+    value += delta;
+    latitudes.push_back(int32_t(value));
+  }
+
+  // points of corrupted block are not appended partially
+  size_t base = points.size();
+  auto fail = [&points, base](){
+    points.truncate(base);
+    return false;
+  };
+  points.reserve(base + count);
+  value = 0;
+  for (size_t i = 0; i < count; i++){
+    if (!reader.readVarInt(delta)){
+      return fail();
+    }
+    value += delta;
+    points.appendFixed(latitudes[i], int32_t(value));
+  }
+
+  value = 0;
+  for (size_t i = 0; i < count; i++){
+    if (timePresence.isPresent(i)){
+      if (!reader.readVarInt(delta)){
+        return fail();
+      }
+      value += delta;
+      points.setTime(base + i, value);
+    }
+  }
+
+  value = 0;
+  for (size_t i = 0; i < count; i++){
+    if (elevationPresence.isPresent(i)){
+      if (!reader.readVarInt(delta)){
+        return fail();
+      }
+      value += delta;
+      points.setElevationFixed(base + i, int32_t(value));
+    }
+  }
+
+  for (size_t i = 0; i < count; i++){
+    if (hdopPresence.isPresent(i)){
+      if (!reader.readVarInt(value)){
+        return fail();
+      }
+      points.setHdopFixed(base + i, int32_t(value));
+    }
+  }
+
+  for (size_t i = 0; i < count; i++){
+    if (vdopPresence.isPresent(i)){
+      if (!reader.readVarInt(value)){
+        return fail();
+      }
+      points.setVdopFixed(base + i, int32_t(value));
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,80 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_TRACKPOINTBLOCK_H
+#define OSMSCOUT_SAILFISH_TRACKPOINTBLOCK_H
+
+#include "TrackPointBuffer.h"
+
+#include <osmscout/gpx/TrackPoint.h>
+
+#include <QByteArray>
+
+#include <vector>
+
+/**
+ * Track point block encoded by TrackPointBlock::encode
+ */
+class EncodedTrackPointBlock
+{
+public:
+  qint64 pointCount{0};
+  QByteArray data;
+};
+
+/**
+ * Compressed, column oriented encoding of consecutive track points.
+ *
+ * Block layout (before zlib compression):
+ *  - format version, point count
+ *  - presence mode (none / all / bitmap) for time, elevation, hdop and vdop
+ *  - latitude and longitude columns: fixed point (1e-7 degree) deltas
+ *  - time column: millisecond deltas of points with time
+ *  - elevation column: centimeter deltas of points with elevation
+ *  - hdop and vdop columns: centimeter values of points with accuracy
+ *
+ * All integers are stored as (zig-zag) varints.
+ */
+class TrackPointBlock
+{
+public:
+  using PointIterator = std::vector<osmscout::gpx::TrackPoint>::const_iterator;
+
+  static QByteArray encode(PointIterator begin, PointIterator end);
+
+  /**
+   * split points to blocks of blockSize points and encode them
+   */
+  static std::vector<EncodedTrackPointBlock> encodeBlocks(const std::vector<osmscout::gpx::TrackPoint> &points,
+                                                          size_t blockSize);
+
+  /**
+   * decode block and append points to the vector
+   * @return false when data are corrupted, points vector is not modified in such case
+   */
+  static bool decode(const QByteArray &data, std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * decode block and append points to the buffer, without materializing gpx points
+   * @return false when data are corrupted, buffer is not modified in such case
+   */
+  static bool decode(const QByteArray &data, TrackPointBuffer &points);
+};
+
+#endif //OSMSCOUT_SAILFISH_TRACKPOINTBLOCK_H
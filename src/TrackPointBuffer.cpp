@@ -0,0 +1,228 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackPointBuffer.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace osmscout;
+
+namespace {
+  static constexpr int64_t NoTimeBase = std::numeric_limits<int64_t>::min();
+
+  inline int32_t toFixed(double value, double scale)
+  {
+    return int32_t(std::llround(value * scale));
+  }
+
+  template<typename T>
+  size_t columnMemory(const std::vector<T> &column)
+  {
+    return column.capacity() * sizeof(T);
+  }
+}
+
+void TrackPointBuffer::reserve(size_t count)
+{
+  latitudes.reserve(count);
+  longitudes.reserve(count);
+}
+
+void TrackPointBuffer::clear()
+{
+  *this = TrackPointBuffer();
+}
+
+void TrackPointBuffer::truncate(size_t count)
+{
+  if (count >= size()){
+    return;
+  }
+  latitudes.resize(count);
+  longitudes.resize(count);
+
+  auto truncatePresence = [count](std::vector<uint64_t> &bits){
+    if (bits.size() > (count + 63) >> 6){
+      bits.resize((count + 63) >> 6);
+    }
+    if ((count & 63) != 0 && (count >> 6) < bits.size()){
+      bits[count >> 6] &= (uint64_t(1) << (count & 63)) - 1;
+    }
+  };
+  auto truncateColumn = [count](std::vector<int32_t> &column){
+    if (column.size() > count){
+      column.resize(count);
+    }
+  };
+
+  // time base of the last chunk is kept, offsets of remaining points are relative to it
+  truncatePresence(timePresence);
+  truncateColumn(timeOffsets);
+  if (timeBases.size() > ((count + (size_t(1) << TimeBaseShift) - 1) >> TimeBaseShift)){
+    timeBases.resize((count + (size_t(1) << TimeBaseShift) - 1) >> TimeBaseShift);
+  }
+  farTimes.erase(farTimes.lower_bound(count), farTimes.end());
+
+  truncatePresence(elevationPresence);
+  truncateColumn(elevations);
+  truncatePresence(hdopPresence);
+  truncateColumn(hdops);
+  truncatePresence(vdopPresence);
+  truncateColumn(vdops);
+}
+
+void TrackPointBuffer::append(const gpx::TrackPoint &p)
+{
+  size_t i = size();
+  appendFixed(toFixed(p.coord.GetLat(), CoordScale), toFixed(p.coord.GetLon(), CoordScale));
+  if (p.time.hasValue()){
+    setTime(i, p.time.get().time_since_epoch().count());
+  }
+  if (p.elevation.hasValue()){
+    setElevationFixed(i, toFixed(p.elevation.get(), ValueScale));
+  }
+  if (p.hdop.hasValue()){
+    setHdopFixed(i, toFixed(p.hdop.get(), ValueScale));
+  }
+  if (p.vdop.hasValue()){
+    setVdopFixed(i, toFixed(p.vdop.get(), ValueScale));
+  }
+}
+
+void TrackPointBuffer::append(const TrackPointBuffer &other)
+{
+  size_t base = size();
+  latitudes.insert(latitudes.end(), other.latitudes.begin(), other.latitudes.end());
+  longitudes.insert(longitudes.end(), other.longitudes.begin(), other.longitudes.end());
+  for (size_t i = 0; i < other.size(); i++){
+    if (other.hasTime(i)){
+      setTime(base + i, other.time(i).time_since_epoch().count());
+    }
+    if (other.hasElevation(i)){
+      setElevationFixed(base + i, other.elevations[i]);
+    }
+    if (other.hasHdop(i)){
+      setHdopFixed(base + i, other.hdops[i]);
+    }
+    if (other.hasVdop(i)){
+      setVdopFixed(base + i, other.vdops[i]);
+    }
+  }
+}
+
+void TrackPointBuffer::appendFixed(int32_t latitude, int32_t longitude)
+{
+  latitudes.push_back(latitude);
+  longitudes.push_back(longitude);
+}
+
+void TrackPointBuffer::setFixed(std::vector<int32_t> &column, std::vector<uint64_t> &presence, size_t i, int32_t value)
+{
+  if (column.size() <= i){
+    if (column.capacity() < latitudes.capacity()){
+      column.reserve(latitudes.capacity());
+    }
+    column.resize(i + 1, 0);
+  }
+  column[i] = value;
+  set(presence, i);
+}
+
+void TrackPointBuffer::setTime(size_t i, int64_t millis)
+{
+  size_t chunk = i >> TimeBaseShift;
+  if (timeBases.size() <= chunk){
+    timeBases.resize(chunk + 1, NoTimeBase);
+  }
+  if (timeBases[chunk] == NoTimeBase){
+    timeBases[chunk] = millis;
+  }
+  int64_t offset = millis - timeBases[chunk];
+  if (offset > std::numeric_limits<int32_t>::max() || offset <= FarTime){
+    farTimes[i] = millis;
+    setFixed(timeOffsets, timePresence, i, FarTime);
+  } else {
+    farTimes.erase(i);
+    setFixed(timeOffsets, timePresence, i, int32_t(offset));
+  }
+}
+
+void TrackPointBuffer::setElevationFixed(size_t i, int32_t centimeters)
+{
+  setFixed(elevations, elevationPresence, i, centimeters);
+}
+
+void TrackPointBuffer::setHdopFixed(size_t i, int32_t centimeters)
+{
+  setFixed(hdops, hdopPresence, i, centimeters);
+}
+
+void TrackPointBuffer::setVdopFixed(size_t i, int32_t centimeters)
+{
+  setFixed(vdops, vdopPresence, i, centimeters);
+}
+
+Timestamp TrackPointBuffer::time(size_t i) const
+{
+  int32_t offset = timeOffsets[i];
+  int64_t millis = offset == FarTime ? farTimes.at(i) : timeBases[i >> TimeBaseShift] + offset;
+  return Timestamp(std::chrono::milliseconds(millis));
+}
+
+gpx::TrackPoint TrackPointBuffer::point(size_t i) const
+{
+  gpx::TrackPoint p(coord(i));
+  if (hasTime(i)){
+    p.time = gpx::Optional<Timestamp>::of(time(i));
+  }
+  if (hasElevation(i)){
+    p.elevation = gpx::Optional<double>::of(elevation(i));
+  }
+  if (hasHdop(i)){
+    p.hdop = gpx::Optional<double>::of(hdop(i));
+  }
+  if (hasVdop(i)){
+    p.vdop = gpx::Optional<double>::of(vdop(i));
+  }
+  return p;
+}
+
+std::vector<gpx::TrackPoint> TrackPointBuffer::points() const
+{
+  std::vector<gpx::TrackPoint> result;
+  result.reserve(size());
+  for (size_t i = 0; i < size(); i++){
+    result.push_back(point(i));
+  }
+  return result;
+}
+
+size_t TrackPointBuffer::memoryUsage() const
+{
+  // std::map node: key, value and three pointers plus color
+  static constexpr size_t MapNodeSize = sizeof(size_t) + sizeof(int64_t) + 4 * sizeof(void*);
+  return sizeof(TrackPointBuffer) +
+         columnMemory(latitudes) + columnMemory(longitudes) +
+         columnMemory(timePresence) + columnMemory(timeBases) + columnMemory(timeOffsets) +
+         farTimes.size() * MapNodeSize +
+         columnMemory(elevationPresence) + columnMemory(elevations) +
+         columnMemory(hdopPresence) + columnMemory(hdops) +
+         columnMemory(vdopPresence) + columnMemory(vdops);
+}
@@ -0,0 +1,168 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_TRACKPOINTBUFFER_H
+#define OSMSCOUT_SAILFISH_TRACKPOINTBUFFER_H
+
+#include <osmscout/gpx/TrackPoint.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * Compact, column oriented (structure of arrays) in-memory representation
+ * of track segment points. Used for tracks loaded for displaying,
+ * gpx::TrackPoint is materialized only when needed (point(i)).
+ *
+ * Values have the same precision as TrackPointBlock encoding, so conversion
+ * from database blocks is lossless:
+ *  - latitude and longitude: int32, 1e-7 degree
+ *  - time: milliseconds, int32 offset to int64 base of every 256 points
+ *  - elevation, hdop and vdop: int32 centimeters
+ *
+ * Optional values have presence bitset, their columns are allocated
+ * with the first present value.
+ */
+class TrackPointBuffer
+{
+public:
+  static constexpr double CoordScale = 10000000.0; // 1e-7 degree ~ 1 cm
+  static constexpr double ValueScale = 100.0; // cm
+
+public:
+  size_t size() const
+  {
+    return latitudes.size();
+  }
+
+  bool empty() const
+  {
+    return latitudes.empty();
+  }
+
+  void reserve(size_t count);
+  void clear();
+
+  /**
+   * remove points from index count to the end
+   */
+  void truncate(size_t count);
+
+  void append(const osmscout::gpx::TrackPoint &p);
+  void append(const TrackPointBuffer &other);
+
+  /**
+   * append point with raw (fixed point) values, used by block decoder
+   */
+  void appendFixed(int32_t latitude, int32_t longitude);
+  void setTime(size_t i, int64_t millis);
+  void setElevationFixed(size_t i, int32_t centimeters);
+  void setHdopFixed(size_t i, int32_t centimeters);
+  void setVdopFixed(size_t i, int32_t centimeters);
+
+  osmscout::GeoCoord coord(size_t i) const
+  {
+    return osmscout::GeoCoord(latitudes[i] / CoordScale, longitudes[i] / CoordScale);
+  }
+
+  bool hasTime(size_t i) const
+  {
+    return isSet(timePresence, i);
+  }
+  osmscout::Timestamp time(size_t i) const;
+
+  bool hasElevation(size_t i) const
+  {
+    return isSet(elevationPresence, i);
+  }
+  double elevation(size_t i) const
+  {
+    return elevations[i] / ValueScale;
+  }
+
+  bool hasHdop(size_t i) const
+  {
+    return isSet(hdopPresence, i);
+  }
+  double hdop(size_t i) const
+  {
+    return hdops[i] / ValueScale;
+  }
+
+  bool hasVdop(size_t i) const
+  {
+    return isSet(vdopPresence, i);
+  }
+  double vdop(size_t i) const
+  {
+    return vdops[i] / ValueScale;
+  }
+
+  /**
+   * materialize point i
+   */
+  osmscout::gpx::TrackPoint point(size_t i) const;
+
+  /**
+   * materialize all points, for export and other consumers of gpx structures
+   */
+  std::vector<osmscout::gpx::TrackPoint> points() const;
+
+  /**
+   * @return approximate count of bytes allocated by the buffer
+   */
+  size_t memoryUsage() const;
+
+private:
+  static constexpr size_t TimeBaseShift = 8; // 256 points share time base
+  static constexpr int32_t FarTime = INT32_MIN; // offset placeholder, time is stored in farTimes
+
+  static bool isSet(const std::vector<uint64_t> &bits, size_t i)
+  {
+    return (i >> 6) < bits.size() && (bits[i >> 6] & (uint64_t(1) << (i & 63))) != 0;
+  }
+  static void set(std::vector<uint64_t> &bits, size_t i)
+  {
+    if ((i >> 6) >= bits.size()){
+      bits.resize((i >> 6) + 1, 0);
+    }
+    bits[i >> 6] |= uint64_t(1) << (i & 63);
+  }
+
+  void setFixed(std::vector<int32_t> &column, std::vector<uint64_t> &presence, size_t i, int32_t value);
+
+private:
+  std::vector<int32_t> latitudes;
+  std::vector<int32_t> longitudes;
+
+  std::vector<uint64_t> timePresence;
+  std::vector<int64_t> timeBases; // base of every 256 points, time of the first point with time
+  std::vector<int32_t> timeOffsets;
+  std::map<size_t, int64_t> farTimes; // times too far from the base (gaps longer than 24 days)
+
+  std::vector<uint64_t> elevationPresence;
+  std::vector<int32_t> elevations;
+  std::vector<uint64_t> hdopPresence;
+  std::vector<int32_t> hdops;
+  std::vector<uint64_t> vdopPresence;
+  std::vector<int32_t> vdops;
+};
+
+#endif //OSMSCOUT_SAILFISH_TRACKPOINTBUFFER_H
@@ -0,0 +1,140 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace osmscout;
+
+namespace {
+  static constexpr double MetersPerDegree = 111319.49; // on equator
+  static constexpr double PixelTolerance = 1.0; // pixels
+
+  struct LocalPoint
+  {
+    double x;
+    double y;
+  };
+
+  /**
+   * squared distance of point p from line segment a-b
+   */
+  inline double segmentDistanceSquared(const LocalPoint &p, const LocalPoint &a, const LocalPoint &b)
+  {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double lengthSquared = dx * dx + dy * dy;
+    double t = 0;
+    if (lengthSquared > 0){
+      t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSquared;
+      t = std::max(0.0, std::min(1.0, t));
+    }
+    double ex = a.x + t * dx - p.x;
+    double ey = a.y + t * dy - p.y;
+    return ex * ex + ey * ey;
+  }
+}
+
+double TrackSimplifier::levelTolerance(int level)
+{
+  return BaseTolerance * std::pow(4.0, level - 1);
+}
+
+int TrackSimplifier::levelForPixelSize(double metersPerPixel)
+{
+  double tolerance = metersPerPixel * PixelTolerance;
+  int level = 0;
+  while (level < LevelCount && levelTolerance(level + 1) <= tolerance){
+    level++;
+  }
+  return level;
+}
+
+std::vector<gpx::TrackPoint> TrackSimplifier::simplify(const std::vector<gpx::TrackPoint> &points,
+                                                       double tolerance)
+{
+  if (points.size() < 3){
+    return points;
+  }
+
+  // project points to local plane in meters (equirectangular, centered on mean latitude)
+  double latSum = 0;
+  for (const auto &p: points){
+    latSum += p.coord.GetLat();
+  }
+  const double lonScale = MetersPerDegree * std::cos(latSum / points.size() * M_PI / 180.0);
+  std::vector<LocalPoint> local;
+  local.reserve(points.size());
+  for (const auto &p: points){
+    local.push_back(LocalPoint{p.coord.GetLon() * lonScale, p.coord.GetLat() * MetersPerDegree});
+  }
+
+  // iterative Douglas-Peucker, stack of ranges to process
+  const double toleranceSquared = tolerance * tolerance;
+  std::vector<char> keep(points.size(), 0);
+  keep.front() = 1;
+  keep.back() = 1;
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, points.size() - 1);
+  while (!stack.empty()){
+    size_t first = stack.back().first;
+    size_t last = stack.back().second;
+    stack.pop_back();
+
+    double maxDistance = 0;
+    size_t farthest = first;
+    for (size_t i = first + 1; i < last; i++){
+      double distance = segmentDistanceSquared(local[i], local[first], local[last]);
+      if (distance > maxDistance){
+        maxDistance = distance;
+        farthest = i;
+      }
+    }
+    if (maxDistance > toleranceSquared){
+      keep[farthest] = 1;
+      if (farthest - first > 1){
+        stack.emplace_back(first, farthest);
+      }
+      if (last - farthest > 1){
+        stack.emplace_back(farthest, last);
+      }
+    }
+  }
+
+  std::vector<gpx::TrackPoint> result;
+  for (size_t i = 0; i < points.size(); i++){
+    if (keep[i]){
+      result.push_back(points[i]);
+    }
+  }
+  return result;
+}
+
+std::vector<std::vector<gpx::TrackPoint>> TrackSimplifier::pyramid(const std::vector<gpx::TrackPoint> &points)
+{
+  std::vector<std::vector<gpx::TrackPoint>> levels;
+  levels.reserve(LevelCount);
+  for (int level = 1; level <= LevelCount; level++){
+    levels.push_back(simplify(level == 1 ? points : levels.back(), levelTolerance(level)));
+  }
+  return levels;
+}
@@ -0,0 +1,66 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_TRACKSIMPLIFIER_H
+#define OSMSCOUT_SAILFISH_TRACKSIMPLIFIER_H
+
+#include <osmscout/gpx/TrackPoint.h>
+
+#include <vector>
+
+/**
+ * Simplified track geometry for displaying tracks at low magnification
+ * (level of detail pyramid).
+ *
+ * Level 0 are raw track points, level N is simplified by Douglas-Peucker
+ * algorithm with tolerance BaseTolerance * 4^(N-1) meters. Level matching
+ * the map view is the coarsest one with tolerance below one screen pixel.
+ */
+class TrackSimplifier
+{
+public:
+  static constexpr int LevelCount = 6; // simplified levels, without raw data
+  static constexpr double BaseTolerance = 4; // meters, tolerance of level 1
+
+  /**
+   * @return tolerance of level in meters, level in range 1..LevelCount
+   */
+  static double levelTolerance(int level);
+
+  /**
+   * @param metersPerPixel map view resolution
+   * @return level of detail matching the view, 0 when raw data should be displayed
+   */
+  static int levelForPixelSize(double metersPerPixel);
+
+  /**
+   * Douglas-Peucker simplification, first and last point are always preserved
+   * @param tolerance maximum distance of removed point from simplified line, in meters
+   */
+  static std::vector<osmscout::gpx::TrackPoint> simplify(const std::vector<osmscout::gpx::TrackPoint> &points,
+                                                         double tolerance);
+
+  /**
+   * compute all simplified levels, every level is computed from the previous one
+   * @return vector of LevelCount levels, starting with level 1
+   */
+  static std::vector<std::vector<osmscout::gpx::TrackPoint>> pyramid(const std::vector<osmscout::gpx::TrackPoint> &points);
+};
+
+#endif //OSMSCOUT_SAILFISH_TRACKSIMPLIFIER_H
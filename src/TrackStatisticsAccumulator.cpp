@@ -0,0 +1,690 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackStatisticsAccumulator.h"
+#include "Storage.h"
+#include "QVariantConverters.h"
+
+#include <osmscout/util/Geometry.h>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace osmscout;
+using namespace converters;
+
+constexpr double TrackStatisticsAccumulator::MaxDilution;
+constexpr double TrackStatisticsAccumulator::MinPointDistance;
+constexpr double TrackStatisticsAccumulator::MaxElevationDilution;
+constexpr double TrackStatisticsAccumulator::ElevationThreshold;
+constexpr std::chrono::minutes TrackStatisticsAccumulator::MaxPause;
+constexpr size_t MaxSpeedBuffer::InitialCapacity;
+
+namespace {
+  static constexpr quint8 SerializationVersion = 5;
+  static constexpr std::chrono::milliseconds MaxSpeedWindow{5000};
+
+  inline void writeTimestamp(QDataStream &stream, const Timestamp &t)
+  {
+    stream << (qint64)t.time_since_epoch().count();
+  }
+
+  inline Timestamp readTimestamp(QDataStream &stream)
+  {
+    qint64 millis;
+    stream >> millis;
+    return Timestamp(std::chrono::milliseconds(millis));
+  }
+
+  inline void writeOptionalTimestamp(QDataStream &stream, const gpx::Optional<Timestamp> &t)
+  {
+    stream << t.hasValue();
+    if (t.hasValue()){
+      writeTimestamp(stream, t.get());
+    }
+  }
+
+  inline gpx::Optional<Timestamp> readOptionalTimestamp(QDataStream &stream)
+  {
+    bool hasValue;
+    stream >> hasValue;
+    return hasValue ? gpx::Optional<Timestamp>::of(readTimestamp(stream)) : gpx::Optional<Timestamp>();
+  }
+
+  inline void writeOptionalDouble(QDataStream &stream, const gpx::Optional<double> &v)
+  {
+    stream << v.hasValue();
+    if (v.hasValue()){
+      stream << v.get();
+    }
+  }
+
+  inline gpx::Optional<double> readOptionalDouble(QDataStream &stream)
+  {
+    bool hasValue;
+    stream >> hasValue;
+    if (!hasValue){
+      return gpx::Optional<double>();
+    }
+    double value;
+    stream >> value;
+    return gpx::Optional<double>::of(value);
+  }
+
+  inline void writeCoord(QDataStream &stream, const GeoCoord &coord)
+  {
+    stream << coord.GetLat() << coord.GetLon();
+  }
+
+  inline GeoCoord readCoord(QDataStream &stream)
+  {
+    double lat, lon;
+    stream >> lat >> lon;
+    return GeoCoord(lat, lon);
+  }
+
+  inline bool sameCoord(const GeoCoord &a, const GeoCoord &b)
+  {
+    return a.GetLat() == b.GetLat() && a.GetLon() == b.GetLon();
+  }
+
+  /**
+   * distance of consecutive points, the same function as the former
+   * multi-pass computation (gpx::TrackSegment::GetLength, FilterNearPoints),
+   * so the statistics are bitwise identical
+   */
+  inline double pointDistance(const GeoCoord &a, const GeoCoord &b)
+  {
+    return GetEllipsoidalDistance(a, b).AsMeter();
+  }
+}
+
+void MaxSpeedBuffer::flush()
+{
+  // entries of the time window are kept, just distance and last point are reset
+  hasLast = false;
+  bufferDistance = 0;
+}
+
+void MaxSpeedBuffer::push(double distance, std::chrono::milliseconds time)
+{
+  if (count == ring.size()){
+    std::vector<Entry> grown(std::max(InitialCapacity, ring.size() * 2));
+    for (size_t i = 0; i < count; i++){
+      grown[i] = ring[(head + i) & (ring.size() - 1)];
+    }
+    ring.swap(grown);
+    head = 0;
+  }
+  ring[(head + count) & (ring.size() - 1)] = Entry{distance, time};
+  count++;
+}
+
+void MaxSpeedBuffer::pop()
+{
+  head = (head + 1) & (ring.size() - 1);
+  count--;
+}
+
+void MaxSpeedBuffer::insert(const gpx::TrackPoint &p)
+{
+  insertPoint(p, nullptr, 0);
+}
+
+void MaxSpeedBuffer::insert(const gpx::TrackPoint &p, const GeoCoord &previous, double distance)
+{
+  insertPoint(p, &previous, distance);
+}
+
+void MaxSpeedBuffer::insertPoint(const gpx::TrackPoint &p, const GeoCoord *previous, double distance)
+{
+  if (!p.time.hasValue()){
+    return;
+  }
+  if (hasLast){
+    std::chrono::milliseconds timeDiff = p.time.get() - lastTime;
+    if (timeDiff.count() < 0){
+      qWarning() << "Traveling in time is not supported";
+      return;
+    }
+    double distanceDiff = previous != nullptr && sameCoord(*previous, lastCoord) ?
+                          distance : pointDistance(lastCoord, p.coord);
+    push(distanceDiff, timeDiff);
+    bufferDistance += distanceDiff;
+    bufferTime += timeDiff;
+
+    while (bufferTime > MaxSpeedWindow && count > 0){
+      double speed = bufferDistance / ((double)bufferTime.count() / 1000.0);
+      maxSpeed = std::max(maxSpeed, speed);
+      const Entry &front = ring[head];
+      bufferDistance -= front.distance; // it can be inaccurate!
+      bufferTime -= front.time;
+      pop();
+    }
+  }
+  hasLast = true;
+  lastCoord = p.coord;
+  lastTime = p.time.get();
+}
+
+double MaxSpeedBuffer::getMaxSpeed() const
+{
+  return maxSpeed;
+}
+
+void MaxSpeedBuffer::resetMaxSpeed()
+{
+  maxSpeed = 0;
+}
+
+bool MaxSpeedBuffer::operator==(const MaxSpeedBuffer &other) const
+{
+  if (count != other.count ||
+      bufferDistance != other.bufferDistance ||
+      bufferTime != other.bufferTime ||
+      hasLast != other.hasLast ||
+      maxSpeed != other.maxSpeed){
+    return false;
+  }
+  if (hasLast && (!sameCoord(lastCoord, other.lastCoord) || lastTime != other.lastTime)){
+    return false;
+  }
+  for (size_t i = 0; i < count; i++){
+    const Entry &a = ring[(head + i) & (ring.size() - 1)];
+    const Entry &b = other.ring[(other.head + i) & (other.ring.size() - 1)];
+    if (a.distance != b.distance || a.time != b.time){
+      return false;
+    }
+  }
+  return true;
+}
+
+void MaxSpeedBuffer::write(QDataStream &stream) const
+{
+  stream << (quint32)count;
+  for (size_t i = 0; i < count; i++){
+    const Entry &e = ring[(head + i) & (ring.size() - 1)];
+    stream << e.distance << (qint64)e.time.count();
+  }
+  stream << bufferDistance << (qint64)bufferTime.count();
+  stream << hasLast;
+  if (hasLast){
+    writeCoord(stream, lastCoord);
+    writeTimestamp(stream, lastTime);
+  }
+  stream << maxSpeed;
+}
+
+void MaxSpeedBuffer::read(QDataStream &stream)
+{
+  ring.clear();
+  head = 0;
+  count = 0;
+  quint32 size;
+  stream >> size;
+  for (quint32 i = 0; i < size && stream.status() == QDataStream::Ok; i++){
+    double meters;
+    qint64 millis;
+    stream >> meters >> millis;
+    push(meters, std::chrono::milliseconds(millis));
+  }
+  qint64 millis;
+  stream >> bufferDistance >> millis;
+  bufferTime = std::chrono::milliseconds(millis);
+  stream >> hasLast;
+  if (hasLast){
+    lastCoord = readCoord(stream);
+    lastTime = readTimestamp(stream);
+  }
+  stream >> maxSpeed;
+}
+
+bool TrackStatisticsAccumulator::isAccurate(const gpx::TrackPoint &p) const
+{
+  return !(p.hdop.hasValue() && p.hdop.get() > MaxDilution) &&
+         !(p.pdop.hasValue() && p.pdop.get() > MaxDilution);
+}
+
+TrackStatistics TrackStatisticsAccumulator::compute(const std::vector<gpx::TrackPoint> &points)
+{
+  TrackStatisticsAccumulator accumulator;
+  accumulator.append(points);
+  return accumulator.statistics();
+}
+
+TrackStatistics TrackStatisticsAccumulator::compute(const gpx::Track &track)
+{
+  TrackStatisticsAccumulator accumulator;
+  for (size_t i = 0; i < track.segments.size(); i++){
+    if (i > 0){
+      accumulator.startSegment();
+    }
+    accumulator.append(track.segments[i].points);
+  }
+  return accumulator.statistics();
+}
+
+TrackStatistics TrackStatisticsAccumulator::merge(const std::vector<TrackStatistics> &segments)
+{
+  QDateTime from;
+  QDateTime to;
+  bool hasPoint = false;
+  double distance = 0;
+  double rawDistance = 0;
+  std::chrono::milliseconds moving(0);
+  double maxSpeed = 0;
+  double ascent = 0;
+  double descent = 0;
+  gpx::Optional<Distance> minElevation;
+  gpx::Optional<Distance> maxElevation;
+  GeoBox bbox;
+  for (const auto &seg: segments){
+    // segment without points has invalid bbox, time of segment with points may be unknown
+    if (seg.bbox.IsValid()){
+      if (!hasPoint){
+        hasPoint = true;
+        from = seg.from;
+      }
+      to = seg.to;
+      bbox.Include(seg.bbox);
+    }
+    distance += seg.distance.AsMeter();
+    rawDistance += seg.rawDistance.AsMeter();
+    moving += seg.movingDuration;
+    maxSpeed = std::max(maxSpeed, seg.maxSpeed);
+    ascent += seg.ascent.AsMeter();
+    descent += seg.descent.AsMeter();
+    if (seg.minElevation.hasValue() &&
+        (!minElevation.hasValue() || minElevation.get().AsMeter() > seg.minElevation.get().AsMeter())){
+      minElevation = seg.minElevation;
+    }
+    if (seg.maxElevation.hasValue() &&
+        (!maxElevation.hasValue() || maxElevation.get().AsMeter() < seg.maxElevation.get().AsMeter())){
+      maxElevation = seg.maxElevation;
+    }
+  }
+
+  std::chrono::milliseconds duration(0);
+  if (from.isValid() && to.isValid()){
+    duration = std::chrono::milliseconds(from.msecsTo(to));
+  }
+  double durationInSeconds = ((double)duration.count() / 1000.0);
+  double movingDurationInSeconds = ((double)moving.count() / 1000.0);
+
+  return TrackStatistics(
+    from,
+    to,
+    Distance::Of<Meter>(distance),
+    Distance::Of<Meter>(rawDistance),
+    duration,
+    moving,
+    maxSpeed,
+    /*averageSpeed*/ durationInSeconds == 0 ? -1 : distance / durationInSeconds,
+    /*movingAverageSpeed*/ movingDurationInSeconds == 0 ? -1 : distance / movingDurationInSeconds,
+    Distance::Of<Meter>(ascent),
+    Distance::Of<Meter>(descent),
+    minElevation,
+    maxElevation,
+    bbox);
+}
+
+void TrackStatisticsAccumulator::Values::include(const Values &seg)
+{
+  if (seg.hasPoint){
+    if (!hasPoint){
+      hasPoint = true;
+      from = seg.from;
+      bbox = seg.bbox;
+    } else {
+      bbox.Include(seg.bbox);
+    }
+    to = seg.to;
+  }
+  // lengths are summed by segment, like gpx::Track::GetLength
+  rawDistance += seg.rawDistance;
+  distance += seg.distance;
+  movingDuration += seg.movingDuration;
+  maxSpeed = std::max(maxSpeed, seg.maxSpeed);
+  if (seg.minElevation.hasValue() && (!minElevation.hasValue() || minElevation.get() > seg.minElevation.get())){
+    minElevation = seg.minElevation;
+  }
+  if (seg.maxElevation.hasValue() && (!maxElevation.hasValue() || maxElevation.get() < seg.maxElevation.get())){
+    maxElevation = seg.maxElevation;
+  }
+  ascent += seg.ascent;
+  descent += seg.descent;
+}
+
+void TrackStatisticsAccumulator::startSegment()
+{
+  closed.include(currentSegment());
+  segment = Values();
+  hasAccepted = false;
+  segmentTime = Unknown;
+  // time window of maximum speed is kept, like in the former computation
+  maxSpeedBuf.flush();
+  maxSpeedBuf.resetMaxSpeed();
+
+  entryWindow = maxSpeedBuf;
+  entryHasElevation = hasElevation;
+  entryElevation = previousElevation;
+  elevationSteps.clear();
+}
+
+bool TrackStatisticsAccumulator::appendSegment(const TrackStatisticsAccumulator &exit)
+{
+  if (segment.hasPoint ||
+      hasElevation != exit.entryHasElevation ||
+      (hasElevation && previousElevation != exit.entryElevation) ||
+      !(maxSpeedBuf == exit.entryWindow)){
+    return false;
+  }
+
+  // the same additions in the same order as by append
+  Values closedSegments = closed;
+  double trackAscent = ascent;
+  double trackDescent = descent;
+  for (double step: exit.elevationSteps){
+    if (step > 0){
+      trackAscent += step;
+    } else {
+      trackDescent += -step;
+    }
+  }
+
+  *this = exit;
+  closed = closedSegments;
+  ascent = trackAscent;
+  descent = trackDescent;
+  return true;
+}
+
+void TrackStatisticsAccumulator::append(const std::vector<gpx::TrackPoint> &points)
+{
+  for (const auto &p: points){
+    append(p);
+  }
+}
+
+void TrackStatisticsAccumulator::append(const gpx::TrackPoint &p)
+{
+  // raw data: time range, raw distance and bbox. Distance from the previous
+  // point is computed once, it is reused by filtering and maximum speed
+  // while the previous point is accepted
+  bool hasRaw = segment.hasPoint;
+  GeoCoord previous = lastRaw;
+  double rawDelta = 0;
+  if (!segment.hasPoint){
+    segment.hasPoint = true;
+    segment.from = p.time;
+    segment.bbox = GeoBox(p.coord, p.coord);
+  } else {
+    segment.bbox.Include(GeoBox(p.coord, p.coord));
+    rawDelta = pointDistance(lastRaw, p.coord);
+    segment.rawDistance += rawDelta;
+  }
+  segment.to = p.time;
+  lastRaw = p.coord;
+
+  // filter inaccurate and near points
+  if (!isAccurate(p)){
+    return;
+  }
+  bool hasDelta = hasAccepted;
+  GeoCoord previousAccepted = lastAccepted;
+  double delta = 0;
+  if (hasAccepted){
+    delta = hasRaw && sameCoord(previous, lastAccepted) ?
+            rawDelta : pointDistance(lastAccepted, p.coord);
+    if (delta < MinPointDistance){
+      return;
+    }
+    segment.distance += delta;
+  }
+  hasAccepted = true;
+  lastAccepted = p.coord;
+
+  // moving time and max speed
+  if (segmentTime == Unknown){
+    if (p.time.hasValue()){
+      segmentTime = Timed;
+      movingFrom = p.time.get();
+      movingPrevious = movingFrom;
+    } else {
+      // first point of segment has no time - don't count it to statistics
+      segmentTime = Untimed;
+    }
+  }
+  if (segmentTime == Timed){
+    if (p.time.hasValue()){
+      Timestamp current = p.time.get();
+      if (current - movingPrevious > MaxPause){
+        segment.movingDuration += movingPrevious - movingFrom;
+        movingFrom = current;
+        movingPrevious = current;
+        maxSpeedBuf.flush();
+      } else {
+        movingPrevious = current;
+      }
+    }
+    if (hasDelta){
+      maxSpeedBuf.insert(p, previousAccepted, delta);
+    } else {
+      maxSpeedBuf.insert(p);
+    }
+  }
+
+  // elevation
+  if (!p.elevation.hasValue() ||
+      (p.vdop.hasValue() && p.vdop.get() > MaxElevationDilution)){
+    return;
+  }
+  double current = p.elevation.get();
+  if (!segment.minElevation.hasValue() || segment.minElevation.get() > current){
+    segment.minElevation = gpx::Optional<double>::of(current);
+  }
+  if (!segment.maxElevation.hasValue() || segment.maxElevation.get() < current){
+    segment.maxElevation = gpx::Optional<double>::of(current);
+  }
+  if (!hasElevation){
+    hasElevation = true;
+    previousElevation = current;
+  } else if (std::abs(current - previousElevation) >= ElevationThreshold){
+    if (current > previousElevation){
+      double step = current - previousElevation;
+      segment.ascent += step;
+      ascent += step;
+      elevationSteps.push_back(step);
+    } else {
+      double step = previousElevation - current;
+      segment.descent += step;
+      descent += step;
+      elevationSteps.push_back(-step);
+    }
+    previousElevation = current;
+  }
+}
+
+TrackStatisticsAccumulator::Values TrackStatisticsAccumulator::currentSegment() const
+{
+  Values values = segment;
+  if (segmentTime == Timed){
+    values.movingDuration += movingPrevious - movingFrom;
+  }
+  values.maxSpeed = maxSpeedBuf.getMaxSpeed();
+  return values;
+}
+
+TrackStatistics TrackStatisticsAccumulator::toStatistics(const Values &values)
+{
+  std::chrono::milliseconds duration(0);
+  if (values.from.hasValue() && values.to.hasValue()){
+    duration = values.to.get() - values.from.get();
+  }
+  double durationInSeconds = ((double)duration.count() / 1000.0);
+  double movingDurationInSeconds = ((double)values.movingDuration.count() / 1000.0);
+
+  return TrackStatistics(
+    timestampToDateTime(values.from),
+    timestampToDateTime(values.to),
+    Distance::Of<Meter>(values.distance),
+    Distance::Of<Meter>(values.rawDistance),
+    duration,
+    values.movingDuration,
+    values.maxSpeed,
+    /*averageSpeed*/ durationInSeconds == 0 ? -1 : values.distance / durationInSeconds,
+    /*movingAverageSpeed*/ movingDurationInSeconds == 0 ? -1 : values.distance / movingDurationInSeconds,
+    Distance::Of<Meter>(values.ascent),
+    Distance::Of<Meter>(values.descent),
+    values.minElevation.hasValue() ? gpx::Optional<Distance>::of(Distance::Of<Meter>(values.minElevation.get())) : gpx::Optional<Distance>(),
+    values.maxElevation.hasValue() ? gpx::Optional<Distance>::of(Distance::Of<Meter>(values.maxElevation.get())) : gpx::Optional<Distance>(),
+    values.bbox);
+}
+
+TrackStatistics TrackStatisticsAccumulator::statistics() const
+{
+  Values track = closed;
+  track.include(currentSegment());
+  track.ascent = ascent;
+  track.descent = descent;
+  return toStatistics(track);
+}
+
+TrackStatistics TrackStatisticsAccumulator::segmentStatistics() const
+{
+  return toStatistics(currentSegment());
+}
+
+void TrackStatisticsAccumulator::Values::write(QDataStream &stream) const
+{
+  stream << hasPoint;
+  writeOptionalTimestamp(stream, from);
+  writeOptionalTimestamp(stream, to);
+  writeCoord(stream, bbox.GetMinCoord());
+  writeCoord(stream, bbox.GetMaxCoord());
+  stream << rawDistance << distance;
+  stream << (qint64)movingDuration.count() << maxSpeed;
+  writeOptionalDouble(stream, minElevation);
+  writeOptionalDouble(stream, maxElevation);
+  stream << ascent << descent;
+}
+
+void TrackStatisticsAccumulator::Values::read(QDataStream &stream)
+{
+  stream >> hasPoint;
+  from = readOptionalTimestamp(stream);
+  to = readOptionalTimestamp(stream);
+  GeoCoord minCoord = readCoord(stream);
+  GeoCoord maxCoord = readCoord(stream);
+  bbox = hasPoint ? GeoBox(minCoord, maxCoord) : GeoBox();
+  stream >> rawDistance >> distance;
+  qint64 movingMillis;
+  stream >> movingMillis >> maxSpeed;
+  movingDuration = std::chrono::milliseconds(movingMillis);
+  minElevation = readOptionalDouble(stream);
+  maxElevation = readOptionalDouble(stream);
+  stream >> ascent >> descent;
+}
+
+QByteArray TrackStatisticsAccumulator::serialize() const
+{
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+  stream.setVersion(QDataStream::Qt_5_0);
+
+  stream << SerializationVersion;
+
+  closed.write(stream);
+  segment.write(stream);
+  stream << ascent << descent;
+
+  writeCoord(stream, lastRaw);
+  stream << hasAccepted;
+  writeCoord(stream, lastAccepted);
+
+  stream << (quint8)segmentTime;
+  writeTimestamp(stream, movingFrom);
+  writeTimestamp(stream, movingPrevious);
+
+  maxSpeedBuf.write(stream);
+  stream << hasElevation << previousElevation;
+
+  entryWindow.write(stream);
+  stream << entryHasElevation << entryElevation;
+  stream << (quint32)elevationSteps.size();
+  for (double step: elevationSteps){
+    stream << step;
+  }
+
+  return data;
+}
+
+bool TrackStatisticsAccumulator::deserialize(const QByteArray &data)
+{
+  QDataStream stream(data);
+  stream.setVersion(QDataStream::Qt_5_0);
+
+  quint8 version;
+  stream >> version;
+  if (stream.status() != QDataStream::Ok || version != SerializationVersion){
+    qWarning() << "Unsupported track statistics state version" << version;
+    return false;
+  }
+
+  TrackStatisticsAccumulator acc;
+  acc.closed.read(stream);
+  acc.segment.read(stream);
+  stream >> acc.ascent >> acc.descent;
+
+  acc.lastRaw = readCoord(stream);
+  stream >> acc.hasAccepted;
+  acc.lastAccepted = readCoord(stream);
+
+  quint8 segmentTime;
+  stream >> segmentTime;
+  if (segmentTime > Untimed){
+    qWarning() << "Corrupted track statistics state";
+    return false;
+  }
+  acc.segmentTime = (SegmentTime)segmentTime;
+  acc.movingFrom = readTimestamp(stream);
+  acc.movingPrevious = readTimestamp(stream);
+
+  acc.maxSpeedBuf.read(stream);
+  stream >> acc.hasElevation >> acc.previousElevation;
+
+  acc.entryWindow.read(stream);
+  stream >> acc.entryHasElevation >> acc.entryElevation;
+  quint32 stepCount;
+  stream >> stepCount;
+  for (quint32 i = 0; i < stepCount && stream.status() == QDataStream::Ok; i++){
+    double step;
+    stream >> step;
+    acc.elevationSteps.push_back(step);
+  }
+
+  if (stream.status() != QDataStream::Ok){
+    qWarning() << "Corrupted track statistics state";
+    return false;
+  }
+  *this = acc;
+  return true;
+}
@@ -0,0 +1,266 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2018 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSMSCOUT_SAILFISH_TRACKSTATISTICSACCUMULATOR_H
+#define OSMSCOUT_SAILFISH_TRACKSTATISTICSACCUMULATOR_H
+
+#include <osmscout/gpx/TrackPoint.h>
+#include <osmscout/util/GeoBox.h>
+
+#include <osmscout/gpx/Track.h>
+
+#include <QByteArray>
+#include <QDataStream>
+
+#include <chrono>
+#include <vector>
+
+class TrackStatistics;
+
+/**
+ * Maximum speed over the time window of 5 seconds. Distances and time
+ * differences inside the window are kept in ring buffer, it is allocated
+ * on first insert and grows just when the window contains more points
+ * than its capacity (points with the same timestamp).
+ */
+class MaxSpeedBuffer{
+public:
+  MaxSpeedBuffer() = default;
+  ~MaxSpeedBuffer() = default;
+
+  void flush();
+  void insert(const osmscout::gpx::TrackPoint &p);
+
+  /**
+   * insert point with known distance from previous point, the distance is used
+   * when previous point is the last inserted point, it is computed otherwise
+   */
+  void insert(const osmscout::gpx::TrackPoint &p, const osmscout::GeoCoord &previous, double distance);
+
+  // return maximum computed speed in m / s
+  double getMaxSpeed() const;
+
+  /**
+   * maximum speed is computed again from following points, the time window is kept
+   */
+  void resetMaxSpeed();
+
+  /**
+   * the same time window, last point and maximum speed
+   */
+  bool operator==(const MaxSpeedBuffer &other) const;
+
+  void write(QDataStream &stream) const;
+  void read(QDataStream &stream);
+
+private:
+  struct Entry {
+    double distance; // meters
+    std::chrono::milliseconds time;
+  };
+
+  static constexpr size_t InitialCapacity = 64; // power of two
+
+  void insertPoint(const osmscout::gpx::TrackPoint &p, const osmscout::GeoCoord *previous, double distance);
+  void push(double distance, std::chrono::milliseconds time);
+  void pop();
+
+private:
+  std::vector<Entry> ring; // capacity is power of two
+  size_t head{0};
+  size_t count{0};
+  double bufferDistance{0}; // meters
+  std::chrono::milliseconds bufferTime{0};
+  bool hasLast{false};
+  osmscout::GeoCoord lastCoord;
+  osmscout::Timestamp lastTime;
+  double maxSpeed{0}; // m / s
+};
+
+/**
+ * Track statistics computed in single pass over the points, without copy
+ * of the track. It is used for imported tracks (compute) and for tracks
+ * that are extended point by point (open tracks). Every appended point
+ * is processed in constant time, with these rules:
+ *
+ *  - points with dilution > 30 and points closer than 5 m to the previous
+ *    accepted point of the segment are filtered out
+ *  - moving time excludes pauses longer than 5 minutes
+ *  - elevation with vdop > 50 is ignored, differences below 9 m are not
+ *    counted to ascent / descent
+ *
+ * Elevation reference and the maximum speed window continue over segments,
+ * like in the former multi-pass computation. Statistics of the current segment
+ * (segmentStatistics) are computed in context of the previous segments,
+ * so ascent and maximum speed of the segment depend on them.
+ *
+ * Accumulator state may be serialized and stored together with the track,
+ * so the statistics may be continued after application restart. State after
+ * the segment is stored with every segment as well: it holds the entry
+ * boundary of the segment (elevation reference and maximum speed window),
+ * its exit boundary and last accepted point, and elevation steps of the segment
+ * (count is bounded by elevation change, not by count of points). Segment
+ * computed from the same entry boundary is folded from this state (appendSegment)
+ * exactly, without its points.
+ */
+class TrackStatisticsAccumulator
+{
+public:
+  static constexpr double MaxDilution = 30;
+  static constexpr double MinPointDistance = 5; // meters
+  static constexpr double MaxElevationDilution = 50;
+  static constexpr double ElevationThreshold = 9; // meters
+  static constexpr std::chrono::minutes MaxPause{5};
+
+public:
+  /**
+   * statistics of single segment
+   */
+  static TrackStatistics compute(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * statistics of the whole track
+   */
+  static TrackStatistics compute(const osmscout::gpx::Track &track);
+
+  /**
+   * summary of consecutive segments (see segmentStatistics), in track order:
+   * distances, moving time, ascent and descent are summed, time range
+   * is from the first to the last segment with points, maximum speed,
+   * elevation range and bounding box covers all segments
+   */
+  static TrackStatistics merge(const std::vector<TrackStatistics> &segments);
+
+  /**
+   * start next track segment, first segment is started implicitly
+   */
+  void startSegment();
+
+  void append(const osmscout::gpx::TrackPoint &p);
+
+  /**
+   * append points of the current segment
+   */
+  void append(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * append segment computed before, at the segment start (after startSegment
+   * or for the first segment). Exit is the accumulator state after the segment
+   * (see serialize), it is usable when it was computed from the same entry
+   * boundary as the current one. Result is bitwise identical to appending
+   * the segment points: values of the segment are taken from the exit state,
+   * track ascent and descent are summed again from its elevation steps.
+   * @return false when the entry boundary differs, points of the segment
+   *    have to be appended then (accumulator is not modified)
+   */
+  bool appendSegment(const TrackStatisticsAccumulator &exit);
+
+  /**
+   * @return statistics of all appended points
+   */
+  TrackStatistics statistics() const;
+
+  /**
+   * @return statistics of points appended since the last startSegment
+   */
+  TrackStatistics segmentStatistics() const;
+
+  QByteArray serialize() const;
+
+  /**
+   * restore state created by serialize
+   * @return false when data are corrupted or from incompatible version
+   */
+  bool deserialize(const QByteArray &data);
+
+private:
+  enum SegmentTime {
+    Unknown = 0, // no accepted point in segment yet
+    Timed = 1, // first accepted point has time
+    Untimed = 2 // first accepted point is without time, segment is excluded from moving time
+  };
+
+  /**
+   * values of segment, or summary of closed segments
+   */
+  struct Values {
+    bool hasPoint{false};
+    osmscout::gpx::Optional<osmscout::Timestamp> from;
+    osmscout::gpx::Optional<osmscout::Timestamp> to;
+    osmscout::GeoBox bbox;
+    double rawDistance{0}; // meters
+    double distance{0}; // meters, filtered points
+    std::chrono::milliseconds movingDuration{0};
+    double maxSpeed{0}; // m / s
+    osmscout::gpx::Optional<double> minElevation;
+    osmscout::gpx::Optional<double> maxElevation;
+    double ascent{0}; // meters
+    double descent{0}; // meters
+
+    /**
+     * include values of the following segment
+     */
+    void include(const Values &segment);
+
+    void write(QDataStream &stream) const;
+    void read(QDataStream &stream);
+  };
+
+  bool isAccurate(const osmscout::gpx::TrackPoint &p) const;
+
+  /**
+   * values of the current segment, including open moving interval
+   */
+  Values currentSegment() const;
+
+  static TrackStatistics toStatistics(const Values &values);
+
+private:
+  Values closed; // closed segments
+  Values segment; // current segment, moving time of closed intervals
+
+  // ascent and descent of the whole track are summed point by point,
+  // like in the former computation
+  double ascent{0}; // meters
+  double descent{0}; // meters
+
+  // filtering, continues within segment
+  osmscout::GeoCoord lastRaw;
+  bool hasAccepted{false};
+  osmscout::GeoCoord lastAccepted;
+
+  // moving time, continues within segment
+  SegmentTime segmentTime{Unknown};
+  osmscout::Timestamp movingFrom;
+  osmscout::Timestamp movingPrevious;
+
+  // continues over segments
+  MaxSpeedBuffer maxSpeedBuf;
+  bool hasElevation{false};
+  double previousElevation{0};
+
+  // entry boundary of the current segment and its elevation steps
+  // (ascent positive, descent negative), see appendSegment
+  MaxSpeedBuffer entryWindow;
+  bool entryHasElevation{false};
+  double entryElevation{0};
+  std::vector<double> elevationSteps;
+};
+
+#endif //OSMSCOUT_SAILFISH_TRACKSTATISTICSACCUMULATOR_H